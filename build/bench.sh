@@ -0,0 +1,25 @@
+#!/bin/sh
+# xapay_hock.c をネイティブエミュレータにリンクし、ハンドラ別ベンチマークをビルド・実行します。
+# 使い方: build/bench.sh [xapay_bench の引数...]
+#
+# 環境変数:
+#   XAPAY_TRACE_LEVEL  フックのトレースレベル (0: OFF (既定), 1: ERROR, 2: DEBUG, 3: VERBOSE)。
+#                      2以上ではハンドラ別・ステップ別の集計も出力する
+
+set -e
+cd "$(dirname "$0")"
+
+CC=${CC:-cc}
+TRACE_LEVEL=${XAPAY_TRACE_LEVEL:-0}
+
+echo "Compiling xapay_hock.c with native hookapi emulator..."
+
+$CC -O2 -std=gnu11 -Wall -DXAPAY_TRACE_LEVEL="$TRACE_LEVEL" \
+    -I ../src/c/emu -I ../src/c \
+    -o xapay_bench \
+    ../src/c/xapay_hock.c \
+    ../src/c/emu/hookapi_emu.c \
+    ../src/c/bench/xapay_bench.c
+
+echo "Output: xapay_bench"
+./xapay_bench "$@"
@@ -0,0 +1,89 @@
+#!/bin/sh
+# xapay_hock.c を WebAssembly にビルドし、サイズ・ガード予算のレポートを出力します (Linux用)。
+# 使い方: build/compile.sh
+#
+# 環境変数:
+#   CLANG        clang (wasm32 ターゲットと wasm-ld が使えるもの)
+#   OPT          最適化オプション (既定: -O2)
+#   XAPAY_TRACE_LEVEL フックのトレースレベル (既定: 0。src/c/xapay_trace.h を参照)
+#   HOOKAPI_DIR  hookapi.h のディレクトリ (既定: ../src/c/emu)
+#   WASM_OPT     wasm-opt (見つからなければ省略)
+#   HOOK_CLEANER hook-cleaner (見つからなければレポートスクリプトが不要なセクションを削除)
+#   GUARD_CHECKER guard_checker (見つからなければレポートスクリプトのガード検証のみ)
+#
+# 出力:
+#   xapay_hock.wasm         デプロイ用 (hook/cbak のみエクスポート、カスタムセクション削除済み)
+#   xapay_hock.report.json  バイナリサイズ、関数別コードサイズ、ループ・ガード予算
+
+set -e
+cd "$(dirname "$0")"
+
+CLANG=${CLANG:-clang}
+OPT=${OPT:--O2}
+TRACE_LEVEL=${XAPAY_TRACE_LEVEL:-0}
+HOOKAPI_DIR=${HOOKAPI_DIR:-../src/c/emu}
+WASM_OPT=${WASM_OPT:-wasm-opt}
+HOOK_CLEANER=${HOOK_CLEANER:-hook-cleaner}
+GUARD_CHECKER=${GUARD_CHECKER:-guard_checker}
+
+OUT=xapay_hock.wasm
+NAMED=xapay_hock.named.wasm
+REPORT=xapay_hock.report.json
+
+# アドレス設定を .env / src/js/hocks.js から再生成する (npm install 済みの場合)
+if [ -d ../node_modules/xrpl ]; then
+    node gen_config.js
+fi
+
+# Xahau にないホスト関数を呼び出していればコンパイル前に終了する
+echo "Checking host functions against the Xahau hook API..."
+node hook_report.js --check-source "$HOOKAPI_DIR/hookapi.h" ../src/c/xapay_hock.c ../src/c/*.h
+
+echo "Compiling xapay_hock.c to WebAssembly..."
+
+# ホスト関数は未定義のまま env モジュールからのインポートにする
+"$CLANG" \
+    --target=wasm32 \
+    $OPT \
+    -DXAPAY_TRACE_LEVEL="$TRACE_LEVEL" \
+    -ffreestanding \
+    -fno-builtin \
+    -nostdlib \
+    -I "$HOOKAPI_DIR" -I ../src/c \
+    -Wl,--no-entry \
+    -Wl,--allow-undefined \
+    -Wl,--export=hook \
+    -Wl,--export-if-defined=cbak \
+    -o "$NAMED" \
+    ../src/c/xapay_hock.c
+
+# 関数名 (name セクション) はレポートのために残す
+if command -v "$WASM_OPT" >/dev/null 2>&1; then
+    echo "Optimizing with wasm-opt..."
+    "$WASM_OPT" $OPT --debuginfo -o "$NAMED" "$NAMED"
+fi
+
+# 前回のレポートがあればサイズの差分を表示する
+BASELINE=
+if [ -f "$REPORT" ]; then
+    cp "$REPORT" "$REPORT.prev"
+    BASELINE="--baseline $REPORT.prev"
+fi
+
+# ガード検証・インポートの検証 (Xahau のホスト関数のみ) に失敗した場合はここで終了する
+node hook_report.js "$NAMED" --strip "$OUT" $BASELINE > "$REPORT"
+rm -f "$REPORT.prev"
+
+if command -v "$HOOK_CLEANER" >/dev/null 2>&1; then
+    echo "Cleaning with hook-cleaner..."
+    "$HOOK_CLEANER" "$OUT" "$OUT"
+fi
+
+if command -v "$GUARD_CHECKER" >/dev/null 2>&1; then
+    echo "Checking guards with guard_checker..."
+    "$GUARD_CHECKER" "$OUT"
+fi
+
+rm -f "$NAMED"
+echo "Compilation successful!"
+echo "Output: $OUT ($(wc -c < "$OUT") bytes), $REPORT"
@@ -0,0 +1,107 @@
+// build/gen_config.js
+// JS側のデプロイ設定 (.env / src/js/hocks.js) から src/c/xapay_config.h を生成する。
+//
+// 使い方: node build/gen_config.js [--check]
+//
+//   --check  生成結果が既存のヘッダと異なれば終了コード1で終了する (書き込まない)
+//
+// フックのアドレス・通貨はここで生成した値だけを使い、xapay_hock.c では手で編集しない。
+const fs = require("fs");
+const path = require("path");
+
+require("dotenv").config({ path: path.join(__dirname, "../.env") });
+const {
+  xrpl,
+  ISSUER_ADDRESS,
+  OPERATOR_ADDRESS,
+  CURRENCY_CODE,
+  MERCHANT_SETTLE_AMOUNT,
+  MERCHANT_SETTLE_COUNT,
+} = require("../src/js/hocks");
+
+const OUTPUT = path.join(__dirname, "../src/c/xapay_config.h");
+
+// 3文字の通貨コードを160ビットの標準形式にする
+function currencyBytes(code) {
+  if (code.length === 40) return Buffer.from(code, "hex");
+  if (!/^[A-Za-z0-9]{3}$/.test(code) || code === "XRP") throw new Error(`invalid currency code: ${code}`);
+  const buf = Buffer.alloc(20);
+  buf.write(code, 12, "ascii");
+  return buf;
+}
+
+function accountBytes(address, label) {
+  if (!xrpl.isValidClassicAddress(address)) throw new Error(`invalid ${label}: ${address}`);
+  return Buffer.from(xrpl.decodeAccountID(address));
+}
+
+// 閾値は正の整数 (金額は XFL の仮数で丸めずに表せる16桁まで)
+function positiveInteger(value, max, label) {
+  const text = String(value);
+  if (!/^[0-9]+$/.test(text) || BigInt(text) <= 0n || BigInt(text) > max) throw new Error(`invalid ${label}: ${value}`);
+  return BigInt(text).toString();
+}
+
+function byteArray(buf) {
+  const hex = [...buf].map((b) => `0x${b.toString(16).toUpperCase().padStart(2, "0")}`);
+  const lines = [];
+  for (let i = 0; i < hex.length; i += 8) lines.push(`    ${hex.slice(i, i + 8).join(", ")}`);
+  return `{ \\\n${lines.join(", \\\n")} \\\n}`;
+}
+
+function render() {
+  const issuer = accountBytes(ISSUER_ADDRESS, "ISSUER_ADDRESS");
+  const operator = accountBytes(OPERATOR_ADDRESS, "OPERATOR_ADDRESS");
+  const currency = currencyBytes(CURRENCY_CODE);
+  const fragment = `:${OPERATOR_ADDRESS}:`;
+  const settleAmount = positiveInteger(MERCHANT_SETTLE_AMOUNT, 9999999999999999n, "MERCHANT_SETTLE_AMOUNT");
+  const settleCount = positiveInteger(MERCHANT_SETTLE_COUNT, 0xffffffffn, "MERCHANT_SETTLE_COUNT");
+
+  return `/**
+ * XApay Hook - デプロイ設定
+ *
+ * build/gen_config.js が .env / src/js/hocks.js から生成します。直接編集しないでください。
+ */
+
+#ifndef XAPAY_CONFIG_H
+#define XAPAY_CONFIG_H
+
+// JPYトークンの発行者 (${ISSUER_ADDRESS})
+#define XAPAY_ISSUER_ACCID ${byteArray(issuer)}
+
+// JPYトークンの通貨コード (${CURRENCY_CODE})
+#define XAPAY_CURRENCY ${byteArray(currency)}
+
+// XApay運営サーバーのアカウント (${OPERATOR_ADDRESS})
+#define XAPAY_OPERATOR_ACCID ${byteArray(operator)}
+
+// 運営者の r-address と、利用許可署名のメッセージ (<ユーザー>:<運営者>:<許可額>) の ":<運営者>:" 部分
+#define XAPAY_OPERATOR_RADDR "${OPERATOR_ADDRESS}"
+#define XAPAY_OPERATOR_RADDR_LEN ${OPERATOR_ADDRESS.length}
+#define XAPAY_OPERATOR_FRAGMENT "${fragment}"
+#define XAPAY_OPERATOR_FRAGMENT_LEN ${fragment.length}
+
+// 加盟店への精算の閾値 (未精算額 (円)・未精算の支払い数のどちらかに達したら精算する)
+#define XAPAY_MERCHANT_SETTLE_AMOUNT ${settleAmount}LL
+#define XAPAY_MERCHANT_SETTLE_COUNT ${settleCount}U
+
+#endif
+`;
+}
+
+function main(argv) {
+  const header = render();
+  const current = fs.existsSync(OUTPUT) ? fs.readFileSync(OUTPUT, "utf8") : null;
+
+  if (argv.includes("--check")) {
+    if (current !== header) {
+      console.error(`${path.relative(process.cwd(), OUTPUT)} is out of date; run node build/gen_config.js`);
+      process.exit(1);
+    }
+    return;
+  }
+  if (current !== header) fs.writeFileSync(OUTPUT, header);
+  console.log(`Generated ${path.relative(process.cwd(), OUTPUT)}`);
+}
+
+main(process.argv.slice(2));
@@ -0,0 +1,1183 @@
+// build/hook_replay.js
+// ビルドしたフックの wasm を Node の WebAssembly で実行し、トランザクションのコーパスを再生する。
+//
+// 使い方: node hook_replay.js <hook.wasm> <corpus.ndjson> [オプション]
+//
+//   --hook-account r...   フックのアカウント (省略時は最初のトランザクションの Destination)
+//   --compare other.wasm  同じコーパスを別のフックでも再生し、結果・Stateの差分を表示する
+//   --out file            トランザクションごとの結果を NDJSON で書き出す (既定は標準出力)
+//   --summary-only        トランザクションごとの結果を出力しない
+//   --state-out file      再生後の State を JSON で書き出す
+//   --drops-per-kinstr n  1000命令あたりの手数料 (drops) を指定すると、見積もり手数料を出力する
+//   --trace               trace / trace_num の出力を結果に含める
+//
+// XAPAY_TRACE_LEVEL >= 2 (DEBUG) でビルドしたフックのトレースポイント (src/c/xapay_trace.h) は常に読み取り、
+// 結果の steps にステップ別の命令数・ホスト関数呼び出し数を、集計の handlers にハンドラ別の実行数・
+// 拒否理由 (ロールバックのコード) 別の件数とステップ別の命令数を出力する。
+//
+// コーパスは1行1メッセージの NDJSON で、次の形式を受け付ける:
+//   { "type": "namespace", "namespace_entries": [...] }      State の初期値 (state_mirror.js の記録と同じ)
+//   { "type": "account", "account": "r...", "regular_key": "r..." }  台帳のアカウント (slot_set の対象)
+//   { "type": "transaction", "transaction": {...} }          ストリームのメッセージ (meta は無視する)
+//   { "TransactionType": "Invoke", ... }                     トランザクションそのもの
+//
+// src/js/workload.js のコーパスのように行に expected があれば、結果 (outcome / code) と比べて異なる件数を
+// 集計の expected_mismatches に出力する。expected.engine_result (フックの実行前に台帳で拒否される
+// トランザクション) の行は実行しない。
+//
+// 命令数は、wasm の各関数を基本ブロックごとに命令数を加算するよう書き換えて数える。
+// ホスト関数は src/c/emu/hookapi_emu.c と同じ意味で実装し、util_verify もエミュレータの署名
+// (emu_sign) のみを受理する。State は再生を通して保持し、accept した実行の変更のみ反映する。
+const fs = require("fs");
+const crypto = require("crypto");
+const { Reader, parseSections, parseImports, blockType, skipImmediates } = require("./hook_report");
+
+const METER_EXPORT = "__xapay_instructions";
+
+// src/c/emu/hookapi.h と一致させること
+const sfTransactionType = (1 << 16) + 2;
+const sfEmitGeneration = (2 << 16) + 43;
+const sfEmitBurden = (3 << 16) + 12;
+const sfEmitParentTxnID = (5 << 16) + 11;
+const sfEmitNonce = (5 << 16) + 12;
+const sfEmitHookHash = (5 << 16) + 14;
+const sfAmount = (6 << 16) + 1;
+const sfFee = (6 << 16) + 8;
+const sfSigningPubKey = (7 << 16) + 3;
+const sfMemoType = (7 << 16) + 12;
+const sfMemoData = (7 << 16) + 13;
+const sfMemoFormat = (7 << 16) + 14;
+const sfAccount = (8 << 16) + 1;
+const sfDestination = (8 << 16) + 3;
+const sfRegularKey = (8 << 16) + 8;
+const sfMemo = (14 << 16) + 10;
+const sfEmitDetails = (14 << 16) + 13;
+const sfMemos = (15 << 16) + 9;
+const KEYLET_ACCOUNT = 3;
+const TT = { Payment: 0, Invoke: 99 };
+
+const OUT_OF_BOUNDS = -1n;
+const INTERNAL_ERROR = -2n;
+const TOO_BIG = -3n;
+const TOO_SMALL = -4n;
+const DOESNT_EXIST = -5n;
+const NO_FREE_SLOTS = -6n;
+const INVALID_ARGUMENT = -7n;
+const ALREADY_SET = -8n;
+const PREREQUISITE_NOT_MET = -9n;
+const EMISSION_FAILURE = -11n;
+const PARSE_ERROR = -18n;
+const NOT_AN_ARRAY = -22n;
+const NOT_AN_OBJECT = -23n;
+const CANT_RETURN_NEGATIVE = -33n;
+const TOO_MANY_STATE_MODIFICATIONS = -44n;
+const INVALID_FLOAT = -10024n;
+
+// トレースポイント (src/c/xapay_trace.h と一致させること)
+const TRACE_POINT_TAG = "XApay:tp";
+const TRACE_POINT_SIZE = 10;
+const TRACE_ITEM_FLAG = 0x80;
+const HANDLER_NAMES = [
+  "hook", "charge", "payment", "allowance_payment", "recharge_allowance", "withdrawal",
+  "withdrawal_flush", "compact", "merchant_settle", "claim_redeem", "register_key",
+];
+
+const STATE_KEY_SIZE = 32;
+const STATE_DATA_SIZE = 256;
+const MAX_STATE_MODS = 256;
+const MAX_SLOTS = 255;
+const MAX_EMITTED = 256;
+const ETXN_DETAILS_SIZE = 116;
+const LEDGER_SEQ = 1000n; // src/c/emu/hookapi_emu.c の EMU_LEDGER_SEQ
+const EMIT_FEE = 12n; // etxn_fee_base が返す手数料 (ドロップ)
+
+// =====================================================================================================================
+// == 命令数の計測 (wasm の書き換え) ==
+// =====================================================================================================================
+
+function uleb(n) {
+  const out = [];
+  do {
+    let b = n & 0x7f;
+    n = Math.floor(n / 128);
+    if (n > 0) b |= 0x80;
+    out.push(b);
+  } while (n > 0);
+  return Buffer.from(out);
+}
+
+function sleb(n) {
+  const out = [];
+  let v = BigInt(n);
+  for (;;) {
+    const b = Number(v & 0x7fn);
+    v >>= 7n;
+    if ((v === 0n && (b & 0x40) === 0) || (v === -1n && (b & 0x40) !== 0)) {
+      out.push(b);
+      return Buffer.from(out);
+    }
+    out.push(b | 0x80);
+  }
+}
+
+function section(id, body) {
+  return Buffer.concat([Buffer.from([id]), uleb(body.length), body]);
+}
+
+// 分岐・呼び出し・ブロックの境界で基本ブロックが終わる命令
+const REGION_END = new Set([0x00, 0x02, 0x03, 0x04, 0x05, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11]);
+
+/**
+ * 関数本体の基本ブロックの先頭に「global += ブロックの命令数」を挿入する
+ */
+function meterBody(buf, start, end, global) {
+  const r = new Reader(buf, start, end);
+  for (let n = r.u32(); n > 0; n--) {
+    r.u32();
+    r.byte();
+  }
+  const parts = [buf.subarray(start, r.pos)];
+  let regionStart = r.pos;
+  let count = 0;
+  const increment = (n) => Buffer.concat([
+    Buffer.from([0x23]), uleb(global), Buffer.from([0x42]), sleb(n), Buffer.from([0x7c, 0x24]), uleb(global),
+  ]);
+
+  while (r.pos < end) {
+    const op = r.byte();
+    count++;
+    switch (op) {
+      case 0x02: case 0x03: case 0x04: blockType(r); break;
+      case 0x0c: case 0x0d: case 0x10: r.u32(); break;
+      case 0x0e: for (let n = r.u32(); n >= 0; n--) r.u32(); break;
+      case 0x11: r.u32(); r.u32(); break;
+      case 0x00: case 0x05: case 0x0b: case 0x0f: break;
+      default: skipImmediates(r, op); break;
+    }
+    if (REGION_END.has(op)) {
+      parts.push(increment(count), buf.subarray(regionStart, r.pos));
+      regionStart = r.pos;
+      count = 0;
+    }
+  }
+  const body = Buffer.concat(parts);
+  return Buffer.concat([uleb(body.length), body]);
+}
+
+const SECTION_ORDER = { 1: 1, 2: 2, 3: 3, 4: 4, 5: 5, 13: 6, 6: 7, 7: 8, 8: 9, 9: 10, 12: 11, 10: 12, 11: 13 };
+
+/**
+ * 実行した命令数を数える i64 のグローバルを追加し、METER_EXPORT でエクスポートする
+ * @returns {{ wasm: Buffer, imports: Array }} 書き換えた wasm とインポート一覧
+ */
+function instrument(buf) {
+  const sections = parseSections(buf);
+  const importSec = sections.find((s) => s.name === "import");
+  const imports = importSec ? parseImports(buf, importSec) : [];
+  const importedGlobals = imports.filter((i) => i.kind === 3).length;
+  const globalSec = sections.find((s) => s.name === "global");
+  const definedGlobals = globalSec ? new Reader(buf, globalSec.body, globalSec.end).u32() : 0;
+  const meter = importedGlobals + definedGlobals;
+
+  const meterGlobal = Buffer.from([0x7e, 0x01, 0x42, 0x00, 0x0b]); // mut i64 = 0
+  const parts = [buf.subarray(0, 8)];
+  let globalDone = false;
+  let exportDone = false;
+  const addGlobal = () => {
+    if (globalDone) return;
+    globalDone = true;
+    if (!globalSec) parts.push(section(6, Buffer.concat([uleb(1), meterGlobal])));
+  };
+  const addExport = (entries = [], count = 0) => {
+    exportDone = true;
+    const name = Buffer.from(METER_EXPORT);
+    parts.push(section(7, Buffer.concat([uleb(count + 1), ...entries, uleb(name.length), name, Buffer.from([3]),
+      uleb(meter)])));
+  };
+
+  for (const sec of sections) {
+    // セクションの並び順 (datacount (12) は code (10) の前) で global・export の位置を決める
+    const order = SECTION_ORDER[sec.id] || 0;
+    if (order > SECTION_ORDER[6]) addGlobal();
+    if (order > SECTION_ORDER[7] && !exportDone) addExport();
+
+    if (sec.id === 6) {
+      const r = new Reader(buf, sec.body, sec.end);
+      const count = r.u32();
+      parts.push(section(6, Buffer.concat([uleb(count + 1), buf.subarray(r.pos, sec.end), meterGlobal])));
+      globalDone = true;
+    } else if (sec.id === 7) {
+      const r = new Reader(buf, sec.body, sec.end);
+      const count = r.u32();
+      addExport([buf.subarray(r.pos, sec.end)], count);
+    } else if (sec.id === 10) {
+      const r = new Reader(buf, sec.body, sec.end);
+      const bodies = [];
+      const count = r.u32();
+      for (let i = 0; i < count; i++) {
+        const size = r.u32();
+        bodies.push(meterBody(buf, r.pos, r.pos + size, meter));
+        r.skip(size);
+      }
+      parts.push(section(10, Buffer.concat([uleb(count), ...bodies])));
+    } else if (sec.id !== 0) {
+      parts.push(buf.subarray(sec.start, sec.end));
+    }
+  }
+  addGlobal();
+  if (!exportDone) addExport();
+  return { wasm: Buffer.concat(parts), imports };
+}
+
+// =====================================================================================================================
+// == アドレス・XFL ==
+// =====================================================================================================================
+
+const B58_ALPHABET = "rpshnaf39wBUDNEGHJKLM4PQRST7VWXYZ2bcdeCg65jkm8oFqi1tuvAxyz";
+const sha256 = (data) => crypto.createHash("sha256").update(data).digest();
+const sha512 = (data) => crypto.createHash("sha512").update(data).digest();
+
+function encodeAddress(accid) {
+  const payload = Buffer.concat([Buffer.from([0]), accid]);
+  const full = Buffer.concat([payload, sha256(sha256(payload)).subarray(0, 4)]);
+  let n = BigInt("0x" + full.toString("hex"));
+  let s = "";
+  while (n > 0n) {
+    s = B58_ALPHABET[Number(n % 58n)] + s;
+    n /= 58n;
+  }
+  for (let i = 0; i < full.length && full[i] === 0; i++) s = B58_ALPHABET[0] + s;
+  return s;
+}
+
+function decodeAddress(address) {
+  if (typeof address !== "string" || address.length < 25 || address.length > 35) return null;
+  let n = 0n;
+  for (const c of address) {
+    const d = B58_ALPHABET.indexOf(c);
+    if (d < 0) return null;
+    n = n * 58n + BigInt(d);
+  }
+  let hex = n.toString(16);
+  if (hex.length % 2) hex = "0" + hex;
+  let zeros = 0;
+  while (address[zeros] === B58_ALPHABET[0]) zeros++;
+  const full = Buffer.concat([Buffer.alloc(zeros), Buffer.from(hex, "hex")]);
+  if (full.length !== 25 || full[0] !== 0) return null;
+  if (!sha256(sha256(full.subarray(0, 21))).subarray(0, 4).equals(full.subarray(21))) return null;
+  return full.subarray(1, 21);
+}
+
+const XFL_MANT_MIN = 1000000000000000n;
+const XFL_MANT_MAX = 9999999999999999n;
+
+function xflUnpack(xfl) {
+  if (xfl === 0n) return { neg: false, mant: 0n, exp: 0 };
+  if (xfl < 0n) return null;
+  const mant = xfl & ((1n << 54n) - 1n);
+  if (mant < XFL_MANT_MIN || mant > XFL_MANT_MAX) return null;
+  return { neg: ((xfl >> 62n) & 1n) === 0n, mant, exp: Number((xfl >> 54n) & 0xffn) - 97 };
+}
+
+function xflPack(neg, mant, exp) {
+  if (mant < 0n) {
+    neg = !neg;
+    mant = -mant;
+  }
+  if (mant === 0n) return 0n;
+  while (mant > XFL_MANT_MAX) { mant /= 10n; exp++; }
+  while (mant < XFL_MANT_MIN) { mant *= 10n; exp--; }
+  if (exp < -96) return 0n;
+  if (exp > 80) return INVALID_FLOAT;
+  return ((neg ? 0n : 1n) << 62n) | (BigInt(exp + 97) << 54n) | mant;
+}
+
+function xflAdd(a, b) {
+  const x = xflUnpack(a);
+  const y = xflUnpack(b);
+  if (!x || !y) return INVALID_FLOAT;
+  if (x.mant === 0n) return b;
+  if (y.mant === 0n) return a;
+  let va = x.neg ? -x.mant : x.mant;
+  let vb = y.neg ? -y.mant : y.mant;
+  let ea = x.exp;
+  let eb = y.exp;
+  if (ea - eb > 18) return a;
+  if (eb - ea > 18) return b;
+  while (ea > eb) { va *= 10n; ea--; }
+  while (eb > ea) { vb *= 10n; eb--; }
+  return xflPack(false, va + vb, ea);
+}
+
+// IOU の金額 (10進文字列) を Amount の先頭8バイトにする
+function serializeIouValue(value) {
+  const m = /^(-?)(\d*)(?:\.(\d*))?(?:[eE]([+-]?\d+))?$/.exec(String(value));
+  if (!m) throw new Error(`invalid amount: ${value}`);
+  const digits = (m[2] + (m[3] || "")).replace(/^0+/, "") || "0";
+  const exp = Number(m[4] || 0) - (m[3] || "").length;
+  const xfl = xflPack(m[1] === "-", BigInt(digits), exp);
+  return Buffer.from((0x8000000000000000n | (xfl < 0n ? 0n : xfl)).toString(16).padStart(16, "0"), "hex");
+}
+
+function currencyBytes(code) {
+  if (code.length === 40) return Buffer.from(code, "hex");
+  const buf = Buffer.alloc(20);
+  buf.write(code, 12, "ascii");
+  return buf;
+}
+
+function serializeAmount(amount) {
+  if (typeof amount === "string") {
+    // XRP (drops): bit62 = 正
+    return Buffer.from((0x4000000000000000n | BigInt(amount)).toString(16).padStart(16, "0"), "hex");
+  }
+  const issuer = decodeAddress(amount.issuer);
+  if (!issuer) throw new Error(`invalid issuer: ${amount.issuer}`);
+  return Buffer.concat([serializeIouValue(amount.value), currencyBytes(amount.currency), issuer]);
+}
+
+function accountKeylet(accid) {
+  const full = sha512(Buffer.concat([Buffer.from([0x00, 0x61]), accid]));
+  return Buffer.concat([Buffer.from([0x00, 0x61]), full.subarray(0, 32)]).toString("hex");
+}
+
+/** util_verify が受理するエミュレータの署名 (src/c/emu の emu_sign と同じ) */
+function emuSign(key, msg) {
+  return sha512(Buffer.concat([key.subarray(0, 64), msg.subarray(0, 1024)]));
+}
+
+// =====================================================================================================================
+// == シリアライズ済みオブジェクト (STObject。hookapi_emu.c と同じ範囲) ==
+// =====================================================================================================================
+
+const STI_AMOUNT = 6;
+const STI_VL = 7;
+const STI_ACCOUNT = 8;
+const STI_OBJECT = 14;
+const STI_ARRAY = 15;
+const STI_VECTOR256 = 19;
+const STI_FIXED_SIZE = { 1: 2, 2: 4, 3: 8, 4: 16, 5: 32, 16: 1, 17: 20 };
+const STO_END_FIELD = 1; // ObjectEndMarker (14, 1) / ArrayEndMarker (15, 1)
+
+function stoReadHeader(b, p, end) {
+  if (p >= end) return null;
+  let type = b[p] >> 4;
+  let field = b[p] & 0x0f;
+  p++;
+  if (type === 0) {
+    if (p >= end) return null;
+    type = b[p++];
+  }
+  if (field === 0) {
+    if (p >= end) return null;
+    field = b[p++];
+  }
+  return { type, field, p };
+}
+
+function stoIsEnd(b, p, end, endType) {
+  const h = stoReadHeader(b, p, end);
+  return h !== null && h.type === endType && h.field === STO_END_FIELD;
+}
+
+/**
+ * 1フィールド分の位置を返す (不正な形式なら null)
+ * value は Blob なら長さの接頭辞を除いた値、オブジェクト・配列なら終端記号を除いた中身
+ */
+function stoReadField(b, p, end, depth = 0) {
+  const h = stoReadHeader(b, p, end);
+  if (!h) return null;
+  const f = { type: h.type, field: h.field, id: h.type * 65536 + h.field, header: p, body: h.p };
+  p = h.p;
+  let len;
+  if (h.type in STI_FIXED_SIZE) {
+    len = STI_FIXED_SIZE[h.type];
+  } else if (h.type === STI_AMOUNT) {
+    if (p >= end) return null;
+    len = b[p] & 0x80 ? 48 : 8;
+  } else if (h.type === STI_VL || h.type === STI_ACCOUNT || h.type === STI_VECTOR256) {
+    if (p >= end) return null;
+    if (b[p] <= 192) {
+      len = b[p];
+      p += 1;
+    } else if (b[p] <= 240) {
+      if (p + 2 > end) return null;
+      len = 193 + (b[p] - 193) * 256 + b[p + 1];
+      p += 2;
+    } else if (b[p] <= 254) {
+      if (p + 3 > end) return null;
+      len = 12481 + (b[p] - 241) * 65536 + b[p + 1] * 256 + b[p + 2];
+      p += 3;
+    } else {
+      return null;
+    }
+  } else if (h.type === STI_OBJECT || h.type === STI_ARRAY) {
+    if (depth > 8) return null;
+    let q = p;
+    while (!stoIsEnd(b, q, end, h.type)) {
+      const inner = stoReadField(b, q, end, depth + 1);
+      if (!inner || (h.type === STI_ARRAY && inner.type !== STI_OBJECT)) return null;
+      q = inner.next;
+    }
+    return { ...f, value: p, valueLen: q - p, next: q + 1 };
+  } else {
+    return null;
+  }
+  if (len > end - p) return null;
+  return { ...f, value: p, valueLen: len, next: p + len };
+}
+
+// [p, end) のトップレベルから fieldId のフィールドを探す (見つからなければエラーコード)
+function stoFind(b, p, end, fieldId) {
+  while (p < end) {
+    const f = stoReadField(b, p, end);
+    if (!f) return PARSE_ERROR;
+    if (f.id === fieldId) return f;
+    p = f.next;
+  }
+  return DOESNT_EXIST;
+}
+
+function stoHeader(type, field) {
+  if (type < 16 && field < 16) return Buffer.from([(type << 4) | field]);
+  if (type < 16) return Buffer.from([type << 4, field]);
+  if (field < 16) return Buffer.from([field, type]);
+  return Buffer.from([0, type, field]);
+}
+
+function stoField(fieldId, data) {
+  return Buffer.concat([stoHeader(fieldId >>> 16, fieldId & 0xffff), data]);
+}
+
+function stoVl(fieldId, data) {
+  const n = data.length;
+  const prefix = n <= 192 ? Buffer.from([n]) : Buffer.from([193 + ((n - 193) >> 8), (n - 193) & 0xff]);
+  return Buffer.concat([stoHeader(fieldId >>> 16, fieldId & 0xffff), prefix, data]);
+}
+
+function stoUint(fieldId, value, size) {
+  const data = Buffer.alloc(size);
+  for (let i = 0; i < size; i++) data[i] = Number((BigInt(value) >> BigInt(8 * (size - 1 - i))) & 0xffn);
+  return stoField(fieldId, data);
+}
+
+function stoObject(fieldId, fields) {
+  return Buffer.concat([stoHeader(STI_OBJECT, fieldId & 0xffff), ...fields, stoHeader(STI_OBJECT, STO_END_FIELD)]);
+}
+
+function stoArray(fieldId, objects) {
+  return Buffer.concat([stoHeader(STI_ARRAY, fieldId & 0xffff), ...objects, stoHeader(STI_ARRAY, STO_END_FIELD)]);
+}
+
+// sto_subfield / sto_subarray の戻り値 (上位32ビットが位置、下位32ビットが長さ)
+const stoRange = (offset, len) => (BigInt(offset) << 32n) | BigInt(len);
+
+// =====================================================================================================================
+// == 再生エンジン ==
+// =====================================================================================================================
+
+class HookExit extends Error {
+  constructor(outcome, message, code) {
+    super(message);
+    this.outcome = outcome;
+    this.code = code;
+  }
+}
+
+/**
+ * フックの wasm を読み込み、State を保持したままトランザクションを順に実行する
+ */
+class HookReplay {
+  /**
+   * @param {Buffer} wasm - フックの wasm
+   * @param {Object} [options]
+   * @param {string} [options.hookAccount] - フックのアカウント
+   * @param {boolean} [options.trace] - trace の出力を結果に含める
+   */
+  constructor(wasm, options = {}) {
+    const { wasm: metered, imports } = instrument(wasm);
+    this.module = new WebAssembly.Module(metered);
+    this.imports = imports;
+    this.importTypes = new Map(WebAssembly.Module.imports(this.module).map((i) => [`${i.module}.${i.name}`, i.kind]));
+    this.resultTypes = importResultTypes(metered);
+    this.hookAccid = options.hookAccount ? decodeAddress(options.hookAccount) : null;
+    this.traceEnabled = !!options.trace;
+    this.state = new Map(); // 32バイトのキー (16進数) => Buffer
+    this.accounts = new Map(); // keylet (16進数) => AccountRoot (sfAccount・sfRegularKey のシリアライズ)
+  }
+
+  /** 台帳にアカウントを追加します (slot_set の対象)。 */
+  addAccount(address, regularKey) {
+    const accid = decodeAddress(address);
+    if (!accid) throw new Error(`invalid account: ${address}`);
+    const fields = [stoVl(sfAccount, accid)];
+    if (regularKey) {
+      const key = decodeAddress(regularKey);
+      if (!key) throw new Error(`invalid regular key: ${regularKey}`);
+      fields.push(stoVl(sfRegularKey, key));
+    }
+    this.accounts.set(accountKeylet(accid), Buffer.concat(fields));
+  }
+
+  /** State を直接設定します (data が null なら削除)。 */
+  setState(keyHex, dataHex) {
+    const key = Buffer.alloc(STATE_KEY_SIZE);
+    Buffer.from(keyHex, "hex").copy(key, STATE_KEY_SIZE - keyHex.length / 2);
+    if (dataHex) this.state.set(key.toString("hex").toUpperCase(), Buffer.from(dataHex, "hex"));
+    else this.state.delete(key.toString("hex").toUpperCase());
+  }
+
+  /**
+   * コーパスの1行を処理します。トランザクションなら実行結果を返します。
+   */
+  apply(message) {
+    if (message.type === "namespace") {
+      message.namespace_entries.forEach((e) => this.setState(e.HookStateKey, e.HookStateData));
+      return null;
+    }
+    if (message.type === "account") {
+      this.addAccount(message.account, message.regular_key);
+      return null;
+    }
+    if (message.type === "ledgerClosed") return null;
+    if (message.expected && message.expected.engine_result) return null;
+    const tx = message.transaction || message.tx_json || message;
+    if (!tx.TransactionType) return null;
+    return this.run(tx);
+  }
+
+  /**
+   * トランザクションを1件実行します。
+   * @param {Object} tx - トランザクション (JSON)
+   */
+  run(tx) {
+    if (!this.hookAccid) this.hookAccid = decodeAddress(tx.Destination);
+    const txn = toHookTxn(tx, this.hookAccid);
+    [tx.Account, tx.Destination].forEach((address) => {
+      const accid = decodeAddress(address);
+      if (accid && !this.accounts.has(accountKeylet(accid))) this.accounts.set(accountKeylet(accid), stoVl(sfAccount, accid));
+    });
+
+    const ctx = {
+      txn,
+      pending: new Map(),
+      guards: new Map(),
+      slots: new Array(MAX_SLOTS + 1).fill(null), // 1 から MAX_SLOTS まで
+      reserved: 0,
+      emitted: [],
+      calls: {},
+      hostCalls: 0,
+      trace: [],
+      points: [],
+      stateReads: 0,
+      stateWrites: 0,
+    };
+    const host = this.hostFunctions(ctx);
+    const env = {};
+    let memory = null;
+    for (const imp of WebAssembly.Module.imports(this.module)) {
+      if (imp.module !== "env") continue;
+      if (imp.kind === "function") {
+        const fn = host[imp.name];
+        const i64 = this.resultTypes.get(imp.name) === 0x7e;
+        env[imp.name] = (...args) => {
+          if (!fn) throw new HookExit("rollback", `unknown host function: ${imp.name}`, -1n);
+          ctx.calls[imp.name] = (ctx.calls[imp.name] || 0) + 1;
+          ctx.hostCalls++;
+          const result = fn(...args);
+          return i64 ? BigInt(result ?? 0) : Number(result ?? 0);
+        };
+      } else if (imp.kind === "memory") {
+        memory = env[imp.name] = new WebAssembly.Memory({ initial: 2 });
+      } else if (imp.kind === "global") {
+        // リンク前のオブジェクトファイル (__stack_pointer など)
+        env[imp.name] = new WebAssembly.Global({ value: "i32", mutable: true }, 65536);
+      } else if (imp.kind === "table") {
+        env[imp.name] = new WebAssembly.Table({ initial: 1, element: "anyfunc" });
+      }
+    }
+
+    const started = process.hrtime.bigint();
+    const instance = new WebAssembly.Instance(this.module, { env });
+    ctx.memory = memory || instance.exports.memory;
+    ctx.instructions = () => Number(instance.exports[METER_EXPORT].value);
+    let outcome = "return";
+    let code = 0n;
+    let message = "";
+    try {
+      instance.exports.hook(0);
+    } catch (error) {
+      if (!(error instanceof HookExit)) {
+        outcome = "trap";
+        message = error.message;
+      } else {
+        ({ outcome, code, message } = error);
+      }
+    }
+    const elapsedNs = Number(process.hrtime.bigint() - started);
+
+    const delta = [];
+    if (outcome === "accept") {
+      for (const [key, data] of ctx.pending) {
+        const before = this.state.get(key);
+        if (data) this.state.set(key, data);
+        else this.state.delete(key);
+        delta.push({ key, before: before ? before.toString("hex").toUpperCase() : null,
+          after: data ? data.toString("hex").toUpperCase() : null });
+      }
+    }
+
+    const result = {
+      hash: tx.hash,
+      type: tx.TransactionType,
+      outcome,
+      code: Number(code),
+      message,
+      instructions: Number(instance.exports[METER_EXPORT].value),
+      host_calls: ctx.hostCalls,
+      state_reads: ctx.stateReads,
+      state_writes: ctx.stateWrites,
+      state_delta: delta,
+      emitted: outcome === "accept" ? ctx.emitted : [],
+      elapsed_ns: elapsedNs,
+    };
+    if (ctx.points.length > 0) result.steps = traceSteps(ctx.points, result.instructions, untracedCalls(ctx));
+    if (this.traceEnabled) result.trace = ctx.trace;
+    return result;
+  }
+
+  hostFunctions(ctx) {
+    const replay = this;
+    const mem = () => new Uint8Array(ctx.memory.buffer);
+    const read = (ptr, len) => {
+      ptr = Number(ptr);
+      len = Number(len);
+      if (ptr < 0 || ptr + len > ctx.memory.buffer.byteLength) throw new HookExit("rollback", "out of bounds", OUT_OF_BOUNDS);
+      return Buffer.from(mem().subarray(ptr, ptr + len));
+    };
+    const write = (ptr, data) => {
+      ptr = Number(ptr);
+      if (ptr < 0 || ptr + data.length > ctx.memory.buffer.byteLength) return OUT_OF_BOUNDS;
+      mem().set(data, ptr);
+      return BigInt(data.length);
+    };
+    const copyOut = (out, outLen, data) => (Number(outLen) < data.length ? TOO_SMALL : write(out, data));
+    const exit = (outcome) => (msg, len, code) => {
+      const text = read(msg, len).toString("utf8").replace(/\0+$/, "");
+      throw new HookExit(outcome, text, BigInt(code));
+    };
+    const padKey = (key, len) => {
+      if (Number(len) === 0 || Number(len) > STATE_KEY_SIZE) return null;
+      const k = Buffer.alloc(STATE_KEY_SIZE);
+      read(key, len).copy(k, STATE_KEY_SIZE - Number(len));
+      return k.toString("hex").toUpperCase();
+    };
+    const stateRead = (out, outLen, key, keyLen) => {
+      ctx.stateReads++;
+      const k = padKey(key, keyLen);
+      if (!k) return TOO_BIG;
+      const data = ctx.pending.has(k) ? ctx.pending.get(k) : replay.state.get(k);
+      if (!data) return DOESNT_EXIST;
+      if (Number(out) === 0) return BigInt(data.length);
+      return copyOut(out, outLen, data);
+    };
+    const txn = ctx.txn;
+    // xahaud と同じく AccountID は長さの接頭辞を除き、それ以外はシリアライズしたまま書き込む
+    const writeField = (out, outLen, buf, f) => (f.type === STI_ACCOUNT || f.type === STI_OBJECT || f.type === STI_ARRAY
+      ? copyOut(out, outLen, buf.subarray(f.value, f.value + f.valueLen))
+      : copyOut(out, outLen, buf.subarray(f.body, f.next)));
+    const slotStore = (slotNo, data, type) => {
+      slotNo >>>= 0;
+      if (slotNo === 0) {
+        slotNo = ctx.slots.indexOf(null, 1);
+        if (slotNo < 0) return NO_FREE_SLOTS;
+      } else if (slotNo > MAX_SLOTS) {
+        return INVALID_ARGUMENT;
+      }
+      ctx.slots[slotNo] = { type, data };
+      return BigInt(slotNo);
+    };
+    // フィールドをスロットに置く (オブジェクト・配列は中身、それ以外はヘッダを除いたシリアライズ形式)
+    const slotStoreField = (slotNo, buf, f) => (f.type === STI_OBJECT || f.type === STI_ARRAY
+      ? slotStore(slotNo, buf.subarray(f.value, f.value + f.valueLen), f.type)
+      : slotStore(slotNo, buf.subarray(f.body, f.next), f.type));
+    const slotGet = (slotNo) => ((slotNo >>> 0) <= MAX_SLOTS ? ctx.slots[slotNo >>> 0] : null);
+    // 配列の要素を順に返す (不正な形式なら null を返して終わる)
+    function* elements(buf, end = buf.length) {
+      for (let p = 0; p < end && !stoIsEnd(buf, p, end, STI_ARRAY);) {
+        const f = stoReadField(buf, p, end);
+        yield f;
+        if (!f) return;
+        p = f.next;
+      }
+    }
+
+    return {
+      _g(id, maxiter) {
+        const count = (ctx.guards.get(id) || 0) + 1;
+        ctx.guards.set(id, count);
+        if (count > maxiter >>> 0) throw new HookExit("rollback", "guard violation", -1n);
+        return 1;
+      },
+      accept: exit("accept"),
+      rollback: exit("rollback"),
+      trace(msg, len, data, dataLen, asHex) {
+        if (Number(dataLen) === TRACE_POINT_SIZE && read(msg, len).toString("latin1") === TRACE_POINT_TAG) {
+          const point = read(data, dataLen);
+          ctx.points.push({
+            handler: point[0],
+            step: point[1] & ~TRACE_ITEM_FLAG,
+            item: (point[1] & TRACE_ITEM_FLAG) !== 0,
+            value: point.readBigInt64LE(2).toString(),
+            instructions: ctx.instructions(),
+            hostCalls: untracedCalls(ctx),
+          });
+        }
+        if (replay.traceEnabled) {
+          const bytes = Number(dataLen) > 0 ? read(data, dataLen) : null;
+          ctx.trace.push(read(msg, len).toString("utf8") +
+            (bytes ? " " + (asHex ? bytes.toString("hex").toUpperCase() : bytes.toString("utf8")) : ""));
+        }
+        return 0;
+      },
+      trace_num(msg, len, number) {
+        if (replay.traceEnabled) ctx.trace.push(`${read(msg, len).toString("utf8")} ${number}`);
+        return 0;
+      },
+      hook_account: (out, outLen) => copyOut(out, outLen, replay.hookAccid),
+      ledger_seq: () => LEDGER_SEQ,
+      otxn_type: () => BigInt(txn.type),
+      otxn_field(out, outLen, fieldId) {
+        const f = stoFind(txn.sto, 0, txn.sto.length, fieldId >>> 0);
+        return typeof f === "bigint" ? f : writeField(out, outLen, txn.sto, f);
+      },
+      otxn_slot: (slotNo) => slotStore(slotNo, txn.sto, STI_OBJECT),
+      slot(out, outLen, slotNo) {
+        const s = slotGet(slotNo);
+        return s ? copyOut(out, outLen, s.data) : DOESNT_EXIST;
+      },
+      slot_count(slotNo) {
+        const s = slotGet(slotNo);
+        if (!s) return DOESNT_EXIST;
+        if (s.type !== STI_ARRAY) return NOT_AN_ARRAY;
+        let count = 0n;
+        for (const f of elements(s.data)) {
+          if (!f) return INTERNAL_ERROR;
+          count++;
+        }
+        return count;
+      },
+      slot_subfield(parentSlot, fieldId, newSlot) {
+        const s = slotGet(parentSlot);
+        if (!s) return DOESNT_EXIST;
+        if (s.type !== STI_OBJECT) return NOT_AN_OBJECT;
+        const f = stoFind(s.data, 0, s.data.length, fieldId >>> 0);
+        if (typeof f === "bigint") return f === PARSE_ERROR ? INTERNAL_ERROR : f;
+        return slotStoreField(newSlot, s.data, f);
+      },
+      slot_subarray(parentSlot, index, newSlot) {
+        const s = slotGet(parentSlot);
+        if (!s) return DOESNT_EXIST;
+        if (s.type !== STI_ARRAY) return NOT_AN_ARRAY;
+        let i = 0;
+        for (const f of elements(s.data)) {
+          if (!f) return INTERNAL_ERROR;
+          if (i++ === index >>> 0) return slotStoreField(newSlot, s.data, f);
+        }
+        return DOESNT_EXIST;
+      },
+      slot_set(keylet, len, slotNo) {
+        if (Number(len) !== 34) return INVALID_ARGUMENT;
+        const account = replay.accounts.get(read(keylet, 34).toString("hex"));
+        return account ? slotStore(slotNo, account, STI_OBJECT) : DOESNT_EXIST;
+      },
+      state: stateRead,
+      state_set(data, dataLen, key, keyLen) {
+        const k = padKey(key, keyLen);
+        if (!k || Number(dataLen) > STATE_DATA_SIZE) return TOO_BIG;
+        if (!ctx.pending.has(k) && ctx.pending.size >= MAX_STATE_MODS) return TOO_MANY_STATE_MODIFICATIONS;
+        if (Number(data) === 0 || Number(dataLen) === 0) {
+          ctx.pending.set(k, null);
+          return 0;
+        }
+        ctx.pending.set(k, read(data, dataLen));
+        ctx.stateWrites++;
+        return BigInt(dataLen);
+      },
+      sto_subfield(sto, stoLen, fieldId) {
+        const buf = read(sto, stoLen);
+        const f = stoFind(buf, 0, buf.length, fieldId >>> 0);
+        return typeof f === "bigint" ? f : stoRange(f.value, f.valueLen);
+      },
+      sto_subarray(sto, stoLen, index) {
+        const buf = read(sto, stoLen);
+        let i = 0;
+        for (const f of elements(buf)) {
+          if (!f) return PARSE_ERROR;
+          if (i++ === index >>> 0) return stoRange(f.header, f.next - f.header);
+        }
+        return DOESNT_EXIST;
+      },
+      util_raddr(out, outLen, accid, len) {
+        if (Number(len) !== 20) return INVALID_ARGUMENT;
+        const raddr = Buffer.from(encodeAddress(read(accid, 20)), "latin1");
+        if (raddr.length > Number(outLen)) return TOO_SMALL;
+        write(out, Number(outLen) > raddr.length ? Buffer.concat([raddr, Buffer.from([0])]) : raddr);
+        return BigInt(raddr.length);
+      },
+      util_accid(out, outLen, raddr, len) {
+        if (Number(outLen) < 20) return TOO_SMALL;
+        if (Number(len) > 49) return TOO_BIG;
+        const accid = decodeAddress(read(raddr, len).toString("latin1").replace(/\0.*$/, ""));
+        return accid ? write(out, accid) : INVALID_ARGUMENT;
+      },
+      util_verify(data, dataLen, sig, sigLen, key, keyLen) {
+        if (Number(keyLen) === 0 || Number(keyLen) > 33 || Number(sigLen) !== 64 || Number(dataLen) > 1024) return 0;
+        return emuSign(read(key, keyLen), read(data, dataLen)).equals(read(sig, 64)) ? 1 : 0;
+      },
+      util_sha512h(out, outLen, data, len) {
+        if (Number(outLen) < 32) return TOO_SMALL;
+        return write(out, sha512(read(data, len)).subarray(0, 32));
+      },
+      util_keylet(out, outLen, type, a, b) {
+        if ((type >>> 0) !== KEYLET_ACCOUNT) return INVALID_ARGUMENT;
+        if (Number(outLen) < 34) return TOO_SMALL;
+        if (Number(a) === 0 || Number(b) !== 20) return INVALID_ARGUMENT;
+        return write(out, Buffer.from(accountKeylet(read(a, 20)), "hex"));
+      },
+      float_sum: (a, b) => xflAdd(a, b),
+      float_compare(a, b, mode) {
+        mode >>>= 0;
+        if (mode === 0 || (mode & ~7) || mode === 7) return INVALID_ARGUMENT;
+        if (!xflUnpack(a) || !xflUnpack(b)) return INVALID_FLOAT;
+        const diff = xflAdd(a, b === 0n ? 0n : b ^ (1n << 62n));
+        if (diff < 0n) return diff;
+        const rel = diff === 0n ? 1 : ((diff >> 62n) & 1n) ? 4 : 2;
+        return mode & rel ? 1 : 0;
+      },
+      float_sto_set(sto, stoLen) {
+        // Amount の8バイトの値 (フィールドヘッダは付いていてもよい)
+        let buf = read(sto, stoLen);
+        if (buf.length > 8) {
+          const h = stoReadHeader(buf, 0, buf.length);
+          if (!h) return NOT_AN_OBJECT;
+          buf = buf.subarray(h.p);
+        }
+        if (buf.length !== 8) return NOT_AN_OBJECT;
+        const v = buf.readBigUInt64BE(0);
+        const neg = ((v >> 62n) & 1n) === 0n;
+        if ((v >> 63n) === 0n) return xflPack(neg, v & ((1n << 62n) - 1n), -6); // XRP (ドロップ)
+        return xflPack(neg, v & ((1n << 54n) - 1n), Number((v >> 54n) & 0xffn) - 97);
+      },
+      float_int(xfl, decimalPlaces, absolute) {
+        const x = xflUnpack(xfl);
+        if (!x) return INVALID_FLOAT;
+        if ((decimalPlaces >>> 0) > 15) return INVALID_ARGUMENT;
+        if (x.mant === 0n) return 0n;
+        if (x.neg && !absolute) return CANT_RETURN_NEGATIVE;
+        // 小数点以下 decimalPlaces 桁より下は切り捨てる
+        const exp = x.exp + (decimalPlaces >>> 0);
+        const v = exp < 0 ? x.mant / 10n ** BigInt(-exp) : x.mant * 10n ** BigInt(exp);
+        return v > 0x7fffffffffffffffn ? TOO_BIG : v;
+      },
+      etxn_reserve(count) {
+        if (ctx.reserved > 0) return ALREADY_SET;
+        if ((count >>> 0) === 0 || (count >>> 0) > MAX_EMITTED) return TOO_BIG;
+        ctx.reserved = count >>> 0;
+        return BigInt(ctx.reserved);
+      },
+      etxn_details(out, outLen) {
+        if (ctx.reserved === 0) return PREREQUISITE_NOT_MET;
+        if (Number(outLen) < ETXN_DETAILS_SIZE) return TOO_SMALL;
+        // sfEmitDetails (コールバックなし)。ハッシュ類は0、ノンスは発行順
+        const nonce = Buffer.alloc(32);
+        nonce[31] = ctx.emitted.length;
+        return write(out, stoObject(sfEmitDetails, [
+          stoUint(sfEmitGeneration, 1, 4),
+          stoUint(sfEmitBurden, 1, 8),
+          stoField(sfEmitParentTxnID, Buffer.alloc(32)),
+          stoField(sfEmitNonce, nonce),
+          stoField(sfEmitHookHash, Buffer.alloc(32)),
+        ]));
+      },
+      etxn_fee_base(blob, len) {
+        if (ctx.reserved === 0) return PREREQUISITE_NOT_MET;
+        return Number(len) === 0 ? INVALID_ARGUMENT : EMIT_FEE;
+      },
+      emit(hashOut, hashLen, blob, len) {
+        if (ctx.reserved === 0) return PREREQUISITE_NOT_MET;
+        if (ctx.emitted.length >= ctx.reserved) return EMISSION_FAILURE;
+        if (Number(hashLen) < 32) return TOO_SMALL;
+
+        // 発行できるのはフックのアカウントから送る、手数料と EmitDetails の付いた IOU の Payment のみ
+        const buf = read(blob, len);
+        const fields = new Map();
+        for (let p = 0; p < buf.length;) {
+          const f = stoReadField(buf, p, buf.length);
+          if (!f) return EMISSION_FAILURE;
+          fields.set(f.id, buf.subarray(f.value, f.value + f.valueLen));
+          p = f.next;
+        }
+        const type = fields.get(sfTransactionType);
+        const fee = fields.get(sfFee);
+        const account = fields.get(sfAccount);
+        const destination = fields.get(sfDestination);
+        const amount = fields.get(sfAmount);
+        if (!type || type.readUInt16BE(0) !== TT.Payment || !fee || fee.length !== 8 || (fee[0] & 0x80) ||
+            !fields.has(sfEmitDetails) || !account || account.length !== 20 || !account.equals(replay.hookAccid) ||
+            !destination || destination.length !== 20 || !amount || amount.length !== 48) return EMISSION_FAILURE;
+
+        ctx.emitted.push({ destination: encodeAddress(destination), amount: amount.toString("hex").toUpperCase() });
+        return write(hashOut, sha512(buf).subarray(0, 32));
+      },
+    };
+  }
+}
+
+// インポートしたホスト関数の戻り値の型 (0x7e: i64, 0x7f: i32)
+function importResultTypes(buf) {
+  const sections = parseSections(buf);
+  const typeSec = sections.find((s) => s.name === "type");
+  const importSec = sections.find((s) => s.name === "import");
+  const results = [];
+  if (typeSec) {
+    const r = new Reader(buf, typeSec.body, typeSec.end);
+    for (let n = r.u32(); n > 0; n--) {
+      r.byte();
+      r.skip(r.u32());
+      const count = r.u32();
+      results.push(count > 0 ? r.byte() : null);
+      r.skip(Math.max(count - 1, 0));
+    }
+  }
+  const types = new Map();
+  if (importSec) {
+    const r = new Reader(buf, importSec.body, importSec.end);
+    for (let n = r.u32(); n > 0; n--) {
+      r.name();
+      const field = r.name();
+      const kind = r.byte();
+      if (kind === 0) types.set(field, results[r.u32()]);
+      else if (kind === 1) { r.byte(); const f = r.byte(); r.u32(); if (f & 1) r.u32(); }
+      else if (kind === 2) { const f = r.byte(); r.u32(); if (f & 1) r.u32(); }
+      else if (kind === 3) { r.byte(); r.byte(); }
+    }
+  }
+  return types;
+}
+
+// JSON のトランザクションをフックから見える形 (XRPL のバイナリ形式。フィールドは型コード・フィールドコードの順) にする
+function toHookTxn(tx, hookAccid) {
+  const account = decodeAddress(tx.Account);
+  if (!account) throw new Error(`invalid Account: ${tx.Account}`);
+  if (!(tx.TransactionType in TT)) throw new Error(`unsupported TransactionType: ${tx.TransactionType}`);
+  const destination = tx.Destination ? decodeAddress(tx.Destination) : hookAccid;
+  if (!destination) throw new Error(`invalid Destination: ${tx.Destination}`);
+
+  const fields = [stoUint(sfTransactionType, TT[tx.TransactionType], 2)];
+  if (tx.Amount !== undefined) fields.push(stoField(sfAmount, serializeAmount(tx.Amount)));
+  if (tx.SigningPubKey) fields.push(stoVl(sfSigningPubKey, Buffer.from(tx.SigningPubKey, "hex")));
+  fields.push(stoVl(sfAccount, account), stoVl(sfDestination, destination));
+  if (tx.Memos && tx.Memos.length > 0) {
+    fields.push(stoArray(sfMemos, tx.Memos.map(({ Memo: m }) => stoObject(sfMemo, [
+      ...(m.MemoType ? [stoVl(sfMemoType, Buffer.from(m.MemoType, "hex"))] : []),
+      ...(m.MemoData !== undefined ? [stoVl(sfMemoData, Buffer.from(m.MemoData, "hex"))] : []),
+      ...(m.MemoFormat ? [stoVl(sfMemoFormat, Buffer.from(m.MemoFormat, "hex"))] : []),
+    ]))));
+  }
+  return { type: TT[tx.TransactionType], sto: Buffer.concat(fields) };
+}
+
+// =====================================================================================================================
+// == CLI ==
+// =====================================================================================================================
+
+// trace / trace_num を除いたホスト関数の呼び出し回数
+function untracedCalls(ctx) {
+  return ctx.hostCalls - (ctx.calls.trace || 0) - (ctx.calls.trace_num || 0);
+}
+
+/**
+ * トレースポイントをステップの区間 (次のトレースポイントまたは終了まで) に分け、命令数とホスト関数呼び出し数を求める。
+ * エントリごとのトレースポイント (item) は区間を区切らない。
+ */
+function traceSteps(points, instructions, hostCalls) {
+  const steps = [];
+  let open = null;
+  const close = (p) => {
+    if (!open) return;
+    open.step.instructions = p.instructions - open.instructions;
+    open.step.host_calls = p.hostCalls - open.hostCalls;
+  };
+  for (const p of points) {
+    const handler = HANDLER_NAMES[p.handler] || String(p.handler);
+    if (p.item) {
+      steps.push({ handler, step: p.step, item: true, value: p.value });
+      continue;
+    }
+    close(p);
+    const step = { handler, step: p.step, value: p.value };
+    steps.push(step);
+    open = { step, instructions: p.instructions, hostCalls: p.hostCalls };
+  }
+  close({ instructions, hostCalls });
+  return steps;
+}
+
+/**
+ * ハンドラ別の集計。実行の結果は最後に通過したステップのハンドラに数える。
+ */
+function summarizeHandlers(results) {
+  const handlers = {};
+  const entry = (name) => (handlers[name] ||= { runs: 0, accepted: 0, rejected: 0, reasons: {}, steps: {} });
+  for (const r of results) {
+    if (!r.steps) continue;
+    let last = null;
+    for (const s of r.steps) {
+      const h = entry(s.handler);
+      const step = (h.steps[s.step] ||= { hits: 0, items: 0, instructions: 0, host_calls: 0 });
+      if (s.item) {
+        step.items++;
+        continue;
+      }
+      if (s.step === 0) h.runs++;
+      step.hits++;
+      step.instructions += s.instructions;
+      step.host_calls += s.host_calls;
+      last = h;
+    }
+    if (!last) continue;
+    if (r.outcome === "accept") last.accepted++;
+    else {
+      last.rejected++;
+      last.reasons[r.code] = (last.reasons[r.code] || 0) + 1;
+    }
+  }
+  for (const h of Object.values(handlers)) {
+    for (const step of Object.values(h.steps)) {
+      step.instructions_avg = step.hits ? Math.round(step.instructions / step.hits) : 0;
+      step.host_calls_avg = step.hits ? +(step.host_calls / step.hits).toFixed(2) : 0;
+    }
+  }
+  return handlers;
+}
+
+function summarize(results, elapsedMs) {
+  const txs = results.length;
+  const count = (outcome) => results.filter((r) => r.outcome === outcome).length;
+  const instructions = results.map((r) => r.instructions);
+  const total = instructions.reduce((a, b) => a + b, 0);
+  const execNs = results.reduce((a, r) => a + r.elapsed_ns, 0);
+  return {
+    transactions: txs,
+    accepted: count("accept"),
+    rolled_back: count("rollback"),
+    returned: count("return"),
+    trapped: count("trap"),
+    instructions_total: total,
+    instructions_avg: txs ? Math.round(total / txs) : 0,
+    instructions_max: txs ? Math.max(...instructions) : 0,
+    host_calls_avg: txs ? +(results.reduce((a, r) => a + r.host_calls, 0) / txs).toFixed(2) : 0,
+    tx_per_second: elapsedMs > 0 ? Math.round((txs * 1000) / elapsedMs) : 0,
+    exec_ns_avg: txs ? Math.round(execNs / txs) : 0,
+    ...(results.some((r) => r.steps) ? { handlers: summarizeHandlers(results) } : {}),
+  };
+}
+
+function parseArgs(argv) {
+  const options = { positional: [] };
+  for (let i = 0; i < argv.length; i++) {
+    const arg = argv[i];
+    if (arg === "--summary-only" || arg === "--trace") options[arg.slice(2)] = true;
+    else if (arg.startsWith("--")) options[arg.slice(2)] = argv[++i];
+    else options.positional.push(arg);
+  }
+  return options;
+}
+
+function main(argv) {
+  const options = parseArgs(argv);
+  const [wasmFile, corpusFile] = options.positional;
+  if (!wasmFile || !corpusFile) {
+    console.error("usage: node hook_replay.js <hook.wasm> <corpus.ndjson> [--hook-account r...] [--compare other.wasm]");
+    process.exit(2);
+  }
+  const engineOptions = { hookAccount: options["hook-account"], trace: options.trace };
+  const engines = [new HookReplay(fs.readFileSync(wasmFile), engineOptions)];
+  if (options.compare) engines.push(new HookReplay(fs.readFileSync(options.compare), engineOptions));
+
+  process.stdout.on("error", (error) => {
+    if (error.code !== "EPIPE") throw error;
+  });
+  const out = options["summary-only"] ? null : options.out ? fs.createWriteStream(options.out) : process.stdout;
+  const dropsPerKinstr = options["drops-per-kinstr"] ? Number(options["drops-per-kinstr"]) : null;
+  const results = engines.map(() => []);
+  const diffs = [];
+  const mismatches = [];
+  let expectations = 0;
+  const started = process.hrtime.bigint();
+
+  const lines = fs.readFileSync(corpusFile, "utf8").split("\n");
+  lines.forEach((line, index) => {
+    if (line.trim() === "") return;
+    const message = JSON.parse(line);
+    const outputs = engines.map((engine) => engine.apply(message));
+    if (!outputs[0]) return;
+    outputs.forEach((r, i) => {
+      if (dropsPerKinstr !== null) r.estimated_fee_drops = Math.ceil((r.instructions * dropsPerKinstr) / 1000);
+      results[i].push(r);
+    });
+    if (message.expected) expectations++;
+    if (message.expected && (outputs[0].outcome !== message.expected.outcome || outputs[0].code !== message.expected.code)) {
+      mismatches.push({ line: index + 1, kind: message.kind, expected: [message.expected.outcome, message.expected.code],
+        actual: [outputs[0].outcome, outputs[0].code, outputs[0].message] });
+    }
+    if (out) out.write(JSON.stringify(engines.length > 1 ? { line: index + 1, results: outputs } : outputs[0]) + "\n");
+    if (outputs.length > 1) {
+      const [a, b] = outputs;
+      const sameResult = a.outcome === b.outcome && a.code === b.code;
+      const sameState = JSON.stringify(a.state_delta) === JSON.stringify(b.state_delta);
+      if (!sameResult || !sameState) diffs.push({ line: index + 1, hash: a.hash, kind: sameResult ? "state" : "result",
+        base: [a.outcome, a.code, a.message], compare: [b.outcome, b.code, b.message] });
+    }
+  });
+
+  const elapsedMs = Number(process.hrtime.bigint() - started) / 1e6;
+  const summary = { wasm: wasmFile, ...summarize(results[0], elapsedMs) };
+  if (engines.length > 1) {
+    summary.compare = { wasm: options.compare, ...summarize(results[1], elapsedMs) };
+    summary.behaviour_diffs = diffs.length;
+    summary.instructions_delta = summary.compare.instructions_total - summary.instructions_total;
+    diffs.slice(0, 20).forEach((d) => console.error(`diff line ${d.line} (${d.kind}): ${JSON.stringify(d.base)} -> ${JSON.stringify(d.compare)}`));
+  }
+  if (expectations > 0) {
+    summary.expected_mismatches = mismatches.length;
+    mismatches.slice(0, 20).forEach((m) => console.error(
+      `mismatch line ${m.line} (${m.kind}): expected ${JSON.stringify(m.expected)}, got ${JSON.stringify(m.actual)}`));
+  }
+  console.error(JSON.stringify(summary, null, 2));
+
+  if (options["state-out"]) {
+    const state = Object.fromEntries([...engines[0].state].map(([k, v]) => [k, v.toString("hex").toUpperCase()]));
+    fs.writeFileSync(options["state-out"], JSON.stringify(state, null, 2) + "\n");
+  }
+  if (out && out !== process.stdout) out.end();
+  process.exitCode = diffs.length > 0 || mismatches.length > 0 ? 1 : 0;
+}
+
+if (require.main === module) main(process.argv.slice(2));
+
+module.exports = {
+  HookReplay,
+  instrument,
+  emuSign,
+  encodeAddress,
+  decodeAddress,
+  accountKeylet,
+  serializeAmount,
+  toHookTxn,
+  stoField,
+  stoVl,
+  stoUint,
+  stoObject,
+};
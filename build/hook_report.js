@@ -0,0 +1,491 @@
+// build/hook_report.js
+// フックの wasm を解析し、サイズ・関数別コードサイズ・ループとガードの予算を JSON で出力する。
+//
+// 使い方: node hook_report.js <hook.wasm> [--strip out.wasm] [--baseline prev.json]
+//         node hook_report.js --check-source <hookapi.h> <source.c|.h>...
+//
+//   --strip         カスタムセクション (name など) を削除した wasm を書き出す
+//   --baseline      前回のレポートとのサイズ差分を標準エラーに表示する
+//   --check-source  hookapi.h で宣言されたホスト関数のうち、ソースが呼び出していて Xahau にないものを
+//                   列挙する (clang なしで実行できる事前チェック。見つかれば終了コード1)
+//
+// 次の場合は終了コード1で終了する (レポートは出力する):
+//   - ループの先頭で _g が呼ばれていない、または _g の引数が定数でない
+//   - hook / cbak 以外の関数をエクスポートしている (wasm-ld が出力する memory は許可)
+//   - env 以外のモジュール、または Xahau のホスト関数 (XAHAU_HOOK_API) にない関数をインポートしている
+//
+// インポートは名前だけを検証します (引数の型は検証しません)。
+const fs = require("fs");
+
+const SECTION_NAMES = [
+  "custom", "type", "import", "function", "table", "memory", "global",
+  "export", "start", "element", "code", "data", "datacount",
+];
+const ALLOWED_EXPORTS = ["hook", "cbak"];
+// GUARD(n) の ID は (1 << 31) + __LINE__
+const GUARD_ID_BASE = 0x80000000;
+
+// Xahau がフックに提供するホスト関数 (xahaud の src/ripple/app/hook/hook_api.macro)。
+// src/c/emu/hookapi.h の宣言ではなくこの一覧で検証する (宣言を追加しただけでは通らないようにする)。
+const XAHAU_HOOK_API = new Set([
+  "_g", "accept", "rollback",
+  "util_raddr", "util_accid", "util_verify", "util_sha512h", "util_keylet",
+  "sto_validate", "sto_subfield", "sto_subarray", "sto_emplace", "sto_erase",
+  "etxn_burden", "etxn_details", "etxn_fee_base", "etxn_reserve", "etxn_generation", "etxn_nonce", "emit",
+  "float_set", "float_multiply", "float_mulratio", "float_negate", "float_compare", "float_sum", "float_sto",
+  "float_sto_set", "float_invert", "float_divide", "float_one", "float_mantissa", "float_sign", "float_int",
+  "float_log", "float_root",
+  "fee_base", "ledger_seq", "ledger_last_time", "ledger_last_hash", "ledger_nonce", "ledger_keylet",
+  "hook_account", "hook_hash", "hook_param_set", "hook_param", "hook_again", "hook_skip", "hook_pos",
+  "slot", "slot_clear", "slot_count", "slot_set", "slot_size", "slot_subarray", "slot_subfield", "slot_type",
+  "slot_float",
+  "state_set", "state_foreign_set", "state", "state_foreign",
+  "trace", "trace_num", "trace_float",
+  "otxn_burden", "otxn_field", "otxn_generation", "otxn_id", "otxn_type", "otxn_slot", "otxn_param",
+  "meta_slot", "xpop_slot", "prepare",
+]);
+
+class Reader {
+  constructor(buf, pos = 0, end = buf.length) {
+    this.buf = buf;
+    this.pos = pos;
+    this.end = end;
+  }
+
+  eof() {
+    return this.pos >= this.end;
+  }
+
+  byte() {
+    if (this.pos >= this.end) throw new Error("unexpected end of wasm");
+    return this.buf[this.pos++];
+  }
+
+  u32() {
+    let result = 0;
+    let shift = 0;
+    for (;;) {
+      const b = this.byte();
+      result += (b & 0x7f) * 2 ** shift;
+      shift += 7;
+      if ((b & 0x80) === 0) return result;
+    }
+  }
+
+  // 符号付きLEB128 (i64 は精度を落とした Number で返す)
+  sleb() {
+    let result = 0n;
+    let shift = 0n;
+    let b;
+    do {
+      b = this.byte();
+      result |= BigInt(b & 0x7f) << shift;
+      shift += 7n;
+    } while (b & 0x80);
+    if (b & 0x40) result -= 1n << shift;
+    return Number(result);
+  }
+
+  skip(n) {
+    this.pos += n;
+  }
+
+  name() {
+    const len = this.u32();
+    const s = this.buf.toString("utf8", this.pos, this.pos + len);
+    this.pos += len;
+    return s;
+  }
+}
+
+function parseSections(buf) {
+  if (buf.length < 8 || buf.readUInt32LE(0) !== 0x6d736100) throw new Error("not a wasm module");
+  const r = new Reader(buf, 8);
+  const sections = [];
+  while (!r.eof()) {
+    const start = r.pos;
+    const id = r.byte();
+    const size = r.u32();
+    const body = r.pos;
+    let name = SECTION_NAMES[id] || `unknown(${id})`;
+    if (id === 0) name = new Reader(buf, body, body + size).name();
+    sections.push({ id, name, start, body, end: body + size, size: body + size - start });
+    r.skip(size);
+  }
+  return sections;
+}
+
+function parseImports(buf, sec) {
+  const r = new Reader(buf, sec.body, sec.end);
+  const imports = [];
+  for (let i = r.u32(); i > 0; i--) {
+    const module = r.name();
+    const field = r.name();
+    const kind = r.byte();
+    if (kind === 0) r.u32();
+    else if (kind === 1) { r.byte(); limits(r); }
+    else if (kind === 2) limits(r);
+    else if (kind === 3) { r.byte(); r.byte(); }
+    imports.push({ module, field, kind });
+  }
+  return imports;
+}
+
+function limits(r) {
+  const flags = r.byte();
+  r.u32();
+  if (flags & 1) r.u32();
+}
+
+function parseExports(buf, sec) {
+  const r = new Reader(buf, sec.body, sec.end);
+  const exports = [];
+  for (let i = r.u32(); i > 0; i--) {
+    const name = r.name();
+    const kind = r.byte();
+    const index = r.u32();
+    exports.push({ name, kind, index });
+  }
+  return exports;
+}
+
+// name セクションの関数名 (サブセクション1)
+function parseFunctionNames(buf, sec) {
+  const names = new Map();
+  const r = new Reader(buf, sec.body, sec.end);
+  r.name();
+  while (!r.eof()) {
+    const id = r.byte();
+    const size = r.u32();
+    const end = r.pos + size;
+    if (id === 1) {
+      for (let i = r.u32(); i > 0; i--) {
+        const index = r.u32();
+        names.set(index, r.name());
+      }
+    }
+    r.pos = end;
+  }
+  return names;
+}
+
+function blockType(r) {
+  const b = r.buf[r.pos];
+  if (b === 0x40 || (b >= 0x6f && b <= 0x7f)) r.pos++;
+  else r.sleb();
+}
+
+/**
+ * 制御命令 (block・loop・if・分岐・呼び出し) 以外の命令の即値を読み飛ばす
+ */
+function skipImmediates(r, op) {
+  switch (op) {
+    case 0x1c: // select t
+      for (let n = r.u32(); n > 0; n--) r.byte();
+      break;
+    case 0x41: // i32.const
+    case 0x42: // i64.const
+      r.sleb();
+      break;
+    case 0x43: // f32.const
+      r.skip(4);
+      break;
+    case 0x44: // f64.const
+      r.skip(8);
+      break;
+    case 0x3f: // memory.size
+    case 0x40: // memory.grow
+    case 0xd0: // ref.null
+      r.byte();
+      break;
+    case 0xd2: // ref.func
+      r.u32();
+      break;
+    case 0xfc: {
+      const sub = r.u32();
+      if (sub === 8) { r.u32(); r.byte(); }
+      else if (sub === 10) { r.byte(); r.byte(); }
+      else if (sub === 11) r.byte();
+      else if (sub === 12 || sub === 14) { r.u32(); r.u32(); }
+      else if (sub === 9 || sub === 13 || sub >= 15) r.u32();
+      break;
+    }
+    default:
+      if (op >= 0x20 && op <= 0x26) r.u32(); // local/global/table get/set
+      else if (op >= 0x28 && op <= 0x3e) { r.u32(); r.u32(); } // load/store memarg
+      else if (op === 0xfd) throw new Error("SIMD instructions are not supported by hooks");
+      else if (op > 0xd2 || (op > 0x1c && op < 0x20) || (op > 0x11 && op < 0x1a) || (op > 0x05 && op < 0x0b))
+        throw new Error(`unknown opcode 0x${op.toString(16)}`);
+      break;
+  }
+}
+
+/**
+ * 関数本体の命令を走査し、命令数とループごとのガードを求める
+ *
+ * Xahau のガード規則に合わせ、ループに入ってから分岐・他の関数呼び出し・
+ * 内側のループより前に _g が呼ばれていることを検証する。
+ */
+function scanBody(r, end, guardIndex) {
+  let instructions = 0;
+  const loops = [];
+  // ループ・ブロックの入れ子 (ループなら loops の要素、それ以外は null)
+  const stack = [];
+  // 直前の i32.const の値 (_g の引数の取得用)
+  const consts = [];
+  // _g 呼び出し待ちのループ
+  let pending = [];
+
+  const violate = (loop, reason) => {
+    if (!loop.violation) loop.violation = reason;
+  };
+  const breakPending = (reason) => {
+    pending.forEach((loop) => violate(loop, reason));
+    pending = [];
+  };
+
+  while (r.pos < end) {
+    const op = r.byte();
+    instructions++;
+    stack.forEach((l) => { if (l) l.body_instructions++; });
+    let isConst = false;
+
+    switch (op) {
+      case 0x02: // block
+      case 0x04: // if
+        blockType(r);
+        stack.push(null);
+        break;
+      case 0x03: { // loop
+        blockType(r);
+        breakPending("nested loop before _g");
+        const loop = { guard_line: null, max_iterations: null, body_instructions: 0, violation: null };
+        loops.push(loop);
+        stack.push(loop);
+        pending.push(loop);
+        break;
+      }
+      case 0x0b: // end
+        stack.pop();
+        break;
+      case 0x0c: // br
+      case 0x0d: // br_if
+        r.u32();
+        breakPending("branch before _g");
+        break;
+      case 0x0e: // br_table
+        for (let n = r.u32(); n >= 0; n--) r.u32();
+        breakPending("branch before _g");
+        break;
+      case 0x0f: // return
+        breakPending("return before _g");
+        break;
+      case 0x10: { // call
+        const callee = r.u32();
+        if (callee === guardIndex) {
+          const [id, max] = consts.slice(-2);
+          pending.forEach((loop) => {
+            if (id === undefined || max === undefined) {
+              violate(loop, "_g arguments are not constant");
+              return;
+            }
+            loop.guard_line = (id >>> 0) - GUARD_ID_BASE;
+            // GUARD(n) は _g(id, n + 1) を呼ぶ
+            loop.max_iterations = max - 1;
+          });
+          pending = [];
+        } else {
+          breakPending("call before _g");
+        }
+        break;
+      }
+      case 0x11: // call_indirect
+        r.u32();
+        r.u32();
+        breakPending("call before _g");
+        break;
+      case 0x41: // i32.const
+        consts.push(r.sleb());
+        isConst = true;
+        break;
+      default:
+        skipImmediates(r, op);
+        break;
+    }
+    if (!isConst) consts.length = 0;
+  }
+  breakPending("function ended before _g");
+  return { instructions, loops };
+}
+
+function parseCode(buf, sec, importCount, guardIndex, names) {
+  const r = new Reader(buf, sec.body, sec.end);
+  const functions = [];
+  const count = r.u32();
+  for (let i = 0; i < count; i++) {
+    const size = r.u32();
+    const end = r.pos + size;
+    for (let n = r.u32(); n > 0; n--) {
+      r.u32();
+      r.byte();
+    }
+    const index = importCount + i;
+    const { instructions, loops } = scanBody(r, end, guardIndex);
+    r.pos = end;
+    // 静的な見積もり: ループ本体の命令数 × 最大反復数 (呼び出し先の命令は含まない)
+    const loopBudget = loops.reduce((sum, l) => sum + (l.max_iterations || 0) * l.body_instructions, 0);
+    functions.push({
+      index,
+      name: names.get(index) || `func[${index}]`,
+      size,
+      instructions,
+      loops,
+      worst_case_loop_instructions: loopBudget,
+    });
+  }
+  return functions;
+}
+
+// hookapi.h で宣言されている関数名
+function hookApiNames(path) {
+  const src = fs.readFileSync(path, "utf8");
+  const names = new Set();
+  for (const m of src.matchAll(/^\s*(?:int64_t|int32_t|uint64_t|uint32_t|void)\s+(\w+)\s*\(/gm)) names.add(m[1]);
+  return names;
+}
+
+/**
+ * ソースが呼び出しているホスト関数 (hookapi.h で宣言されたもの) のうち、Xahau にないものを返す。
+ * コメント・文字列は除かずに識別子の直後の "(" で判定する。
+ */
+function checkSource(hookapi, sources) {
+  const declared = hookApiNames(hookapi);
+  const missing = new Map(); // 関数名 => 呼び出しているファイル
+  for (const file of sources) {
+    const src = fs.readFileSync(file, "utf8");
+    for (const m of src.matchAll(/\b(\w+)\s*\(/g)) {
+      const name = m[1];
+      if (!declared.has(name) || XAHAU_HOOK_API.has(name)) continue;
+      if (!missing.has(name)) missing.set(name, new Set());
+      missing.get(name).add(file);
+    }
+  }
+  return [...missing].map(([name, files]) => ({ name, files: [...files] }));
+}
+
+function stripCustomSections(buf, sections) {
+  const parts = [buf.subarray(0, 8)];
+  sections.filter((s) => s.id !== 0).forEach((s) => parts.push(buf.subarray(s.start, s.end)));
+  return Buffer.concat(parts);
+}
+
+function report(file, options = {}) {
+  const buf = fs.readFileSync(file);
+  const sections = parseSections(buf);
+  const find = (name) => sections.find((s) => s.name === name);
+  const errors = [];
+
+  const imports = find("import") ? parseImports(buf, find("import")) : [];
+  const funcImports = imports.filter((imp) => imp.kind === 0);
+  const exports = find("export") ? parseExports(buf, find("export")) : [];
+  const names = find("name") ? parseFunctionNames(buf, find("name")) : new Map();
+  funcImports.forEach((imp, i) => { if (!names.has(i)) names.set(i, imp.field); });
+
+  const guardIndex = funcImports.findIndex((imp) => imp.field === "_g");
+  const functions = find("code") ? parseCode(buf, find("code"), funcImports.length, guardIndex, names) : [];
+
+  imports.forEach((imp) => {
+    if (imp.module !== "env") errors.push(`import from non-env module: ${imp.module}.${imp.field}`);
+    else if (imp.kind !== 0) errors.push(`non-function import: ${imp.field}`);
+    else if (!XAHAU_HOOK_API.has(imp.field)) errors.push(`import not provided by Xahau: ${imp.field}`);
+  });
+  exports.forEach((exp) => {
+    if (exp.kind === 0 && !ALLOWED_EXPORTS.includes(exp.name)) errors.push(`unexpected export: ${exp.name}`);
+  });
+  if (!exports.some((exp) => exp.name === "hook")) errors.push("hook is not exported");
+
+  const loops = [];
+  functions.forEach((fn) => fn.loops.forEach((loop) => {
+    loops.push(loop);
+    if (loop.violation) errors.push(`${fn.name}: ${loop.violation}`);
+  }));
+
+  const stripped = stripCustomSections(buf, sections);
+  const result = {
+    file,
+    size: buf.length,
+    stripped_size: stripped.length,
+    sections: sections.map(({ name, size }) => ({ name, size })),
+    imports: funcImports.map((imp) => imp.field),
+    exports: exports.map((exp) => exp.name),
+    functions: functions.sort((a, b) => b.size - a.size),
+    guards: {
+      loops: loops.length,
+      guarded: loops.filter((l) => l.max_iterations !== null).length,
+      max_iterations_total: loops.reduce((sum, l) => sum + (l.max_iterations || 0), 0),
+      worst_case_loop_instructions: functions.reduce((sum, fn) => sum + fn.worst_case_loop_instructions, 0),
+    },
+    errors,
+  };
+
+  if (options.strip) fs.writeFileSync(options.strip, stripped);
+  return result;
+}
+
+function printDelta(result, baseline) {
+  const prev = JSON.parse(fs.readFileSync(baseline, "utf8"));
+  const delta = (a, b) => `${b} (${b - a >= 0 ? "+" : ""}${b - a})`;
+  console.error(`stripped size: ${delta(prev.stripped_size, result.stripped_size)} bytes`);
+  console.error(`worst-case loop instructions: ${delta(prev.guards.worst_case_loop_instructions,
+    result.guards.worst_case_loop_instructions)}`);
+  const prevFns = new Map(prev.functions.map((fn) => [fn.name, fn.size]));
+  result.functions.forEach((fn) => {
+    const before = prevFns.get(fn.name);
+    if (before !== undefined && before !== fn.size) console.error(`  ${fn.name}: ${delta(before, fn.size)} bytes`);
+  });
+}
+
+function main(argv) {
+  if (argv[0] === "--check-source") {
+    const [hookapi, ...sources] = argv.slice(1);
+    if (!hookapi || sources.length === 0) {
+      console.error("usage: node hook_report.js --check-source <hookapi.h> <source>...");
+      process.exit(2);
+    }
+    const missing = checkSource(hookapi, sources);
+    missing.forEach(({ name, files }) => console.error(`error: host function not provided by Xahau: ${name} (${files.join(", ")})`));
+    process.exit(missing.length > 0 ? 1 : 0);
+  }
+
+  const options = {};
+  let file = null;
+  for (let i = 0; i < argv.length; i++) {
+    if (argv[i] === "--strip") options.strip = argv[++i];
+    else if (argv[i] === "--baseline") options.baseline = argv[++i];
+    else file = argv[i];
+  }
+  if (!file) {
+    console.error("usage: node hook_report.js <hook.wasm> [--strip out.wasm] [--baseline prev.json]");
+    process.exit(2);
+  }
+
+  const result = report(file, options);
+  console.log(JSON.stringify(result, null, 2));
+  if (options.baseline) printDelta(result, options.baseline);
+  if (result.errors.length > 0) {
+    result.errors.forEach((e) => console.error(`error: ${e}`));
+    process.exit(1);
+  }
+}
+
+if (require.main === module) main(process.argv.slice(2));
+
+module.exports = {
+  report,
+  Reader,
+  parseSections,
+  parseImports,
+  parseExports,
+  blockType,
+  skipImmediates,
+};
@@ -0,0 +1,27 @@
+#!/bin/sh
+# xapay_hock.c をネイティブエミュレータにリンクし、src/c/test のテストをビルド・実行します。
+# トレースの集計を確かめるため、トレースレベルごとにビルドして実行します。
+# 使い方: build/test.sh
+#
+# 環境変数:
+#   XAPAY_TRACE_LEVELS  実行するトレースレベル (既定: "0 1 2 3")
+
+set -e
+cd "$(dirname "$0")"
+
+CC=${CC:-cc}
+TRACE_LEVELS=${XAPAY_TRACE_LEVELS:-0 1 2 3}
+
+for level in $TRACE_LEVELS; do
+    echo "Compiling xapay_hock.c tests with native hookapi emulator (XAPAY_TRACE_LEVEL=$level)..."
+
+    $CC -O2 -std=gnu11 -Wall -DXAPAY_TRACE_LEVEL="$level" \
+        -I ../src/c/emu -I ../src/c -I ../src/c/test \
+        -o xapay_test \
+        ../src/c/xapay_hock.c \
+        ../src/c/emu/hookapi_emu.c \
+        ../src/c/test/*.c
+
+    echo "Output: xapay_test"
+    ./xapay_test
+done
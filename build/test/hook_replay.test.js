@@ -0,0 +1,240 @@
+// build/test/hook_replay.test.js
+// hook_replay.js のホスト関数の試験 (手で組み立てた最小の wasm と、ビルド済みのフックの再生)
+const test = require("node:test");
+const assert = require("node:assert");
+const fs = require("fs");
+const path = require("path");
+const crypto = require("crypto");
+const {
+  HookReplay, encodeAddress, decodeAddress, serializeAmount, stoField, stoVl, stoUint,
+} = require("../hook_replay");
+
+const address = (label) => encodeAddress(crypto.createHash("sha256").update(String(label)).digest().subarray(0, 20));
+const HOOK = address("hook");
+const USER = address("user");
+
+// src/c/xapay_config.h の発行者 (ビルド済みのフックが受け付ける JPY)
+const ISSUER = encodeAddress(Buffer.from(
+  /XAPAY_ISSUER_ACCID \{([^}]*)\}/.exec(fs.readFileSync(path.join(__dirname, "../../src/c/xapay_config.h"), "utf8"))[1]
+    .match(/0x[0-9A-Fa-f]{2}/g).map(Number)));
+const jpy = (value) => ({ currency: "JPY", issuer: ISSUER, value });
+const hex = (text) => Buffer.from(text).toString("hex").toUpperCase();
+
+// src/c/emu/hookapi.h と一致させること
+const sfTransactionType = (1 << 16) + 2;
+const sfAmount = (6 << 16) + 1;
+const sfFee = (6 << 16) + 8;
+const sfMemoData = (7 << 16) + 13;
+const sfAccount = (8 << 16) + 1;
+const sfDestination = (8 << 16) + 3;
+const sfMemos = (15 << 16) + 9;
+
+// =====================================================================================================================
+// == 最小の wasm の組み立て ==
+// =====================================================================================================================
+
+function uleb(n) {
+  const out = [];
+  do {
+    let b = n & 0x7f;
+    n = Math.floor(n / 128);
+    if (n > 0) b |= 0x80;
+    out.push(b);
+  } while (n > 0);
+  return out;
+}
+
+function sleb(n) {
+  const out = [];
+  let v = BigInt(n);
+  for (;;) {
+    const b = Number(v & 0x7fn);
+    v >>= 7n;
+    if ((v === 0n && (b & 0x40) === 0) || (v === -1n && (b & 0x40) !== 0)) return [...out, b];
+    out.push(b | 0x80);
+  }
+}
+
+const I32 = 0x7f;
+const I64 = 0x7e;
+const vec = (items) => [...uleb(items.length), ...items.flat()];
+const name = (s) => vec([...Buffer.from(s)]);
+const section = (id, body) => [id, ...uleb(body.length), ...body];
+
+// src/c/emu/hookapi.h の宣言と同じ型
+const HOST_TYPES = {
+  accept: [[I32, I32, I64], I64],
+  otxn_field: [[I32, I32, I32], I64],
+  otxn_slot: [[I32], I64],
+  slot: [[I32, I32, I32], I64],
+  slot_count: [[I32], I64],
+  slot_subfield: [[I32, I32, I32], I64],
+  slot_subarray: [[I32, I32, I32], I64],
+  sto_subfield: [[I32, I32, I32], I64],
+  util_raddr: [[I32, I32, I32, I32], I64],
+  float_sto_set: [[I32, I32], I64],
+  float_int: [[I64, I32, I32], I64],
+  etxn_reserve: [[I32], I64],
+  etxn_details: [[I32, I32], I64],
+  etxn_fee_base: [[I32, I32], I64],
+  emit: [[I32, I32, I32, I32], I64],
+  otxn_memo: [[I32, I32, I32], I64], // 実在しない関数
+};
+
+/**
+ * hook(i32) -> i64 だけを持つモジュールを組み立てる
+ * @param {string[]} imports - インポートするホスト関数
+ * @param {number[]} locals - 引数の後に置くローカル変数の型
+ * @param {Function} body - (op) => 命令の配列。op.call(name) でホスト関数を呼ぶ
+ * @param {Array} [data] - [位置, Buffer] のデータセグメント
+ */
+function hookModule(imports, locals, body, data = []) {
+  const op = {
+    i32: (n) => [0x41, ...sleb(n)],
+    i64: (n) => [0x42, ...sleb(n)],
+    call: (fn) => [0x10, ...uleb(imports.indexOf(fn))],
+    get: (i) => [0x20, i],
+    set: (i) => [0x21, i],
+    wrap: [0xa7],
+    shr_u: [0x88],
+    add: [0x6a],
+    drop: [0x1a],
+  };
+  const types = [...imports.map((fn) => HOST_TYPES[fn]), [[I32], I64]];
+  const code = [...vec(locals.map((t) => [1, t])), ...body(op).flat(), 0x0b];
+  return Buffer.from([
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    ...section(1, vec(types.map(([params, result]) => [0x60, ...vec(params), 1, result]))),
+    ...section(2, vec(imports.map((fn, i) => [...name("env"), ...name(fn), 0x00, ...uleb(i)]))),
+    ...section(3, vec([uleb(imports.length)])),
+    ...section(5, vec([[0x00, 1]])),
+    ...section(7, vec([[...name("hook"), 0x00, ...uleb(imports.length)], [...name("memory"), 0x02, 0]])),
+    ...section(10, vec([[...uleb(code.length), ...code]])),
+    ...section(11, vec(data.map(([offset, bytes]) => [0x00, 0x41, ...sleb(offset), 0x0b, ...vec([...bytes])]))),
+  ]);
+}
+
+const invoke = (memos) => ({
+  TransactionType: "Invoke", Account: USER, Destination: HOOK, Memos: memos.map((Memo) => ({ Memo })),
+});
+
+// =====================================================================================================================
+// == 試験 ==
+// =====================================================================================================================
+
+test("Memo は otxn_slot / slot_subfield / slot_subarray / slot / sto_subfield で読める", () => {
+  // 2件目の Memo の MemoData をメッセージに、Memo の件数をコードにして accept する
+  const wasm = hookModule(
+    ["otxn_slot", "slot_subfield", "slot_subarray", "slot", "slot_count", "sto_subfield", "accept"],
+    [I64, I32, I64],
+    (op) => [
+      op.i32(0), op.call("otxn_slot"), op.wrap, op.i32(sfMemos), op.i32(0), op.call("slot_subfield"), op.wrap, op.set(2),
+      op.get(2), op.call("slot_count"), op.set(3),
+      op.get(2), op.i32(1), op.i32(0), op.call("slot_subarray"), op.wrap, op.set(2),
+      op.i32(1024), op.i32(512), op.get(2), op.call("slot"), op.wrap, op.set(2),
+      op.i32(1024), op.get(2), op.i32(sfMemoData), op.call("sto_subfield"), op.set(1),
+      op.get(1), op.i64(32), op.shr_u, op.wrap, op.i32(1024), op.add, op.get(1), op.wrap, op.get(3), op.call("accept"),
+    ]);
+  const replay = new HookReplay(wasm);
+  const long = "x".repeat(300); // 長さの接頭辞が2バイトになる MemoData
+  const result = replay.run(invoke([
+    { MemoData: hex("first") },
+    { MemoType: hex("xapay"), MemoData: hex(long), MemoFormat: hex("text/plain") },
+  ]));
+  assert.strictEqual(result.outcome, "accept");
+  assert.strictEqual(result.message, long);
+  assert.strictEqual(result.code, 2);
+
+});
+
+test("金額は float_sto_set / float_int で整数部を取り出し、負の額は CANT_RETURN_NEGATIVE", () => {
+  const wasm = hookModule(["otxn_field", "float_sto_set", "float_int", "accept"], [I64], (op) => [
+    op.i32(2048), op.i32(48), op.i32(sfAmount), op.call("otxn_field"), op.drop,
+    op.i32(2048), op.i32(8), op.call("float_sto_set"), op.i32(0), op.i32(0), op.call("float_int"), op.set(1),
+    op.i32(0), op.i32(0), op.get(1), op.call("accept"),
+  ]);
+  const replay = new HookReplay(wasm, { hookAccount: HOOK });
+  const pay = (Amount) => replay.run({ TransactionType: "Payment", Account: USER, Destination: HOOK, Amount }).code;
+  assert.strictEqual(pay(jpy("100.5")), 100);
+  assert.strictEqual(pay(jpy("1e3")), 1000);
+  assert.strictEqual(pay(jpy("-5")), -33);
+  assert.strictEqual(pay("2500000"), 2); // XRP (ドロップ) は XRP 単位
+});
+
+test("emit はフックのアカウントから送る Payment のシリアライズを受け付け、宛先と金額を記録する", () => {
+  const fee = Buffer.from("400000000000000C", "hex");
+  const blob = (account) => Buffer.concat([
+    stoUint(sfTransactionType, 0, 2),
+    stoField(sfAmount, serializeAmount(jpy("250"))),
+    stoField(sfFee, fee),
+    stoVl(sfAccount, account),
+    stoVl(sfDestination, decodeAddress(USER)),
+  ]);
+  const emitWith = (prefix) => hookModule(["etxn_reserve", "etxn_details", "etxn_fee_base", "emit", "accept"], [I64, I32],
+    (op) => [
+      op.i32(1), op.call("etxn_reserve"), op.drop,
+      op.i32(4096 + prefix.length), op.i32(200), op.call("etxn_details"), op.wrap, op.set(2),
+      op.i32(4096), op.i32(prefix.length), op.call("etxn_fee_base"), op.drop,
+      op.i32(0), op.i32(32), op.i32(4096), op.i32(prefix.length), op.get(2), op.add, op.call("emit"), op.set(1),
+      op.i32(0), op.i32(0), op.get(1), op.call("accept"),
+    ], [[4096, prefix]]);
+
+  const hookAccid = decodeAddress(HOOK);
+  const ok = new HookReplay(emitWith(blob(hookAccid)), { hookAccount: HOOK }).run(invoke([]));
+  assert.strictEqual(ok.code, 32);
+  assert.deepStrictEqual(ok.emitted, [{ destination: USER,
+    amount: serializeAmount(jpy("250")).toString("hex").toUpperCase() }]);
+  assert.strictEqual(ok.instructions > 0, true);
+
+  // フック以外のアカウントからの送金は発行できない
+  const other = decodeAddress(USER);
+  const rejected = new HookReplay(emitWith(blob(other)), { hookAccount: HOOK }).run(invoke([]));
+  assert.strictEqual(rejected.code, -11);
+  assert.deepStrictEqual(rejected.emitted, []);
+});
+
+test("util_raddr はアカウントIDから r アドレスを書き、その長さを返す", () => {
+  const accid = crypto.createHash("sha256").update("raddr").digest().subarray(0, 20);
+  const wasm = hookModule(["util_raddr", "accept"], [I64], (op) => [
+    op.i32(100), op.i32(40), op.i32(0), op.i32(20), op.call("util_raddr"), op.set(1),
+    op.i32(100), op.get(1), op.wrap, op.get(1), op.call("accept"),
+  ], [[0, accid]]);
+  const result = new HookReplay(wasm).run(invoke([]));
+  assert.strictEqual(result.message, encodeAddress(accid));
+  assert.strictEqual(result.code, encodeAddress(accid).length);
+});
+
+test("Xahau にないホスト関数をインポートしたフックは実行できない", () => {
+  const wasm = hookModule(["otxn_memo", "accept"], [], (op) => [
+    op.i32(0), op.i32(0), op.i32(0), op.call("otxn_memo"),
+  ]);
+  const result = new HookReplay(wasm).run(invoke([]));
+  assert.strictEqual(result.outcome, "rollback");
+  assert.match(result.message, /unknown host function: otxn_memo/);
+});
+
+// build/compile.sh でビルドしたフック (XAPAY_HOOK_WASM で別のファイルも指定できる)
+const HOOK_WASM = process.env.XAPAY_HOOK_WASM || path.join(__dirname, "../xapay_hock.wasm");
+
+test("ビルドしたフックはチャージ・署名鍵の登録・引き出しを再生できる", {
+  skip: !fs.existsSync(HOOK_WASM) && `${HOOK_WASM} がありません (build/compile.sh でビルドしてください)`,
+}, () => {
+  const replay = new HookReplay(fs.readFileSync(HOOK_WASM), { hookAccount: HOOK });
+  const payment = (Amount) => replay.run({ TransactionType: "Payment", Account: USER, Destination: HOOK, Amount });
+
+  const charged = payment(jpy("1000.5"));
+  assert.deepStrictEqual([charged.outcome, charged.code], ["accept", 0]);
+  assert.strictEqual(charged.state_delta.length, 1);
+  assert.strictEqual(payment("1000000").code, 11); // XRP
+  assert.strictEqual(payment(jpy("-1")).code, 14);
+
+  // TLV の Memo (src/c/xapay_memo.h): マジック・バージョンの後に種類のタグ
+  const tlv = (type, ...fields) => Buffer.from([0x58, 0x01, 0x01, 1, type, ...fields]).toString("hex").toUpperCase();
+  const registered = replay.run({ ...invoke([{ MemoData: tlv(9) }]), SigningPubKey: "ED" + "11".repeat(32) });
+  assert.deepStrictEqual([registered.outcome, registered.code], ["accept", 0]);
+
+  const amount = Buffer.from("400");
+  const withdrawn = replay.run(invoke([{ MemoData: tlv(3, 0x03, amount.length, ...amount) }]));
+  assert.deepStrictEqual([withdrawn.outcome, withdrawn.code], ["accept", 0]);
+  assert.strictEqual(replay.run(invoke([])).code, 101); // Memo なし
+});
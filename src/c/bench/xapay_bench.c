@@ -0,0 +1,599 @@
+/**
+ * XApay Hook - ハンドラ別マイクロベンチマーク
+ *
+ * ネイティブエミュレータ上で hook() に合成トランザクションを流し、
+ * ハンドラごとに ns/op・ホスト関数呼び出し回数・State読み書きバイト数を出力します。
+ *
+ * 使い方: xapay_bench [-n 反復回数] [-u ユーザー数] [-v]
+ *
+ * フックを XAPAY_TRACE_LEVEL >= 2 (DEBUG) でビルドした場合は、ハンドラ別の実行数・拒否理由と
+ * ステップ別のホスト関数呼び出し数も出力します (build/bench.sh では環境変数 XAPAY_TRACE_LEVEL で指定)。
+ */
+
+#include "hookapi.h"
+#include "emu.h"
+#include "xapay_memo.h"
+#include "xapay_state.h"
+#include "xapay_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int64_t hook(uint32_t reserved);
+
+extern unsigned char ISSUER_ACCID[20];
+extern unsigned char CURRENCY_JPY[20];
+extern unsigned char OPERATOR_ACCID[20];
+
+#define CHARGE_AMOUNT     100000
+#define ALLOWANCE_AMOUNT  "1000000"
+#define PAYMENT_AMOUNT    "10"
+#define WITHDRAW_AMOUNT   "10"
+#define BATCH_USERS       4    // 一括決済1件あたりのユーザー数
+#define BATCH_PER_USER    2    // ユーザーあたりの支払い数
+#define COMPACT_USERS     16   // コンパクション1件あたりのユーザー数
+#define BENCH_MERCHANTS   3    // 支払い先の加盟店の数
+#define CLAIM_USERS       4    // 累積請求の引き落とし1件あたりのユーザー数
+#define CLAIM_TOTAL       "1000"
+#define PAYMENT_NONCE     "1"
+
+typedef struct {
+    uint8_t accid[20];
+    char raddr[36];
+    uint8_t pubkey[XAPAY_PUBKEY_SIZE]; // 登録する SigningPubKey (偶数番目は ed25519、奇数番目は secp256k1)
+} bench_user_t;
+
+typedef struct {
+    const char* name;
+    emu_txn_t* (*build)(void); // ユーザーごとに1件 (直前のシナリオの State を見て作るため、実行の直前に作る)
+    uint32_t payments; // 1トランザクションあたりの支払い (エントリ) 数 (0は1とみなす)
+    uint32_t iterations; // 実行回数 (0は -n の値)
+} bench_scenario_t;
+
+static bench_user_t* g_users;
+static uint32_t g_user_count = 1000;
+static uint8_t g_merchants[BENCH_MERCHANTS][20];
+static uint32_t g_iterations = 20000;
+static int g_verbose;
+static char g_operator_raddr[36];
+
+#define HANDLER_NAME(id, name) #name,
+static const char* const g_handler_names[XAPAY_HANDLER_COUNT] = { XAPAY_HANDLERS(HANDLER_NAME) };
+#undef HANDLER_NAME
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void to_hex(char* out, const uint8_t* data, uint32_t len)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    for (uint32_t i = 0; i < len; i++) {
+        out[i * 2] = digits[data[i] >> 4];
+        out[i * 2 + 1] = digits[data[i] & 0x0F];
+    }
+    out[len * 2] = '\0';
+}
+
+static void make_users(void)
+{
+    g_users = calloc(g_user_count, sizeof(bench_user_t));
+    if (!g_users) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    // r-address の長さ (25〜35文字) はアカウントによって異なる
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        char label[64];
+        uint8_t digest[32];
+        int n = snprintf(label, sizeof(label), "xapay-bench-user-%u", i);
+        emu_sha256(label, (uint32_t)n, digest);
+        emu_encode_raddr(g_users[i].raddr, sizeof(g_users[i].raddr), digest);
+        memcpy(g_users[i].accid, digest, 20);
+        g_users[i].pubkey[0] = (i % 2 == 0) ? 0xED : 0x02;
+        emu_sha256(digest, 32, g_users[i].pubkey + 1);
+    }
+    for (uint32_t m = 0; m < BENCH_MERCHANTS; m++) {
+        char label[64];
+        uint8_t digest[32];
+        int n = snprintf(label, sizeof(label), "xapay-bench-merchant-%u", m);
+        emu_sha256(label, (uint32_t)n, digest);
+        memcpy(g_merchants[m], digest, 20);
+    }
+}
+
+// 登録済みの公開鍵 (register_key で登録) で検証される署名を作る
+static void sign_allowance(uint8_t sig[64], const bench_user_t* user, const char* amount)
+{
+    char message[256];
+    int n = snprintf(message, sizeof(message), "%s:%s:%s", user->raddr, g_operator_raddr, amount);
+    emu_sign(user->pubkey, XAPAY_PUBKEY_SIZE, message, (uint32_t)n, sig);
+}
+
+// ノンス付きの支払いの署名 (<ユーザー>:<運営者>:<ノンス>:<支払い額>)
+static void sign_payment(uint8_t sig[64], const bench_user_t* user, const char* nonce, const char* amount)
+{
+    char message[256];
+    int n = snprintf(message, sizeof(message), "%s:%s:%s:%s", user->raddr, g_operator_raddr, nonce, amount);
+    emu_sign(user->pubkey, XAPAY_PUBKEY_SIZE, message, (uint32_t)n, sig);
+}
+
+// ユーザーの現在の利用許可の世代 (10進文字列)
+static void allowance_generation(char* out, size_t out_len, const bench_user_t* user)
+{
+    uint8_t key[21];
+    xapay_record_t record = { 0 };
+    key[0] = PREFIX_USER_RECORD;
+    memcpy(key + 1, user->accid, 20);
+    emu_state_peek(&record, sizeof(record), key, sizeof(key));
+    snprintf(out, out_len, "%u", record.allowance_generation);
+}
+
+// 請求署名 (<ユーザー>:<運営者>:<利用許可のダイジェスト (32バイト)>:<世代>:<累積請求額>)。
+// ダイジェストは ALLOWANCE_AMOUNT の利用許可 (フックの allowance_digest と同じ計算)
+static void sign_claim(uint8_t sig[64], const bench_user_t* user, const char* generation, const char* total)
+{
+    uint8_t allowance_sig[64];
+    sign_allowance(allowance_sig, user, ALLOWANCE_AMOUNT);
+
+    uint8_t buf[20 + 1 + 32 + 64];
+    uint32_t amount_len = (uint32_t)strlen(ALLOWANCE_AMOUNT);
+    memcpy(buf, user->accid, 20);
+    buf[20] = (uint8_t)amount_len;
+    memcpy(buf + 21, ALLOWANCE_AMOUNT, amount_len);
+    memcpy(buf + 21 + amount_len, allowance_sig, 64);
+    uint8_t digest[64];
+    emu_sha512(buf, 21 + amount_len + 64, digest);
+
+    char message[256];
+    int n = snprintf(message, sizeof(message), "%s:%s:", user->raddr, g_operator_raddr);
+    memcpy(message + n, digest, 32);
+    n += 32;
+    n += snprintf(message + n, sizeof(message) - n, ":%s:%s", generation, total);
+    emu_sign(user->pubkey, XAPAY_PUBKEY_SIZE, message, (uint32_t)n, sig);
+}
+
+typedef struct {
+    uint8_t data[EMU_MAX_MEMO_SIZE];
+    uint32_t len;
+} tlv_buf_t;
+
+static void tlv_begin(tlv_buf_t* b)
+{
+    b->data[0] = XAPAY_MEMO_MAGIC;
+    b->data[1] = XAPAY_MEMO_VERSION;
+    b->len = 2;
+}
+
+static void tlv_put(tlv_buf_t* b, uint8_t tag, const void* value, uint32_t len)
+{
+    b->data[b->len] = tag;
+    b->data[b->len + 1] = (uint8_t)len;
+    memcpy(b->data + b->len + 2, value, len);
+    b->len += 2 + len;
+}
+
+static void tlv_put_type(tlv_buf_t* b, uint8_t type)
+{
+    tlv_put(b, XAPAY_TLV_TYPE, &type, 1);
+}
+
+static void tlv_put_str(tlv_buf_t* b, uint8_t tag, const char* str)
+{
+    tlv_put(b, tag, str, (uint32_t)strlen(str));
+}
+
+static emu_txn_t* alloc_txns(void)
+{
+    emu_txn_t* txns = calloc(g_user_count, sizeof(emu_txn_t));
+    if (!txns) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_register_key(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        tlv_buf_t memo;
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_REGISTER_KEY);
+        emu_txn_init(&txns[i], ttINVOKE, g_users[i].accid);
+        memcpy(txns[i].signing_pubkey, g_users[i].pubkey, XAPAY_PUBKEY_SIZE);
+        txns[i].signing_pubkey_len = XAPAY_PUBKEY_SIZE;
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_charge(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        emu_txn_init(&txns[i], ttPAYMENT, g_users[i].accid);
+        emu_txn_set_iou(&txns[i], CHARGE_AMOUNT, CURRENCY_JPY, ISSUER_ACCID);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_allowance_payment(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        uint8_t sig[64];
+        tlv_buf_t memo;
+        sign_allowance(sig, &g_users[i], ALLOWANCE_AMOUNT);
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+        tlv_put(&memo, XAPAY_TLV_USER, g_users[i].accid, 20);
+        tlv_put_str(&memo, XAPAY_TLV_AMOUNT, PAYMENT_AMOUNT);
+        tlv_put_str(&memo, XAPAY_TLV_ALLOWANCE_AMOUNT, ALLOWANCE_AMOUNT);
+        tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+        emu_txn_init(&txns[i], ttINVOKE, OPERATOR_ACCID);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_allowance_payment_json(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        uint8_t sig[64];
+        char sig_hex[129];
+        char memo[EMU_MAX_MEMO_SIZE];
+        sign_allowance(sig, &g_users[i], ALLOWANCE_AMOUNT);
+        to_hex(sig_hex, sig, 64);
+        int n = snprintf(memo, sizeof(memo),
+            "{\"type\":\"allowance_payment\",\"user_address\":\"%s\",\"payment_amount\":\"%s\","
+            "\"allowance\":{\"amount\":\"%s\",\"signature\":\"%s\"}}",
+            g_users[i].raddr, PAYMENT_AMOUNT, ALLOWANCE_AMOUNT, sig_hex);
+        emu_txn_init(&txns[i], ttINVOKE, OPERATOR_ACCID);
+        emu_txn_add_memo(&txns[i], memo, (uint32_t)n);
+    }
+    return txns;
+}
+
+// ノンスはユーザーごとに1回しか使えないため、ユーザーごとに1回だけ実行する
+static emu_txn_t* build_nonce_payment(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        uint8_t sig[64];
+        tlv_buf_t memo;
+        sign_payment(sig, &g_users[i], PAYMENT_NONCE, PAYMENT_AMOUNT);
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_NONCE_PAYMENT);
+        tlv_put(&memo, XAPAY_TLV_USER, g_users[i].accid, 20);
+        tlv_put_str(&memo, XAPAY_TLV_AMOUNT, PAYMENT_AMOUNT);
+        tlv_put_str(&memo, XAPAY_TLV_NONCE, PAYMENT_NONCE);
+        tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+        // 加盟店の指定ありとなしを交互にする
+        if (i % 2 == 0)
+            tlv_put(&memo, XAPAY_TLV_MERCHANT, g_merchants[(i / 2) % BENCH_MERCHANTS], 20);
+        emu_txn_init(&txns[i], ttINVOKE, OPERATOR_ACCID);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+// merchant が真ならエントリごとに加盟店を順に割り当てる
+static emu_txn_t* build_allowance_payment_batch_to(int merchant)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        tlv_buf_t memo;
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+        for (uint32_t p = 0; p < BATCH_PER_USER; p++) {
+            for (uint32_t u = 0; u < BATCH_USERS; u++) {
+                const bench_user_t* user = &g_users[(i + u) % g_user_count];
+                tlv_buf_t entry;
+                entry.len = 0;
+                tlv_put(&entry, XAPAY_TLV_USER, user->accid, 20);
+                tlv_put_str(&entry, XAPAY_TLV_AMOUNT, PAYMENT_AMOUNT);
+                if (merchant)
+                    tlv_put(&entry, XAPAY_TLV_MERCHANT, g_merchants[(i + u + p) % BENCH_MERCHANTS], 20);
+                // 利用許可はユーザーごとに最初のエントリにだけ含める
+                if (p == 0) {
+                    uint8_t sig[64];
+                    sign_allowance(sig, user, ALLOWANCE_AMOUNT);
+                    tlv_put_str(&entry, XAPAY_TLV_ALLOWANCE_AMOUNT, ALLOWANCE_AMOUNT);
+                    tlv_put(&entry, XAPAY_TLV_SIGNATURE, sig, 64);
+                }
+                tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+            }
+        }
+        emu_txn_init(&txns[i], ttINVOKE, OPERATOR_ACCID);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_allowance_payment_batch(void)
+{
+    return build_allowance_payment_batch_to(0);
+}
+
+static emu_txn_t* build_allowance_payment_merchant(void)
+{
+    return build_allowance_payment_batch_to(1);
+}
+
+static emu_txn_t* build_recharge(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        uint8_t sig[64];
+        tlv_buf_t memo;
+        sign_allowance(sig, &g_users[i], ALLOWANCE_AMOUNT);
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE);
+        tlv_put_str(&memo, XAPAY_TLV_ALLOWANCE_AMOUNT, ALLOWANCE_AMOUNT);
+        tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+        emu_txn_init(&txns[i], ttINVOKE, g_users[i].accid);
+        emu_txn_set_iou(&txns[i], CHARGE_AMOUNT, CURRENCY_JPY, ISSUER_ACCID);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_recharge_json(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        uint8_t sig[64];
+        char sig_hex[129];
+        char memo[EMU_MAX_MEMO_SIZE];
+        sign_allowance(sig, &g_users[i], ALLOWANCE_AMOUNT);
+        to_hex(sig_hex, sig, 64);
+        int n = snprintf(memo, sizeof(memo),
+            "{\"type\":\"update_allowance\",\"allowance\":\"%s\",\"signature\":\"%s\"}",
+            ALLOWANCE_AMOUNT, sig_hex);
+        emu_txn_init(&txns[i], ttINVOKE, g_users[i].accid);
+        emu_txn_set_iou(&txns[i], CHARGE_AMOUNT, CURRENCY_JPY, ISSUER_ACCID);
+        emu_txn_add_memo(&txns[i], memo, (uint32_t)n);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_withdrawal(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        tlv_buf_t memo;
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_WITHDRAW);
+        tlv_put_str(&memo, XAPAY_TLV_AMOUNT, WITHDRAW_AMOUNT);
+        emu_txn_init(&txns[i], ttINVOKE, g_users[i].accid);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_withdrawal_json(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        char memo[EMU_MAX_MEMO_SIZE];
+        int n = snprintf(memo, sizeof(memo), "{\"type\":\"withdraw\",\"amount\":\"%s\"}", WITHDRAW_AMOUNT);
+        emu_txn_init(&txns[i], ttINVOKE, g_users[i].accid);
+        emu_txn_add_memo(&txns[i], memo, (uint32_t)n);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_withdrawal_flush(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        tlv_buf_t memo;
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_WITHDRAW_FLUSH);
+        emu_txn_init(&txns[i], ttINVOKE, OPERATOR_ACCID);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_compact(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        tlv_buf_t memo;
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_COMPACT);
+        for (uint32_t k = 0; k < COMPACT_USERS; k++) {
+            tlv_buf_t entry;
+            entry.len = 0;
+            tlv_put(&entry, XAPAY_TLV_USER, g_users[(i * COMPACT_USERS + k) % g_user_count].accid, 20);
+            tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+        }
+        emu_txn_init(&txns[i], ttINVOKE, OPERATOR_ACCID);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_merchant_settle(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        tlv_buf_t memo;
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_MERCHANT_SETTLE);
+        for (uint32_t m = 0; m < BENCH_MERCHANTS; m++) {
+            tlv_buf_t entry;
+            entry.len = 0;
+            tlv_put(&entry, XAPAY_TLV_USER, g_merchants[m], 20);
+            tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+        }
+        emu_txn_init(&txns[i], ttINVOKE, OPERATOR_ACCID);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static emu_txn_t* build_claim_redeem(void)
+{
+    emu_txn_t* txns = alloc_txns();
+    for (uint32_t i = 0; i < g_user_count; i++) {
+        tlv_buf_t memo;
+        tlv_begin(&memo);
+        tlv_put_type(&memo, XAPAY_MEMO_TYPE_CLAIM_REDEEM);
+        for (uint32_t k = 0; k < CLAIM_USERS; k++) {
+            const bench_user_t* user = &g_users[(i * CLAIM_USERS + k) % g_user_count];
+            char generation[16];
+            uint8_t sig[64];
+            allowance_generation(generation, sizeof(generation), user);
+            sign_claim(sig, user, generation, CLAIM_TOTAL);
+            tlv_buf_t entry;
+            entry.len = 0;
+            tlv_put(&entry, XAPAY_TLV_USER, user->accid, 20);
+            tlv_put_str(&entry, XAPAY_TLV_AMOUNT, CLAIM_TOTAL);
+            tlv_put_str(&entry, XAPAY_TLV_GENERATION, generation);
+            tlv_put(&entry, XAPAY_TLV_SIGNATURE, sig, 64);
+            tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+        }
+        emu_txn_init(&txns[i], ttINVOKE, OPERATOR_ACCID);
+        emu_txn_add_memo(&txns[i], memo.data, memo.len);
+    }
+    return txns;
+}
+
+static int64_t run_hook(void* arg)
+{
+    (void)arg;
+    return hook(0);
+}
+
+// トレースポイントの集計 (トレースなしでビルドしたフックでは何も出力しない)
+static void print_handler_stats(double n)
+{
+    for (uint32_t h = 0; h < XAPAY_HANDLER_COUNT; h++) {
+        const emu_handler_stats_t* hs = emu_handler_stats(h);
+        if (hs->runs == 0) continue;
+        printf("    [%s] runs %llu, accept %llu, reject %llu\n", g_handler_names[h],
+               (unsigned long long)hs->runs, (unsigned long long)hs->accepts, (unsigned long long)hs->rejects);
+        for (uint32_t s = 0; s < EMU_TRACE_MAX_STEPS; s++) {
+            const emu_step_stats_t* st = &hs->steps[s];
+            if (st->hits == 0) continue;
+            printf("      step %2u: %8.2f host/op, value %.1f avg", s, st->host_calls / n, (double)st->value_sum / st->hits);
+            if (st->items > 0)
+                printf(", %.2f items/op, item value %.1f avg", st->items / n, (double)st->item_value_sum / st->items);
+            printf("\n");
+        }
+        for (uint32_t r = 0; r < hs->reason_count; r++)
+            printf("      reject %lld: %llu\n", (long long)hs->reasons[r].code, (unsigned long long)hs->reasons[r].count);
+    }
+}
+
+static void run_scenario(const bench_scenario_t* sc)
+{
+    uint64_t outcomes[3] = { 0 };
+    uint64_t elapsed = 0;
+    uint64_t memo_bytes = 0;
+    char first_rollback[256] = "";
+
+    uint32_t iterations = sc->iterations ? sc->iterations : g_iterations;
+    emu_txn_t* txns = sc->build();
+    emu_reset_stats();
+    for (uint32_t i = 0; i < iterations; i++) {
+        const emu_txn_t* txn = &txns[i % g_user_count];
+        for (uint32_t m = 0; m < txn->memo_count; m++) memo_bytes += txn->memo_len[m];
+        emu_set_txn(txn);
+        uint64_t t0 = now_ns();
+        int outcome = emu_run(run_hook, NULL);
+        elapsed += now_ns() - t0;
+        outcomes[outcome]++;
+        if (outcome != EMU_ACCEPT && first_rollback[0] == '\0')
+            snprintf(first_rollback, sizeof(first_rollback), "%s (code %lld)", emu_last_message(), (long long)emu_last_code());
+    }
+
+    const emu_stats_t* st = emu_stats();
+    double n = (double)iterations;
+    printf("%-24s %8u %8llu %8llu %10.1f %8.1f %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+           sc->name, iterations,
+           (unsigned long long)outcomes[EMU_ACCEPT],
+           (unsigned long long)(outcomes[EMU_ROLLBACK] + outcomes[EMU_RETURN]),
+           elapsed / n, memo_bytes / n, st->host_calls / n,
+           st->state_reads / n, st->state_read_bytes / n,
+           st->state_writes / n, st->state_write_bytes / n);
+    if (sc->payments > 1) {
+        double np = n * sc->payments;
+        printf("    per entry (x%u): %.1f ns, %.1f memo B, %.2f host calls\n",
+               sc->payments, elapsed / np, memo_bytes / np, st->host_calls / np);
+    }
+    if (st->emitted > 0)
+        printf("    emitted: %.2f/op, %.1f ns per emitted payment\n", st->emitted / n, elapsed / (double)st->emitted);
+    if (first_rollback[0]) printf("    rollback: %s\n", first_rollback);
+    print_handler_stats(n);
+    if (g_verbose) {
+        for (int f = 0; f < EMU_FN_COUNT; f++)
+            if (st->calls[f]) printf("    %-24s %8.2f/op\n", emu_host_fn_names[f], st->calls[f] / n);
+    }
+    free(txns);
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) g_iterations = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) g_user_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-v") == 0) g_verbose = 1;
+        else {
+            fprintf(stderr, "usage: %s [-n iterations] [-u users] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (g_iterations == 0 || g_user_count == 0) {
+        fprintf(stderr, "bench: iterations and users must be positive\n");
+        return 2;
+    }
+
+    uint8_t hook_accid[32];
+    emu_sha256("xapay-bench-hook", 16, hook_accid);
+    emu_init(hook_accid);
+    emu_encode_raddr(g_operator_raddr, sizeof(g_operator_raddr), OPERATOR_ACCID);
+    make_users();
+
+    // 署名の検証に使う公開鍵の登録と、残高を用意するためのチャージを先に実行する
+    bench_scenario_t scenarios[] = {
+        { "register_key", build_register_key, 1, g_user_count },
+        { "charge", build_charge, 1 },
+        { "recharge_allowance", build_recharge, 1 },
+        { "recharge_allowance_json", build_recharge_json, 1 },
+        { "allowance_payment", build_allowance_payment, 1 },
+        { "allowance_payment_json", build_allowance_payment_json, 1 },
+        { "nonce_payment", build_nonce_payment, 1, g_user_count },
+        { "allowance_payment_batch", build_allowance_payment_batch, BATCH_USERS * BATCH_PER_USER },
+        // 加盟店ごとに閾値 (xapay_config.h) に達するたびに精算の Payment が発行される
+        { "merchant_payment_batch", build_allowance_payment_merchant, BATCH_USERS * BATCH_PER_USER },
+        // 残りの未精算額を1回で精算する
+        { "merchant_settle", build_merchant_settle, BENCH_MERCHANTS, 1 },
+        // 全ユーザーの請求を1回ずつ引き落とす
+        { "claim_redeem", build_claim_redeem, CLAIM_USERS, (g_user_count + CLAIM_USERS - 1) / CLAIM_USERS },
+        { "withdrawal", build_withdrawal, 1 },
+        { "withdrawal_json", build_withdrawal_json, 1 },
+        // 引き出し待ちの宛先 (最大でユーザー数) をすべて発行する回数だけ実行する
+        { "withdrawal_flush", build_withdrawal_flush, 1,
+          (g_user_count + XAPAY_WITHDRAW_FLUSH_MAX - 1) / XAPAY_WITHDRAW_FLUSH_MAX + 1 },
+        // 全ユーザーを1回ずつ対象にする (発行済みの引き出しキューの位置も削除される)
+        { "compact", build_compact, COMPACT_USERS, (g_user_count + COMPACT_USERS - 1) / COMPACT_USERS },
+    };
+
+    printf("%-24s %8s %8s %8s %10s %8s %8s %8s %8s %8s %8s\n",
+           "handler", "ops", "accept", "reject", "ns/op", "memo_B", "host/op", "st_rd/op", "rd_B/op", "st_wr/op", "wr_B/op");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) run_scenario(&scenarios[i]);
+    printf("state: %llu entries, %llu bytes\n",
+           (unsigned long long)emu_state_entries(), (unsigned long long)emu_state_bytes());
+
+    free(g_users);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * XApay Hook - ネイティブエミュレータのハーネス側API
+ *
+ * ベンチマークやテストドライバから、元トランザクション・台帳・Stateを用意して
+ * フック関数を実行し、ホスト関数の呼び出し回数などを取得するためのAPIです。
+ */
+
+#ifndef XAPAY_EMU_H
+#define XAPAY_EMU_H
+
+#include <stdint.h>
+
+#define EMU_MAX_MEMOS       16
+#define EMU_MAX_MEMO_SIZE   1024
+#define EMU_MAX_EMITTED     256
+#define EMU_STATE_KEY_SIZE  32
+#define EMU_STATE_DATA_SIZE 256
+
+// 集計対象のホスト関数一覧
+#define EMU_HOST_FUNCTIONS(X) \
+    X(_g) X(accept) X(rollback) X(trace) X(trace_num) \
+    X(hook_account) X(ledger_seq) \
+    X(otxn_type) X(otxn_field) X(otxn_slot) \
+    X(state) X(state_set) \
+    X(sto_subfield) X(sto_subarray) \
+    X(util_raddr) X(util_accid) X(util_verify) X(util_sha512h) X(util_keylet) \
+    X(slot) X(slot_set) X(slot_count) X(slot_subfield) X(slot_subarray) \
+    X(float_sum) X(float_compare) X(float_sto_set) X(float_int) \
+    X(etxn_reserve) X(etxn_details) X(etxn_fee_base) X(emit)
+
+#define EMU_FN_ENUM(name) EMU_FN_##name,
+enum emu_host_fn { EMU_HOST_FUNCTIONS(EMU_FN_ENUM) EMU_FN_COUNT };
+#undef EMU_FN_ENUM
+
+extern const char* const emu_host_fn_names[EMU_FN_COUNT];
+
+// フック実行の結果
+enum emu_outcome {
+    EMU_ACCEPT = 0,
+    EMU_ROLLBACK = 1,
+    EMU_RETURN = 2   // accept/rollback を呼ばずに関数が戻った
+};
+
+typedef struct {
+    uint64_t calls[EMU_FN_COUNT];
+    uint64_t host_calls;
+    uint64_t state_reads;
+    uint64_t state_read_bytes;
+    uint64_t state_writes;
+    uint64_t state_write_bytes;
+    uint64_t state_deletes;
+    uint64_t emitted;
+} emu_stats_t;
+
+// フックのトレースポイント (src/c/xapay_trace.h と一致させること)
+#define EMU_TRACE_POINT_TAG    "XApay:tp"
+#define EMU_TRACE_POINT_SIZE   10
+#define EMU_TRACE_ITEM_FLAG    0x80
+#define EMU_TRACE_MAX_HANDLERS 16
+#define EMU_TRACE_MAX_STEPS    16
+#define EMU_TRACE_MAX_REASONS  16
+
+typedef struct {
+    uint64_t hits;            // トレースポイントの通過回数
+    int64_t value_sum;        // トレースポイントの値の合計
+    uint64_t items;           // エントリごとのトレースポイントの回数 (区間は区切らない)
+    int64_t item_value_sum;
+    uint64_t host_calls;      // このステップから次のトレースポイントまでのホスト関数呼び出し数 (trace を除く)
+} emu_step_stats_t;
+
+typedef struct {
+    int64_t code;
+    uint64_t count;
+} emu_reason_stats_t;
+
+// ハンドラ別の集計。実行の結果は最後に通過したトレースポイントのハンドラに数える
+typedef struct {
+    uint64_t runs;            // ステップ0 (ハンドラの開始) の回数
+    uint64_t accepts;
+    uint64_t rejects;         // rollback、または accept/rollback を呼ばずに戻った実行
+    emu_step_stats_t steps[EMU_TRACE_MAX_STEPS];
+    emu_reason_stats_t reasons[EMU_TRACE_MAX_REASONS]; // 拒否理由 (ロールバックのコード) 別の件数
+    uint32_t reason_count;
+} emu_handler_stats_t;
+
+typedef struct {
+    int64_t type;
+    uint8_t account[20];
+    uint8_t signing_pubkey[33];
+    uint32_t signing_pubkey_len;
+    uint8_t amount[48];
+    uint32_t amount_len;        // 0 の場合 sfAmount なし
+    uint32_t memo_count;
+    uint32_t memo_len[EMU_MAX_MEMOS];
+    uint8_t memo[EMU_MAX_MEMOS][EMU_MAX_MEMO_SIZE];
+} emu_txn_t;
+
+// emit に渡された Payment の送金元・宛先・金額
+typedef struct {
+    uint8_t account[20];
+    uint8_t destination[20];
+    uint8_t amount[48];
+} emu_emitted_t;
+
+// --- 初期化 ---
+void emu_init(const uint8_t hook_accid[20]);
+void emu_reset_stats(void);
+const emu_stats_t* emu_stats(void);
+
+// --- 台帳 (AccountRoot) ---
+void emu_ledger_add_account(const uint8_t accid[20], const uint8_t* regular_key);
+
+// --- トレースポイントの集計 (XAPAY_TRACE_LEVEL >= DEBUG でビルドしたフックのみ。emu_reset_stats で0に戻る) ---
+const emu_handler_stats_t* emu_handler_stats(uint32_t handler);
+
+// --- 元トランザクション ---
+void emu_txn_init(emu_txn_t* txn, int64_t type, const uint8_t account[20]);
+void emu_txn_set_iou(emu_txn_t* txn, int64_t value, const uint8_t currency[20], const uint8_t issuer[20]);
+int emu_txn_add_memo(emu_txn_t* txn, const void* data, uint32_t len);
+void emu_set_txn(const emu_txn_t* txn);
+const emu_txn_t* emu_current_txn(void);
+
+// --- 実行 ---
+// fn を実行し accept/rollback で抜けた時点までの結果を返す。accept の場合のみ State をコミットする。
+int emu_run(int64_t (*fn)(void* arg), void* arg);
+const char* emu_last_message(void);
+int64_t emu_last_code(void);
+uint32_t emu_emitted_count(void);
+const emu_emitted_t* emu_emitted(uint32_t index);
+// 直前の実行で etxn_reserve が予約した件数 (予約しなければ0)
+uint32_t emu_reserved(void);
+
+// --- State の直接操作 (ホスト呼び出しとしては数えない) ---
+int64_t emu_state_peek(void* out, uint32_t out_len, const void* key, uint32_t key_len);
+void emu_state_poke(const void* data, uint32_t data_len, const void* key, uint32_t key_len);
+uint64_t emu_state_entries(void);
+uint64_t emu_state_bytes(void);
+
+// --- 補助 ---
+// util_verify が受理する署名 (64バイト) を生成する。本物の楕円曲線署名ではない。
+void emu_sign(const void* key, uint32_t key_len, const void* msg, uint32_t msg_len, uint8_t sig[64]);
+int emu_encode_raddr(char* out, uint32_t out_len, const uint8_t accid[20]);
+void emu_sha256(const void* data, uint32_t len, uint8_t out[32]);
+void emu_sha512(const void* data, uint32_t len, uint8_t out[64]);
+
+#endif
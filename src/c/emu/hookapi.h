@@ -0,0 +1,183 @@
+/**
+ * XApay Hook - ネイティブ実行用 hookapi.h
+ *
+ * xapay_hock.c をLinux上でネイティブにビルドするための hookapi.h の代替です。
+ * ホスト関数は hookapi_emu.c のインメモリ実装にリンクされます。
+ *
+ * 宣言する関数はすべて Xahau のホスト関数で、名前・引数の順序・戻り値は xahaud と同じです
+ * (wasm の hookapi.h と異なり、ポインタは uint32_t ではなく通常のポインタで受け取ります)。
+ *
+ * build/compile.sh の wasm ビルドでも使います。wasm32 では宣言した関数が env モジュールからの
+ * インポートになり、libc を使わずにガード付きのループで比較・コピーします。
+ * build/hook_report.js --check-source は、ソースが Xahau にない関数を呼び出していないかを検証します。
+ */
+
+#ifndef XAPAY_EMU_HOOKAPI_H
+#define XAPAY_EMU_HOOKAPI_H
+
+#include <stdint.h>
+#ifndef __wasm__
+#include <string.h>
+#endif
+
+// --- トランザクションタイプ ---
+#define ttPAYMENT 0
+#define ttINVOKE  99
+
+// --- トランザクションのフラグ ---
+#define tfCANONICAL 0x80000000UL
+
+// --- フィールドコード ((型コード << 16) + フィールドコード) ---
+#define sfTransactionType     ((1U << 16U) + 2U)
+#define sfFlags               ((2U << 16U) + 2U)
+#define sfSequence            ((2U << 16U) + 4U)
+#define sfFirstLedgerSequence ((2U << 16U) + 26U)
+#define sfLastLedgerSequence  ((2U << 16U) + 27U)
+#define sfEmitGeneration      ((2U << 16U) + 43U)
+#define sfEmitBurden          ((3U << 16U) + 12U)
+#define sfEmitParentTxnID     ((5U << 16U) + 11U)
+#define sfEmitNonce           ((5U << 16U) + 12U)
+#define sfEmitHookHash        ((5U << 16U) + 14U)
+#define sfAmount              ((6U << 16U) + 1U)
+#define sfFee                 ((6U << 16U) + 8U)
+#define sfSigningPubKey       ((7U << 16U) + 3U)
+#define sfMemoType            ((7U << 16U) + 12U)
+#define sfMemoData            ((7U << 16U) + 13U)
+#define sfMemoFormat          ((7U << 16U) + 14U)
+#define sfAccount             ((8U << 16U) + 1U)
+#define sfDestination         ((8U << 16U) + 3U)
+#define sfRegularKey          ((8U << 16U) + 8U)
+#define sfMemo                ((14U << 16U) + 10U)
+#define sfEmitDetails         ((14U << 16U) + 13U)
+#define sfMemos               ((15U << 16U) + 9U)
+
+// --- Keylet ---
+#define KEYLET_ACCOUNT 3
+
+// --- float_compare モード ---
+#define COMPARE_EQUAL   1U
+#define COMPARE_LESS    2U
+#define COMPARE_GREATER 4U
+
+// --- ホスト関数のエラーコード ---
+#define OUT_OF_BOUNDS          -1
+#define INTERNAL_ERROR         -2
+#define TOO_BIG                -3
+#define TOO_SMALL              -4
+#define DOESNT_EXIST           -5
+#define NO_FREE_SLOTS          -6
+#define INVALID_ARGUMENT       -7
+#define ALREADY_SET            -8
+#define PREREQUISITE_NOT_MET   -9
+#define EMISSION_FAILURE       -11
+#define INVALID_FIELD          -17
+#define PARSE_ERROR            -18
+#define NOT_AN_ARRAY           -22
+#define NOT_AN_OBJECT          -23
+#define CANT_RETURN_NEGATIVE   -33
+#define TOO_MANY_STATE_MODIFICATIONS -44
+#define INVALID_FLOAT          -10024
+
+// --- マクロ ---
+#define SBUF(str) (str), sizeof(str)
+#define TRACESTR(str) trace((str), sizeof(str) - 1, 0, 0, 0)
+#define GUARD(maxiter) _g((1ULL << 31U) + __LINE__, (maxiter) + 1)
+#define COPY(dst, src, n) memcpy((dst), (src), (n))
+// sto_subfield / sto_subarray の戻り値 (上位32ビット: オフセット、下位32ビット: 長さ)
+#define SUB_OFFSET(x) ((int32_t)((x) >> 32))
+#define SUB_LENGTH(x) ((int32_t)(x))
+#ifdef __wasm__
+#define BUFFER_EQUAL(a, b, n) hookapi_buffer_equal((a), (b), (n))
+#else
+#define BUFFER_EQUAL(a, b, n) (memcmp((a), (b), (n)) == 0)
+#endif
+
+// --- 制御 ---
+// accept / rollback はフックの実行を終了して戻らない (後続の未初期化警告を出さないよう明示する)
+int32_t _g(uint32_t id, uint32_t maxiter);
+__attribute__((noreturn)) int64_t accept(const void* msg, uint32_t msg_len, int64_t code);
+__attribute__((noreturn)) int64_t rollback(const void* msg, uint32_t msg_len, int64_t code);
+int64_t trace(const void* msg, uint32_t msg_len, const void* data, uint32_t data_len, uint32_t as_hex);
+int64_t trace_num(const void* msg, uint32_t msg_len, int64_t number);
+
+// --- フック・レジャー ---
+int64_t hook_account(void* out, uint32_t out_len);
+int64_t ledger_seq(void);
+
+// --- 元トランザクション ---
+// otxn_field は AccountID を20バイトで、Blob (SigningPubKey など) は長さの接頭辞付きで書き込む
+int64_t otxn_type(void);
+int64_t otxn_field(void* out, uint32_t out_len, uint32_t field_id);
+int64_t otxn_slot(uint32_t slot_no);
+
+// --- State ---
+int64_t state(void* out, uint32_t out_len, const void* key, uint32_t key_len);
+int64_t state_set(const void* data, uint32_t data_len, const void* key, uint32_t key_len);
+
+// --- シリアライズ済みオブジェクト ---
+// 戻り値はフィールドの値 (Blob は長さの接頭辞を除く) の位置 (SUB_OFFSET / SUB_LENGTH で取り出す)
+int64_t sto_subfield(const void* sto, uint32_t sto_len, uint32_t field_id);
+int64_t sto_subarray(const void* sto, uint32_t sto_len, uint32_t array_index);
+
+// --- ユーティリティ ---
+int64_t util_raddr(void* out, uint32_t out_len, const void* accid, uint32_t accid_len);
+int64_t util_accid(void* out, uint32_t out_len, const void* raddr, uint32_t raddr_len);
+int64_t util_verify(const void* data, uint32_t data_len, const void* sig, uint32_t sig_len,
+                    const void* key, uint32_t key_len);
+int64_t util_sha512h(void* out, uint32_t out_len, const void* data, uint32_t data_len);
+int64_t util_keylet(void* out, uint32_t out_len, uint32_t keylet_type,
+                    const void* a, uint32_t b, uint32_t c, uint32_t d, uint32_t e, uint32_t f);
+
+// --- スロット ---
+// slot_no / new_slot が 0 なら空きスロットを割り当てる。戻り値は使ったスロット番号
+int64_t slot(void* out, uint32_t out_len, uint32_t slot_no);
+int64_t slot_set(const void* keylet, uint32_t keylet_len, uint32_t slot_no);
+int64_t slot_count(uint32_t slot_no);
+int64_t slot_subfield(uint32_t parent_slot, uint32_t field_id, uint32_t new_slot);
+int64_t slot_subarray(uint32_t parent_slot, uint32_t array_index, uint32_t new_slot);
+
+// --- XFL ---
+int64_t float_sum(int64_t a, int64_t b);
+int64_t float_compare(int64_t a, int64_t b, uint32_t mode);
+int64_t float_sto_set(const void* sto, uint32_t sto_len);
+int64_t float_int(int64_t xfl, uint32_t decimal_places, uint32_t absolute);
+
+// --- Emitted Transaction ---
+int64_t etxn_reserve(uint32_t count);
+int64_t etxn_details(void* out, uint32_t out_len);
+int64_t etxn_fee_base(const void* txn, uint32_t txn_len);
+int64_t emit(void* hash_out, uint32_t hash_len, const void* txn, uint32_t txn_len);
+
+#ifdef __wasm__
+// 1回の実行で比較・コピーするバイト数の上限 (ガードは全呼び出しで共有される)
+#define HOOKAPI_MAX_COPY_BYTES 65536
+
+// 構造体のコピー・初期化でコンパイラが生成する呼び出しもここで解決する
+void* memcpy(void* dst, const void* src, unsigned long n)
+{
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+    for (unsigned long i = 0; GUARD(HOOKAPI_MAX_COPY_BYTES), i < n; ++i)
+        d[i] = s[i];
+    return dst;
+}
+
+void* memset(void* dst, int c, unsigned long n)
+{
+    uint8_t* d = (uint8_t*)dst;
+    for (unsigned long i = 0; GUARD(HOOKAPI_MAX_COPY_BYTES), i < n; ++i)
+        d[i] = (uint8_t)c;
+    return dst;
+}
+
+static inline int hookapi_buffer_equal(const void* a, const void* b, unsigned long n)
+{
+    const uint8_t* x = (const uint8_t*)a;
+    const uint8_t* y = (const uint8_t*)b;
+    for (unsigned long i = 0; GUARD(HOOKAPI_MAX_COPY_BYTES), i < n; ++i)
+        if (x[i] != y[i]) return 0;
+    return 1;
+}
+#endif
+
+#endif
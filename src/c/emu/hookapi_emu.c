@@ -0,0 +1,1448 @@
+/**
+ * XApay Hook - hookapi のインメモリ実装 (ネイティブエミュレータ)
+ *
+ * xapay_hock.c が使用するホスト関数を、State・台帳・元トランザクションを
+ * すべてメモリ上に持つ形で実装します。各ホスト関数の呼び出し回数と
+ * Stateの読み書きバイト数を集計し、emu_stats() で参照できます。
+ *
+ * 注意:
+ * - util_verify は楕円曲線署名を検証しません。emu_sign() で生成した署名のみを受理します。
+ * - Stateキーは32バイトに左詰めゼロパディングされ、32バイトを超えるキーは TOO_BIG になります。
+ * - accept で終了した実行のみ State の変更と Emitted Transaction がコミットされます。
+ * - 元トランザクションは emu_set_txn でXRPLのバイナリ形式にシリアライズし、otxn_field・スロット・
+ *   sto_subfield はその上で動きます (Memo は MemoData のみ)。
+ * - emit は渡された Payment を解析して宛先と金額を記録します (署名・手数料の額は検証しません)。
+ */
+
+#include "hookapi.h"
+#include "emu.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define EMU_MAX_STATE_MODS 256
+#define EMU_MAX_SLOTS      255
+#define EMU_MAX_GUARDS     64
+#define EMU_ETXN_DETAILS_SIZE 116 // コールバックのないフックの sfEmitDetails
+#define EMU_LEDGER_SEQ     1000
+#define EMU_EMIT_FEE       12        // etxn_fee_base が返す手数料 (ドロップ)
+#define EMU_ACCOUNT_STO_SIZE 64
+// 元トランザクションのシリアライズ形式 (Memo は1件あたり最大 EMU_MAX_MEMO_SIZE + ヘッダ類)
+#define EMU_TXN_STO_SIZE   (256 + EMU_MAX_MEMOS * (EMU_MAX_MEMO_SIZE + 8))
+
+#define HOST(name) (g_stats.calls[EMU_FN_##name]++, g_stats.host_calls++)
+
+#define EMU_FN_NAME(name) #name,
+const char* const emu_host_fn_names[EMU_FN_COUNT] = { EMU_HOST_FUNCTIONS(EMU_FN_NAME) };
+#undef EMU_FN_NAME
+
+// =====================================================================================================================
+// == SHA-256 / SHA-512 ==
+// =====================================================================================================================
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t h[8], const uint8_t* p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) | ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = k + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + K256[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void emu_sha256(const void* data, uint32_t len, uint8_t out[32])
+{
+    uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t i = 0;
+    for (; i + 64 <= len; i += 64) sha256_block(h, p + i);
+
+    uint8_t tail[128] = { 0 };
+    uint32_t rem = len - i;
+    memcpy(tail, p + i, rem);
+    tail[rem] = 0x80;
+    uint32_t tail_len = (rem < 56) ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int j = 0; j < 8; j++) tail[tail_len - 1 - j] = (uint8_t)(bits >> (8 * j));
+    for (uint32_t j = 0; j < tail_len; j += 64) sha256_block(h, tail + j);
+
+    for (int j = 0; j < 8; j++) {
+        out[j * 4] = (uint8_t)(h[j] >> 24); out[j * 4 + 1] = (uint8_t)(h[j] >> 16);
+        out[j * 4 + 2] = (uint8_t)(h[j] >> 8); out[j * 4 + 3] = (uint8_t)h[j];
+    }
+}
+
+static const uint64_t K512[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL,
+    0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+    0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL, 0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+    0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL, 0x983e5152ee66dfabULL,
+    0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL,
+    0x53380d139d95b3dfULL, 0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+    0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL, 0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+    0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL,
+    0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL, 0xca273eceea26619cULL,
+    0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+    0x113f9804bef90daeULL, 0x1b710b35131c471bULL, 0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+    0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static void sha512_block(uint64_t h[8], const uint8_t* p)
+{
+    uint64_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = 0;
+        for (int j = 0; j < 8; j++) w[i] = (w[i] << 8) | p[i * 8 + j];
+    }
+    for (int i = 16; i < 80; i++) {
+        uint64_t s0 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        uint64_t s1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint64_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 80; i++) {
+        uint64_t t1 = k + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41)) + ((e & f) ^ (~e & g)) + K512[i] + w[i];
+        uint64_t t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void emu_sha512(const void* data, uint32_t len, uint8_t out[64])
+{
+    uint64_t h[8] = {
+        0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+        0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+    };
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t i = 0;
+    for (; i + 128 <= len; i += 128) sha512_block(h, p + i);
+
+    uint8_t tail[256] = { 0 };
+    uint32_t rem = len - i;
+    memcpy(tail, p + i, rem);
+    tail[rem] = 0x80;
+    uint32_t tail_len = (rem < 112) ? 128 : 256;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int j = 0; j < 8; j++) tail[tail_len - 1 - j] = (uint8_t)(bits >> (8 * j));
+    for (uint32_t j = 0; j < tail_len; j += 128) sha512_block(h, tail + j);
+
+    for (int j = 0; j < 8; j++)
+        for (int b = 0; b < 8; b++) out[j * 8 + b] = (uint8_t)(h[j] >> (56 - 8 * b));
+}
+
+// =====================================================================================================================
+// == Base58 (XRPL アルファベット) ==
+// =====================================================================================================================
+
+static const char B58_ALPHABET[] = "rpshnaf39wBUDNEGHJKLM4PQRST7VWXYZ2bcdeCg65jkm8oFqi1tuvAxyz";
+
+int emu_encode_raddr(char* out, uint32_t out_len, const uint8_t accid[20])
+{
+    uint8_t payload[25];
+    uint8_t hash[32];
+    payload[0] = 0x00;
+    memcpy(payload + 1, accid, 20);
+    emu_sha256(payload, 21, hash);
+    emu_sha256(hash, 32, hash);
+    memcpy(payload + 21, hash, 4);
+
+    uint8_t digits[40] = { 0 };
+    int digit_count = 0;
+    for (int i = 0; i < 25; i++) {
+        uint32_t carry = payload[i];
+        for (int j = 0; j < digit_count; j++) {
+            carry += (uint32_t)digits[j] << 8;
+            digits[j] = carry % 58;
+            carry /= 58;
+        }
+        while (carry > 0) {
+            digits[digit_count++] = carry % 58;
+            carry /= 58;
+        }
+    }
+
+    int zeros = 0;
+    while (zeros < 25 && payload[zeros] == 0) zeros++;
+
+    int len = zeros + digit_count;
+    if ((uint32_t)len > out_len) return TOO_SMALL;
+    for (int i = 0; i < zeros; i++) out[i] = B58_ALPHABET[0];
+    for (int i = 0; i < digit_count; i++) out[zeros + i] = B58_ALPHABET[digits[digit_count - 1 - i]];
+    if ((uint32_t)len < out_len) out[len] = '\0';
+    return len;
+}
+
+static int decode_raddr(uint8_t accid[20], const uint8_t* str, uint32_t len)
+{
+    uint8_t bytes[32] = { 0 };
+    int byte_count = 0;
+    int zeros = 0;
+    uint32_t n = 0;
+    while (n < len && str[n] != '\0') n++;
+    if (n < 25 || n > 35) return -1;
+
+    while (zeros < (int)n && str[zeros] == (uint8_t)B58_ALPHABET[0]) zeros++;
+    for (uint32_t i = 0; i < n; i++) {
+        const char* pos = memchr(B58_ALPHABET, str[i], 58);
+        if (!pos) return -1;
+        uint32_t carry = (uint32_t)(pos - B58_ALPHABET);
+        for (int j = 0; j < byte_count; j++) {
+            carry += (uint32_t)bytes[j] * 58;
+            bytes[j] = (uint8_t)carry;
+            carry >>= 8;
+        }
+        while (carry > 0) {
+            if (byte_count >= (int)sizeof(bytes)) return -1;
+            bytes[byte_count++] = (uint8_t)carry;
+            carry >>= 8;
+        }
+    }
+    if (zeros + byte_count != 25) return -1;
+
+    uint8_t payload[25] = { 0 };
+    for (int i = 0; i < byte_count; i++) payload[zeros + i] = bytes[byte_count - 1 - i];
+    if (payload[0] != 0x00) return -1;
+
+    uint8_t hash[32];
+    emu_sha256(payload, 21, hash);
+    emu_sha256(hash, 32, hash);
+    if (memcmp(hash, payload + 21, 4) != 0) return -1;
+
+    memcpy(accid, payload + 1, 20);
+    return 0;
+}
+
+// =====================================================================================================================
+// == State ストア ==
+// =====================================================================================================================
+
+typedef struct {
+    uint8_t used;  // 0: 空き, 1: 使用中, 2: 削除済み
+    uint8_t key[EMU_STATE_KEY_SIZE];
+    uint16_t len;
+    uint8_t data[EMU_STATE_DATA_SIZE];
+} emu_state_entry_t;
+
+typedef struct {
+    uint8_t key[EMU_STATE_KEY_SIZE];
+    int32_t len;   // -1: 削除
+    uint8_t data[EMU_STATE_DATA_SIZE];
+} emu_pending_t;
+
+static emu_state_entry_t* g_table;
+static uint64_t g_table_cap;
+static uint64_t g_table_live;
+static uint64_t g_table_used;
+static uint64_t g_table_bytes;
+
+static emu_pending_t g_pending[EMU_MAX_STATE_MODS];
+static uint32_t g_pending_count;
+
+static uint64_t hash_key(const uint8_t* key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < EMU_STATE_KEY_SIZE; i++) {
+        h ^= key[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void pad_key(uint8_t out[EMU_STATE_KEY_SIZE], const void* key, uint32_t key_len)
+{
+    memset(out, 0, EMU_STATE_KEY_SIZE);
+    memcpy(out + EMU_STATE_KEY_SIZE - key_len, key, key_len);
+}
+
+static emu_state_entry_t* table_find(const uint8_t* key)
+{
+    if (!g_table) return NULL;
+    uint64_t mask = g_table_cap - 1;
+    for (uint64_t i = hash_key(key) & mask;; i = (i + 1) & mask) {
+        emu_state_entry_t* e = &g_table[i];
+        if (e->used == 0) return NULL;
+        if (e->used == 1 && memcmp(e->key, key, EMU_STATE_KEY_SIZE) == 0) return e;
+    }
+}
+
+static void table_put(const uint8_t* key, const uint8_t* data, uint32_t len);
+
+static void table_grow(void)
+{
+    emu_state_entry_t* old = g_table;
+    uint64_t old_cap = g_table_cap;
+    g_table_cap = old_cap ? old_cap * 2 : 1024;
+    g_table = calloc(g_table_cap, sizeof(emu_state_entry_t));
+    if (!g_table) {
+        fprintf(stderr, "emu: out of memory\n");
+        exit(1);
+    }
+    g_table_live = g_table_used = g_table_bytes = 0;
+    for (uint64_t i = 0; i < old_cap; i++)
+        if (old[i].used == 1) table_put(old[i].key, old[i].data, old[i].len);
+    free(old);
+}
+
+static void table_put(const uint8_t* key, const uint8_t* data, uint32_t len)
+{
+    emu_state_entry_t* e = table_find(key);
+    if (e) {
+        g_table_bytes -= e->len;
+    } else {
+        if ((g_table_used + 1) * 4 >= g_table_cap * 3) table_grow();
+        uint64_t mask = g_table_cap - 1;
+        uint64_t i = hash_key(key) & mask;
+        while (g_table[i].used == 1) i = (i + 1) & mask;
+        e = &g_table[i];
+        if (e->used == 0) g_table_used++;
+        e->used = 1;
+        memcpy(e->key, key, EMU_STATE_KEY_SIZE);
+        g_table_live++;
+    }
+    e->len = (uint16_t)len;
+    memcpy(e->data, data, len);
+    g_table_bytes += len;
+}
+
+static void table_delete(const uint8_t* key)
+{
+    emu_state_entry_t* e = table_find(key);
+    if (!e) return;
+    e->used = 2;
+    g_table_live--;
+    g_table_bytes -= e->len;
+}
+
+static emu_pending_t* pending_find(const uint8_t* key)
+{
+    for (uint32_t i = 0; i < g_pending_count; i++)
+        if (memcmp(g_pending[i].key, key, EMU_STATE_KEY_SIZE) == 0) return &g_pending[i];
+    return NULL;
+}
+
+// 実行中の変更を反映した値を返す (存在しない場合は -1)
+static int32_t state_lookup(const uint8_t* key, const uint8_t** data)
+{
+    emu_pending_t* p = pending_find(key);
+    if (p) {
+        *data = p->data;
+        return p->len;
+    }
+    emu_state_entry_t* e = table_find(key);
+    if (!e) return -1;
+    *data = e->data;
+    return e->len;
+}
+
+// =====================================================================================================================
+// == 実行コンテキスト ==
+// =====================================================================================================================
+
+typedef struct {
+    uint8_t accid[20];
+    uint8_t keylet[34];
+    uint8_t sto[EMU_ACCOUNT_STO_SIZE]; // AccountRoot (Account と RegularKey のみ) のシリアライズ形式
+    uint32_t sto_len;
+} emu_account_t;
+
+// スロットは元トランザクション・台帳のシリアライズ形式の一部を指す
+typedef struct {
+    uint8_t used;
+    uint32_t type;          // STI_* (STI_OBJECT / STI_ARRAY は中身、それ以外はフィールドヘッダを除いた形式)
+    const uint8_t* data;
+    uint32_t len;
+} emu_slot_t;
+
+static uint8_t g_hook_accid[20];
+static emu_stats_t g_stats;
+static emu_txn_t g_txn;
+static uint8_t g_txn_sto[EMU_TXN_STO_SIZE];
+static uint32_t g_txn_sto_len;
+static int g_trace_enabled;
+
+static emu_account_t* g_accounts;
+static uint32_t g_account_count;
+static uint32_t g_account_cap;
+
+static jmp_buf g_jmp;
+static int g_running;
+static char g_message[256];
+static int64_t g_code;
+
+static emu_handler_stats_t g_handler_stats[EMU_TRACE_MAX_HANDLERS];
+static int32_t g_span_handler = -1; // 実行中の区間のハンドラ (-1: トレースポイントをまだ通過していない)
+static uint32_t g_span_step;
+static uint64_t g_span_start;       // 区間の開始時点のホスト関数呼び出し数
+
+static emu_slot_t g_slots[EMU_MAX_SLOTS + 1]; // 1 から EMU_MAX_SLOTS まで
+
+static struct { uint32_t id; uint32_t count; } g_guards[EMU_MAX_GUARDS];
+static uint32_t g_guard_count;
+
+static int64_t g_reserved;
+static emu_emitted_t g_emit_pending[EMU_MAX_EMITTED];
+static uint32_t g_emit_pending_count;
+static emu_emitted_t g_emitted[EMU_MAX_EMITTED];
+static uint32_t g_emitted_count;
+
+__attribute__((noreturn)) static void finish(int outcome, const void* msg, uint32_t msg_len, int64_t code)
+{
+    if (msg_len >= sizeof(g_message)) msg_len = sizeof(g_message) - 1;
+    memcpy(g_message, msg, msg_len);
+    while (msg_len > 0 && g_message[msg_len - 1] == '\0') msg_len--;
+    g_message[msg_len] = '\0';
+    g_code = code;
+    if (g_running) longjmp(g_jmp, outcome + 1);
+    fprintf(stderr, "emu: %s called outside emu_run: %s\n", outcome == EMU_ACCEPT ? "accept" : "rollback", g_message);
+    exit(1);
+}
+
+// =====================================================================================================================
+// == トレースポイントの集計 ==
+// =====================================================================================================================
+
+static uint64_t untraced_host_calls(void)
+{
+    return g_stats.host_calls - g_stats.calls[EMU_FN_trace] - g_stats.calls[EMU_FN_trace_num];
+}
+
+static void span_close(void)
+{
+    if (g_span_handler < 0) return;
+    g_handler_stats[g_span_handler].steps[g_span_step].host_calls += untraced_host_calls() - g_span_start;
+}
+
+static void trace_point(const uint8_t* point)
+{
+    uint32_t handler = point[0];
+    uint32_t step = point[1] & ~EMU_TRACE_ITEM_FLAG;
+    if (handler >= EMU_TRACE_MAX_HANDLERS || step >= EMU_TRACE_MAX_STEPS) return;
+    int64_t value;
+    memcpy(&value, point + 2, 8);
+
+    emu_handler_stats_t* h = &g_handler_stats[handler];
+    if (point[1] & EMU_TRACE_ITEM_FLAG) {
+        h->steps[step].items++;
+        h->steps[step].item_value_sum += value;
+        return;
+    }
+    span_close();
+    if (step == 0) h->runs++;
+    h->steps[step].hits++;
+    h->steps[step].value_sum += value;
+    g_span_handler = (int32_t)handler;
+    g_span_step = step;
+    g_span_start = untraced_host_calls();
+}
+
+static void trace_outcome(int outcome, int64_t code)
+{
+    span_close();
+    if (g_span_handler < 0) return;
+    emu_handler_stats_t* h = &g_handler_stats[g_span_handler];
+    g_span_handler = -1;
+    if (outcome == EMU_ACCEPT) {
+        h->accepts++;
+        return;
+    }
+    h->rejects++;
+    for (uint32_t i = 0; i < h->reason_count; i++) {
+        if (h->reasons[i].code == code) {
+            h->reasons[i].count++;
+            return;
+        }
+    }
+    if (h->reason_count < EMU_TRACE_MAX_REASONS)
+        h->reasons[h->reason_count++] = (emu_reason_stats_t){ .code = code, .count = 1 };
+}
+
+// =====================================================================================================================
+// == XFL ==
+// =====================================================================================================================
+
+#define XFL_MANT_MIN 1000000000000000LL
+#define XFL_MANT_MAX 9999999999999999LL
+
+static int xfl_unpack(int64_t xfl, int* neg, int64_t* mant, int32_t* exp)
+{
+    if (xfl == 0) {
+        *neg = 0; *mant = 0; *exp = 0;
+        return 0;
+    }
+    if (xfl < 0) return -1;
+    *neg = ((xfl >> 62) & 1) == 0;
+    *exp = (int32_t)((xfl >> 54) & 0xFF) - 97;
+    *mant = xfl & ((1LL << 54) - 1);
+    if (*mant < XFL_MANT_MIN || *mant > XFL_MANT_MAX) return -1;
+    return 0;
+}
+
+static int64_t xfl_pack(int neg, __int128 mant, int32_t exp)
+{
+    if (mant < 0) {
+        neg = !neg;
+        mant = -mant;
+    }
+    if (mant == 0) return 0;
+    while (mant > XFL_MANT_MAX) { mant /= 10; exp++; }
+    while (mant < XFL_MANT_MIN) { mant *= 10; exp--; }
+    if (exp < -96) return 0;
+    if (exp > 80) return INVALID_FLOAT;
+    return ((int64_t)(neg ? 0 : 1) << 62) | ((int64_t)(exp + 97) << 54) | (int64_t)mant;
+}
+
+static int64_t xfl_add(int64_t a, int64_t b)
+{
+    int na, nb;
+    int64_t ma, mb;
+    int32_t ea, eb;
+    if (xfl_unpack(a, &na, &ma, &ea) < 0 || xfl_unpack(b, &nb, &mb, &eb) < 0) return INVALID_FLOAT;
+    if (ma == 0) return b;
+    if (mb == 0) return a;
+
+    __int128 va = na ? -(__int128)ma : ma;
+    __int128 vb = nb ? -(__int128)mb : mb;
+    if (ea - eb > 18) return a;
+    if (eb - ea > 18) return b;
+    while (ea > eb) { va *= 10; ea--; }
+    while (eb > ea) { vb *= 10; eb--; }
+    return xfl_pack(0, va + vb, ea);
+}
+
+// =====================================================================================================================
+// == シリアライズ済みオブジェクト (STObject) ==
+// =====================================================================================================================
+
+#define STI_UINT16  1
+#define STI_UINT32  2
+#define STI_UINT64  3
+#define STI_HASH128 4
+#define STI_HASH256 5
+#define STI_AMOUNT  6
+#define STI_VL      7
+#define STI_ACCOUNT 8
+#define STI_OBJECT  14
+#define STI_ARRAY   15
+#define STI_UINT8   16
+#define STI_HASH160 17
+#define STI_VECTOR256 19
+
+#define STO_END_FIELD 1 // ObjectEndMarker (14, 1) / ArrayEndMarker (15, 1)
+
+// 1フィールド分の位置
+typedef struct {
+    uint32_t type;
+    uint32_t field;
+    const uint8_t* header;  // フィールドヘッダの先頭
+    const uint8_t* body;    // ヘッダの直後 (Blob は長さの接頭辞から)
+    const uint8_t* value;   // 値 (Blob は長さの接頭辞を除く、オブジェクト・配列は終端記号を除く中身)
+    uint32_t value_len;
+    const uint8_t* next;    // 次のフィールド
+} sto_field_t;
+
+static int sto_read_field(sto_field_t* f, const uint8_t* p, const uint8_t* end, int depth);
+
+static const uint8_t* sto_read_header(const uint8_t* p, const uint8_t* end, uint32_t* type, uint32_t* field)
+{
+    if (p >= end) return NULL;
+    *type = *p >> 4;
+    *field = *p & 0x0F;
+    p++;
+    if (*type == 0) {
+        if (p >= end) return NULL;
+        *type = *p++;
+    }
+    if (*field == 0) {
+        if (p >= end) return NULL;
+        *field = *p++;
+    }
+    return p;
+}
+
+static int sto_is_end(const uint8_t* p, const uint8_t* end, uint32_t end_type)
+{
+    uint32_t type, field;
+    return sto_read_header(p, end, &type, &field) && type == end_type && field == STO_END_FIELD;
+}
+
+// オブジェクト・配列の中身を終端記号まで読み進める
+static const uint8_t* sto_skip_inner(const uint8_t* p, const uint8_t* end, uint32_t end_type, int depth)
+{
+    if (depth > 8) return NULL;
+    while (!sto_is_end(p, end, end_type)) {
+        sto_field_t inner;
+        if (sto_read_field(&inner, p, end, depth + 1) < 0) return NULL;
+        if (end_type == STI_ARRAY && inner.type != STI_OBJECT) return NULL;
+        p = inner.next;
+    }
+    return p;
+}
+
+static int sto_read_field(sto_field_t* f, const uint8_t* p, const uint8_t* end, int depth)
+{
+    f->header = p;
+    p = sto_read_header(p, end, &f->type, &f->field);
+    if (!p) return -1;
+    f->body = p;
+
+    uint32_t len;
+    switch (f->type) {
+    case STI_UINT8:   len = 1; break;
+    case STI_UINT16:  len = 2; break;
+    case STI_UINT32:  len = 4; break;
+    case STI_UINT64:  len = 8; break;
+    case STI_HASH128: len = 16; break;
+    case STI_HASH160: len = 20; break;
+    case STI_HASH256: len = 32; break;
+    case STI_AMOUNT:
+        if (p >= end) return -1;
+        len = (*p & 0x80) ? 48 : 8;
+        break;
+    case STI_VL:
+    case STI_ACCOUNT:
+    case STI_VECTOR256:
+        if (p >= end) return -1;
+        if (p[0] <= 192) {
+            len = p[0];
+            p += 1;
+        } else if (p[0] <= 240) {
+            if (p + 2 > end) return -1;
+            len = 193 + ((uint32_t)(p[0] - 193) << 8) + p[1];
+            p += 2;
+        } else if (p[0] <= 254) {
+            if (p + 3 > end) return -1;
+            len = 12481 + ((uint32_t)(p[0] - 241) << 16) + ((uint32_t)p[1] << 8) + p[2];
+            p += 3;
+        } else {
+            return -1;
+        }
+        break;
+    case STI_OBJECT:
+    case STI_ARRAY: {
+        const uint8_t* inner_end = sto_skip_inner(p, end, f->type, depth);
+        if (!inner_end) return -1;
+        f->value = p;
+        f->value_len = (uint32_t)(inner_end - p);
+        f->next = inner_end + 1;
+        return 0;
+    }
+    default:
+        return -1;
+    }
+    if (len > (uint32_t)(end - p)) return -1;
+    f->value = p;
+    f->value_len = len;
+    f->next = p + len;
+    return 0;
+}
+
+// [p, end) のトップレベルから field_id のフィールドを探す
+static int64_t sto_find(sto_field_t* f, const uint8_t* p, const uint8_t* end, uint32_t field_id)
+{
+    while (p < end) {
+        if (sto_read_field(f, p, end, 0) < 0) return PARSE_ERROR;
+        if ((f->type << 16) + f->field == field_id) return 0;
+        p = f->next;
+    }
+    return DOESNT_EXIST;
+}
+
+static uint8_t* sto_put_header(uint8_t* p, uint32_t type, uint32_t field)
+{
+    if (type < 16 && field < 16) {
+        *p++ = (uint8_t)((type << 4) | field);
+    } else if (type < 16) {
+        *p++ = (uint8_t)(type << 4);
+        *p++ = (uint8_t)field;
+    } else if (field < 16) {
+        *p++ = (uint8_t)field;
+        *p++ = (uint8_t)type;
+    } else {
+        *p++ = 0;
+        *p++ = (uint8_t)type;
+        *p++ = (uint8_t)field;
+    }
+    return p;
+}
+
+static uint8_t* sto_put(uint8_t* p, uint32_t field_id, const void* data, uint32_t len)
+{
+    p = sto_put_header(p, field_id >> 16, field_id & 0xFFFF);
+    memcpy(p, data, len);
+    return p + len;
+}
+
+static uint8_t* sto_put_vl(uint8_t* p, uint32_t field_id, const void* data, uint32_t len)
+{
+    p = sto_put_header(p, field_id >> 16, field_id & 0xFFFF);
+    if (len <= 192) {
+        *p++ = (uint8_t)len;
+    } else {
+        uint32_t v = len - 193;
+        *p++ = (uint8_t)(193 + (v >> 8));
+        *p++ = (uint8_t)v;
+    }
+    memcpy(p, data, len);
+    return p + len;
+}
+
+static uint8_t* sto_put_uint(uint8_t* p, uint32_t field_id, uint64_t v, uint32_t size)
+{
+    p = sto_put_header(p, field_id >> 16, field_id & 0xFFFF);
+    for (uint32_t i = 0; i < size; i++) *p++ = (uint8_t)(v >> (8 * (size - 1 - i)));
+    return p;
+}
+
+// =====================================================================================================================
+// == ホスト関数 ==
+// =====================================================================================================================
+
+int32_t _g(uint32_t id, uint32_t maxiter)
+{
+    HOST(_g);
+    for (uint32_t i = 0; i < g_guard_count; i++) {
+        if (g_guards[i].id == id) {
+            if (++g_guards[i].count > maxiter) finish(EMU_ROLLBACK, SBUF("emu: guard violation"), -1);
+            return 1;
+        }
+    }
+    if (g_guard_count < EMU_MAX_GUARDS) {
+        g_guards[g_guard_count].id = id;
+        g_guards[g_guard_count].count = 1;
+        g_guard_count++;
+    }
+    return 1;
+}
+
+int64_t accept(const void* msg, uint32_t msg_len, int64_t code)
+{
+    HOST(accept);
+    finish(EMU_ACCEPT, msg, msg_len, code);
+}
+
+int64_t rollback(const void* msg, uint32_t msg_len, int64_t code)
+{
+    HOST(rollback);
+    finish(EMU_ROLLBACK, msg, msg_len, code);
+}
+
+int64_t trace(const void* msg, uint32_t msg_len, const void* data, uint32_t data_len, uint32_t as_hex)
+{
+    HOST(trace);
+    if (msg_len == sizeof(EMU_TRACE_POINT_TAG) - 1 && memcmp(msg, EMU_TRACE_POINT_TAG, msg_len) == 0 &&
+        data_len == EMU_TRACE_POINT_SIZE)
+        trace_point((const uint8_t*)data);
+    if (g_trace_enabled) {
+        fprintf(stderr, "trace: %.*s", (int)msg_len, (const char*)msg);
+        if (data && data_len > 0) {
+            fputc(' ', stderr);
+            for (uint32_t i = 0; i < data_len; i++) {
+                if (as_hex) fprintf(stderr, "%02X", ((const uint8_t*)data)[i]);
+                else fputc(((const uint8_t*)data)[i], stderr);
+            }
+        }
+        fputc('\n', stderr);
+    }
+    return 0;
+}
+
+int64_t trace_num(const void* msg, uint32_t msg_len, int64_t number)
+{
+    HOST(trace_num);
+    if (g_trace_enabled) fprintf(stderr, "trace: %.*s %lld\n", (int)msg_len, (const char*)msg, (long long)number);
+    return 0;
+}
+
+int64_t hook_account(void* out, uint32_t out_len)
+{
+    HOST(hook_account);
+    if (out_len < 20) return TOO_SMALL;
+    memcpy(out, g_hook_accid, 20);
+    return 20;
+}
+
+int64_t ledger_seq(void)
+{
+    HOST(ledger_seq);
+    return EMU_LEDGER_SEQ;
+}
+
+int64_t otxn_type(void)
+{
+    HOST(otxn_type);
+    return g_txn.type;
+}
+
+static int64_t copy_field(void* out, uint32_t out_len, const void* src, uint32_t len)
+{
+    if (out_len < len) return TOO_SMALL;
+    memcpy(out, src, len);
+    return len;
+}
+
+// xahaud と同じく AccountID は長さの接頭辞を除き、それ以外はシリアライズしたまま書き込む
+static int64_t write_field(void* out, uint32_t out_len, const sto_field_t* f)
+{
+    if (f->type == STI_ACCOUNT || f->type == STI_OBJECT || f->type == STI_ARRAY)
+        return copy_field(out, out_len, f->value, f->value_len);
+    return copy_field(out, out_len, f->body, (uint32_t)(f->next - f->body));
+}
+
+int64_t otxn_field(void* out, uint32_t out_len, uint32_t field_id)
+{
+    HOST(otxn_field);
+    sto_field_t f;
+    int64_t found = sto_find(&f, g_txn_sto, g_txn_sto + g_txn_sto_len, field_id);
+    if (found < 0) return found;
+    return write_field(out, out_len, &f);
+}
+
+// --- スロット ---
+
+static int64_t slot_store(uint32_t slot_no, const uint8_t* data, uint32_t len, uint32_t type)
+{
+    if (slot_no == 0) {
+        for (slot_no = 1; slot_no <= EMU_MAX_SLOTS && g_slots[slot_no].used; slot_no++)
+            ;
+        if (slot_no > EMU_MAX_SLOTS) return NO_FREE_SLOTS;
+    } else if (slot_no > EMU_MAX_SLOTS) {
+        return INVALID_ARGUMENT;
+    }
+    g_slots[slot_no].used = 1;
+    g_slots[slot_no].type = type;
+    g_slots[slot_no].data = data;
+    g_slots[slot_no].len = len;
+    return slot_no;
+}
+
+static const emu_slot_t* slot_get(uint32_t slot_no)
+{
+    if (slot_no == 0 || slot_no > EMU_MAX_SLOTS || !g_slots[slot_no].used) return NULL;
+    return &g_slots[slot_no];
+}
+
+// フィールドをスロットに置く (オブジェクト・配列は中身、それ以外はヘッダを除いたシリアライズ形式)
+static int64_t slot_store_field(uint32_t slot_no, const sto_field_t* f)
+{
+    if (f->type == STI_OBJECT || f->type == STI_ARRAY)
+        return slot_store(slot_no, f->value, f->value_len, f->type);
+    return slot_store(slot_no, f->body, (uint32_t)(f->next - f->body), f->type);
+}
+
+int64_t otxn_slot(uint32_t slot_no)
+{
+    HOST(otxn_slot);
+    return slot_store(slot_no, g_txn_sto, g_txn_sto_len, STI_OBJECT);
+}
+
+int64_t slot(void* out, uint32_t out_len, uint32_t slot_no)
+{
+    HOST(slot);
+    const emu_slot_t* s = slot_get(slot_no);
+    if (!s) return DOESNT_EXIST;
+    return copy_field(out, out_len, s->data, s->len);
+}
+
+int64_t slot_count(uint32_t slot_no)
+{
+    HOST(slot_count);
+    const emu_slot_t* s = slot_get(slot_no);
+    if (!s) return DOESNT_EXIST;
+    if (s->type != STI_ARRAY) return NOT_AN_ARRAY;
+    int64_t count = 0;
+    sto_field_t f;
+    for (const uint8_t* p = s->data; p < s->data + s->len; p = f.next, count++)
+        if (sto_read_field(&f, p, s->data + s->len, 0) < 0) return INTERNAL_ERROR;
+    return count;
+}
+
+int64_t slot_subfield(uint32_t parent_slot, uint32_t field_id, uint32_t new_slot)
+{
+    HOST(slot_subfield);
+    const emu_slot_t* s = slot_get(parent_slot);
+    if (!s) return DOESNT_EXIST;
+    if (s->type != STI_OBJECT) return NOT_AN_OBJECT;
+    sto_field_t f;
+    int64_t found = sto_find(&f, s->data, s->data + s->len, field_id);
+    if (found < 0) return found == PARSE_ERROR ? INTERNAL_ERROR : found;
+    return slot_store_field(new_slot, &f);
+}
+
+int64_t slot_subarray(uint32_t parent_slot, uint32_t array_index, uint32_t new_slot)
+{
+    HOST(slot_subarray);
+    const emu_slot_t* s = slot_get(parent_slot);
+    if (!s) return DOESNT_EXIST;
+    if (s->type != STI_ARRAY) return NOT_AN_ARRAY;
+    sto_field_t f;
+    const uint8_t* p = s->data;
+    for (uint32_t i = 0; p < s->data + s->len; i++, p = f.next) {
+        if (sto_read_field(&f, p, s->data + s->len, 0) < 0) return INTERNAL_ERROR;
+        if (i == array_index) return slot_store_field(new_slot, &f);
+    }
+    return DOESNT_EXIST;
+}
+
+static void account_keylet(uint8_t out[34], const uint8_t accid[20])
+{
+    uint8_t buf[22];
+    uint8_t full[64];
+    buf[0] = 0x00;
+    buf[1] = 0x61;
+    memcpy(buf + 2, accid, 20);
+    emu_sha512(buf, 22, full);
+    out[0] = 0x00;
+    out[1] = 0x61;
+    memcpy(out + 2, full, 32);
+}
+
+int64_t slot_set(const void* keylet, uint32_t keylet_len, uint32_t slot_no)
+{
+    HOST(slot_set);
+    if (keylet_len != 34) return INVALID_ARGUMENT;
+    for (uint32_t i = 0; i < g_account_count; i++) {
+        if (memcmp(g_accounts[i].keylet, keylet, 34) == 0)
+            return slot_store(slot_no, g_accounts[i].sto, g_accounts[i].sto_len, STI_OBJECT);
+    }
+    return DOESNT_EXIST;
+}
+
+// --- State ---
+
+static int64_t state_read(void* out, uint32_t out_len, const void* key, uint32_t key_len)
+{
+    g_stats.state_reads++;
+    if (key_len == 0 || key_len > EMU_STATE_KEY_SIZE) return TOO_BIG;
+
+    uint8_t k[EMU_STATE_KEY_SIZE];
+    pad_key(k, key, key_len);
+    const uint8_t* data;
+    int32_t len = state_lookup(k, &data);
+    if (len < 0) return DOESNT_EXIST;
+    if (!out) return len;
+    if ((uint32_t)len > out_len) return TOO_SMALL;
+    memcpy(out, data, len);
+    g_stats.state_read_bytes += len;
+    return len;
+}
+
+int64_t state(void* out, uint32_t out_len, const void* key, uint32_t key_len)
+{
+    HOST(state);
+    return state_read(out, out_len, key, key_len);
+}
+
+int64_t state_set(const void* data, uint32_t data_len, const void* key, uint32_t key_len)
+{
+    HOST(state_set);
+    if (key_len == 0 || key_len > EMU_STATE_KEY_SIZE) return TOO_BIG;
+    if (data_len > EMU_STATE_DATA_SIZE) return TOO_BIG;
+
+    uint8_t k[EMU_STATE_KEY_SIZE];
+    pad_key(k, key, key_len);
+    emu_pending_t* p = pending_find(k);
+    if (!p) {
+        if (g_pending_count >= EMU_MAX_STATE_MODS) return TOO_MANY_STATE_MODIFICATIONS;
+        p = &g_pending[g_pending_count++];
+        memcpy(p->key, k, EMU_STATE_KEY_SIZE);
+    }
+    if (!data || data_len == 0) {
+        p->len = -1;
+        g_stats.state_deletes++;
+        return 0;
+    }
+    p->len = (int32_t)data_len;
+    memcpy(p->data, data, data_len);
+    g_stats.state_writes++;
+    g_stats.state_write_bytes += data_len;
+    return data_len;
+}
+
+// --- シリアライズ済みオブジェクト ---
+
+int64_t sto_subfield(const void* sto, uint32_t sto_len, uint32_t field_id)
+{
+    HOST(sto_subfield);
+    const uint8_t* start = (const uint8_t*)sto;
+    sto_field_t f;
+    int64_t found = sto_find(&f, start, start + sto_len, field_id);
+    if (found < 0) return found;
+    return ((int64_t)(f.value - start) << 32) | f.value_len;
+}
+
+int64_t sto_subarray(const void* sto, uint32_t sto_len, uint32_t array_index)
+{
+    HOST(sto_subarray);
+    const uint8_t* start = (const uint8_t*)sto;
+    const uint8_t* end = start + sto_len;
+    sto_field_t f;
+    uint32_t i = 0;
+    for (const uint8_t* p = start; p < end && !sto_is_end(p, end, STI_ARRAY); p = f.next, i++) {
+        if (sto_read_field(&f, p, end, 0) < 0) return PARSE_ERROR;
+        if (i == array_index) return ((int64_t)(f.header - start) << 32) | (uint32_t)(f.next - f.header);
+    }
+    return DOESNT_EXIST;
+}
+
+// --- ユーティリティ ---
+
+int64_t util_raddr(void* out, uint32_t out_len, const void* accid, uint32_t accid_len)
+{
+    HOST(util_raddr);
+    if (accid_len != 20) return INVALID_ARGUMENT;
+    return emu_encode_raddr((char*)out, out_len, (const uint8_t*)accid);
+}
+
+int64_t util_accid(void* out, uint32_t out_len, const void* raddr, uint32_t raddr_len)
+{
+    HOST(util_accid);
+    if (out_len < 20) return TOO_SMALL;
+    if (raddr_len > 49) return TOO_BIG;
+    if (decode_raddr((uint8_t*)out, (const uint8_t*)raddr, raddr_len) < 0) return INVALID_ARGUMENT;
+    return 20;
+}
+
+void emu_sign(const void* key, uint32_t key_len, const void* msg, uint32_t msg_len, uint8_t sig[64])
+{
+    uint8_t buf[64 + 1024];
+    uint32_t kl = key_len > 64 ? 64 : key_len;
+    uint32_t ml = msg_len > 1024 ? 1024 : msg_len;
+    memcpy(buf, key, kl);
+    memcpy(buf + kl, msg, ml);
+    emu_sha512(buf, kl + ml, sig);
+}
+
+int64_t util_verify(const void* data, uint32_t data_len, const void* sig, uint32_t sig_len,
+                    const void* key, uint32_t key_len)
+{
+    HOST(util_verify);
+    if (key_len == 0 || key_len > 33 || sig_len != 64 || data_len > 1024) return 0;
+    uint8_t expected[64];
+    emu_sign(key, key_len, data, data_len, expected);
+    return memcmp(expected, sig, 64) == 0 ? 1 : 0;
+}
+
+int64_t util_sha512h(void* out, uint32_t out_len, const void* data, uint32_t data_len)
+{
+    HOST(util_sha512h);
+    if (out_len < 32) return TOO_SMALL;
+    uint8_t full[64];
+    emu_sha512(data, data_len, full);
+    memcpy(out, full, 32);
+    return 32;
+}
+
+int64_t util_keylet(void* out, uint32_t out_len, uint32_t keylet_type,
+                    const void* a, uint32_t b, uint32_t c, uint32_t d, uint32_t e, uint32_t f)
+{
+    HOST(util_keylet);
+    (void)c; (void)d; (void)e; (void)f;
+    if (keylet_type != KEYLET_ACCOUNT) return INVALID_ARGUMENT;
+    if (out_len < 34) return TOO_SMALL;
+    if (!a || b != 20) return INVALID_ARGUMENT;
+    account_keylet((uint8_t*)out, (const uint8_t*)a);
+    return 34;
+}
+
+// --- XFL ---
+
+int64_t float_sum(int64_t a, int64_t b)
+{
+    HOST(float_sum);
+    return xfl_add(a, b);
+}
+
+int64_t float_compare(int64_t a, int64_t b, uint32_t mode)
+{
+    HOST(float_compare);
+    if (mode == 0 || (mode & ~7U) || mode == 7) return INVALID_ARGUMENT;
+    int neg;
+    int64_t mant;
+    int32_t exp;
+    if (xfl_unpack(a, &neg, &mant, &exp) < 0 || xfl_unpack(b, &neg, &mant, &exp) < 0) return INVALID_FLOAT;
+
+    int64_t neg_b = (b == 0) ? 0 : (b ^ (1LL << 62));
+    int64_t diff = xfl_add(a, neg_b);
+    if (diff < 0) return diff;
+    uint32_t rel = (diff == 0) ? COMPARE_EQUAL : (((diff >> 62) & 1) ? COMPARE_GREATER : COMPARE_LESS);
+    return (mode & rel) ? 1 : 0;
+}
+
+int64_t float_sto_set(const void* sto, uint32_t sto_len)
+{
+    HOST(float_sto_set);
+    // Amount の8バイトの値 (フィールドヘッダは付いていてもよい)
+    const uint8_t* p = (const uint8_t*)sto;
+    if (sto_len > 8) {
+        uint32_t type, field;
+        const uint8_t* value = sto_read_header(p, p + sto_len, &type, &field);
+        if (!value) return NOT_AN_OBJECT;
+        sto_len -= (uint32_t)(value - p);
+        p = value;
+    }
+    if (sto_len != 8) return NOT_AN_OBJECT;
+
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    if ((v & (1ULL << 63)) == 0) {
+        // XRP (ドロップ)
+        int64_t drops = (int64_t)(v & ((1ULL << 62) - 1));
+        return xfl_pack(((v >> 62) & 1) == 0, drops, -6);
+    }
+    int64_t mant = (int64_t)(v & ((1ULL << 54) - 1));
+    if (mant == 0) return 0;
+    return xfl_pack(((v >> 62) & 1) == 0, mant, (int32_t)((v >> 54) & 0xFF) - 97);
+}
+
+int64_t float_int(int64_t xfl, uint32_t decimal_places, uint32_t absolute)
+{
+    HOST(float_int);
+    int neg;
+    int64_t mant;
+    int32_t exp;
+    if (xfl_unpack(xfl, &neg, &mant, &exp) < 0) return INVALID_FLOAT;
+    if (decimal_places > 15) return INVALID_ARGUMENT;
+    if (mant == 0) return 0;
+    if (neg && !absolute) return CANT_RETURN_NEGATIVE;
+
+    // 小数点以下 decimal_places 桁より下は切り捨てる
+    __int128 v = mant;
+    for (exp += (int32_t)decimal_places; exp < 0 && v > 0; exp++) v /= 10;
+    for (; exp > 0; exp--) {
+        v *= 10;
+        if (v > INT64_MAX) return TOO_BIG;
+    }
+    return (int64_t)v;
+}
+
+// --- Emitted Transaction ---
+
+int64_t etxn_reserve(uint32_t count)
+{
+    HOST(etxn_reserve);
+    if (g_reserved > 0) return ALREADY_SET;
+    if (count == 0 || count > EMU_MAX_EMITTED) return TOO_BIG;
+    g_reserved = count;
+    return count;
+}
+
+int64_t etxn_details(void* out, uint32_t out_len)
+{
+    HOST(etxn_details);
+    if (g_reserved == 0) return PREREQUISITE_NOT_MET;
+    if (out_len < EMU_ETXN_DETAILS_SIZE) return TOO_SMALL;
+
+    // sfEmitDetails (コールバックなし)。ハッシュ類は0、ノンスは発行順
+    uint8_t zero[32] = { 0 };
+    uint8_t* p = sto_put_header((uint8_t*)out, STI_OBJECT, sfEmitDetails & 0xFFFF);
+    p = sto_put_uint(p, sfEmitGeneration, 1, 4);
+    p = sto_put_uint(p, sfEmitBurden, 1, 8);
+    p = sto_put(p, sfEmitParentTxnID, zero, 32);
+    zero[31] = (uint8_t)g_emit_pending_count;
+    p = sto_put(p, sfEmitNonce, zero, 32);
+    zero[31] = 0;
+    p = sto_put(p, sfEmitHookHash, zero, 32);
+    p = sto_put_header(p, STI_OBJECT, STO_END_FIELD);
+    return p - (uint8_t*)out;
+}
+
+int64_t etxn_fee_base(const void* txn, uint32_t txn_len)
+{
+    HOST(etxn_fee_base);
+    (void)txn;
+    if (g_reserved == 0) return PREREQUISITE_NOT_MET;
+    if (txn_len == 0) return INVALID_ARGUMENT;
+    return EMU_EMIT_FEE;
+}
+
+int64_t emit(void* hash_out, uint32_t hash_len, const void* txn, uint32_t txn_len)
+{
+    HOST(emit);
+    if (g_reserved == 0) return PREREQUISITE_NOT_MET;
+    if (g_emit_pending_count >= (uint32_t)g_reserved) return EMISSION_FAILURE;
+    if (hash_len < 32) return TOO_SMALL;
+
+    // 発行できるのはフックのアカウントから送る、手数料と EmitDetails の付いた IOU の Payment のみ
+    const uint8_t* start = (const uint8_t*)txn;
+    const uint8_t* end = start + txn_len;
+    const uint8_t* account = NULL;
+    const uint8_t* destination = NULL;
+    const uint8_t* amount = NULL;
+    int has_type = 0, has_fee = 0, has_details = 0;
+    sto_field_t f;
+    for (const uint8_t* p = start; p < end; p = f.next) {
+        if (sto_read_field(&f, p, end, 0) < 0) return EMISSION_FAILURE;
+        uint32_t id = (f.type << 16) + f.field;
+        if (id == sfTransactionType) has_type = f.value[0] == 0 && f.value[1] == ttPAYMENT;
+        else if (id == sfFee) has_fee = f.value_len == 8 && (f.value[0] & 0x80) == 0;
+        else if (id == sfEmitDetails) has_details = 1;
+        else if (id == sfAccount && f.value_len == 20) account = f.value;
+        else if (id == sfDestination && f.value_len == 20) destination = f.value;
+        else if (id == sfAmount && f.value_len == 48) amount = f.value;
+    }
+    if (!has_type || !has_fee || !has_details || !account || !destination || !amount) return EMISSION_FAILURE;
+    if (memcmp(account, g_hook_accid, 20) != 0) return EMISSION_FAILURE;
+
+    emu_emitted_t* e = &g_emit_pending[g_emit_pending_count++];
+    memcpy(e->account, account, 20);
+    memcpy(e->destination, destination, 20);
+    memcpy(e->amount, amount, 48);
+    uint8_t hash[64];
+    emu_sha512(start, txn_len, hash);
+    memcpy(hash_out, hash, 32);
+    return 32;
+}
+
+// =====================================================================================================================
+// == ハーネスAPI ==
+// =====================================================================================================================
+
+void emu_init(const uint8_t hook_accid[20])
+{
+    memcpy(g_hook_accid, hook_accid, 20);
+    free(g_table);
+    g_table = NULL;
+    g_table_cap = g_table_live = g_table_used = g_table_bytes = 0;
+    table_grow();
+    free(g_accounts);
+    g_accounts = NULL;
+    g_account_count = g_account_cap = 0;
+    g_emitted_count = 0;
+    g_trace_enabled = getenv("XAPAY_EMU_TRACE") != NULL;
+    memset(&g_txn, 0, sizeof(g_txn));
+    g_txn_sto_len = 0;
+    emu_reset_stats();
+}
+
+void emu_reset_stats(void)
+{
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(g_handler_stats, 0, sizeof(g_handler_stats));
+    g_span_handler = -1;
+}
+
+const emu_stats_t* emu_stats(void)
+{
+    return &g_stats;
+}
+
+const emu_handler_stats_t* emu_handler_stats(uint32_t handler)
+{
+    return handler < EMU_TRACE_MAX_HANDLERS ? &g_handler_stats[handler] : NULL;
+}
+
+void emu_ledger_add_account(const uint8_t accid[20], const uint8_t* regular_key)
+{
+    if (g_account_count == g_account_cap) {
+        g_account_cap = g_account_cap ? g_account_cap * 2 : 64;
+        g_accounts = realloc(g_accounts, g_account_cap * sizeof(emu_account_t));
+        if (!g_accounts) {
+            fprintf(stderr, "emu: out of memory\n");
+            exit(1);
+        }
+    }
+    emu_account_t* acc = &g_accounts[g_account_count++];
+    memcpy(acc->accid, accid, 20);
+    account_keylet(acc->keylet, accid);
+    uint8_t* end = sto_put_vl(acc->sto, sfAccount, accid, 20);
+    if (regular_key) end = sto_put_vl(end, sfRegularKey, regular_key, 20);
+    acc->sto_len = (uint32_t)(end - acc->sto);
+}
+
+void emu_txn_init(emu_txn_t* txn, int64_t type, const uint8_t account[20])
+{
+    txn->type = type;
+    memcpy(txn->account, account, 20);
+    txn->signing_pubkey_len = 0;
+    txn->amount_len = 0;
+    txn->memo_count = 0;
+}
+
+void emu_txn_set_iou(emu_txn_t* txn, int64_t value, const uint8_t currency[20], const uint8_t issuer[20])
+{
+    uint64_t v = 1ULL << 63;
+    if (value != 0) {
+        int neg = value < 0;
+        int64_t mant = neg ? -value : value;
+        int32_t exp = 0;
+        while (mant < XFL_MANT_MIN) { mant *= 10; exp--; }
+        while (mant > XFL_MANT_MAX) { mant /= 10; exp++; }
+        v |= ((uint64_t)(neg ? 0 : 1) << 62) | ((uint64_t)(exp + 97) << 54) | (uint64_t)mant;
+    }
+    for (int i = 0; i < 8; i++) txn->amount[i] = (uint8_t)(v >> (56 - 8 * i));
+    memcpy(txn->amount + 8, currency, 20);
+    memcpy(txn->amount + 28, issuer, 20);
+    txn->amount_len = 48;
+}
+
+int emu_txn_add_memo(emu_txn_t* txn, const void* data, uint32_t len)
+{
+    if (txn->memo_count >= EMU_MAX_MEMOS || len > EMU_MAX_MEMO_SIZE) return -1;
+    memcpy(txn->memo[txn->memo_count], data, len);
+    txn->memo_len[txn->memo_count] = len;
+    txn->memo_count++;
+    return 0;
+}
+
+void emu_set_txn(const emu_txn_t* txn)
+{
+    // 使用中の部分だけをコピーする
+    g_txn.type = txn->type;
+    memcpy(g_txn.account, txn->account, 20);
+    g_txn.signing_pubkey_len = txn->signing_pubkey_len;
+    memcpy(g_txn.signing_pubkey, txn->signing_pubkey, txn->signing_pubkey_len);
+    g_txn.amount_len = txn->amount_len;
+    memcpy(g_txn.amount, txn->amount, txn->amount_len);
+    g_txn.memo_count = txn->memo_count;
+    for (uint32_t i = 0; i < txn->memo_count; i++) {
+        g_txn.memo_len[i] = txn->memo_len[i];
+        memcpy(g_txn.memo[i], txn->memo[i], txn->memo_len[i]);
+    }
+
+    // ホスト関数が読むシリアライズ形式 (フィールドは型コード・フィールドコードの順)
+    uint8_t* p = sto_put_uint(g_txn_sto, sfTransactionType, (uint64_t)txn->type, 2);
+    if (txn->amount_len) p = sto_put(p, sfAmount, txn->amount, txn->amount_len);
+    if (txn->signing_pubkey_len) p = sto_put_vl(p, sfSigningPubKey, txn->signing_pubkey, txn->signing_pubkey_len);
+    p = sto_put_vl(p, sfAccount, txn->account, 20);
+    p = sto_put_vl(p, sfDestination, g_hook_accid, 20);
+    if (txn->memo_count) {
+        p = sto_put_header(p, STI_ARRAY, sfMemos & 0xFFFF);
+        for (uint32_t i = 0; i < txn->memo_count; i++) {
+            p = sto_put_header(p, STI_OBJECT, sfMemo & 0xFFFF);
+            p = sto_put_vl(p, sfMemoData, txn->memo[i], txn->memo_len[i]);
+            p = sto_put_header(p, STI_OBJECT, STO_END_FIELD);
+        }
+        p = sto_put_header(p, STI_ARRAY, STO_END_FIELD);
+    }
+    g_txn_sto_len = (uint32_t)(p - g_txn_sto);
+}
+
+const emu_txn_t* emu_current_txn(void)
+{
+    return &g_txn;
+}
+
+static void commit(void)
+{
+    for (uint32_t i = 0; i < g_pending_count; i++) {
+        if (g_pending[i].len < 0) table_delete(g_pending[i].key);
+        else table_put(g_pending[i].key, g_pending[i].data, (uint32_t)g_pending[i].len);
+    }
+    for (uint32_t i = 0; i < g_emit_pending_count && g_emitted_count < EMU_MAX_EMITTED; i++)
+        g_emitted[g_emitted_count++] = g_emit_pending[i];
+    g_stats.emitted += g_emit_pending_count;
+}
+
+int emu_run(int64_t (*fn)(void* arg), void* arg)
+{
+    g_pending_count = 0;
+    memset(g_slots, 0, sizeof(g_slots));
+    g_guard_count = 0;
+    g_reserved = 0;
+    g_emit_pending_count = 0;
+    g_emitted_count = 0;
+    g_message[0] = '\0';
+    g_code = 0;
+    g_span_handler = -1;
+
+    int outcome;
+    int jumped = setjmp(g_jmp);
+    if (jumped == 0) {
+        g_running = 1;
+        fn(arg);
+        outcome = EMU_RETURN;
+    } else {
+        outcome = jumped - 1;
+    }
+    g_running = 0;
+
+    trace_outcome(outcome, g_code);
+    if (outcome == EMU_ACCEPT) commit();
+    return outcome;
+}
+
+const char* emu_last_message(void)
+{
+    return g_message;
+}
+
+int64_t emu_last_code(void)
+{
+    return g_code;
+}
+
+uint32_t emu_emitted_count(void)
+{
+    return g_emitted_count;
+}
+
+uint32_t emu_reserved(void)
+{
+    return (uint32_t)g_reserved;
+}
+
+const emu_emitted_t* emu_emitted(uint32_t index)
+{
+    return index < g_emitted_count ? &g_emitted[index] : NULL;
+}
+
+int64_t emu_state_peek(void* out, uint32_t out_len, const void* key, uint32_t key_len)
+{
+    if (key_len == 0 || key_len > EMU_STATE_KEY_SIZE) return TOO_BIG;
+    uint8_t k[EMU_STATE_KEY_SIZE];
+    pad_key(k, key, key_len);
+    emu_state_entry_t* e = table_find(k);
+    if (!e) return DOESNT_EXIST;
+    if (e->len > out_len) return TOO_SMALL;
+    memcpy(out, e->data, e->len);
+    return e->len;
+}
+
+void emu_state_poke(const void* data, uint32_t data_len, const void* key, uint32_t key_len)
+{
+    if (key_len == 0 || key_len > EMU_STATE_KEY_SIZE || data_len > EMU_STATE_DATA_SIZE) return;
+    uint8_t k[EMU_STATE_KEY_SIZE];
+    pad_key(k, key, key_len);
+    if (!data || data_len == 0) table_delete(k);
+    else table_put(k, (const uint8_t*)data, data_len);
+}
+
+uint64_t emu_state_entries(void)
+{
+    return g_table_live;
+}
+
+uint64_t emu_state_bytes(void)
+{
+    return g_table_bytes;
+}
@@ -0,0 +1,211 @@
+/**
+ * XApay Hook - 利用許可 (チャージ＋利用許可枠更新と利用許可決済) の不変条件のテスト
+ */
+
+#include "xapay_test.h"
+
+// 利用許可決済の Memo。allowance が NULL なら利用許可を省略する (現在の利用許可を使う)
+static void payment(emu_txn_t* txn, const test_user_t* user, const char* amount,
+                    const char* allowance, const uint8_t* sig)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    test_tlv_put(&memo, XAPAY_TLV_USER, user->accid, 20);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, amount);
+    if (allowance) {
+        test_tlv_put_str(&memo, XAPAY_TLV_ALLOWANCE_AMOUNT, allowance);
+        test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    }
+    test_operator_invoke(txn, &memo);
+}
+
+static void setup(test_user_t* user)
+{
+    test_user(user, "alice");
+    test_register_key(user);
+}
+
+// 使用済み金額は許可額を超えず、残高は負にならない
+static void spend_within_allowance(void)
+{
+    test_user_t user;
+    uint8_t sig[64];
+    emu_txn_t txn;
+    xapay_record_t record;
+    setup(&user);
+    test_recharge(&user, 500, "1000");
+    test_sign_allowance(sig, &user, "1000");
+
+    payment(&txn, &user, "400", "1000", sig);
+    EXPECT_ACCEPT(&txn);
+    payment(&txn, &user, "200", NULL, NULL);
+    EXPECT_ROLLBACK(&txn, 304); // 残高 100
+    test_recharge(&user, 1000, "1000");
+    payment(&txn, &user, "1000", NULL, NULL);
+    EXPECT_ACCEPT(&txn);
+    payment(&txn, &user, "1", NULL, NULL);
+    EXPECT_ROLLBACK(&txn, 303);
+
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 100);
+    CHECK_EQ(record.spent, 1000);
+    CHECK_EQ(record.allowance, 1000);
+}
+
+// 運営者以外は支払いを実行できない
+static void payment_requires_operator(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    setup(&user);
+    test_recharge(&user, 500, "1000");
+    payment(&txn, &user, "10", NULL, NULL);
+    memcpy(txn.account, user.accid, 20);
+    EXPECT_ROLLBACK(&txn, 100);
+}
+
+// 利用許可がなければ支払えない (署名を付けても運営者が利用許可を作ることはできない)
+static void payment_requires_allowance(void)
+{
+    test_user_t user;
+    uint8_t sig[64];
+    emu_txn_t txn;
+    setup(&user);
+    test_sign_allowance(sig, &user, "1000");
+
+    payment(&txn, &user, "10", NULL, NULL);
+    EXPECT_ROLLBACK(&txn, 103);
+    payment(&txn, &user, "10", "1000", sig);
+    EXPECT_ROLLBACK(&txn, 302);
+}
+
+// 過去の利用許可を交互に提示して使用済み金額を0に戻すことはできない
+static void alternating_allowances_rejected(void)
+{
+    test_user_t user;
+    uint8_t sig_a[64], sig_b[64];
+    emu_txn_t txn;
+    xapay_record_t record;
+    setup(&user);
+    test_sign_allowance(sig_a, &user, "1000");
+    test_sign_allowance(sig_b, &user, "2000");
+
+    test_recharge(&user, 5000, "1000");
+    payment(&txn, &user, "600", "1000", sig_a);
+    EXPECT_ACCEPT(&txn);
+    test_recharge(&user, 1, "2000");
+    payment(&txn, &user, "1500", "2000", sig_b);
+    EXPECT_ACCEPT(&txn);
+
+    // 利用許可 A (ユーザーが過去に署名したもの) を提示しても受け付けない
+    payment(&txn, &user, "600", "1000", sig_a);
+    EXPECT_ROLLBACK(&txn, 302);
+    payment(&txn, &user, "600", NULL, NULL);
+    EXPECT_ROLLBACK(&txn, 303);
+
+    test_record(&record, &user);
+    CHECK_EQ(record.allowance, 2000);
+    CHECK_EQ(record.spent, 1500);
+    CHECK_EQ(record.allowance_generation, 2);
+
+    // 一括決済でも同じ (利用許可 A のエントリでバッチ全体がロールバックする)
+    test_tlv_t memo, entry;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+    entry.len = 0;
+    test_tlv_put(&entry, XAPAY_TLV_USER, user.accid, 20);
+    test_tlv_put_str(&entry, XAPAY_TLV_AMOUNT, "100");
+    test_tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+    test_tlv_put_str(&entry, XAPAY_TLV_ALLOWANCE_AMOUNT, "1000");
+    test_tlv_put(&entry, XAPAY_TLV_SIGNATURE, sig_a, 64);
+    test_tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+    test_operator_invoke(&txn, &memo);
+    EXPECT_ROLLBACK(&txn, 302);
+    test_record(&record, &user);
+    CHECK_EQ(record.spent, 1500);
+}
+
+// 支払いの利用許可の額・署名は現在のものと一致しなければならない
+static void payment_allowance_must_match(void)
+{
+    test_user_t user;
+    uint8_t sig[64];
+    emu_txn_t txn;
+    setup(&user);
+    test_recharge(&user, 5000, "1000");
+    test_sign_allowance(sig, &user, "1000");
+
+    payment(&txn, &user, "10", "9999", sig);
+    EXPECT_ROLLBACK(&txn, 302);
+    sig[0] ^= 1;
+    payment(&txn, &user, "10", "1000", sig);
+    EXPECT_ROLLBACK(&txn, 302);
+}
+
+// 利用許可の更新はユーザー本人の有効な署名が必要で、そのときだけ使用済み金額を0に戻す
+static void recharge_resets_only_with_signature(void)
+{
+    test_user_t user, other;
+    uint8_t sig[64];
+    emu_txn_t txn;
+    xapay_record_t record;
+    setup(&user);
+    test_user(&other, "bob");
+    test_recharge(&user, 5000, "1000");
+    payment(&txn, &user, "700", NULL, NULL);
+    EXPECT_ACCEPT(&txn);
+
+    // 他人の署名
+    test_sign_allowance(sig, &other, "1000");
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE);
+    test_tlv_put_str(&memo, XAPAY_TLV_ALLOWANCE_AMOUNT, "1000");
+    test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    emu_txn_init(&txn, ttINVOKE, user.accid);
+    emu_txn_set_iou(&txn, 1, CURRENCY_JPY, ISSUER_ACCID);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 302);
+
+    // 公開鍵を登録していないユーザー
+    memcpy(txn.account, other.accid, 20);
+    EXPECT_ROLLBACK(&txn, 802);
+
+    test_record(&record, &user);
+    CHECK_EQ(record.spent, 700);
+    CHECK_EQ(record.allowance_generation, 1);
+
+    test_recharge(&user, 1, "1000");
+    test_record(&record, &user);
+    CHECK_EQ(record.spent, 0);
+    CHECK_EQ(record.allowance_generation, 2);
+    CHECK_EQ(record.balance, 5000 - 700 + 1);
+}
+
+// 33文字の r-address のユーザーも署名のメッセージが一致する
+static void short_raddr_user(void)
+{
+    test_user_t user;
+    uint8_t sig[64];
+    emu_txn_t txn;
+    test_user_raddr_len(&user, "carol", 33);
+    CHECK_EQ(strlen(user.raddr), 33);
+    test_register_key(&user);
+    test_recharge(&user, 500, "1000");
+    test_sign_allowance(sig, &user, "1000");
+
+    payment(&txn, &user, "400", "1000", sig);
+    EXPECT_ACCEPT(&txn);
+    sig[0] ^= 1;
+    payment(&txn, &user, "100", "1000", sig);
+    EXPECT_ROLLBACK(&txn, 302);
+}
+
+void test_allowance(void)
+{
+    TEST_CASE(spend_within_allowance);
+    TEST_CASE(payment_requires_operator);
+    TEST_CASE(payment_requires_allowance);
+    TEST_CASE(alternating_allowances_rejected);
+    TEST_CASE(payment_allowance_must_match);
+    TEST_CASE(recharge_resets_only_with_signature);
+    TEST_CASE(short_raddr_user);
+}
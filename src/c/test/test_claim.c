@@ -0,0 +1,270 @@
+/**
+ * XApay Hook - 累積請求 (利用許可の世代ごとの引き落とし済み額) の不変条件のテスト
+ */
+
+#include "xapay_test.h"
+
+#define ALLOWANCE "1000"
+
+// 請求の署名: <r-address>:<運営者>:<利用許可のダイジェスト32バイト>:<世代>:<累積額>
+static void sign_claim(uint8_t sig[64], const test_user_t* user, const char* generation, const char* total)
+{
+    uint8_t allowance_sig[64];
+    test_sign_allowance(allowance_sig, user, ALLOWANCE);
+
+    uint8_t buf[20 + 1 + 32 + 64];
+    uint32_t amount_len = (uint32_t)strlen(ALLOWANCE);
+    memcpy(buf, user->accid, 20);
+    buf[20] = (uint8_t)amount_len;
+    memcpy(buf + 21, ALLOWANCE, amount_len);
+    memcpy(buf + 21 + amount_len, allowance_sig, 64);
+    uint8_t digest[64];
+    emu_sha512(buf, 21 + amount_len + 64, digest);
+
+    char message[256];
+    int n = snprintf(message, sizeof(message), "%s:%s:", user->raddr, g_test_operator_raddr);
+    memcpy(message + n, digest, 32);
+    n += 32;
+    n += snprintf(message + n, sizeof(message) - n, ":%s:%s", generation, total);
+    emu_sign(user->pubkey, XAPAY_PUBKEY_SIZE, message, (uint32_t)n, sig);
+}
+
+// 請求の Memo。generation が NULL なら世代を省略し、sig が NULL なら正しく署名する
+static void claim(emu_txn_t* txn, const test_user_t* user, const char* generation, const char* total,
+                  const uint8_t* sig)
+{
+    uint8_t own[64];
+    if (!sig) {
+        sign_claim(own, user, generation ? generation : "", total);
+        sig = own;
+    }
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_CLAIM_REDEEM);
+    test_tlv_put(&memo, XAPAY_TLV_USER, user->accid, 20);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, total);
+    if (generation)
+        test_tlv_put_str(&memo, XAPAY_TLV_GENERATION, generation);
+    test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    test_operator_invoke(txn, &memo);
+}
+
+// accept のコードは今回引き落とした額
+#define EXPECT_DEBIT(txn, delta) test_expect((txn), EMU_ACCEPT, (delta), __FILE__, __LINE__)
+
+static void claim_state(xapay_claim_t* state, const test_user_t* user)
+{
+    uint8_t key[21];
+    key[0] = PREFIX_CLAIM;
+    memcpy(key + 1, user->accid, 20);
+    memset(state, 0, sizeof(*state));
+    emu_state_peek(state, sizeof(*state), key, sizeof(key));
+}
+
+static void setup(test_user_t* user)
+{
+    test_user(user, "alice");
+    test_register_key(user);
+    test_recharge(user, 5000, ALLOWANCE);
+}
+
+// 累積額の差分だけを引き落とし、同じ累積額は何もしない
+static void redeem_delta(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_record_t record;
+    xapay_claim_t state;
+    setup(&user);
+
+    claim(&txn, &user, "1", "100", NULL);
+    EXPECT_DEBIT(&txn, 100);
+    claim(&txn, &user, "1", "250", NULL);
+    EXPECT_DEBIT(&txn, 150);
+    claim(&txn, &user, "1", "250", NULL);
+    EXPECT_DEBIT(&txn, 0);
+
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 5000 - 250);
+    CHECK_EQ(record.spent, 250);
+    claim_state(&state, &user);
+    CHECK_EQ(state.allowance_generation, 1);
+    CHECK_EQ(state.redeemed, 250);
+}
+
+// 引き落とし済みより小さい累積額は 703 (署名が正しくても)
+static void lower_total_is_stale(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    setup(&user);
+    claim(&txn, &user, "1", "300", NULL);
+    EXPECT_DEBIT(&txn, 300);
+    claim(&txn, &user, "1", "200", NULL);
+    EXPECT_ROLLBACK(&txn, 703);
+}
+
+// 累積額は利用上限と残高を超えない
+static void total_within_allowance(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    setup(&user);
+    claim(&txn, &user, "1", "1001", NULL);
+    EXPECT_ROLLBACK(&txn, 303);
+    claim(&txn, &user, "1", "1000", NULL);
+    EXPECT_DEBIT(&txn, 1000);
+}
+
+// 利用許可を更新すると古い世代の請求は 703、新しい世代は0から数える
+static void recharge_starts_new_generation(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_claim_t state;
+    uint8_t old_sig[64];
+    setup(&user);
+    claim(&txn, &user, "1", "300", NULL);
+    EXPECT_DEBIT(&txn, 300);
+    sign_claim(old_sig, &user, "1", "400");
+
+    test_recharge(&user, 1, ALLOWANCE);
+    claim(&txn, &user, "1", "400", old_sig);
+    EXPECT_ROLLBACK(&txn, 703);
+    claim(&txn, &user, "2", "100", NULL);
+    EXPECT_DEBIT(&txn, 100);
+
+    claim_state(&state, &user);
+    CHECK_EQ(state.allowance_generation, 2);
+    CHECK_EQ(state.redeemed, 100);
+}
+
+// 存在しない世代は 702、世代の省略は 103、運営者以外は 701
+static void generation_required(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    setup(&user);
+    claim(&txn, &user, "2", "100", NULL);
+    EXPECT_ROLLBACK(&txn, 702);
+    claim(&txn, &user, "x", "100", NULL);
+    EXPECT_ROLLBACK(&txn, 702);
+    claim(&txn, &user, NULL, "100", NULL);
+    EXPECT_ROLLBACK(&txn, 103);
+    claim(&txn, &user, "1", "100", NULL);
+    memcpy(txn.account, user.accid, 20);
+    EXPECT_ROLLBACK(&txn, 701);
+}
+
+// 署名は世代・累積額・現在の利用許可に対するもの
+static void signature_binds_claim(void)
+{
+    test_user_t user, other;
+    emu_txn_t txn;
+    uint8_t sig[64];
+    setup(&user);
+    test_user(&other, "bob");
+
+    sign_claim(sig, &user, "1", "100");
+    claim(&txn, &user, "1", "200", sig);
+    EXPECT_ROLLBACK(&txn, 702);
+    sig[0] ^= 1;
+    claim(&txn, &user, "1", "100", sig);
+    EXPECT_ROLLBACK(&txn, 702);
+
+    // 利用許可のない (鍵も登録していない) ユーザー
+    claim(&txn, &other, "1", "100", NULL);
+    EXPECT_ROLLBACK(&txn, 702);
+
+    xapay_record_t record;
+    test_record(&record, &user);
+    CHECK_EQ(record.spent, 0);
+}
+
+// 保存済みの引き落とし額は世代が進んだときだけ0に戻る (利用許可のダイジェストの不一致では戻らない)
+static void stored_claim_kept(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_record_t record;
+    xapay_claim_t state;
+    uint8_t key[21];
+    setup(&user);
+    claim(&txn, &user, "1", "300", NULL);
+    EXPECT_DEBIT(&txn, 300);
+
+    test_record(&record, &user);
+    record.allowance_hash[0] ^= 1;
+    key[0] = PREFIX_USER_RECORD;
+    memcpy(key + 1, user.accid, 20);
+    emu_state_poke(&record, sizeof(record), key, sizeof(key));
+
+    claim(&txn, &user, "1", "100", NULL);
+    EXPECT_ROLLBACK(&txn, 703);
+    claim_state(&state, &user);
+    CHECK_EQ(state.allowance_generation, 1);
+    CHECK_EQ(state.redeemed, 300);
+}
+
+// 一括の請求は1件でも失敗すれば全体をロールバックする
+static void batch_is_atomic(void)
+{
+    test_user_t alice, bob;
+    uint8_t sig[64];
+    emu_txn_t txn;
+    xapay_claim_t state;
+    test_user(&alice, "alice");
+    test_user(&bob, "bob");
+    test_register_key(&alice);
+    test_register_key(&bob);
+    test_recharge(&alice, 5000, ALLOWANCE);
+    test_recharge(&bob, 5000, ALLOWANCE);
+
+    test_tlv_t memo, entry;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_CLAIM_REDEEM);
+    entry.len = 0;
+    sign_claim(sig, &alice, "1", "100");
+    test_tlv_put(&entry, XAPAY_TLV_USER, alice.accid, 20);
+    test_tlv_put_str(&entry, XAPAY_TLV_AMOUNT, "100");
+    test_tlv_put_str(&entry, XAPAY_TLV_GENERATION, "1");
+    test_tlv_put(&entry, XAPAY_TLV_SIGNATURE, sig, 64);
+    test_tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+    entry.len = 0;
+    sign_claim(sig, &bob, "2", "100");
+    test_tlv_put(&entry, XAPAY_TLV_USER, bob.accid, 20);
+    test_tlv_put_str(&entry, XAPAY_TLV_AMOUNT, "100");
+    test_tlv_put_str(&entry, XAPAY_TLV_GENERATION, "2");
+    test_tlv_put(&entry, XAPAY_TLV_SIGNATURE, sig, 64);
+    test_tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+    test_operator_invoke(&txn, &memo);
+    EXPECT_ROLLBACK(&txn, 702);
+
+    claim_state(&state, &alice);
+    CHECK_EQ(state.redeemed, 0);
+}
+
+// 33文字の r-address のユーザーも署名のメッセージが一致する
+static void short_raddr_user(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    test_user_raddr_len(&user, "carol", 33);
+    CHECK_EQ(strlen(user.raddr), 33);
+    test_register_key(&user);
+    test_recharge(&user, 5000, ALLOWANCE);
+
+    claim(&txn, &user, "1", "100", NULL);
+    EXPECT_DEBIT(&txn, 100);
+}
+
+void test_claim(void)
+{
+    TEST_CASE(redeem_delta);
+    TEST_CASE(lower_total_is_stale);
+    TEST_CASE(total_within_allowance);
+    TEST_CASE(recharge_starts_new_generation);
+    TEST_CASE(generation_required);
+    TEST_CASE(signature_binds_claim);
+    TEST_CASE(stored_claim_kept);
+    TEST_CASE(batch_is_atomic);
+    TEST_CASE(short_raddr_user);
+}
@@ -0,0 +1,190 @@
+/**
+ * XApay Hook - State のコンパクション (handle_compact) のテスト
+ */
+
+#include "xapay_test.h"
+
+// accept のコード (削除したバイト数) まで確認する
+#define EXPECT_RECLAIMED(txn, bytes) test_expect((txn), EMU_ACCEPT, (bytes), __FILE__, __LINE__)
+
+static void user_key(uint8_t key[21], uint8_t prefix, const test_user_t* user)
+{
+    key[0] = prefix;
+    memcpy(key + 1, user->accid, 20);
+}
+
+static int key_exists(uint8_t prefix, const test_user_t* user)
+{
+    uint8_t key[21], data[XAPAY_RECORD_SIZE];
+    user_key(key, prefix, user);
+    return emu_state_peek(data, sizeof(data), key, sizeof(key)) >= 0;
+}
+
+static void poke_claim(const test_user_t* user, uint32_t generation, int64_t redeemed)
+{
+    uint8_t key[21];
+    xapay_claim_t claim = { .allowance_generation = generation, .redeemed = redeemed };
+    user_key(key, PREFIX_CLAIM, user);
+    emu_state_poke(&claim, sizeof(claim), key, sizeof(key));
+}
+
+static void compact_memo(test_tlv_t* memo, const test_user_t* users, int count)
+{
+    test_tlv_begin(memo, XAPAY_MEMO_TYPE_COMPACT);
+    for (int i = 0; i < count; i++) {
+        test_tlv_t entry;
+        entry.len = 0;
+        test_tlv_put(&entry, XAPAY_TLV_USER, users[i].accid, 20);
+        test_tlv_put(memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+    }
+}
+
+// 旧形式のキーだけのユーザーはレコードに移行してから旧キーを削除する
+static void legacy_keys_migrated(void)
+{
+    test_user_t users[2];
+    uint8_t key[21];
+    int64_t balance = 3000;
+    test_tlv_t memo;
+    emu_txn_t txn;
+    xapay_record_t record;
+    test_user(&users[0], "alice");
+    test_user(&users[1], "bob");
+    user_key(key, PREFIX_USER_BALANCE, &users[0]);
+    emu_state_poke(&balance, sizeof(balance), key, sizeof(key));
+    user_key(key, PREFIX_ALLOWANCE, &users[0]);
+    emu_state_poke("5000", 4, key, sizeof(key));
+
+    // bob は State がないので何もしない
+    compact_memo(&memo, users, 2);
+    test_operator_invoke(&txn, &memo);
+    EXPECT_RECLAIMED(&txn, (int64_t)sizeof(balance) + 4 - XAPAY_RECORD_SIZE);
+
+    test_record(&record, &users[0]);
+    CHECK_EQ(record.version, XAPAY_RECORD_VERSION);
+    CHECK_EQ(record.balance, 3000);
+    CHECK_EQ(record.allowance, 5000);
+    CHECK_EQ(record.flags, 0);
+    CHECK(!key_exists(PREFIX_USER_BALANCE, &users[0]));
+    CHECK(!key_exists(PREFIX_ALLOWANCE, &users[0]));
+    CHECK(!key_exists(PREFIX_USER_RECORD, &users[1]));
+
+    // 2回目は削除するものがない
+    EXPECT_RECLAIMED(&txn, 0);
+}
+
+// 入れ替え済みの利用許可に対する累積請求だけを削除する
+static void stale_claim_deleted(void)
+{
+    test_user_t users[2];
+    test_tlv_t memo;
+    emu_txn_t txn;
+    test_user(&users[0], "alice");
+    test_user(&users[1], "bob");
+    for (int i = 0; i < 2; i++) {
+        test_register_key(&users[i]);
+        test_recharge(&users[i], 1000, "2000");
+        test_recharge(&users[i], 1000, "3000");
+    }
+    poke_claim(&users[0], 1, 500);
+    poke_claim(&users[1], 2, 700);
+
+    compact_memo(&memo, users, 2);
+    test_operator_invoke(&txn, &memo);
+    EXPECT_RECLAIMED(&txn, sizeof(xapay_claim_t));
+    CHECK(!key_exists(PREFIX_CLAIM, &users[0]));
+    CHECK(key_exists(PREFIX_CLAIM, &users[1]));
+}
+
+// 2件目以降の Memo のユーザーも対象にする
+static void users_in_extra_memos(void)
+{
+    test_user_t users[2];
+    test_tlv_t memo;
+    emu_txn_t txn;
+    test_user(&users[0], "alice");
+    test_user(&users[1], "bob");
+    test_register_key(&users[1]);
+    test_recharge(&users[1], 1000, "2000");
+    test_recharge(&users[1], 1000, "3000");
+    poke_claim(&users[1], 1, 500);
+
+    compact_memo(&memo, &users[0], 1);
+    test_operator_invoke(&txn, &memo);
+    compact_memo(&memo, &users[1], 1);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_RECLAIMED(&txn, sizeof(xapay_claim_t));
+    CHECK(!key_exists(PREFIX_CLAIM, &users[1]));
+
+    // コンパクション以外の Memo は受け付けない
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW_FLUSH);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 101);
+}
+
+// 発行済みの引き出しキューの位置だけを削除し、削除済みの位置を記録する
+static void queue_slots_swept(void)
+{
+    uint8_t header_key[1] = { PREFIX_WITHDRAW_QUEUE };
+    xapay_withdraw_queue_t queue = { .head = 3, .tail = 4, .swept = 0 };
+    uint8_t accid[20] = { 0 };
+    test_tlv_t memo;
+    emu_txn_t txn;
+    emu_state_poke(&queue, sizeof(queue), header_key, sizeof(header_key));
+    for (uint32_t position = 0; position < 4; position++) {
+        uint8_t slot_key[5];
+        xapay_withdraw_slot_key(slot_key, position);
+        emu_state_poke(accid, sizeof(accid), slot_key, sizeof(slot_key));
+    }
+
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_COMPACT);
+    test_operator_invoke(&txn, &memo);
+    EXPECT_RECLAIMED(&txn, 3 * sizeof(accid));
+
+    for (uint32_t position = 0; position < 4; position++) {
+        uint8_t slot_key[5];
+        xapay_withdraw_slot_key(slot_key, position);
+        CHECK_EQ(emu_state_peek(accid, sizeof(accid), slot_key, sizeof(slot_key)) >= 0, position == 3);
+    }
+    CHECK_EQ(emu_state_peek(&queue, sizeof(queue), header_key, sizeof(header_key)), sizeof(queue));
+    CHECK_EQ(queue.swept, 3);
+
+    EXPECT_RECLAIMED(&txn, 0);
+}
+
+// 運営者以外は 501、ユーザーが上限を超えると 101
+static void rejected(void)
+{
+    test_user_t users[XAPAY_MEMO_MAX_ENTRIES];
+    test_tlv_t memo;
+    emu_txn_t txn;
+    for (int i = 0; i < XAPAY_MEMO_MAX_ENTRIES; i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "user%d", i);
+        test_user(&users[i], label);
+    }
+
+    compact_memo(&memo, users, 1);
+    emu_txn_init(&txn, ttINVOKE, users[0].accid);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 501);
+
+    // 16件 x 3 = 48人までは受け付け、49人目で拒否する
+    compact_memo(&memo, users, XAPAY_MEMO_MAX_ENTRIES);
+    test_operator_invoke(&txn, &memo);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_RECLAIMED(&txn, 0);
+    compact_memo(&memo, users, 1);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 101);
+}
+
+void test_compact(void)
+{
+    TEST_CASE(legacy_keys_migrated);
+    TEST_CASE(stale_claim_deleted);
+    TEST_CASE(users_in_extra_memos);
+    TEST_CASE(queue_slots_swept);
+    TEST_CASE(rejected);
+}
@@ -0,0 +1,148 @@
+/**
+ * XApay Hook - 署名鍵の登録 (handle_register_key) と未登録のユーザーの署名の検証のテスト
+ */
+
+#include "xapay_test.h"
+
+// SigningPubKey が pubkey (pubkey_len バイト、0 なら SigningPubKey なし) の登録の Invoke
+static void register_key(emu_txn_t* txn, const test_user_t* user, const uint8_t* pubkey, uint32_t pubkey_len)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_REGISTER_KEY);
+    emu_txn_init(txn, ttINVOKE, user->accid);
+    memcpy(txn->signing_pubkey, pubkey, pubkey_len);
+    txn->signing_pubkey_len = pubkey_len;
+    emu_txn_add_memo(txn, memo.data, memo.len);
+}
+
+// 署名済みのチャージ＋利用許可枠更新
+static void recharge(emu_txn_t* txn, const test_user_t* user, const uint8_t sig[64], const char* allowance)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE);
+    test_tlv_put_str(&memo, XAPAY_TLV_ALLOWANCE_AMOUNT, allowance);
+    test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    emu_txn_init(txn, ttINVOKE, user->accid);
+    emu_txn_set_iou(txn, 1000, CURRENCY_JPY, ISSUER_ACCID);
+    emu_txn_add_memo(txn, memo.data, memo.len);
+}
+
+// 登録済みの鍵を読む (未登録なら 0)
+static int load_key(xapay_pubkey_t* key, const test_user_t* user)
+{
+    uint8_t state_key[21];
+    state_key[0] = PREFIX_PUBKEY;
+    memcpy(state_key + 1, user->accid, 20);
+    memset(key, 0, sizeof(*key));
+    return emu_state_peek(key, sizeof(*key), state_key, sizeof(state_key)) == sizeof(*key);
+}
+
+// SigningPubKey と鍵の種類を登録し、その鍵の署名を受け付ける
+static void registered(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_pubkey_t key;
+    xapay_record_t record;
+    test_user(&user, "alice");
+
+    register_key(&txn, &user, user.pubkey, XAPAY_PUBKEY_SIZE);
+    EXPECT_ACCEPT(&txn);
+    CHECK(load_key(&key, &user));
+    CHECK_EQ(key.key_type, XAPAY_KEY_TYPE_SECP256K1);
+    CHECK(memcmp(key.pubkey, user.pubkey, XAPAY_PUBKEY_SIZE) == 0);
+
+    test_recharge(&user, 1000, "5000");
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 1000);
+    CHECK_EQ(record.allowance, 5000);
+}
+
+// 登録し直すと鍵を上書きし、以前の鍵の署名は検証に失敗する
+static void reregister_replaces(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_pubkey_t key;
+    uint8_t old_sig[64];
+    test_user(&user, "alice");
+    test_register_key(&user);
+    test_sign_allowance(old_sig, &user, "5000");
+
+    // RegularKey を ed25519 の鍵に変更した
+    user.pubkey[0] = 0xED;
+    test_register_key(&user);
+    CHECK(load_key(&key, &user));
+    CHECK_EQ(key.key_type, XAPAY_KEY_TYPE_ED25519);
+    CHECK(memcmp(key.pubkey, user.pubkey, XAPAY_PUBKEY_SIZE) == 0);
+
+    recharge(&txn, &user, old_sig, "5000");
+    EXPECT_ROLLBACK(&txn, 302);
+    test_recharge(&user, 1000, "5000");
+
+    // 同じ鍵を登録し直しても変わらない
+    test_register_key(&user);
+    CHECK(load_key(&key, &user));
+    CHECK_EQ(key.key_type, XAPAY_KEY_TYPE_ED25519);
+}
+
+// SigningPubKey がない (マルチシグ)・長さや種類が違う鍵は 801 で、登録済みの鍵も変えない
+static void invalid_key(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_pubkey_t key;
+    uint8_t pubkey[XAPAY_PUBKEY_SIZE];
+    test_user(&user, "alice");
+    memcpy(pubkey, user.pubkey, sizeof(pubkey));
+
+    register_key(&txn, &user, pubkey, 0);
+    EXPECT_ROLLBACK(&txn, 801);
+    register_key(&txn, &user, pubkey, XAPAY_PUBKEY_SIZE - 1);
+    EXPECT_ROLLBACK(&txn, 801);
+    pubkey[0] = 0x04;
+    register_key(&txn, &user, pubkey, XAPAY_PUBKEY_SIZE);
+    EXPECT_ROLLBACK(&txn, 801);
+    CHECK(!load_key(&key, &user));
+
+    test_register_key(&user);
+    register_key(&txn, &user, pubkey, XAPAY_PUBKEY_SIZE);
+    EXPECT_ROLLBACK(&txn, 801);
+    CHECK(load_key(&key, &user));
+    CHECK(memcmp(key.pubkey, user.pubkey, XAPAY_PUBKEY_SIZE) == 0);
+}
+
+// 鍵を登録していないユーザーの署名は検証せずに 802。登録は送信者本人の鍵にしか効かない
+static void not_registered(void)
+{
+    test_user_t alice, bob;
+    emu_txn_t txn;
+    uint8_t sig[64];
+    xapay_record_t record;
+    test_user(&alice, "alice");
+    test_user(&bob, "bob");
+
+    test_sign_allowance(sig, &alice, "5000");
+    recharge(&txn, &alice, sig, "5000");
+    EXPECT_ROLLBACK(&txn, 802);
+
+    // bob の Invoke に alice の鍵を付けても、登録されるのは bob の鍵
+    register_key(&txn, &bob, alice.pubkey, XAPAY_PUBKEY_SIZE);
+    EXPECT_ACCEPT(&txn);
+    recharge(&txn, &alice, sig, "5000");
+    EXPECT_ROLLBACK(&txn, 802);
+    test_record(&record, &alice);
+    CHECK_EQ(record.balance, 0);
+
+    // 登録すれば同じ署名を受け付ける
+    test_register_key(&alice);
+    EXPECT_ACCEPT(&txn);
+}
+
+void test_key(void)
+{
+    TEST_CASE(registered);
+    TEST_CASE(reregister_replaces);
+    TEST_CASE(invalid_key);
+    TEST_CASE(not_registered);
+}
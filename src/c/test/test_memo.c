@@ -0,0 +1,254 @@
+/**
+ * XApay Hook - TLV Memo のデコードと一括決済のテスト
+ */
+
+#include "xapay_test.h"
+
+// 正しい単一の支払いの Memo はデコードできる
+static void decode_single_payment(void)
+{
+    test_user_t user;
+    test_tlv_t memo;
+    xapay_memo_t decoded;
+    test_user(&user, "alice");
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    test_tlv_put(&memo, XAPAY_TLV_USER, user.accid, 20);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, "100");
+
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), 0);
+    CHECK_EQ(decoded.type, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    CHECK(decoded.has_user && memcmp(decoded.user_accid, user.accid, 20) == 0);
+    CHECK_EQ(decoded.amount.len, 3);
+    CHECK_EQ(decoded.signature.len, 0);
+}
+
+// JSONの Memo はトップレベルのキーだけを読み、入れ子の allowance から利用許可を取り出す
+static void decode_json_payment(void)
+{
+    test_user_t user;
+    char json[512];
+    xapay_memo_t decoded;
+    test_user(&user, "alice");
+    int len = snprintf(json, sizeof(json),
+        "{ \"user_address\": \"%s\", \"merchant_address\": \"%s\", "
+        "\"allowance\": {\"amount\": \"1000\", \"signature\": \"0aFF\"}, \"payment_amount\": \"150\" }",
+        user.raddr, user.raddr);
+
+    CHECK_EQ(test_decode(&decoded, json, (uint32_t)len), 0);
+    CHECK_EQ(decoded.type, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    CHECK(decoded.has_user && memcmp(decoded.user_accid, user.accid, 20) == 0);
+    CHECK(decoded.has_merchant && memcmp(decoded.merchant_accid, user.accid, 20) == 0);
+    CHECK(decoded.amount.len == 3 && memcmp(decoded.amount.ptr, "150", 3) == 0);
+    CHECK(decoded.allowance_amount.len == 4 && memcmp(decoded.allowance_amount.ptr, "1000", 4) == 0);
+    CHECK(decoded.signature.len == 2 && decoded.signature.ptr[0] == 0x0a && decoded.signature.ptr[1] == 0xff);
+
+    // 入れ子の amount は支払い金額として扱わない
+    len = snprintf(json, sizeof(json), "{\"allowance\": {\"amount\": \"1000\"}}");
+    CHECK_EQ(test_decode(&decoded, json, (uint32_t)len), 0);
+    CHECK(decoded.amount.len <= 0);
+
+    // 閉じていない値
+    len = snprintf(json, sizeof(json), "{\"payment_amount\": \"150");
+    CHECK_EQ(test_decode(&decoded, json, (uint32_t)len), 0);
+    CHECK(decoded.amount.len <= 0);
+}
+
+// 値の長さがMemoの末尾を越える・ヘッダが途中で切れている
+static void decode_truncated(void)
+{
+    test_tlv_t memo;
+    xapay_memo_t decoded;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, "100");
+
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len - 1), -1);
+    memo.data[memo.len] = XAPAY_TLV_AMOUNT; // 長さのないタグ
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len + 1), -1);
+    CHECK_EQ(test_decode(&decoded, memo.data, 1), -1);
+}
+
+static void decode_bad_header(void)
+{
+    test_tlv_t memo;
+    xapay_memo_t decoded;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW);
+    memo.data[1] = XAPAY_MEMO_VERSION + 1;
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+
+    // 種類なし・範囲外の種類
+    test_tlv_begin(&memo, 0);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_LAST + 1);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+}
+
+// アカウントIDは20バイトちょうど
+static void decode_account_length(void)
+{
+    uint8_t accid[21] = { 0 };
+    test_tlv_t memo;
+    xapay_memo_t decoded;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    test_tlv_put(&memo, XAPAY_TLV_USER, accid, 19);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_MERCHANT_SETTLE);
+    test_tlv_put(&memo, XAPAY_TLV_MERCHANT, accid, 21);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+}
+
+// 未知のタグは読み飛ばす
+static void decode_unknown_tag(void)
+{
+    test_tlv_t memo;
+    xapay_memo_t decoded;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW);
+    test_tlv_put_str(&memo, 0x7F, "ignored");
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, "5");
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), 0);
+    CHECK_EQ(decoded.amount.len, 1);
+}
+
+// フィールド数の上限を超えるMemoは末尾まで読めないため不正
+static void decode_too_many_fields(void)
+{
+    test_tlv_t memo;
+    xapay_memo_t decoded;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW);
+    for (int i = 1; i < XAPAY_MEMO_MAX_FIELDS + XAPAY_MEMO_MAX_ENTRIES; i++)
+        test_tlv_put(&memo, XAPAY_TLV_AMOUNT, "", 0);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), 0);
+    test_tlv_put(&memo, XAPAY_TLV_AMOUNT, "", 0);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+}
+
+static void put_entry(test_tlv_t* memo, const test_user_t* user, const char* amount)
+{
+    test_tlv_t entry;
+    entry.len = 0;
+    test_tlv_put(&entry, XAPAY_TLV_USER, user->accid, 20);
+    test_tlv_put_str(&entry, XAPAY_TLV_AMOUNT, amount);
+    test_tlv_put(memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+}
+
+// 一括決済のエントリ: 0件・上限超過・USERなし・エントリ内の切り詰め
+static void decode_batch_entries(void)
+{
+    test_user_t user;
+    test_tlv_t memo;
+    xapay_memo_t decoded;
+    test_user(&user, "alice");
+
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+
+    for (int i = 0; i < XAPAY_MEMO_MAX_ENTRIES; i++)
+        put_entry(&memo, &user, "1");
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), 0);
+    CHECK_EQ(decoded.entry_count, XAPAY_MEMO_MAX_ENTRIES);
+    put_entry(&memo, &user, "1");
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+
+    test_tlv_t entry;
+    entry.len = 0;
+    test_tlv_put_str(&entry, XAPAY_TLV_AMOUNT, "1");
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+    test_tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+
+    entry.len = 0;
+    test_tlv_put(&entry, XAPAY_TLV_USER, user.accid, 20);
+    test_tlv_put_str(&entry, XAPAY_TLV_AMOUNT, "1");
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+    test_tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len - 1);
+    CHECK_EQ(test_decode(&decoded, memo.data, memo.len), -1);
+}
+
+// 不正なMemoのInvokeは 101 でロールバックする
+static void hook_rejects_malformed(void)
+{
+    test_tlv_t memo;
+    emu_txn_t txn;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    memo.len--;
+    test_operator_invoke(&txn, &memo);
+    EXPECT_ROLLBACK(&txn, 101);
+
+    emu_txn_init(&txn, ttINVOKE, OPERATOR_ACCID);
+    EXPECT_ROLLBACK(&txn, 101);
+}
+
+// 一括決済は1件でも失敗すれば全体をロールバックし、State を変更しない
+static void batch_is_atomic(void)
+{
+    test_user_t alice, bob;
+    test_user(&alice, "alice");
+    test_user(&bob, "bob");
+    test_register_key(&alice);
+    test_register_key(&bob);
+    test_recharge(&alice, 1000, "1000");
+    test_recharge(&bob, 100, "1000");
+
+    test_tlv_t memo;
+    emu_txn_t txn;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+    put_entry(&memo, &alice, "300");
+    put_entry(&memo, &bob, "200"); // 残高不足
+    test_operator_invoke(&txn, &memo);
+    EXPECT_ROLLBACK(&txn, 304);
+
+    xapay_record_t record;
+    test_record(&record, &alice);
+    CHECK_EQ(record.balance, 1000);
+    CHECK_EQ(record.spent, 0);
+
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+    put_entry(&memo, &alice, "300");
+    put_entry(&memo, &bob, "60");
+    put_entry(&memo, &alice, "200");
+    test_operator_invoke(&txn, &memo);
+    EXPECT_ACCEPT(&txn);
+    test_record(&record, &alice);
+    CHECK_EQ(record.balance, 500);
+    CHECK_EQ(record.spent, 500);
+    test_record(&record, &bob);
+    CHECK_EQ(record.balance, 40);
+}
+
+// Memo を XAPAY_MEMO_MAX_COUNT 件使った最大の一括決済 (ガードは実行全体で数える) と、Memo 数の超過
+static void batch_max_memos(void)
+{
+    test_user_t alice;
+    test_user(&alice, "alice");
+    test_register_key(&alice);
+    test_recharge(&alice, 1000, "1000");
+
+    test_tlv_t memo;
+    emu_txn_t txn;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+    for (int i = 0; i < XAPAY_MEMO_MAX_ENTRIES; i++)
+        put_entry(&memo, &alice, "1");
+    emu_txn_init(&txn, ttINVOKE, OPERATOR_ACCID);
+    for (int m = 0; m < XAPAY_MEMO_MAX_COUNT; m++)
+        emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ACCEPT(&txn);
+
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_PAYMENT_BATCH);
+    put_entry(&memo, &alice, "1");
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 101);
+}
+
+void test_memo(void)
+{
+    TEST_CASE(decode_single_payment);
+    TEST_CASE(decode_json_payment);
+    TEST_CASE(decode_truncated);
+    TEST_CASE(decode_bad_header);
+    TEST_CASE(decode_account_length);
+    TEST_CASE(decode_unknown_tag);
+    TEST_CASE(decode_too_many_fields);
+    TEST_CASE(decode_batch_entries);
+    TEST_CASE(hook_rejects_malformed);
+    TEST_CASE(batch_is_atomic);
+    TEST_CASE(batch_max_memos);
+}
@@ -0,0 +1,202 @@
+/**
+ * XApay Hook - 加盟店の未精算額 (支払いでの加算・閾値での精算・運営者による精算) のテスト
+ */
+
+#include "xapay_test.h"
+#include "xapay_config.h"
+
+// 利用許可決済 (現在の利用許可を使う) で merchant に支払う
+static void pay(emu_txn_t* txn, const test_user_t* user, const char* amount, const test_user_t* merchant)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    test_tlv_put(&memo, XAPAY_TLV_USER, user->accid, 20);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, amount);
+    test_tlv_put(&memo, XAPAY_TLV_MERCHANT, merchant->accid, 20);
+    test_operator_invoke(txn, &memo);
+}
+
+// 精算の Invoke。merchant は Memo の MERCHANT、entries は ENTRY の USER に並べる
+static void settle(emu_txn_t* txn, const test_user_t* merchant, const test_user_t* entries, int entry_count)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_MERCHANT_SETTLE);
+    if (merchant)
+        test_tlv_put(&memo, XAPAY_TLV_MERCHANT, merchant->accid, 20);
+    for (int i = 0; i < entry_count; i++) {
+        test_tlv_t entry;
+        entry.len = 0;
+        test_tlv_put(&entry, XAPAY_TLV_USER, entries[i].accid, 20);
+        test_tlv_put(&memo, XAPAY_TLV_ENTRY, entry.data, entry.len);
+    }
+    test_operator_invoke(txn, &memo);
+}
+
+// accept のコードは発行した精算の Payment の数
+#define EXPECT_SETTLED(txn, count) test_expect((txn), EMU_ACCEPT, (count), __FILE__, __LINE__)
+
+static void merchant_state(xapay_merchant_t* merchant, const test_user_t* user)
+{
+    uint8_t key[21];
+    key[0] = PREFIX_MERCHANT;
+    memcpy(key + 1, user->accid, 20);
+    memset(merchant, 0, sizeof(*merchant));
+    emu_state_peek(merchant, sizeof(*merchant), key, sizeof(key));
+}
+
+static void check_settlement(uint32_t index, const test_user_t* merchant, int64_t yen)
+{
+    const emu_emitted_t* emitted = emu_emitted(index);
+    uint8_t amount[48];
+    CHECK(emitted != NULL);
+    if (!emitted)
+        return;
+    xapay_yen_to_amount(amount, yen);
+    CHECK(memcmp(emitted->destination, merchant->accid, 20) == 0);
+    CHECK(memcmp(emitted->amount, amount, 8) == 0);
+}
+
+static void setup(test_user_t* user, test_user_t* merchant, int64_t balance)
+{
+    test_user(user, "alice");
+    test_user(merchant, "shop");
+    test_register_key(user);
+    test_recharge(user, balance, "1000000");
+}
+
+// 支払いは同じ実行で加盟店の未精算額に加算し、閾値までは精算しない
+static void credit_accumulates(void)
+{
+    test_user_t user, shop;
+    emu_txn_t txn;
+    xapay_merchant_t merchant;
+    xapay_record_t record;
+    setup(&user, &shop, 10000);
+
+    pay(&txn, &user, "300", &shop);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_emitted_count(), 0);
+    pay(&txn, &user, "200", &shop);
+    EXPECT_ACCEPT(&txn);
+
+    merchant_state(&merchant, &shop);
+    CHECK_EQ(merchant.accrued, 500);
+    CHECK_EQ(merchant.payments, 2);
+    CHECK_EQ(merchant.settled, 0);
+    CHECK_EQ(merchant.settlements, 0);
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 9500);
+
+    // 支払いが拒否されれば加算もしない
+    pay(&txn, &user, "10000", &shop);
+    EXPECT_ROLLBACK(&txn, 304);
+    merchant_state(&merchant, &shop);
+    CHECK_EQ(merchant.accrued, 500);
+}
+
+// 未精算額・支払い数のどちらかが閾値に達した支払いで1件の精算を発行する
+static void threshold_emits_settlement(void)
+{
+    test_user_t user, shop;
+    emu_txn_t txn;
+    xapay_merchant_t merchant;
+    setup(&user, &shop, 2 * XAPAY_MERCHANT_SETTLE_AMOUNT);
+
+    pay(&txn, &user, "1000", &shop);
+    EXPECT_ACCEPT(&txn);
+    char amount[32];
+    snprintf(amount, sizeof(amount), "%lld", (long long)(XAPAY_MERCHANT_SETTLE_AMOUNT - 1000));
+    pay(&txn, &user, amount, &shop);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_emitted_count(), 1);
+    check_settlement(0, &shop, XAPAY_MERCHANT_SETTLE_AMOUNT);
+
+    merchant_state(&merchant, &shop);
+    CHECK_EQ(merchant.accrued, 0);
+    CHECK_EQ(merchant.payments, 0);
+    CHECK_EQ(merchant.settled, XAPAY_MERCHANT_SETTLE_AMOUNT);
+    CHECK_EQ(merchant.settlements, 1);
+
+    // 支払い数の閾値
+    for (uint32_t i = 1; i < XAPAY_MERCHANT_SETTLE_COUNT; i++) {
+        pay(&txn, &user, "1", &shop);
+        EXPECT_ACCEPT(&txn);
+        CHECK_EQ(emu_emitted_count(), 0);
+    }
+    pay(&txn, &user, "1", &shop);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_emitted_count(), 1);
+    check_settlement(0, &shop, XAPAY_MERCHANT_SETTLE_COUNT);
+    merchant_state(&merchant, &shop);
+    CHECK_EQ(merchant.settlements, 2);
+}
+
+// 運営者の精算は閾値によらず未精算額のある加盟店に1件ずつ発行する
+static void explicit_settle(void)
+{
+    test_user_t user, shops[2];
+    emu_txn_t txn;
+    xapay_merchant_t merchant;
+    test_user(&user, "alice");
+    test_user(&shops[0], "shop");
+    test_user(&shops[1], "cafe");
+    test_register_key(&user);
+    test_recharge(&user, 10000, "1000000");
+
+    pay(&txn, &user, "300", &shops[0]);
+    EXPECT_ACCEPT(&txn);
+    pay(&txn, &user, "700", &shops[1]);
+    EXPECT_ACCEPT(&txn);
+
+    settle(&txn, NULL, shops, 2);
+    EXPECT_SETTLED(&txn, 2);
+    check_settlement(0, &shops[0], 300);
+    check_settlement(1, &shops[1], 700);
+    merchant_state(&merchant, &shops[1]);
+    CHECK_EQ(merchant.accrued, 0);
+    CHECK_EQ(merchant.settled, 700);
+    CHECK_EQ(merchant.settlements, 1);
+
+    // 未精算額がなければ何も発行しない
+    pay(&txn, &user, "50", &shops[0]);
+    EXPECT_ACCEPT(&txn);
+    settle(&txn, &shops[0], &shops[1], 1);
+    EXPECT_SETTLED(&txn, 1);
+    check_settlement(0, &shops[0], 50);
+    settle(&txn, &shops[0], NULL, 0);
+    EXPECT_SETTLED(&txn, 0);
+    CHECK_EQ(emu_emitted_count(), 0);
+}
+
+// 運営者以外は 601、支払いを受けたことのないアカウントは 603
+static void settle_rejected(void)
+{
+    test_user_t user, shop;
+    test_tlv_t memo;
+    emu_txn_t txn;
+    xapay_merchant_t merchant;
+    setup(&user, &shop, 10000);
+    pay(&txn, &user, "300", &shop);
+    EXPECT_ACCEPT(&txn);
+
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_MERCHANT_SETTLE);
+    test_tlv_put(&memo, XAPAY_TLV_MERCHANT, shop.accid, 20);
+    emu_txn_init(&txn, ttINVOKE, user.accid);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 601);
+
+    // ENTRY の USER に加盟店でないユーザーを並べると、加盟店の分も精算しない
+    settle(&txn, &shop, &user, 1);
+    EXPECT_ROLLBACK(&txn, 603);
+    CHECK_EQ(emu_emitted_count(), 0);
+    merchant_state(&merchant, &shop);
+    CHECK_EQ(merchant.accrued, 300);
+}
+
+void test_merchant(void)
+{
+    TEST_CASE(credit_accumulates);
+    TEST_CASE(threshold_emits_settlement);
+    TEST_CASE(explicit_settle);
+    TEST_CASE(settle_rejected);
+}
@@ -0,0 +1,132 @@
+/**
+ * XApay Hook - 旧形式のキー ('U' 残高, 'A' 利用許可額) からユーザーレコードへの移行のテスト
+ */
+
+#include "xapay_test.h"
+
+static void legacy_key(uint8_t key[21], uint8_t prefix, const test_user_t* user)
+{
+    key[0] = prefix;
+    memcpy(key + 1, user->accid, 20);
+}
+
+// 旧フックが書き込んだ形式のキーを置く (allowance が NULL なら 'A' を置かない)
+static void poke_legacy(const test_user_t* user, int64_t balance, const char* allowance)
+{
+    uint8_t key[21];
+    legacy_key(key, PREFIX_USER_BALANCE, user);
+    emu_state_poke(&balance, sizeof(balance), key, sizeof(key));
+    if (allowance) {
+        legacy_key(key, PREFIX_ALLOWANCE, user);
+        emu_state_poke(allowance, (uint32_t)strlen(allowance), key, sizeof(key));
+    }
+}
+
+static int legacy_exists(uint8_t prefix, const test_user_t* user)
+{
+    uint8_t key[21], data[64];
+    legacy_key(key, prefix, user);
+    return emu_state_peek(data, sizeof(data), key, sizeof(key)) >= 0;
+}
+
+static void withdraw(emu_txn_t* txn, const test_user_t* user, const char* amount)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, amount);
+    emu_txn_init(txn, ttINVOKE, user->accid);
+    emu_txn_add_memo(txn, memo.data, memo.len);
+}
+
+// 旧形式の残高はチャージ＋利用許可枠更新で引き継がれ、旧キーは削除される
+static void recharge_migrates_balance(void)
+{
+    test_user_t user;
+    xapay_record_t record;
+    test_user(&user, "alice");
+    test_register_key(&user);
+    poke_legacy(&user, 3000, "5000");
+
+    test_recharge(&user, 1000, "2000");
+    test_record(&record, &user);
+    CHECK_EQ(record.version, XAPAY_RECORD_VERSION);
+    CHECK_EQ(record.balance, 4000);
+    CHECK_EQ(record.allowance, 2000);
+    CHECK_EQ(record.allowance_generation, 1);
+    CHECK_EQ(record.flags, XAPAY_RECORD_HAS_ALLOWANCE);
+    CHECK(!legacy_exists(PREFIX_USER_BALANCE, &user));
+    CHECK(!legacy_exists(PREFIX_ALLOWANCE, &user));
+}
+
+// 旧形式の残高だけのユーザーも引き出せる (移行したレコードに利用許可はない)
+static void withdraw_migrates_balance(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_record_t record;
+    test_user(&user, "alice");
+    poke_legacy(&user, 3000, "5000");
+
+    withdraw(&txn, &user, "3001");
+    EXPECT_ROLLBACK(&txn, 304);
+    CHECK(legacy_exists(PREFIX_USER_BALANCE, &user));
+
+    withdraw(&txn, &user, "1000");
+    EXPECT_ACCEPT(&txn);
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 2000);
+    CHECK_EQ(record.allowance, 5000);
+    CHECK_EQ(record.flags, 0);
+    CHECK(!legacy_exists(PREFIX_USER_BALANCE, &user));
+    CHECK(!legacy_exists(PREFIX_ALLOWANCE, &user));
+
+    // 2回目以降はレコードだけを使う
+    withdraw(&txn, &user, "500");
+    EXPECT_ACCEPT(&txn);
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 1500);
+}
+
+// 旧形式の利用許可はダイジェストを持たないため、移行しても支払いには使えない
+static void legacy_allowance_needs_recharge(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    test_tlv_t memo;
+    test_user(&user, "alice");
+    test_register_key(&user);
+    poke_legacy(&user, 3000, "5000");
+
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+    test_tlv_put(&memo, XAPAY_TLV_USER, user.accid, 20);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, "100");
+    test_operator_invoke(&txn, &memo);
+    EXPECT_ROLLBACK(&txn, 103);
+    CHECK(legacy_exists(PREFIX_USER_BALANCE, &user));
+    CHECK(legacy_exists(PREFIX_ALLOWANCE, &user));
+}
+
+// 読めない旧形式の利用許可額は0として移行し、残高は引き継ぐ
+static void malformed_legacy_allowance(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_record_t record;
+    test_user(&user, "alice");
+    poke_legacy(&user, 800, "12a");
+
+    withdraw(&txn, &user, "800");
+    EXPECT_ACCEPT(&txn);
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 0);
+    CHECK_EQ(record.allowance, 0);
+    CHECK(!legacy_exists(PREFIX_ALLOWANCE, &user));
+}
+
+void test_migration(void)
+{
+    TEST_CASE(recharge_migrates_balance);
+    TEST_CASE(withdraw_migrates_balance);
+    TEST_CASE(legacy_allowance_needs_recharge);
+    TEST_CASE(malformed_legacy_allowance);
+}
@@ -0,0 +1,208 @@
+/**
+ * XApay Hook - ノンスのスライディングウィンドウとノンス付きの支払いのテスト
+ */
+
+#include "xapay_test.h"
+
+static void sign_payment(uint8_t sig[64], const test_user_t* user, const char* nonce, const char* amount)
+{
+    char message[256];
+    int n = snprintf(message, sizeof(message), "%s:%s:%s:%s", user->raddr, g_test_operator_raddr, nonce, amount);
+    emu_sign(user->pubkey, XAPAY_PUBKEY_SIZE, message, (uint32_t)n, sig);
+}
+
+// ノンス付きの支払い。sig が NULL なら nonce と amount に正しく署名する
+static void nonce_payment(emu_txn_t* txn, const test_user_t* user, const char* nonce, const char* amount,
+                          const uint8_t* sig)
+{
+    uint8_t own[64];
+    if (!sig) {
+        sign_payment(own, user, nonce, amount);
+        sig = own;
+    }
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_NONCE_PAYMENT);
+    test_tlv_put(&memo, XAPAY_TLV_USER, user->accid, 20);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, amount);
+    test_tlv_put_str(&memo, XAPAY_TLV_NONCE, nonce);
+    test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    test_operator_invoke(txn, &memo);
+}
+
+static void pay(const test_user_t* user, const char* nonce, int outcome, int64_t code, int line)
+{
+    emu_txn_t txn;
+    nonce_payment(&txn, user, nonce, "1", NULL);
+    test_expect(&txn, outcome, code, __FILE__, line);
+}
+
+#define PAY_OK(user, nonce) pay((user), (nonce), EMU_ACCEPT, 0, __LINE__)
+#define PAY_FAIL(user, nonce, code) pay((user), (nonce), EMU_ROLLBACK, (code), __LINE__)
+
+static void setup(test_user_t* user, int64_t balance)
+{
+    test_user(user, "alice");
+    test_register_key(user);
+    if (balance > 0)
+        test_recharge(user, balance, "1");
+}
+
+// xapay_nonce_use の境界: 0 は予約、ウィンドウの端、ウィンドウを越える前進
+static void window_edges(void)
+{
+    xapay_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+
+    CHECK_EQ(xapay_nonce_use(&rec, 0), -2);
+    CHECK_EQ(xapay_nonce_use(&rec, 1), 0);
+    CHECK_EQ(xapay_nonce_use(&rec, 1), -1);
+    CHECK_EQ(xapay_nonce_use(&rec, 0), -2);
+
+    CHECK_EQ(xapay_nonce_use(&rec, 100), 0);
+    CHECK_EQ(xapay_nonce_use(&rec, 100 - (XAPAY_NONCE_WINDOW - 1)), 0); // ウィンドウの最も古い位置
+    CHECK_EQ(xapay_nonce_use(&rec, 100 - (XAPAY_NONCE_WINDOW - 1)), -1);
+    CHECK_EQ(xapay_nonce_use(&rec, 100 - XAPAY_NONCE_WINDOW), -2);
+    CHECK_EQ(xapay_nonce_use(&rec, 99), 0);
+
+    // 63 進めると使用済みの 100 がウィンドウの最も古い位置に残る
+    CHECK_EQ(xapay_nonce_use(&rec, 100 + (XAPAY_NONCE_WINDOW - 1)), 0);
+    CHECK_EQ(xapay_nonce_use(&rec, 100), -1);
+    CHECK_EQ(xapay_nonce_use(&rec, 99), -2);
+
+    // ウィンドウ幅以上進めると以前のビットはすべて外れる
+    uint64_t high = rec.nonce_high;
+    CHECK_EQ(xapay_nonce_use(&rec, high + XAPAY_NONCE_WINDOW), 0);
+    CHECK_EQ(rec.nonce_window, 1);
+    CHECK_EQ(xapay_nonce_use(&rec, high), -2);
+    CHECK_EQ(xapay_nonce_use(&rec, high + 1), 0);
+}
+
+// ウィンドウ内のノンスは順不同でちょうど1回ずつ使える
+static void window_out_of_order_once(void)
+{
+    xapay_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    for (uint64_t n = XAPAY_NONCE_WINDOW; n >= 1; n--)
+        CHECK_EQ(xapay_nonce_use(&rec, n), 0);
+    for (uint64_t n = 1; n <= XAPAY_NONCE_WINDOW; n++)
+        CHECK_EQ(xapay_nonce_use(&rec, n), -1);
+    CHECK_EQ(rec.nonce_window, UINT64_MAX);
+    CHECK_EQ(rec.nonce_high, XAPAY_NONCE_WINDOW);
+}
+
+// フック経由: 再利用は 33、ウィンドウより古いノンスと 0 は 35
+static void hook_replay_and_age(void)
+{
+    test_user_t user;
+    setup(&user, 1000);
+    PAY_FAIL(&user, "0", 35);
+    PAY_OK(&user, "5");
+    PAY_OK(&user, "3");
+    PAY_FAIL(&user, "5", 33);
+    PAY_FAIL(&user, "3", 33);
+    PAY_OK(&user, "200");
+    PAY_FAIL(&user, "136", 35);
+    PAY_OK(&user, "137");
+    PAY_FAIL(&user, "137", 33);
+
+    xapay_record_t record;
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 1000 - 4);
+    CHECK_EQ(record.nonce_high, 200);
+}
+
+// ノンスは10進18桁まで。数字以外・19桁は 101
+static void hook_nonce_format(void)
+{
+    test_user_t user;
+    setup(&user, 1000);
+    PAY_OK(&user, "999999999999999999");
+    PAY_FAIL(&user, "999999999999999999", 33);
+    PAY_FAIL(&user, "1000000000000000000", 101);
+    PAY_FAIL(&user, "12a", 101);
+    PAY_FAIL(&user, "-1", 101);
+
+    emu_txn_t txn;
+    test_tlv_t memo;
+    uint8_t sig[64] = { 0 };
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_NONCE_PAYMENT);
+    test_tlv_put(&memo, XAPAY_TLV_USER, user.accid, 20);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, "1");
+    test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    test_operator_invoke(&txn, &memo);
+    EXPECT_ROLLBACK(&txn, 103);
+}
+
+// ロールバックした支払いはノンスを消費しない
+static void rollback_keeps_nonce(void)
+{
+    test_user_t user;
+    setup(&user, 0);
+    PAY_FAIL(&user, "7", 34);
+    test_recharge(&user, 10, "1");
+    PAY_OK(&user, "7");
+    PAY_FAIL(&user, "7", 33);
+}
+
+// 署名はノンスと支払い額に対するもの。運営者以外・未登録のユーザーは拒否する
+static void signature_binds_nonce(void)
+{
+    test_user_t user, other;
+    uint8_t sig[64];
+    emu_txn_t txn;
+    setup(&user, 1000);
+    test_user(&other, "bob");
+
+    sign_payment(sig, &user, "1", "1");
+    nonce_payment(&txn, &user, "2", "1", sig);
+    EXPECT_ROLLBACK(&txn, 32);
+    nonce_payment(&txn, &user, "1", "100", sig);
+    EXPECT_ROLLBACK(&txn, 32);
+    nonce_payment(&txn, &user, "1", "1", sig);
+    memcpy(txn.account, user.accid, 20);
+    EXPECT_ROLLBACK(&txn, 30);
+
+    nonce_payment(&txn, &other, "1", "1", NULL);
+    EXPECT_ROLLBACK(&txn, 802);
+}
+
+// ノンスの記録はユーザーレコードのみ (支払いの数によらず State のエントリ数は増えない)
+static void state_size_is_constant(void)
+{
+    test_user_t user;
+    setup(&user, 100000);
+    uint64_t entries = emu_state_entries();
+    uint64_t bytes = emu_state_bytes();
+    for (int n = 1; n <= 300; n++) {
+        char nonce[16];
+        snprintf(nonce, sizeof(nonce), "%d", n);
+        PAY_OK(&user, nonce);
+    }
+    CHECK_EQ(emu_state_entries(), entries);
+    CHECK_EQ(emu_state_bytes(), bytes);
+}
+
+// 33文字の r-address のユーザーも署名のメッセージが一致する
+static void short_raddr_user(void)
+{
+    test_user_t user;
+    test_user_raddr_len(&user, "carol", 33);
+    CHECK_EQ(strlen(user.raddr), 33);
+    test_register_key(&user);
+    test_recharge(&user, 10, "1");
+
+    PAY_OK(&user, "1");
+    PAY_FAIL(&user, "1", 33);
+}
+
+void test_nonce(void)
+{
+    TEST_CASE(window_edges);
+    TEST_CASE(window_out_of_order_once);
+    TEST_CASE(hook_replay_and_age);
+    TEST_CASE(hook_nonce_format);
+    TEST_CASE(rollback_keeps_nonce);
+    TEST_CASE(signature_binds_nonce);
+    TEST_CASE(state_size_is_constant);
+    TEST_CASE(short_raddr_user);
+}
@@ -0,0 +1,148 @@
+/**
+ * XApay Hook - トレースレベル (XAPAY_TRACE_LEVEL) ごとのトレースとトレースポイントの集計のテスト
+ *
+ * build/test.sh はレベル 0〜3 でそれぞれビルドして実行する。
+ */
+
+#include "xapay_test.h"
+#include "xapay_trace.h"
+
+static void withdraw(emu_txn_t* txn, const test_user_t* user, const char* amount)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, amount);
+    emu_txn_init(txn, ttINVOKE, user->accid);
+    emu_txn_add_memo(txn, memo.data, memo.len);
+}
+
+#if XAPAY_TRACE_LEVEL >= XAPAY_TRACE_LEVEL_DEBUG
+static int64_t reason_count(const emu_handler_stats_t* h, int64_t code)
+{
+    for (uint32_t i = 0; i < h->reason_count; i++) {
+        if (h->reasons[i].code == code)
+            return (int64_t)h->reasons[i].count;
+    }
+    return 0;
+}
+#else
+// DEBUG 未満ではハンドラ別の集計がすべて0のまま
+static void check_no_points(void)
+{
+    for (uint32_t handler = 0; handler < XAPAY_HANDLER_COUNT; handler++) {
+        const emu_handler_stats_t* h = emu_handler_stats(handler);
+        CHECK_EQ(h->runs + h->accepts + h->rejects + h->reason_count, 0);
+        for (uint32_t step = 0; step < EMU_TRACE_MAX_STEPS; step++)
+            CHECK_EQ(h->steps[step].hits + h->steps[step].items + h->steps[step].host_calls, 0);
+    }
+}
+#endif
+
+// 実行数・結果・拒否理由をハンドラ別に数え、結果は最後に通過したトレースポイントのハンドラに数える
+static void handler_counters(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    uint8_t sig[64];
+    test_tlv_t memo;
+    test_user(&user, "alice");
+
+    test_register_key(&user);
+    test_recharge(&user, 1000, "5000");
+    test_sign_allowance(sig, &user, "4000");
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE);
+    test_tlv_put_str(&memo, XAPAY_TLV_ALLOWANCE_AMOUNT, "5000");
+    test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    emu_txn_init(&txn, ttINVOKE, user.accid);
+    emu_txn_set_iou(&txn, 1000, CURRENCY_JPY, ISSUER_ACCID);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 302);
+
+    // ハンドラに入る前の拒否 (Memo なし) はフック本体に数える
+    emu_txn_init(&txn, ttINVOKE, user.accid);
+    EXPECT_ROLLBACK(&txn, 101);
+
+    const emu_stats_t* stats = emu_stats();
+    const emu_handler_stats_t* hook = emu_handler_stats(XAPAY_HANDLER_HOOK);
+    const emu_handler_stats_t* key = emu_handler_stats(XAPAY_HANDLER_REGISTER_KEY);
+    const emu_handler_stats_t* recharge = emu_handler_stats(XAPAY_HANDLER_RECHARGE);
+#if XAPAY_TRACE_LEVEL >= XAPAY_TRACE_LEVEL_DEBUG
+    CHECK_EQ(hook->runs, 4);
+    CHECK_EQ(hook->steps[1].hits, 3);
+    CHECK_EQ(hook->steps[1].value_sum,
+             XAPAY_MEMO_TYPE_REGISTER_KEY + 2 * XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE);
+    CHECK_EQ(hook->accepts, 0);
+    CHECK_EQ(hook->rejects, 1);
+    CHECK_EQ(reason_count(hook, 101), 1);
+
+    CHECK_EQ(key->runs, 1);
+    CHECK_EQ(key->accepts, 1);
+    CHECK_EQ(key->rejects, 0);
+    for (uint32_t step = 1; step <= 4; step++)
+        CHECK_EQ(key->steps[step].hits, 1);
+    CHECK_EQ(key->steps[3].value_sum, XAPAY_PUBKEY_SIZE);
+    CHECK(key->steps[4].host_calls > 0);
+
+    CHECK_EQ(recharge->runs, 2);
+    CHECK_EQ(recharge->accepts, 1);
+    CHECK_EQ(recharge->rejects, 1);
+    CHECK_EQ(recharge->reason_count, 1);
+    CHECK_EQ(reason_count(recharge, 302), 1);
+    CHECK(stats->calls[EMU_FN_trace] > 0);
+#else
+    (void)hook;
+    (void)key;
+    (void)recharge;
+    check_no_points();
+    // ERROR でもエラーのない実行・ロールバックのメッセージで分かる拒否はトレースしない
+    CHECK_EQ(stats->calls[EMU_FN_trace], 0);
+    CHECK_EQ(stats->calls[EMU_FN_trace_num], 0);
+#endif
+}
+
+// エントリごとのトレースポイントは VERBOSE のときだけ数え、ステップの区間を区切らない
+static void item_counters(void)
+{
+    test_user_t users[3];
+    emu_txn_t txn;
+    test_tlv_t memo;
+    for (int i = 0; i < 3; i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "user%d", i);
+        test_user(&users[i], label);
+        test_register_key(&users[i]);
+        test_recharge(&users[i], 1000, "1");
+        withdraw(&txn, &users[i], i == 0 ? "300" : "100");
+        EXPECT_ACCEPT(&txn);
+    }
+
+    emu_reset_stats();
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW_FLUSH);
+    test_operator_invoke(&txn, &memo);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_emitted_count(), 3);
+
+    const emu_handler_stats_t* flush = emu_handler_stats(XAPAY_HANDLER_WITHDRAWAL_FLUSH);
+#if XAPAY_TRACE_LEVEL >= XAPAY_TRACE_LEVEL_VERBOSE
+    CHECK_EQ(flush->steps[5].items, 3);
+    CHECK_EQ(flush->steps[5].item_value_sum, 500);
+#else
+    CHECK_EQ(flush->steps[5].items, 0);
+    CHECK_EQ(flush->steps[5].item_value_sum, 0);
+#endif
+#if XAPAY_TRACE_LEVEL >= XAPAY_TRACE_LEVEL_DEBUG
+    CHECK_EQ(flush->runs, 1);
+    CHECK_EQ(flush->accepts, 1);
+    CHECK_EQ(flush->steps[5].hits, 1);
+    // 3件の emit はステップ5の区間に数える
+    CHECK(flush->steps[5].host_calls >= 3);
+#else
+    check_no_points();
+#endif
+}
+
+void test_trace(void)
+{
+    TEST_CASE(handler_counters);
+    TEST_CASE(item_counters);
+}
@@ -0,0 +1,208 @@
+/**
+ * XApay Hook - 引き出し (キューへの追加) と引き出しのフラッシュ (Payment の発行) のテスト
+ */
+
+#include "xapay_test.h"
+
+static void withdraw(emu_txn_t* txn, const test_user_t* user, const char* amount)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW);
+    test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, amount);
+    emu_txn_init(txn, ttINVOKE, user->accid);
+    emu_txn_add_memo(txn, memo.data, memo.len);
+}
+
+// 引き出しのフラッシュ。count が NULL なら件数を省略する (XAPAY_WITHDRAW_FLUSH_MAX)
+static void flush(emu_txn_t* txn, const char* count)
+{
+    test_tlv_t memo;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW_FLUSH);
+    if (count)
+        test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, count);
+    test_operator_invoke(txn, &memo);
+}
+
+static void setup(test_user_t* user, const char* label, int64_t balance)
+{
+    test_user(user, label);
+    test_register_key(user);
+    test_recharge(user, balance, "1");
+}
+
+static void queue_header(xapay_withdraw_queue_t* queue)
+{
+    uint8_t key[1] = { PREFIX_WITHDRAW_QUEUE };
+    memset(queue, 0, sizeof(*queue));
+    emu_state_peek(queue, sizeof(*queue), key, sizeof(key));
+}
+
+static int pending_exists(const test_user_t* user)
+{
+    uint8_t key[21];
+    xapay_withdraw_t pending;
+    key[0] = PREFIX_WITHDRAW_PENDING;
+    memcpy(key + 1, user->accid, 20);
+    return emu_state_peek(&pending, sizeof(pending), key, sizeof(key)) >= 0;
+}
+
+// 発行された index 番目の Payment の宛先と額を確認する
+static void check_emitted(uint32_t index, const test_user_t* user, int64_t yen)
+{
+    const emu_emitted_t* emitted = emu_emitted(index);
+    uint8_t amount[48];
+    CHECK(emitted != NULL);
+    if (!emitted)
+        return;
+    xapay_yen_to_amount(amount, yen);
+    CHECK(memcmp(emitted->destination, user->accid, 20) == 0);
+    CHECK(memcmp(emitted->amount, amount, 8) == 0);
+    CHECK(memcmp(emitted->amount + 8, CURRENCY_JPY, 20) == 0);
+    CHECK(memcmp(emitted->amount + 28, ISSUER_ACCID, 20) == 0);
+}
+
+// 同じ宛先の引き出しは1件にまとめ、フラッシュで宛先ごとに1件の Payment を発行する
+static void flush_merges_per_user(void)
+{
+    test_user_t alice, bob;
+    emu_txn_t txn;
+    xapay_record_t record;
+    xapay_withdraw_queue_t queue;
+    setup(&alice, "alice", 1000);
+    setup(&bob, "bob", 1000);
+
+    withdraw(&txn, &alice, "300");
+    EXPECT_ACCEPT(&txn);
+    withdraw(&txn, &bob, "100");
+    EXPECT_ACCEPT(&txn);
+    withdraw(&txn, &alice, "200");
+    EXPECT_ACCEPT(&txn);
+    withdraw(&txn, &bob, "901");
+    EXPECT_ROLLBACK(&txn, 304);
+
+    queue_header(&queue);
+    CHECK_EQ(queue.tail - queue.head, 2);
+    test_record(&record, &alice);
+    CHECK_EQ(record.balance, 500);
+
+    flush(&txn, NULL);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_reserved(), 2);
+    CHECK_EQ(emu_emitted_count(), 2);
+    check_emitted(0, &alice, 500);
+    check_emitted(1, &bob, 100);
+    CHECK(!pending_exists(&alice));
+    CHECK(!pending_exists(&bob));
+    queue_header(&queue);
+    CHECK_EQ(queue.head, queue.tail);
+
+    // 空のキューは何も発行しない
+    flush(&txn, NULL);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_emitted_count(), 0);
+}
+
+// 引き出し待ちの残っていない位置は予約・発行せずに読み飛ばす
+static void flush_skips_stale_slots(void)
+{
+    test_user_t alice, bob, carol;
+    emu_txn_t txn;
+    xapay_withdraw_queue_t queue;
+    setup(&alice, "alice", 1000);
+    test_user(&bob, "bob");
+    setup(&carol, "carol", 1000);
+
+    withdraw(&txn, &alice, "300");
+    EXPECT_ACCEPT(&txn);
+
+    // 引き出し待ちのない宛先の位置を末尾に置く
+    uint8_t header_key[1] = { PREFIX_WITHDRAW_QUEUE };
+    uint8_t slot_key[5];
+    queue_header(&queue);
+    xapay_withdraw_slot_key(slot_key, queue.tail);
+    emu_state_poke(bob.accid, 20, slot_key, sizeof(slot_key));
+    queue.tail++;
+    emu_state_poke(&queue, sizeof(queue), header_key, sizeof(header_key));
+
+    withdraw(&txn, &carol, "100");
+    EXPECT_ACCEPT(&txn);
+
+    flush(&txn, NULL);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_reserved(), 2);
+    CHECK_EQ(emu_emitted_count(), 2);
+    check_emitted(0, &alice, 300);
+    check_emitted(1, &carol, 100);
+    queue_header(&queue);
+    CHECK_EQ(queue.head, 3);
+    CHECK_EQ(queue.tail, 3);
+
+    // 読み飛ばす位置だけなら予約せずに先頭を進める
+    xapay_withdraw_slot_key(slot_key, queue.tail);
+    emu_state_poke(bob.accid, 20, slot_key, sizeof(slot_key));
+    queue.tail++;
+    emu_state_poke(&queue, sizeof(queue), header_key, sizeof(header_key));
+    flush(&txn, NULL);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_reserved(), 0);
+    CHECK_EQ(emu_emitted_count(), 0);
+    queue_header(&queue);
+    CHECK_EQ(queue.head, 4);
+}
+
+// 件数を指定したフラッシュはキューの先頭から順に発行し、残りは次回
+static void flush_limit(void)
+{
+    test_user_t users[3];
+    emu_txn_t txn;
+    for (int i = 0; i < 3; i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "user%d", i);
+        setup(&users[i], label, 1000);
+        withdraw(&txn, &users[i], "100");
+        EXPECT_ACCEPT(&txn);
+    }
+
+    flush(&txn, "2");
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_emitted_count(), 2);
+    check_emitted(0, &users[0], 100);
+    check_emitted(1, &users[1], 100);
+    CHECK(pending_exists(&users[2]));
+
+    flush(&txn, NULL);
+    EXPECT_ACCEPT(&txn);
+    CHECK_EQ(emu_emitted_count(), 1);
+    check_emitted(0, &users[2], 100);
+
+    flush(&txn, "0");
+    EXPECT_ROLLBACK(&txn, 105);
+}
+
+// フラッシュは運営者のみ (402)。失敗した引き出しは State を変えない
+static void rejected(void)
+{
+    test_user_t alice;
+    emu_txn_t txn;
+    test_tlv_t memo;
+    setup(&alice, "alice", 1000);
+
+    withdraw(&txn, &alice, "0");
+    EXPECT_ROLLBACK(&txn, 100);
+    withdraw(&txn, &alice, "1001");
+    EXPECT_ROLLBACK(&txn, 304);
+    CHECK(!pending_exists(&alice));
+
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_WITHDRAW_FLUSH);
+    emu_txn_init(&txn, ttINVOKE, alice.accid);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 402);
+}
+
+void test_withdraw(void)
+{
+    TEST_CASE(flush_merges_per_user);
+    TEST_CASE(flush_skips_stale_slots);
+    TEST_CASE(flush_limit);
+    TEST_CASE(rejected);
+}
@@ -0,0 +1,210 @@
+/**
+ * XApay Hook - 円の整数演算 (10進文字列の解析・加減算・Amount へのシリアライズ) のテスト
+ */
+
+#include "xapay_test.h"
+
+typedef struct {
+    const char* str;
+    int64_t value;
+    int64_t result;
+} parse_args_t;
+
+static int64_t run_parse(void* arg)
+{
+    parse_args_t* args = arg;
+    args->result = xapay_yen_parse(&args->value, (const uint8_t*)args->str, (int64_t)strlen(args->str));
+    return 0;
+}
+
+// xapay_yen_parse をフックの実行と同じ条件 (ガードの回数) で呼ぶ
+static int64_t parse(const char* str, int64_t* value)
+{
+    parse_args_t args = { str, -1, 0 };
+    emu_txn_t txn;
+    emu_txn_init(&txn, ttINVOKE, OPERATOR_ACCID);
+    emu_set_txn(&txn);
+    if (emu_run(run_parse, &args) != EMU_RETURN) {
+        test_check(0, "xapay_yen_parse returned", __FILE__, __LINE__);
+        return -99;
+    }
+    *value = args.value;
+    return args.result;
+}
+
+typedef struct {
+    int64_t yen;
+    uint8_t amount[8];
+    int64_t result;
+} amount_args_t;
+
+static int64_t run_to_amount(void* arg)
+{
+    amount_args_t* args = arg;
+    args->result = xapay_yen_to_amount(args->amount, args->yen);
+    return 0;
+}
+
+static int64_t to_amount(int64_t yen, uint8_t amount[8])
+{
+    amount_args_t args;
+    args.yen = yen;
+    args.result = 0;
+    emu_txn_t txn;
+    emu_txn_init(&txn, ttINVOKE, OPERATOR_ACCID);
+    emu_set_txn(&txn);
+    if (emu_run(run_to_amount, &args) != EMU_RETURN) {
+        test_check(0, "xapay_yen_to_amount returned", __FILE__, __LINE__);
+        return -99;
+    }
+    memcpy(amount, args.amount, 8);
+    return args.result;
+}
+
+// 0 から 18桁 (999...9) まで。19桁は int64 に収まる値でも不正
+static void parse_digits(void)
+{
+    int64_t value;
+    CHECK_EQ(parse("0", &value), XAPAY_YEN_OK);
+    CHECK_EQ(value, 0);
+    CHECK_EQ(parse("000123", &value), XAPAY_YEN_OK);
+    CHECK_EQ(value, 123);
+    CHECK_EQ(parse("999999999999999999", &value), XAPAY_YEN_OK);
+    CHECK_EQ(value, 999999999999999999LL);
+    CHECK_EQ(parse("1000000000000000000", &value), XAPAY_YEN_INVALID);
+    CHECK_EQ(parse("9223372036854775807", &value), XAPAY_YEN_INVALID);
+    CHECK_EQ(parse("99999999999999999999", &value), XAPAY_YEN_INVALID);
+}
+
+// 数字以外・空文字列は不正で、出力を書き換えない
+static void parse_junk(void)
+{
+    static const char* junk[] = { "", "-1", "+1", " 1", "1 ", "12a", "1.5", "1e3", "0x10", "/", ":" };
+    for (unsigned i = 0; i < sizeof(junk) / sizeof(junk[0]); i++) {
+        int64_t value;
+        CHECK_EQ(parse(junk[i], &value), XAPAY_YEN_INVALID);
+        CHECK_EQ(value, -1);
+    }
+}
+
+static void add_sub(void)
+{
+    int64_t out = 7;
+    CHECK_EQ(xapay_yen_add(&out, 1, 2), XAPAY_YEN_OK);
+    CHECK_EQ(out, 3);
+    CHECK_EQ(xapay_yen_add(&out, INT64_MAX - 1, 1), XAPAY_YEN_OK);
+    CHECK_EQ(out, INT64_MAX);
+    out = 7;
+    CHECK_EQ(xapay_yen_add(&out, INT64_MAX, 1), XAPAY_YEN_OVERFLOW);
+    CHECK_EQ(xapay_yen_add(&out, -1, 1), XAPAY_YEN_NEGATIVE);
+    CHECK_EQ(xapay_yen_add(&out, 1, -1), XAPAY_YEN_NEGATIVE);
+    CHECK_EQ(out, 7);
+
+    CHECK_EQ(xapay_yen_sub(&out, 5, 5), XAPAY_YEN_OK);
+    CHECK_EQ(out, 0);
+    out = 7;
+    CHECK_EQ(xapay_yen_sub(&out, 5, 6), XAPAY_YEN_NEGATIVE);
+    CHECK_EQ(xapay_yen_sub(&out, -1, 0), XAPAY_YEN_NEGATIVE);
+    CHECK_EQ(xapay_yen_sub(&out, 0, -1), XAPAY_YEN_NEGATIVE);
+    CHECK_EQ(out, 7);
+}
+
+// Amount へのシリアライズはエミュレータの IOU (XFL の正規形) と一致し、丸めが生じる額は失敗する
+static void to_amount_exact(void)
+{
+    static const int64_t values[] = { 0, 1, 9, 10, 123456789, 1000000000000000LL, XAPAY_YEN_MAX_EXACT };
+    uint8_t amount[8];
+    emu_txn_t txn;
+    for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        CHECK_EQ(to_amount(values[i], amount), XAPAY_YEN_OK);
+        emu_txn_set_iou(&txn, values[i], CURRENCY_JPY, ISSUER_ACCID);
+        CHECK(memcmp(amount, txn.amount, 8) == 0);
+    }
+    CHECK_EQ(to_amount(XAPAY_YEN_MAX_EXACT + 1, amount), XAPAY_YEN_OVERFLOW);
+    CHECK_EQ(to_amount(-1, amount), XAPAY_YEN_NEGATIVE);
+}
+
+// フック経由: 支払い額の 0・19桁・数字以外は 105、利用許可額の不正も 105
+static void hook_rejects_bad_amounts(void)
+{
+    test_user_t user;
+    uint8_t sig[64];
+    emu_txn_t txn;
+    test_tlv_t memo;
+    test_user(&user, "alice");
+    test_register_key(&user);
+    test_recharge(&user, 1000, "1000");
+
+    static const char* bad[] = { "0", "1000000000000000000", "12a", "-5" };
+    for (unsigned i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        test_tlv_begin(&memo, XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT);
+        test_tlv_put(&memo, XAPAY_TLV_USER, user.accid, 20);
+        test_tlv_put_str(&memo, XAPAY_TLV_AMOUNT, bad[i]);
+        test_operator_invoke(&txn, &memo);
+        EXPECT_ROLLBACK(&txn, 105);
+    }
+
+    test_sign_allowance(sig, &user, "1000000000000000000");
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE);
+    test_tlv_put_str(&memo, XAPAY_TLV_ALLOWANCE_AMOUNT, "1000000000000000000");
+    test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    emu_txn_init(&txn, ttINVOKE, user.accid);
+    emu_txn_set_iou(&txn, 1, CURRENCY_JPY, ISSUER_ACCID);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ROLLBACK(&txn, 105);
+
+    xapay_record_t record;
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 1000);
+    CHECK_EQ(record.spent, 0);
+    CHECK_EQ(record.allowance, 1000);
+}
+
+// emu_txn_set_iou で作った IOU の値を 10^-shift 倍にする (XFL の指数部だけを書き換える)
+static void scale_iou(emu_txn_t* txn, int shift)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | txn->amount[i];
+    v -= (uint64_t)shift << 54;
+    for (int i = 0; i < 8; i++) txn->amount[i] = (uint8_t)(v >> (56 - 8 * i));
+}
+
+// チャージ: 1円未満は切り捨て、XRP・他の発行者・負の額・1円未満だけの額は拒否する
+static void charge_amounts(void)
+{
+    test_user_t user;
+    emu_txn_t txn;
+    xapay_record_t record;
+    test_user(&user, "alice");
+
+    emu_txn_init(&txn, ttPAYMENT, user.accid);
+    emu_txn_set_iou(&txn, 1005, CURRENCY_JPY, ISSUER_ACCID);
+    scale_iou(&txn, 1); // 100.5
+    EXPECT_ACCEPT(&txn);
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 100);
+
+    emu_txn_set_iou(&txn, 5, CURRENCY_JPY, ISSUER_ACCID);
+    scale_iou(&txn, 1); // 0.5
+    EXPECT_ROLLBACK(&txn, 15);
+    emu_txn_set_iou(&txn, -100, CURRENCY_JPY, ISSUER_ACCID);
+    EXPECT_ROLLBACK(&txn, 14);
+    emu_txn_set_iou(&txn, 100, CURRENCY_JPY, user.accid);
+    EXPECT_ROLLBACK(&txn, 13);
+    memcpy(txn.amount, "\x40\x00\x00\x00\x00\x00\x00\x64", 8); // 100 drops の XRP
+    txn.amount_len = 8;
+    EXPECT_ROLLBACK(&txn, 11);
+
+    test_record(&record, &user);
+    CHECK_EQ(record.balance, 100);
+}
+
+void test_yen(void)
+{
+    TEST_CASE(parse_digits);
+    TEST_CASE(parse_junk);
+    TEST_CASE(add_sub);
+    TEST_CASE(to_amount_exact);
+    TEST_CASE(hook_rejects_bad_amounts);
+    TEST_CASE(charge_amounts);
+}
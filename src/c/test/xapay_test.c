@@ -0,0 +1,197 @@
+/**
+ * XApay Hook - エミュレータ上のテストのドライバと共通処理
+ *
+ * 使い方: xapay_test
+ * 失敗した検証を出力し、1件でも失敗すれば終了コード1で終了します。
+ */
+
+#include "xapay_test.h"
+
+#include <stdlib.h>
+
+int64_t hook(uint32_t reserved);
+
+char g_test_operator_raddr[36];
+
+static uint32_t g_checks;
+static uint32_t g_failures;
+static uint32_t g_cases;
+static const char* g_case_name = "";
+
+static void fail(const char* file, int line)
+{
+    g_failures++;
+    fprintf(stderr, "FAIL %s (%s:%d): ", g_case_name, file, line);
+}
+
+void test_check(int ok, const char* expr, const char* file, int line)
+{
+    g_checks++;
+    if (ok) return;
+    fail(file, line);
+    fprintf(stderr, "%s\n", expr);
+}
+
+void test_check_eq(int64_t actual, int64_t expected, const char* expr, const char* file, int line)
+{
+    g_checks++;
+    if (actual == expected) return;
+    fail(file, line);
+    fprintf(stderr, "%s == %lld, expected %lld\n", expr, (long long)actual, (long long)expected);
+}
+
+static int64_t run_hook(void* arg)
+{
+    (void)arg;
+    return hook(0);
+}
+
+void test_expect(const emu_txn_t* txn, int outcome, int64_t code, const char* file, int line)
+{
+    g_checks++;
+    emu_set_txn(txn);
+    int actual = emu_run(run_hook, NULL);
+    if (actual == outcome && emu_last_code() == code) return;
+    fail(file, line);
+    fprintf(stderr, "outcome %d code %lld (%s), expected outcome %d code %lld\n",
+            actual, (long long)emu_last_code(), emu_last_message(), outcome, (long long)code);
+}
+
+void test_case(const char* name, void (*fn)(void))
+{
+    uint8_t hook_accid[32];
+    emu_sha256("xapay-test-hook", 15, hook_accid);
+    emu_init(hook_accid);
+    g_case_name = name;
+    g_cases++;
+    fn();
+}
+
+void test_user(test_user_t* user, const char* label)
+{
+    test_user_raddr_len(user, label, 34);
+}
+
+void test_user_raddr_len(test_user_t* user, const char* label, int raddr_len)
+{
+    for (uint32_t seed = 0;; seed++) {
+        char buf[96];
+        uint8_t digest[32];
+        int n = snprintf(buf, sizeof(buf), "xapay-test-%s-%u", label, seed);
+        emu_sha256(buf, (uint32_t)n, digest);
+        if (emu_encode_raddr(user->raddr, sizeof(user->raddr), digest) != raddr_len) continue;
+        memcpy(user->accid, digest, 20);
+        user->pubkey[0] = 0x02;
+        emu_sha256(digest, 32, user->pubkey + 1);
+        return;
+    }
+}
+
+void test_sign_allowance(uint8_t sig[64], const test_user_t* user, const char* amount)
+{
+    char message[256];
+    int n = snprintf(message, sizeof(message), "%s:%s:%s", user->raddr, g_test_operator_raddr, amount);
+    emu_sign(user->pubkey, XAPAY_PUBKEY_SIZE, message, (uint32_t)n, sig);
+}
+
+void test_record(xapay_record_t* record, const test_user_t* user)
+{
+    uint8_t key[21];
+    key[0] = PREFIX_USER_RECORD;
+    memcpy(key + 1, user->accid, 20);
+    memset(record, 0, sizeof(*record));
+    emu_state_peek(record, sizeof(*record), key, sizeof(key));
+}
+
+void test_register_key(const test_user_t* user)
+{
+    test_tlv_t memo;
+    emu_txn_t txn;
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_REGISTER_KEY);
+    emu_txn_init(&txn, ttINVOKE, user->accid);
+    memcpy(txn.signing_pubkey, user->pubkey, XAPAY_PUBKEY_SIZE);
+    txn.signing_pubkey_len = XAPAY_PUBKEY_SIZE;
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ACCEPT(&txn);
+}
+
+void test_recharge(const test_user_t* user, int64_t charge, const char* allowance)
+{
+    uint8_t sig[64];
+    test_tlv_t memo;
+    emu_txn_t txn;
+    test_sign_allowance(sig, user, allowance);
+    test_tlv_begin(&memo, XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE);
+    test_tlv_put_str(&memo, XAPAY_TLV_ALLOWANCE_AMOUNT, allowance);
+    test_tlv_put(&memo, XAPAY_TLV_SIGNATURE, sig, 64);
+    emu_txn_init(&txn, ttINVOKE, user->accid);
+    emu_txn_set_iou(&txn, charge, CURRENCY_JPY, ISSUER_ACCID);
+    emu_txn_add_memo(&txn, memo.data, memo.len);
+    EXPECT_ACCEPT(&txn);
+}
+
+void test_tlv_begin(test_tlv_t* b, uint8_t type)
+{
+    b->data[0] = XAPAY_MEMO_MAGIC;
+    b->data[1] = XAPAY_MEMO_VERSION;
+    b->len = 2;
+    test_tlv_put(b, XAPAY_TLV_TYPE, &type, 1);
+}
+
+void test_tlv_put(test_tlv_t* b, uint8_t tag, const void* value, uint32_t len)
+{
+    b->data[b->len] = tag;
+    b->data[b->len + 1] = (uint8_t)len;
+    memcpy(b->data + b->len + 2, value, len);
+    b->len += 2 + len;
+}
+
+void test_tlv_put_str(test_tlv_t* b, uint8_t tag, const char* str)
+{
+    test_tlv_put(b, tag, str, (uint32_t)strlen(str));
+}
+
+typedef struct {
+    xapay_memo_t* memo;
+    const void* data;
+    uint32_t len;
+    int64_t result;
+} decode_args_t;
+
+static int64_t run_decode(void* arg)
+{
+    decode_args_t* args = arg;
+    args->result = xapay_memo_decode(args->memo, args->data, args->len);
+    return 0;
+}
+
+int64_t test_decode(xapay_memo_t* memo, const void* data, uint32_t len)
+{
+    decode_args_t args = { memo, data, len, 0 };
+    emu_txn_t txn;
+    emu_txn_init(&txn, ttINVOKE, OPERATOR_ACCID);
+    emu_set_txn(&txn);
+    if (emu_run(run_decode, &args) != EMU_RETURN) {
+        test_check(0, "xapay_memo_decode returned", __FILE__, __LINE__);
+        return -1;
+    }
+    return args.result;
+}
+
+void test_operator_invoke(emu_txn_t* txn, const test_tlv_t* memo)
+{
+    emu_txn_init(txn, ttINVOKE, OPERATOR_ACCID);
+    emu_txn_add_memo(txn, memo->data, memo->len);
+}
+
+int main(void)
+{
+    emu_encode_raddr(g_test_operator_raddr, sizeof(g_test_operator_raddr), OPERATOR_ACCID);
+
+#define XAPAY_TEST_SUITE_RUN(name) test_##name();
+    XAPAY_TEST_SUITES(XAPAY_TEST_SUITE_RUN)
+#undef XAPAY_TEST_SUITE_RUN
+
+    printf("%u cases, %u checks, %u failures\n", g_cases, g_checks, g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+/**
+ * XApay Hook - エミュレータ上のテストの共通定義
+ *
+ * テストは src/c/test/test_<スイート>.c に置き、void test_<スイート>(void) から
+ * TEST_CASE で各ケースを実行します。ケースごとにエミュレータ (State) を初期化します。
+ *
+ * 使い方: build/test.sh
+ */
+
+#ifndef XAPAY_TEST_H
+#define XAPAY_TEST_H
+
+#include "hookapi.h"
+#include "emu.h"
+#include "xapay_memo.h"
+#include "xapay_state.h"
+#include "xapay_yen.h"
+
+#include <stdio.h>
+
+// テストスイート一覧
+#define XAPAY_TEST_SUITES(X) \
+    X(memo) \
+    X(allowance) \
+    X(nonce) \
+    X(yen) \
+    X(claim) \
+    X(migration) \
+    X(compact) \
+    X(withdraw) \
+    X(merchant) \
+    X(key) \
+    X(trace)
+
+#define XAPAY_TEST_SUITE_DECL(name) void test_##name(void);
+XAPAY_TEST_SUITES(XAPAY_TEST_SUITE_DECL)
+#undef XAPAY_TEST_SUITE_DECL
+
+extern unsigned char ISSUER_ACCID[20];
+extern unsigned char CURRENCY_JPY[20];
+extern unsigned char OPERATOR_ACCID[20];
+
+typedef struct {
+    uint8_t accid[20];
+    char raddr[36];
+    uint8_t pubkey[XAPAY_PUBKEY_SIZE]; // 登録する SigningPubKey (secp256k1)
+} test_user_t;
+
+typedef struct {
+    uint8_t data[EMU_MAX_MEMO_SIZE];
+    uint32_t len;
+} test_tlv_t;
+
+// --- 検証 ---
+void test_check(int ok, const char* expr, const char* file, int line);
+void test_check_eq(int64_t actual, int64_t expected, const char* expr, const char* file, int line);
+void test_expect(const emu_txn_t* txn, int outcome, int64_t code, const char* file, int line);
+
+#define CHECK(cond) test_check((cond) != 0, #cond, __FILE__, __LINE__)
+#define CHECK_EQ(actual, expected) test_check_eq((int64_t)(actual), (int64_t)(expected), #actual, __FILE__, __LINE__)
+// フックを実行し、accept (コード0) またはロールバックのコードを確認する
+#define EXPECT_ACCEPT(txn) test_expect((txn), EMU_ACCEPT, 0, __FILE__, __LINE__)
+#define EXPECT_ROLLBACK(txn, code) test_expect((txn), EMU_ROLLBACK, (code), __FILE__, __LINE__)
+
+// ケースの実行 (State を初期化してから fn を呼ぶ)
+void test_case(const char* name, void (*fn)(void));
+#define TEST_CASE(fn) test_case(#fn, fn)
+
+// --- 準備 ---
+// 34文字の r-address になるユーザーを label から決定的に作る
+void test_user(test_user_t* user, const char* label);
+// r-address が raddr_len 文字 (25〜35) になるユーザーを作る
+void test_user_raddr_len(test_user_t* user, const char* label, int raddr_len);
+void test_sign_allowance(uint8_t sig[64], const test_user_t* user, const char* amount);
+void test_record(xapay_record_t* record, const test_user_t* user);
+// 以下はフックを実行し、accept されなければ失敗として記録する
+void test_register_key(const test_user_t* user);
+void test_recharge(const test_user_t* user, int64_t charge, const char* allowance);
+
+// --- Memo ---
+void test_tlv_begin(test_tlv_t* b, uint8_t type);
+void test_tlv_put(test_tlv_t* b, uint8_t tag, const void* value, uint32_t len);
+void test_tlv_put_str(test_tlv_t* b, uint8_t tag, const char* str);
+// xapay_memo_decode をフックの実行と同じ条件 (ガードの回数) で呼ぶ
+int64_t test_decode(xapay_memo_t* memo, const void* data, uint32_t len);
+// 運営者の Invoke に Memo を1件付ける
+void test_operator_invoke(emu_txn_t* txn, const test_tlv_t* memo);
+
+extern char g_test_operator_raddr[36];
+
+#endif
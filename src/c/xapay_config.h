@@ -0,0 +1,41 @@
+/**
+ * XApay Hook - デプロイ設定
+ *
+ * build/gen_config.js が .env / src/js/hocks.js から生成します。直接編集しないでください。
+ */
+
+#ifndef XAPAY_CONFIG_H
+#define XAPAY_CONFIG_H
+
+// JPYトークンの発行者 (rhyYNdxAyFQ7s2KYXhaTMJKF7NrkkZj1X9)
+#define XAPAY_ISSUER_ACCID { \
+    0x2B, 0x99, 0xBE, 0xB7, 0x21, 0x37, 0xBD, 0xDF, \
+    0xEF, 0x39, 0x51, 0xEA, 0xF1, 0x4B, 0x49, 0x73, \
+    0xEE, 0x2F, 0x9C, 0xF4 \
+}
+
+// JPYトークンの通貨コード (JPY)
+#define XAPAY_CURRENCY { \
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
+    0x00, 0x00, 0x00, 0x00, 0x4A, 0x50, 0x59, 0x00, \
+    0x00, 0x00, 0x00, 0x00 \
+}
+
+// XApay運営サーバーのアカウント (rHzN5Fkw67xccV22UmeCLHFZy2aVLt55e8)
+#define XAPAY_OPERATOR_ACCID { \
+    0xBA, 0x55, 0x2D, 0x18, 0x3A, 0x43, 0x38, 0xD2, \
+    0x32, 0x1C, 0x26, 0x2E, 0x25, 0xA0, 0xB4, 0xB8, \
+    0xA9, 0xB8, 0x5A, 0x3A \
+}
+
+// 運営者の r-address と、利用許可署名のメッセージ (<ユーザー>:<運営者>:<許可額>) の ":<運営者>:" 部分
+#define XAPAY_OPERATOR_RADDR "rHzN5Fkw67xccV22UmeCLHFZy2aVLt55e8"
+#define XAPAY_OPERATOR_RADDR_LEN 34
+#define XAPAY_OPERATOR_FRAGMENT ":rHzN5Fkw67xccV22UmeCLHFZy2aVLt55e8:"
+#define XAPAY_OPERATOR_FRAGMENT_LEN 36
+
+// 加盟店への精算の閾値 (未精算額 (円)・未精算の支払い数のどちらかに達したら精算する)
+#define XAPAY_MERCHANT_SETTLE_AMOUNT 100000LL
+#define XAPAY_MERCHANT_SETTLE_COUNT 100U
+
+#endif
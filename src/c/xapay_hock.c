@@ -9,38 +9,28 @@
 
 #include "hookapi.h"
 #include <stdint.h>
+#include "xapay_config.h"
+#include "xapay_memo.h"
+#include "xapay_yen.h"
+#include "xapay_state.h"
+#include "xapay_trace.h"
 
 // =====================================================================================================================
-// == CONFIGURATION - ここをあなたの環境に合わせて設定してください ==
+// == CONFIGURATION - 値は xapay_config.h (build/gen_config.js で .env / src/js/hocks.js から生成) ==
 // =====================================================================================================================
 
-// JPYトークンの発行者アカウントID (20バイトの16進数)
-unsigned char ISSUER_ACCID[20] = {
-    0x5E, 0x32, 0xD1, 0x83, 0xA4, 0x33, 0x8D, 0x23,
-    0x21, 0xC2, 0x62, 0xE2, 0x5A, 0x0B, 0x4B, 0x8A,
-    0x9B, 0x85, 0xA3, 0xA2
-};
+// JPYトークンの発行者アカウントID (20バイト)
+unsigned char ISSUER_ACCID[20] = XAPAY_ISSUER_ACCID;
 
 // JPYトークンの通貨コード (160ビット)
-unsigned char CURRENCY_JPY[20] = {
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x4A, 0x50, 0x59, 0x00,
-    0x00, 0x00, 0x00, 0x00
-};
-
-// XApay運営サーバーのアカウントの16進数アドレス (20バイト)
-unsigned char OPERATOR_ACCID[20] = {
-    0xBA, 0x55, 0x2D, 0x18, 0x3A, 0x43, 0x38, 0xD2,
-    0x32, 0x1C, 0x26, 0x2E, 0x25, 0xA0, 0xB4, 0xB8,
-    0xA9, 0xB8, 0x5A, 0x3A
-};
+unsigned char CURRENCY_JPY[20] = XAPAY_CURRENCY;
+
+// XApay運営サーバーのアカウントID (20バイト)
+unsigned char OPERATOR_ACCID[20] = XAPAY_OPERATOR_ACCID;
 
 // =====================================================================================================================
 
-// Stateキーのプレフィックス
-#define PREFIX_USER_BALANCE 0x55 // 'U'
-#define PREFIX_NONCE        0x4E // 'N'
-#define PREFIX_ALLOWANCE    0x41 // 'A'
+// Stateのキーとユーザーレコードのレイアウトは xapay_state.h を参照
 
 // エラーコード定義
 #define SUCCESS 0
@@ -49,24 +39,42 @@ unsigned char OPERATOR_ACCID[20] = {
 #define ERROR_INVALID_JSON 102
 #define ERROR_MISSING_FIELD 103
 #define ERROR_UNKNOWN_PAYMENT_TYPE 104
+#define ERROR_INVALID_AMOUNT 105
 #define ERROR_CHARGE_INVALID_CURRENCY 201
 #define ERROR_CHARGE_INVALID_ISSUER 202
 #define ERROR_ALLOWANCE_INVALID_ADDRESS 301
 #define ERROR_ALLOWANCE_VERIFICATION_FAILED 302
 #define ERROR_ALLOWANCE_EXCEEDED 303
 #define ERROR_INSUFFICIENT_BALANCE 304
+#define ERROR_WITHDRAW_QUEUE_FULL 401
+#define ERROR_WITHDRAW_UNAUTHORIZED 402
+#define ERROR_WITHDRAW_EMIT_FAILED 403
+#define ERROR_COMPACT_UNAUTHORIZED 501
+#define ERROR_SETTLE_UNAUTHORIZED 601
+#define ERROR_SETTLE_EMIT_FAILED 602
+#define ERROR_SETTLE_NOT_MERCHANT 603
+#define ERROR_CLAIM_UNAUTHORIZED 701
+#define ERROR_CLAIM_VERIFICATION_FAILED 702
+#define ERROR_CLAIM_STALE 703
+#define ERROR_KEY_INVALID 801
+#define ERROR_KEY_NOT_REGISTERED 802
 
 // 関数のプロトタイプ宣言
 int64_t handle_charge();
-int64_t handle_payment();
-int64_t handle_allowance_payment(uint8_t* data_ptr, int64_t data_len);
-int64_t handle_recharge_and_update_allowance();
-int64_t handle_withdrawal();
+int64_t handle_payment(xapay_memo_t* memo);
+int64_t handle_allowance_payment(xapay_memo_t* memo, int64_t memos_slot);
+int64_t handle_recharge_and_update_allowance(xapay_memo_t* memo);
+int64_t handle_withdrawal(xapay_memo_t* memo);
+int64_t handle_withdrawal_flush(xapay_memo_t* memo);
+int64_t handle_compact(xapay_memo_t* memo, int64_t memos_slot);
+int64_t handle_merchant_settle(xapay_memo_t* memo);
+int64_t handle_claim_redeem(xapay_memo_t* memo);
+int64_t handle_register_key(xapay_memo_t* memo);
 
 // --- メイン関数 ---
 int64_t hook(uint32_t reserved)
 {
-    TRACESTR("XApay Hook: BGN");
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_HOOK, "XApay Hook: BGN");
 
     // トランザクションタイプの確認
     int64_t tx_type = otxn_type();
@@ -75,25 +83,48 @@ int64_t hook(uint32_t reserved)
         return handle_charge();
     }
     else if (tx_type == ttINVOKE) {
-        // Memoの有無で処理を分岐
-        if (otxn_memo_count() > 0) {
-            uint8_t memo_data[1024];
-            int64_t memo_len = otxn_memo(0, SBUF(memo_data));
+        // Memoの有無で処理を分岐 (Memo 0 の MemoData をスロット経由で読む)
+        int64_t memos_slot = xapay_memo_slot();
+        if (memos_slot > 0) {
+            uint8_t memo_buf[XAPAY_MEMO_BUFFER_SIZE];
+            const uint8_t* memo_data;
+            int64_t memo_len = xapay_memo_data(&memo_data, memo_buf, sizeof(memo_buf), memos_slot, 0);
             if (memo_len > 0) {
-                // Memoの内容を確認して処理を分岐
-                uint8_t type_buf[32];
-                if (sto_from_json(type_buf, sizeof(type_buf), memo_data, memo_len, "type") > 0) {
-                    if (BUFFER_EQUAL(type_buf, "update_allowance", 15)) {
-                        return handle_recharge_and_update_allowance();
-                    }
-                    else if (BUFFER_EQUAL(type_buf, "withdraw", 7)) {
-                        return handle_withdrawal();
-                    }
+                // Memoを一度だけ解析し、その結果で処理を分岐
+                xapay_memo_t memo;
+                if (xapay_memo_decode(&memo, memo_data, memo_len) < 0) {
+                    rollback(SBUF("XApay Error: Malformed memo."), ERROR_INVALID_MEMO);
+                }
+                XAPAY_TRACE_STEP(1, memo.type);
+                if (memo.type == XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE) {
+                    return handle_recharge_and_update_allowance(&memo);
+                }
+                else if (memo.type == XAPAY_MEMO_TYPE_WITHDRAW) {
+                    return handle_withdrawal(&memo);
+                }
+                else if (memo.type == XAPAY_MEMO_TYPE_WITHDRAW_FLUSH) {
+                    return handle_withdrawal_flush(&memo);
+                }
+                else if (memo.type == XAPAY_MEMO_TYPE_COMPACT) {
+                    return handle_compact(&memo, memos_slot);
                 }
-                return handle_allowance_payment(memo_data, memo_len);
+                else if (memo.type == XAPAY_MEMO_TYPE_MERCHANT_SETTLE) {
+                    return handle_merchant_settle(&memo);
+                }
+                else if (memo.type == XAPAY_MEMO_TYPE_CLAIM_REDEEM) {
+                    return handle_claim_redeem(&memo);
+                }
+                else if (memo.type == XAPAY_MEMO_TYPE_REGISTER_KEY) {
+                    return handle_register_key(&memo);
+                }
+                else if (memo.type == XAPAY_MEMO_TYPE_NONCE_PAYMENT) {
+                    return handle_payment(&memo);
+                }
+                // 単一の支払い・一括決済
+                return handle_allowance_payment(&memo, memos_slot);
             }
         }
-        return handle_payment();
+        rollback(SBUF("XApay Error: Missing memo."), ERROR_INVALID_MEMO);
     }
 
     accept(SBUF("XApay: Accepting non-payment/invoke transaction."), 0);
@@ -106,9 +137,10 @@ int64_t hook(uint32_t reserved)
  */
 int64_t handle_charge()
 {
-    TRACESTR("XApay Hook: Handling Charge.");
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_CHARGE, "XApay Hook: Handling Charge.");
 
     // 1. トランザクションのAmountフィールド(sfAmount)をシリアライズされたまま取得
+    XAPAY_TRACE_STEP(1, 0);
     uint8_t amount_buffer[48]; // IOU Amountの最大サイズ
     int64_t amount_len = otxn_field(SBUF(amount_buffer), sfAmount);
     if (amount_len < 0) {
@@ -116,27 +148,26 @@ int64_t handle_charge()
     }
 
     // 2. 通貨と発行者を厳密にチェック
-    // AmountオブジェクトからsfIssuerフィールドを抽出
-    uint8_t issuer_buffer[20];
-    if (sto_subfield(amount_buffer, amount_len, SBUF(issuer_buffer), sfIssuer) < 0) {
-        rollback(SBUF("XApay Error(Charge): Could not get Issuer from Amount."), 11);
-    }
-
-    // AmountオブジェクトからsfCurrencyフィールドを抽出
-    uint8_t currency_buffer[20];
-    if (sto_subfield(amount_buffer, amount_len, SBUF(currency_buffer), sfCurrency) < 0) {
-        rollback(SBUF("XApay Error(Charge): Could not get Currency from Amount."), 12);
+    // IOU Amount は値(8バイト)・通貨(20バイト)・発行者(20バイト)の順 (XRP は8バイトのみ)
+    XAPAY_TRACE_STEP(2, 0);
+    if (amount_len != 48) {
+        rollback(SBUF("XApay Error(Charge): Amount is not an issued currency."), 11);
     }
+    const uint8_t* currency_buffer = amount_buffer + 8;
+    const uint8_t* issuer_buffer = amount_buffer + 28;
 
     // 定義した発行者・通貨と一致するか検証
     if (!BUFFER_EQUAL(issuer_buffer, ISSUER_ACCID, 20) || !BUFFER_EQUAL(currency_buffer, CURRENCY_JPY, 20)) {
         rollback(SBUF("XApay Error(Charge): Invalid currency or issuer."), 13);
     }
-    TRACESTR("XApay Hook: Currency and Issuer verified.");
-
-    // 3. IOUの金額を正確に抽出
-    int64_t amount_val; // IOUの整数値
-    if (sto_amount_to_int64(&amount_val, amount_buffer, amount_len) < 0) {
+    XAPAY_TRACE_DEBUG("XApay Hook: Currency and Issuer verified.");
+
+    // 3. IOUの金額を正確に抽出 (値を XFL にして整数部を取り出す。1円未満は切り捨て)
+    XAPAY_TRACE_STEP(3, 0);
+    int64_t amount_val = float_sto_set(amount_buffer, 8);
+    if (amount_val >= 0)
+        amount_val = float_int(amount_val, 0, 0);
+    if (amount_val < 0) {
         rollback(SBUF("XApay Error(Charge): Could not parse amount value."), 14);
     }
     if (amount_val <= 0) {
@@ -144,201 +175,587 @@ int64_t handle_charge()
     }
 
     // 4. Stateを更新
+    XAPAY_TRACE_STEP(4, amount_val);
     uint8_t source_accid[20];
-    otxn_source_account(SBUF(source_accid));
+    otxn_field(SBUF(source_accid), sfAccount);
 
-    uint8_t user_balance_key[21];
-    user_balance_key[0] = PREFIX_USER_BALANCE;
-    COPY(user_balance_key + 1, source_accid, 20);
+    uint8_t record_key[21];
+    xapay_record_t record;
+    xapay_record_load(&record, record_key, source_accid);
 
-    int64_t current_balance = 0;
-    state_get(&current_balance, sizeof(current_balance), SBUF(user_balance_key));
-    
-    int64_t new_balance = current_balance + amount_val;
-    state_set(&new_balance, sizeof(new_balance), SBUF(user_balance_key));
+    if (xapay_yen_add(&record.balance, record.balance, amount_val) < 0) {
+        rollback(SBUF("XApay Error(Charge): Balance overflow."), 16);
+    }
+    xapay_record_store(&record, record_key);
 
     accept(SBUF("XApay: Charge accepted successfully."), 0);
     return 0;
 }
 
+// 発行する Payment のフィールド (sfEmitDetails を除く) のサイズと、sfEmitDetails を含めた上限
+#define EMIT_PAYMENT_FIELDS_SIZE 162
+#define EMIT_PAYMENT_MAX_SIZE    (EMIT_PAYMENT_FIELDS_SIZE + 138)
+
+// 発行するトランザクションは署名しない (SigningPubKey は33バイトの0)
+static const uint8_t EMIT_SIGNING_PUBKEY[33] = { 0 };
+
+static uint8_t* put_uint32(uint8_t* ptr, uint32_t value)
+{
+    ptr[0] = (uint8_t)(value >> 24);
+    ptr[1] = (uint8_t)(value >> 16);
+    ptr[2] = (uint8_t)(value >> 8);
+    ptr[3] = (uint8_t)value;
+    return ptr + 4;
+}
+
+/**
+ * @brief フックのアカウントから IOU の Payment を発行する (etxn_reserve は呼び出し側で行う)
+ *
+ * hookapi の PREPARE_PAYMENT_SIMPLE_TRUSTLINE と同じフィールドでシリアライズし、etxn_details の
+ * sfEmitDetails を付けてから etxn_fee_base の手数料を書き込む。
+ * @param amount IOU Amount (48バイト)
+ * @return emit の戻り値
+ */
+static int64_t emit_payment(const uint8_t* destination, const uint8_t* amount)
+{
+    uint8_t txn[EMIT_PAYMENT_MAX_SIZE];
+    uint8_t* ptr = txn;
+    uint32_t ledger = (uint32_t)ledger_seq();
+
+    *ptr++ = 0x12; *ptr++ = 0x00; *ptr++ = ttPAYMENT;                  // TransactionType
+    *ptr++ = 0x22; ptr = put_uint32(ptr, tfCANONICAL);                 // Flags
+    *ptr++ = 0x24; ptr = put_uint32(ptr, 0);                           // Sequence
+    *ptr++ = 0x20; *ptr++ = 0x1A; ptr = put_uint32(ptr, ledger + 1);   // FirstLedgerSequence
+    *ptr++ = 0x20; *ptr++ = 0x1B; ptr = put_uint32(ptr, ledger + 5);   // LastLedgerSequence
+    *ptr++ = 0x61; COPY(ptr, amount, 48); ptr += 48;                   // Amount
+    uint8_t* fee = ptr;                                                // Fee (最後に書き込む)
+    *ptr++ = 0x68; ptr += 8;
+    *ptr++ = 0x73; *ptr++ = 0x21;                                      // SigningPubKey (空)
+    COPY(ptr, EMIT_SIGNING_PUBKEY, 33); ptr += 33;
+    *ptr++ = 0x81; *ptr++ = 0x14; hook_account(ptr, 20); ptr += 20;   // Account
+    *ptr++ = 0x83; *ptr++ = 0x14; COPY(ptr, destination, 20); ptr += 20; // Destination
+
+    int64_t details_len = etxn_details(ptr, EMIT_PAYMENT_MAX_SIZE - EMIT_PAYMENT_FIELDS_SIZE);
+    if (details_len < 0)
+        return details_len;
+    ptr += details_len;
+
+    int64_t fee_drops = etxn_fee_base(txn, ptr - txn);
+    if (fee_drops < 0)
+        return fee_drops;
+    // XRP の Amount は正の値のビット (0x40) を立てた64ビット整数
+    uint64_t drops = (uint64_t)fee_drops | 0x4000000000000000ULL;
+    put_uint32(fee + 1, (uint32_t)(drops >> 32));
+    put_uint32(fee + 5, (uint32_t)drops);
+
+    uint8_t hash[32];
+    return emit(SBUF(hash), txn, ptr - txn);
+}
+
+/**
+ * @brief フックのアカウントから JPY の Payment を発行する (etxn_reserve は呼び出し側で行う)
+ * @return emit の戻り値 (金額を Amount にできない場合は負数)
+ */
+static int64_t emit_jpy_payment(const uint8_t* destination, int64_t amount)
+{
+    uint8_t amount_buf[48];
+    if (xapay_yen_to_amount(amount_buf, amount) < 0)
+        return -1;
+    COPY(amount_buf + 8, CURRENCY_JPY, 20);
+    COPY(amount_buf + 28, ISSUER_ACCID, 20);
+    return emit_payment(destination, amount_buf);
+}
+
+/**
+ * @brief 加盟店の未精算額に支払いを加算する
+ */
+static void merchant_credit(xapay_merchant_t* merchant, int64_t amount)
+{
+    // 1件の Payment で精算できる額まで
+    if (xapay_yen_add(&merchant->accrued, merchant->accrued, amount) < 0 || merchant->accrued > XAPAY_YEN_MAX_EXACT) {
+        rollback(SBUF("XApay Error(Merchant): Accrued balance too large."), ERROR_INVALID_AMOUNT);
+    }
+    merchant->payments++;
+}
+
+/**
+ * @brief 閾値 (xapay_config.h) に達して精算が必要か
+ */
+static int64_t merchant_settle_due(const xapay_merchant_t* merchant)
+{
+    return merchant->accrued >= XAPAY_MERCHANT_SETTLE_AMOUNT || merchant->payments >= XAPAY_MERCHANT_SETTLE_COUNT;
+}
+
+/**
+ * @brief 未精算額を1件の Payment で加盟店に送り、未精算額を0にする (etxn_reserve は呼び出し側で行う)
+ */
+static void merchant_settle(xapay_merchant_t* merchant, const uint8_t* merchant_accid)
+{
+    int64_t emitted = emit_jpy_payment(merchant_accid, merchant->accrued);
+    if (emitted < 0) {
+        XAPAY_TRACE_ERROR("XApay Hook: emit failed", emitted);
+        rollback(SBUF("XApay Error(Merchant): Failed to emit settlement."), ERROR_SETTLE_EMIT_FAILED);
+    }
+    // 累計は集計用のため、上限に達したらそれ以上増やさない
+    if (xapay_yen_add(&merchant->settled, merchant->settled, merchant->accrued) < 0)
+        merchant->settled = INT64_MAX;
+    merchant->accrued = 0;
+    merchant->payments = 0;
+    merchant->settlements++;
+}
+
+// 一括決済の上限
+#define BATCH_MAX_ENTRIES    (XAPAY_MEMO_MAX_COUNT * XAPAY_MEMO_MAX_ENTRIES)
+#define BATCH_MAX_USERS      16
+#define BATCH_MAX_MERCHANTS  16
+
+// 一括決済中のユーザーごとの作業領域 (レコードは1回だけ読み、最後に1回だけ書く)
+typedef struct {
+    uint8_t accid[20];
+    uint8_t record_key[21];
+    xapay_record_t record;
+} batch_user_t;
+
+// 一括決済中の加盟店ごとの作業領域 (未精算額は1回だけ読み、最後に1回だけ書く)
+typedef struct {
+    uint8_t accid[20];
+    uint8_t key[21];
+    xapay_merchant_t merchant;
+    int64_t exists;     // 未精算額の記録が State にあったか (支払いを受けたことのある加盟店か)
+} batch_merchant_t;
+
+/**
+ * @brief 利用許可 (ユーザー・許可額・署名) のダイジェストを求める
+ *
+ * チャージ時に検証した利用許可としてユーザーレコードに保存し、支払いに含まれる
+ * 利用許可が現在のものかどうかを照合するために使う。
+ */
+static void allowance_digest(uint8_t* digest, const uint8_t* user_accid,
+                             const uint8_t* amount, int64_t amount_len,
+                             const uint8_t* signature, int64_t signature_len)
+{
+    uint8_t buf[20 + 1 + 32 + 74];
+    uint8_t* ptr = buf;
+    COPY(ptr, user_accid, 20); ptr += 20;
+    ptr[0] = (uint8_t)amount_len; ptr++;
+    COPY(ptr, amount, amount_len); ptr += amount_len;
+    COPY(ptr, signature, signature_len); ptr += signature_len;
+    util_sha512h(digest, 32, buf, ptr - buf);
+}
+
+/**
+ * @brief ユーザーの署名の検証に使う登録済みの公開鍵を取得する (State の読み込み1回)
+ *
+ * 公開鍵が登録されていなければロールバックする (handle_register_key で登録する)。
+ * @param user_pubkey XAPAY_PUBKEY_SIZE バイトの領域
+ * @return 鍵の長さ
+ */
+static int64_t user_signing_key(uint8_t* user_pubkey, const uint8_t* user_accid)
+{
+    xapay_pubkey_t key;
+    if (!xapay_pubkey_load(&key, user_accid)) {
+        rollback(SBUF("XApay Error: Signing key not registered."), ERROR_KEY_NOT_REGISTERED);
+    }
+    COPY(user_pubkey, key.pubkey, XAPAY_PUBKEY_SIZE);
+    return XAPAY_PUBKEY_SIZE;
+}
+
+/**
+ * @brief 署名メッセージの先頭 (<ユーザー>:<運営者>:) を書き込む
+ *
+ * r-address は25〜35文字になるため、util_raddr が書き込んだ長さだけ進める。
+ * @param ptr 書き込み先 (35 + XAPAY_OPERATOR_FRAGMENT_LEN バイト以上)
+ * @return 書き込んだ次の位置 (r-address を作れなければ 0)
+ */
+static uint8_t* write_message_prefix(uint8_t* ptr, const uint8_t* user_accid)
+{
+    int64_t raddr_len = util_raddr(ptr, 35, user_accid, 20);
+    if (raddr_len < 25 || raddr_len > 35)
+        return 0;
+    ptr += raddr_len;
+    // ":<運営者>:" はコンパイル時に決まる (xapay_config.h)
+    COPY(ptr, XAPAY_OPERATOR_FRAGMENT, XAPAY_OPERATOR_FRAGMENT_LEN);
+    return ptr + XAPAY_OPERATOR_FRAGMENT_LEN;
+}
+
+/**
+ * @brief 利用許可署名 (<ユーザー>:<運営者>:<許可額>) を検証する
+ * @return 1: 署名が有効
+ */
+static int64_t verify_allowance_signature(const uint8_t* user_accid,
+                                          const uint8_t* amount, int64_t amount_len,
+                                          const uint8_t* signature, int64_t signature_len)
+{
+    uint8_t message[256];
+    uint8_t* ptr = write_message_prefix(message, user_accid);
+    if (!ptr)
+        return 0;
+    COPY(ptr, amount, amount_len); ptr += amount_len;
+
+    uint8_t user_pubkey[XAPAY_PUBKEY_SIZE];
+    int64_t pubkey_len = user_signing_key(user_pubkey, user_accid);
+    return util_verify(message, ptr - message, signature, signature_len, user_pubkey, pubkey_len);
+}
+
+/**
+ * @brief 請求署名 (<ユーザー>:<運営者>:<利用許可のダイジェスト (32バイト)>:<世代>:<累積請求額>) を検証する
+ * @return 1: 署名が有効
+ */
+static int64_t verify_claim_signature(const uint8_t* user_accid, const uint8_t* allowance_hash,
+                                      const uint8_t* generation, int64_t generation_len,
+                                      const uint8_t* total, int64_t total_len,
+                                      const uint8_t* signature, int64_t signature_len)
+{
+    uint8_t message[256];
+    uint8_t* ptr = write_message_prefix(message, user_accid);
+    if (!ptr)
+        return 0;
+    COPY(ptr, allowance_hash, 32); ptr += 32;
+    *ptr++ = ':';
+    COPY(ptr, generation, generation_len); ptr += generation_len;
+    *ptr++ = ':';
+    COPY(ptr, total, total_len); ptr += total_len;
+
+    uint8_t user_pubkey[XAPAY_PUBKEY_SIZE];
+    int64_t pubkey_len = user_signing_key(user_pubkey, user_accid);
+    return util_verify(message, ptr - message, signature, signature_len, user_pubkey, pubkey_len);
+}
+
+/**
+ * @brief ノンス付きの支払い (<ユーザー>:<運営者>:<ノンス>:<支払い額>) の署名を検証する
+ * @return 1: 署名が有効
+ */
+static int64_t verify_payment_signature(const uint8_t* user_accid,
+                                        const uint8_t* nonce, int64_t nonce_len,
+                                        const uint8_t* amount, int64_t amount_len,
+                                        const uint8_t* signature, int64_t signature_len)
+{
+    uint8_t message[256];
+    uint8_t* ptr = write_message_prefix(message, user_accid);
+    if (!ptr)
+        return 0;
+    COPY(ptr, nonce, nonce_len); ptr += nonce_len;
+    *ptr++ = ':';
+    COPY(ptr, amount, amount_len); ptr += amount_len;
+
+    uint8_t user_pubkey[XAPAY_PUBKEY_SIZE];
+    int64_t pubkey_len = user_signing_key(user_pubkey, user_accid);
+    return util_verify(message, ptr - message, signature, signature_len, user_pubkey, pubkey_len);
+}
+
 /**
- * @brief 決済処理: 運営サーバーからのトリガーで決済を実行する
+ * @brief 決済処理: 運営サーバーからのトリガーでノンス付きの支払いを実行する
+ *
+ * ユーザーは支払いごとに連番のノンスと支払い額に署名する。ノンスはユーザーレコードの
+ * スライディングウィンドウで1回だけ使え、ウィンドウ内なら順不同で届いてもよい。
+ * 加盟店 (MERCHANT) が指定されていれば、その未精算額に支払い額を加算する。
+ * @param memo 解析済みのMemo (USER/AMOUNT/NONCE/SIGNATURE/MERCHANT)
  * @return 承認または拒否コード
  */
-int64_t handle_payment()
+int64_t handle_payment(xapay_memo_t* memo)
 {
-    TRACESTR("XApay Hook: Handling Payment.");
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_PAYMENT, "XApay Hook: Handling Payment.");
 
     // 1. 送信元が運営アカウントであることを検証
+    XAPAY_TRACE_STEP(1, 0);
     uint8_t source_accid[20];
-    otxn_source_account(SBUF(source_accid));
+    otxn_field(SBUF(source_accid), sfAccount);
     if (!BUFFER_EQUAL(source_accid, OPERATOR_ACCID, 20)) {
         rollback(SBUF("XApay Error(Payment): Unauthorized trigger."), 30);
     }
-    TRACESTR("XApay Hook: Operator verified.");
+    XAPAY_TRACE_DEBUG("XApay Hook: Operator verified.");
 
-    // 2. Memoを解析
-    // プロダクションではTLVなど、より堅牢な形式を推奨します。
-    // ここでは、前回の脆弱なポインタ操作より安全な、擬似的なKey-Valueパーサーを実装します。
-    // (この部分は簡潔さのため、主要なロジックのみを記述します)
-    
-    // TODO: Memoから user_accid, amount, nonce, signature を抽出する堅牢なパーサーをここに実装
-    // ...
+    // 2. Memoのフィールドを検証
+    XAPAY_TRACE_STEP(2, 0);
+    if (!memo->has_user || memo->amount.len <= 0 || memo->nonce.len <= 0 || memo->signature.len <= 0)
+        rollback(SBUF("XApay Error(Payment): Required field missing."), ERROR_MISSING_FIELD);
 
-    // (以下、Memoからデータが抽出できたと仮定したロジック)
-    uint8_t user_accid[20];       // Memoからパース
-    int64_t amount;               // Memoからパース
-    uint8_t nonce[16];            // Memoからパース
-    uint8_t signature[72];        // Memoからパース (最大長)
-    int64_t signature_len;        // Memoからパース
+    int64_t amount;
+    if (xapay_yen_parse(&amount, memo->amount.ptr, memo->amount.len) < 0 || amount <= 0)
+        rollback(SBUF("XApay Error(Payment): Invalid payment amount."), ERROR_INVALID_AMOUNT);
+
+    // ノンスは10進18桁まで (0 は xapay_nonce_use が拒否する)
+    int64_t nonce;
+    if (xapay_yen_parse(&nonce, memo->nonce.ptr, memo->nonce.len) < 0)
+        rollback(SBUF("XApay Error(Payment): Invalid nonce."), ERROR_INVALID_MEMO);
+    if (memo->signature.len > 72)
+        rollback(SBUF("XApay Error(Payment): Invalid signature length."), 32);
 
     // 3. 署名検証
-    uint8_t pubkey[33];
-    if (util_accid(SBUF(pubkey), SBUF(user_accid)) < 0)
-        rollback(SBUF("XApay Error(Payment): Could not get public key."), 31);
+    XAPAY_TRACE_STEP(3, 0);
+    if (verify_payment_signature(memo->user_accid, memo->nonce.ptr, memo->nonce.len, memo->amount.ptr, memo->amount.len,
+                                 memo->signature.ptr, memo->signature.len) != 1)
+        rollback(SBUF("XApay Error(Payment): Signature verification failed."), 32);
 
-    uint8_t signed_data[16]; // 署名対象はNonce
-    COPY(signed_data, nonce, 16);
+    XAPAY_TRACE_DEBUG("XApay Hook: Signature verified.");
 
-    if (util_verify(SBUF(signed_data), SBUF(signature), SBUF(pubkey)) != 1)
-        rollback(SBUF("XApay Error(Payment): Signature verification failed."), 32);
+    // 4. Nonce検証 (ユーザーレコードのスライディングウィンドウで確認・記録する)
+    XAPAY_TRACE_STEP(4, 0);
+    uint8_t record_key[21];
+    xapay_record_t record;
+    xapay_record_load(&record, record_key, memo->user_accid);
 
-    TRACESTR("XApay Hook: Signature verified.");
-    
-    // 4. Nonce検証
-    uint8_t nonce_key[17];
-    nonce_key[0] = PREFIX_NONCE;
-    COPY(nonce_key + 1, nonce, 16);
-    if (state_get(0, 0, SBUF(nonce_key)) >= 0)
+    int64_t nonce_ret = xapay_nonce_use(&record, (uint64_t)nonce);
+    if (nonce_ret == -1)
         rollback(SBUF("XApay Error(Payment): Nonce already used."), 33);
+    if (nonce_ret < 0)
+        rollback(SBUF("XApay Error(Payment): Nonce too old."), 35);
 
-    TRACESTR("XApay Hook: Nonce is new.");
-    
-    // 5. 残高検証
-    uint8_t user_balance_key[21];
-    user_balance_key[0] = PREFIX_USER_BALANCE;
-    COPY(user_balance_key + 1, user_accid, 20);
+    XAPAY_TRACE_DEBUG("XApay Hook: Nonce is new.");
 
-    int64_t user_balance = 0;
-    state_get(&user_balance, sizeof(user_balance), SBUF(user_balance_key));
-    if (user_balance < amount)
+    // 5. 残高検証
+    XAPAY_TRACE_STEP(5, 0);
+    if (xapay_yen_sub(&record.balance, record.balance, amount) < 0)
         rollback(SBUF("XApay Error(Payment): Insufficient balance."), 34);
 
-    TRACESTR("XApay Hook: Balance is sufficient.");
-    
-    // 6. Stateの更新
-    int64_t new_balance = user_balance - amount;
-    state_set(&new_balance, sizeof(new_balance), SBUF(user_balance_key));
+    XAPAY_TRACE_DEBUG("XApay Hook: Balance is sufficient.");
+
+    // 6. 加盟店の未精算額に加算 (閾値に達したら精算の Payment を発行)
+    XAPAY_TRACE_STEP(6, memo->has_merchant);
+    if (memo->has_merchant) {
+        uint8_t merchant_key[21];
+        xapay_merchant_t merchant;
+        xapay_merchant_load(&merchant, merchant_key, memo->merchant_accid);
+        merchant_credit(&merchant, amount);
+        if (merchant_settle_due(&merchant)) {
+            if (etxn_reserve(1) < 0)
+                rollback(SBUF("XApay Error(Payment): Could not reserve settlement."), ERROR_SETTLE_EMIT_FAILED);
+            merchant_settle(&merchant, memo->merchant_accid);
+        }
+        xapay_merchant_store(&merchant, merchant_key);
+    }
 
-    uint8_t nonce_val = 1;
-    state_set(&nonce_val, sizeof(nonce_val), SBUF(nonce_key));
+    // 7. Stateの更新
+    XAPAY_TRACE_STEP(7, 0);
+    xapay_record_store(&record, record_key);
 
     accept(SBUF("XApay: Payment processed successfully."), 0);
     return 0;
 }
 
 /**
- * @brief 利用許可モデルに基づいた支払いを処理する
- * @param data_ptr メモのJSONデータへのポインタ
- * @param data_len メモのJSONデータの長さ
+ * @brief Memoから一括決済のエントリを取り出して entries に追加する
  */
-int64_t handle_allowance_payment(uint8_t* data_ptr, int64_t data_len)
+static void collect_payment_entries(xapay_memo_t* memo, xapay_entry_t* entries, int64_t* entry_count)
 {
-    TRACESTR("XApay Hook: Handling Allowance Payment.");
-
-    // 1. 運営者アカウントの検証
-    uint8_t operator_accid[20];
-    otxn_source_account(SBUF(operator_accid));
-    if (!BUFFER_EQUAL(operator_accid, OPERATOR_ACCID, 20)) {
-        rollback(SBUF("XApay Error(Allowance): Unauthorized operator."), ERROR_INVALID_TRANSACTION);
+    if (memo->type == XAPAY_MEMO_TYPE_PAYMENT_BATCH) {
+        // ガードは実行全体で数えるため、Memoごとのループの終了判定の分 (最大 XAPAY_MEMO_MAX_COUNT 回) を加える
+        for (int64_t i = 0; GUARD(BATCH_MAX_ENTRIES + XAPAY_MEMO_MAX_COUNT - 1), i < memo->entry_count; ++i) {
+            if (*entry_count >= BATCH_MAX_ENTRIES)
+                rollback(SBUF("XApay Error(Allowance): Too many batch entries."), ERROR_INVALID_MEMO);
+            xapay_entry_t* entry = &entries[(*entry_count)++];
+            *entry = memo->entries[i];
+            // 加盟店を省略したエントリは Memo の加盟店に支払う
+            if (!entry->merchant_accid && memo->has_merchant)
+                entry->merchant_accid = memo->merchant_accid;
+        }
+        return;
     }
 
-    // 2. JSONからフィールドを抽出
-    uint8_t user_raddr[35], user_accid[20], payment_amount_str[20];
-    uint8_t allowance_amount_str[20], allowance_sig_hex[148], allowance_sig[74];
-    
-    // ユーザーアドレスを取得
-    if (sto_from_json(user_raddr, sizeof(user_raddr), data_ptr, data_len, "user_address") <= 0) 
-        rollback(SBUF("XApay Error(Allowance): 'user_address' missing."), ERROR_MISSING_FIELD);
-    if (util_raddr(user_accid, sizeof(user_accid), user_raddr, sizeof(user_raddr)) != 20) 
+    if (memo->type != XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT)
+        rollback(SBUF("XApay Error(Allowance): Unexpected memo in batch."), ERROR_INVALID_MEMO);
+
+    // ユーザーアドレス
+    if (!memo->has_user) {
+        if (memo->user_raddr_len <= 0)
+            rollback(SBUF("XApay Error(Allowance): 'user_address' missing."), ERROR_MISSING_FIELD);
         rollback(SBUF("XApay Error(Allowance): Invalid user r-address."), ERROR_ALLOWANCE_INVALID_ADDRESS);
+    }
+    if (*entry_count >= BATCH_MAX_ENTRIES)
+        rollback(SBUF("XApay Error(Allowance): Too many batch entries."), ERROR_INVALID_MEMO);
+
+    xapay_entry_t* entry = &entries[(*entry_count)++];
+    entry->user_accid = memo->user_accid;
+    entry->amount = memo->amount;
+    entry->allowance_amount = memo->allowance_amount;
+    entry->signature = memo->signature;
+    entry->merchant_accid = memo->has_merchant ? memo->merchant_accid : 0;
+}
 
-    // 支払い額を取得
-    int64_t payment_amount_str_len = sto_from_json(payment_amount_str, sizeof(payment_amount_str), data_ptr, data_len, "payment_amount");
-    if (payment_amount_str_len <= 0) 
-        rollback(SBUF("XApay Error(Allowance): 'payment_amount' missing."), ERROR_MISSING_FIELD);
-    int64_t payment_amount_xfl = sto_amount_to_int64(payment_amount_str, payment_amount_str_len);
-    
-    // 利用許可額を取得
-    int64_t allowance_amount_str_len = sto_from_json_nested(allowance_amount_str, sizeof(allowance_amount_str), data_ptr, data_len, "allowance.amount");
-    if (allowance_amount_str_len <= 0) 
-        rollback(SBUF("XApay Error(Allowance): 'allowance.amount' missing."), ERROR_MISSING_FIELD);
-    int64_t allowance_amount_xfl = sto_amount_to_int64(allowance_amount_str, allowance_amount_str_len);
+/**
+ * @brief バッチ内のユーザーを探し、初出ならレコードを読み込む
+ */
+static int64_t batch_user(batch_user_t* users, int64_t* user_count, const uint8_t* accid)
+{
+    for (int64_t i = 0; GUARD(BATCH_MAX_ENTRIES * BATCH_MAX_USERS), i < *user_count; ++i) {
+        if (BUFFER_EQUAL(users[i].accid, accid, 20))
+            return i;
+    }
+    if (*user_count >= BATCH_MAX_USERS)
+        rollback(SBUF("XApay Error(Allowance): Too many users in batch."), ERROR_INVALID_MEMO);
 
-    // 利用許可署名を取得
-    int64_t allowance_sig_hex_len = sto_from_json_nested(allowance_sig_hex, sizeof(allowance_sig_hex), data_ptr, data_len, "allowance.signature");
-    if (allowance_sig_hex_len <= 0) 
-        rollback(SBUF("XApay Error(Allowance): 'allowance.signature' missing."), ERROR_MISSING_FIELD);
-    int64_t allowance_sig_len = util_hex_to_byte(allowance_sig, sizeof(allowance_sig), allowance_sig_hex, allowance_sig_hex_len);
+    batch_user_t* user = &users[*user_count];
+    COPY(user->accid, accid, 20);
+    xapay_record_load(&user->record, user->record_key, accid);
+    return (*user_count)++;
+}
 
-    // 3. 利用許可署名の検証
-    uint8_t operator_raddr[35];
-    util_accid(operator_raddr, sizeof(operator_raddr), OPERATOR_ACCID, 20);
-    
-    uint8_t message[256];
-    uint8_t* ptr = message;
-    COPY(ptr, user_raddr, 34); ptr += 34;
-    ptr[0] = ':'; ptr++;
-    COPY(ptr, operator_raddr, 34); ptr += 34;
-    ptr[0] = ':'; ptr++;
-    COPY(ptr, allowance_amount_str, allowance_amount_str_len);
-    int64_t message_len = 34 + 1 + 34 + 1 + allowance_amount_str_len;
-
-    uint8_t user_pubkey[33];
-    int64_t kl_ret = util_keylet(user_pubkey, sizeof(user_pubkey), KEYLET_ACCOUNT, user_accid, 20, 0,0,0,0);
-    int64_t slot_no = slot_set(user_pubkey, kl_ret);
-    int64_t pubkey_len = slot_subfield(slot_no, sfRegularKey, user_pubkey, sizeof(user_pubkey));
-    if (pubkey_len <= 0) pubkey_len = slot_subfield(slot_no, sfAccount, user_pubkey, sizeof(user_pubkey));
-    
-    if (util_verify(message, message_len, allowance_sig, allowance_sig_len, user_pubkey, pubkey_len) != 1) {
-        rollback(SBUF("XApay Error(Allowance): Signature verification failed."), ERROR_ALLOWANCE_VERIFICATION_FAILED);
+/**
+ * @brief バッチ内の加盟店を探し、初出なら未精算額を読み込む
+ */
+static int64_t batch_merchant(batch_merchant_t* merchants, int64_t* merchant_count, const uint8_t* accid)
+{
+    for (int64_t i = 0; GUARD(BATCH_MAX_ENTRIES * BATCH_MAX_MERCHANTS), i < *merchant_count; ++i) {
+        if (BUFFER_EQUAL(merchants[i].accid, accid, 20))
+            return i;
     }
-    
-    // 4. 利用上限と残高のチェック
-    uint8_t state_key[20 + 148];
-    COPY(state_key, user_accid, 20);
-    COPY(state_key + 20, allowance_sig_hex, allowance_sig_hex_len);
-    
-    int64_t spent_amount_xfl = 0;
-    uint8_t spent_amount_buf[8];
-    if (state(spent_amount_buf, sizeof(spent_amount_buf), state_key, 20 + allowance_sig_hex_len) == 8) {
-        spent_amount_xfl = float_sto_to_int64(spent_amount_buf);
+    if (*merchant_count >= BATCH_MAX_MERCHANTS)
+        rollback(SBUF("XApay Error(Allowance): Too many merchants in batch."), ERROR_INVALID_MEMO);
+
+    batch_merchant_t* merchant = &merchants[*merchant_count];
+    COPY(merchant->accid, accid, 20);
+    merchant->exists = xapay_merchant_load(&merchant->merchant, merchant->key, accid);
+    return (*merchant_count)++;
+}
+
+/**
+ * @brief バッチ内で閾値に達した加盟店に精算の Payment を発行する
+ */
+static void batch_settle_merchants(batch_merchant_t* merchants, int64_t merchant_count)
+{
+    int64_t due = 0;
+    for (int64_t i = 0; GUARD(BATCH_MAX_MERCHANTS), i < merchant_count; ++i) {
+        if (merchant_settle_due(&merchants[i].merchant))
+            due++;
+    }
+    if (due == 0)
+        return;
+    int64_t reserved = etxn_reserve(due);
+    if (reserved < 0) {
+        XAPAY_TRACE_ERROR("XApay Hook: etxn_reserve failed", reserved);
+        rollback(SBUF("XApay Error(Merchant): Could not reserve settlements."), ERROR_SETTLE_EMIT_FAILED);
+    }
+    for (int64_t i = 0; GUARD(BATCH_MAX_MERCHANTS), i < merchant_count; ++i) {
+        if (merchant_settle_due(&merchants[i].merchant))
+            merchant_settle(&merchants[i].merchant, merchants[i].accid);
     }
+}
 
-    int64_t new_spent_amount_xfl = float_sum(spent_amount_xfl, payment_amount_xfl);
+/**
+ * @brief エントリの利用許可がユーザーの現在の利用許可であることを確認する
+ *
+ * 利用許可を入れ替えられるのはユーザー本人の Invoke (handle_recharge_and_update_allowance) だけで、
+ * 支払いに含まれる利用許可は現在のものと同じダイジェストでなければ拒否する。
+ * (運営者が過去の利用許可を提示して使用済み金額を0に戻すことを防ぐ)
+ * 利用許可が省略されたエントリは現在の利用許可を使う。
+ */
+static void batch_use_allowance(batch_user_t* user, xapay_entry_t* entry)
+{
+    xapay_record_t* rec = &user->record;
+    if (!(rec->flags & XAPAY_RECORD_HAS_ALLOWANCE)) {
+        if (entry->signature.len <= 0)
+            rollback(SBUF("XApay Error(Allowance): 'allowance.signature' missing."), ERROR_MISSING_FIELD);
+        rollback(SBUF("XApay Error(Allowance): No active allowance."), ERROR_ALLOWANCE_VERIFICATION_FAILED);
+    }
+    if (entry->signature.len <= 0)
+        return;
+
+    if (entry->allowance_amount.len <= 0 || entry->allowance_amount.len > 20)
+        rollback(SBUF("XApay Error(Allowance): 'allowance.amount' missing."), ERROR_MISSING_FIELD);
+    if (entry->signature.len > 74)
+        rollback(SBUF("XApay Error(Allowance): Invalid signature length."), ERROR_ALLOWANCE_VERIFICATION_FAILED);
+
+    uint8_t digest[32];
+    allowance_digest(digest, user->accid, entry->allowance_amount.ptr, entry->allowance_amount.len,
+                     entry->signature.ptr, entry->signature.len);
+    if (!BUFFER_EQUAL(rec->allowance_hash, digest, 32))
+        rollback(SBUF("XApay Error(Allowance): Allowance is not the current one."), ERROR_ALLOWANCE_VERIFICATION_FAILED);
+}
+
+/**
+ * @brief 利用許可モデルに基づいた支払いを処理する
+ *
+ * 1つのInvokeで複数の支払いを処理できる (一括決済)。支払いは Memo 0 の
+ * 単一支払いまたは PAYMENT_BATCH のエントリと、続く Memo に含まれるものを順に適用する。
+ * いずれか1件でも失敗した場合はバッチ全体をロールバックする。
+ * 加盟店を指定した支払いはその加盟店の未精算額に加算し、閾値に達した加盟店には
+ * 同じ実行で精算の Payment を1件ずつ発行する。
+ * @param memo 解析済みのMemo 0
+ * @param memos_slot 元トランザクションの Memos のスロット
+ */
+int64_t handle_allowance_payment(xapay_memo_t* memo, int64_t memos_slot)
+{
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_ALLOWANCE_PAYMENT, "XApay Hook: Handling Allowance Payment.");
 
-    if (float_compare(new_spent_amount_xfl, allowance_amount_xfl, COMPARE_GREATER) == 1) {
-        rollback(SBUF("XApay Error(Allowance): Amount exceeds allowance."), ERROR_ALLOWANCE_EXCEEDED);
+    // 1. 運営者アカウントの検証
+    XAPAY_TRACE_STEP(1, 0);
+    uint8_t operator_accid[20];
+    otxn_field(SBUF(operator_accid), sfAccount);
+    if (!BUFFER_EQUAL(operator_accid, OPERATOR_ACCID, 20)) {
+        rollback(SBUF("XApay Error(Allowance): Unauthorized operator."), ERROR_INVALID_TRANSACTION);
     }
 
-    // 5. 残高の更新
-    uint8_t user_balance_key[21];
-    user_balance_key[0] = PREFIX_USER_BALANCE;
-    COPY(user_balance_key + 1, user_accid, 20);
+    // 2. 全Memoから支払いエントリを集める
+    XAPAY_TRACE_STEP(2, 0);
+    xapay_entry_t entries[BATCH_MAX_ENTRIES];
+    int64_t entry_count = 0;
+    collect_payment_entries(memo, entries, &entry_count);
+
+    int64_t memo_count = slot_count(memos_slot);
+    if (memo_count > XAPAY_MEMO_MAX_COUNT)
+        rollback(SBUF("XApay Error(Allowance): Too many memos."), ERROR_INVALID_MEMO);
+
+    uint8_t extra_buf[XAPAY_MEMO_MAX_COUNT - 1][XAPAY_MEMO_BUFFER_SIZE];
+    xapay_memo_t extra_memo[XAPAY_MEMO_MAX_COUNT - 1];
+    for (int64_t i = 1; GUARD(XAPAY_MEMO_MAX_COUNT), i < memo_count; ++i) {
+        const uint8_t* data;
+        int64_t len = xapay_memo_data(&data, extra_buf[i - 1], XAPAY_MEMO_BUFFER_SIZE, memos_slot, (uint32_t)i);
+        if (len <= 0 || xapay_memo_decode(&extra_memo[i - 1], data, len) < 0)
+            rollback(SBUF("XApay Error(Allowance): Malformed memo."), ERROR_INVALID_MEMO);
+        collect_payment_entries(&extra_memo[i - 1], entries, &entry_count);
+    }
 
-    int64_t user_balance = 0;
-    state_get(&user_balance, sizeof(user_balance), SBUF(user_balance_key));
-    if (user_balance < payment_amount_xfl) {
-        rollback(SBUF("XApay Error(Allowance): Insufficient balance."), ERROR_INSUFFICIENT_BALANCE);
+    // 3. 支払いを順に適用する (Stateの書き込みは最後にまとめて行う)
+    XAPAY_TRACE_STEP(3, entry_count);
+    batch_user_t users[BATCH_MAX_USERS];
+    int64_t user_count = 0;
+    batch_merchant_t merchants[BATCH_MAX_MERCHANTS];
+    int64_t merchant_count = 0;
+
+    for (int64_t i = 0; GUARD(BATCH_MAX_ENTRIES), i < entry_count; ++i) {
+        xapay_entry_t* entry = &entries[i];
+
+        // 支払い額
+        if (entry->amount.len <= 0) 
+            rollback(SBUF("XApay Error(Allowance): 'payment_amount' missing."), ERROR_MISSING_FIELD);
+        int64_t payment_amount;
+        if (xapay_yen_parse(&payment_amount, entry->amount.ptr, entry->amount.len) < 0 || payment_amount <= 0)
+            rollback(SBUF("XApay Error(Allowance): Invalid payment amount."), ERROR_INVALID_AMOUNT);
+        XAPAY_TRACE_ITEM(3, payment_amount);
+
+        int64_t u = batch_user(users, &user_count, entry->user_accid);
+        batch_use_allowance(&users[u], entry);
+        xapay_record_t* rec = &users[u].record;
+
+        // 利用上限と残高のチェック
+        int64_t new_spent;
+        if (xapay_yen_add(&new_spent, rec->spent, payment_amount) < 0 || new_spent > rec->allowance) {
+            rollback(SBUF("XApay Error(Allowance): Amount exceeds allowance."), ERROR_ALLOWANCE_EXCEEDED);
+        }
+        if (xapay_yen_sub(&rec->balance, rec->balance, payment_amount) < 0) {
+            rollback(SBUF("XApay Error(Allowance): Insufficient balance."), ERROR_INSUFFICIENT_BALANCE);
+        }
+        rec->spent = new_spent;
+
+        // 加盟店の未精算額に加算
+        if (entry->merchant_accid) {
+            int64_t m = batch_merchant(merchants, &merchant_count, entry->merchant_accid);
+            merchant_credit(&merchants[m].merchant, payment_amount);
+        }
     }
 
-    int64_t new_balance = user_balance - payment_amount_xfl;
-    state_set(&new_balance, sizeof(new_balance), SBUF(user_balance_key));
+    // 4. 閾値に達した加盟店に精算の Payment を発行
+    XAPAY_TRACE_STEP(4, merchant_count);
+    batch_settle_merchants(merchants, merchant_count);
 
-    // 6. 使用済み金額の更新
-    uint8_t new_spent_amount_buf[8];
-    float_sto_set(new_spent_amount_buf, new_spent_amount_xfl);
-    state_set(new_spent_amount_buf, sizeof(new_spent_amount_buf), state_key, 20 + allowance_sig_hex_len);
+    // 5. ユーザーレコードと加盟店の未精算額の更新
+    XAPAY_TRACE_STEP(5, user_count);
+    for (int64_t i = 0; GUARD(BATCH_MAX_USERS), i < user_count; ++i) {
+        xapay_record_store(&users[i].record, users[i].record_key);
+    }
+    for (int64_t i = 0; GUARD(BATCH_MAX_MERCHANTS), i < merchant_count; ++i) {
+        xapay_merchant_store(&merchants[i].merchant, merchants[i].key);
+    }
     
     accept(SBUF("XApay: Allowance payment processed successfully."), SUCCESS);
     return 0;
@@ -346,41 +763,41 @@ int64_t handle_allowance_payment(uint8_t* data_ptr, int64_t data_len)
 
 /**
  * @brief チャージと利用許可枠の更新を同時に処理する
+ * @param memo 解析済みのMemo
  * @return 承認または拒否コード
  */
-int64_t handle_recharge_and_update_allowance()
+int64_t handle_recharge_and_update_allowance(xapay_memo_t* memo)
 {
-    TRACESTR("XApay Hook: Handling Recharge and Allowance Update.");
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_RECHARGE, "XApay Hook: Handling Recharge and Allowance Update.");
 
     // 1. ユーザーのアカウントIDを取得
+    XAPAY_TRACE_STEP(1, 0);
     uint8_t user_accid[20];
     otxn_field(SBUF(user_accid), sfAccount);
 
     // 2. チャージ額を取得
+    XAPAY_TRACE_STEP(2, 0);
     uint8_t amount_buffer[48];
     int64_t amount_len = otxn_field(SBUF(amount_buffer), sfAmount);
     if (amount_len < 0) {
         rollback(SBUF("XApay Error(Recharge): Could not get Amount field."), ERROR_INVALID_TRANSACTION);
     }
 
-    // 3. 通貨と発行者を検証
-    uint8_t issuer_buffer[20];
-    if (sto_subfield(amount_buffer, amount_len, SBUF(issuer_buffer), sfIssuer) < 0) {
-        rollback(SBUF("XApay Error(Recharge): Could not get Issuer from Amount."), ERROR_CHARGE_INVALID_ISSUER);
+    // 3. 通貨と発行者を検証 (IOU Amount の通貨は +8、発行者は +28)
+    XAPAY_TRACE_STEP(3, 0);
+    if (amount_len != 48) {
+        rollback(SBUF("XApay Error(Recharge): Amount is not an issued currency."), ERROR_CHARGE_INVALID_CURRENCY);
     }
-
-    uint8_t currency_buffer[20];
-    if (sto_subfield(amount_buffer, amount_len, SBUF(currency_buffer), sfCurrency) < 0) {
-        rollback(SBUF("XApay Error(Recharge): Could not get Currency from Amount."), ERROR_CHARGE_INVALID_CURRENCY);
-    }
-
-    if (!BUFFER_EQUAL(issuer_buffer, ISSUER_ACCID, 20) || !BUFFER_EQUAL(currency_buffer, CURRENCY_JPY, 20)) {
+    if (!BUFFER_EQUAL(amount_buffer + 28, ISSUER_ACCID, 20) || !BUFFER_EQUAL(amount_buffer + 8, CURRENCY_JPY, 20)) {
         rollback(SBUF("XApay Error(Recharge): Invalid currency or issuer."), ERROR_CHARGE_INVALID_CURRENCY);
     }
 
-    // 4. チャージ額を取得
-    int64_t charge_amount;
-    if (sto_amount_to_int64(&charge_amount, amount_buffer, amount_len) < 0) {
+    // 4. チャージ額を取得 (1円未満は切り捨て)
+    XAPAY_TRACE_STEP(4, 0);
+    int64_t charge_amount = float_sto_set(amount_buffer, 8);
+    if (charge_amount >= 0)
+        charge_amount = float_int(charge_amount, 0, 0);
+    if (charge_amount < 0) {
         rollback(SBUF("XApay Error(Recharge): Could not parse amount value."), ERROR_INVALID_TRANSACTION);
     }
     if (charge_amount <= 0) {
@@ -388,149 +805,613 @@ int64_t handle_recharge_and_update_allowance()
     }
 
     // 5. Memoから新しい利用許可枠の情報を取得
-    uint8_t memo_data[1024];
-    int64_t memo_len = otxn_memo(0, SBUF(memo_data));
-    if (memo_len < 0) {
-        rollback(SBUF("XApay Error(Recharge): Could not get memo."), ERROR_INVALID_MEMO);
-    }
-
-    uint8_t new_allowance_str[32];
-    int64_t new_allowance_len = sto_from_json(new_allowance_str, sizeof(new_allowance_str), memo_data, memo_len, "allowance");
-    if (new_allowance_len <= 0) {
+    XAPAY_TRACE_STEP(5, charge_amount);
+    const uint8_t* new_allowance_str = memo->allowance_amount.ptr;
+    int64_t new_allowance_len = memo->allowance_amount.len;
+    if (new_allowance_len <= 0 || new_allowance_len > 32) {
         rollback(SBUF("XApay Error(Recharge): Could not get new allowance amount."), ERROR_MISSING_FIELD);
     }
+    int64_t new_allowance;
+    if (xapay_yen_parse(&new_allowance, new_allowance_str, new_allowance_len) < 0) {
+        rollback(SBUF("XApay Error(Recharge): Invalid allowance amount."), ERROR_INVALID_AMOUNT);
+    }
 
-    uint8_t signature_hex[148];
-    int64_t signature_hex_len = sto_from_json(signature_hex, sizeof(signature_hex), memo_data, memo_len, "signature");
-    if (signature_hex_len <= 0) {
+    const uint8_t* signature = memo->signature.ptr;
+    int64_t signature_len = memo->signature.len;
+    if (signature_len <= 0) {
         rollback(SBUF("XApay Error(Recharge): Could not get signature."), ERROR_MISSING_FIELD);
     }
+    if (signature_len > 74) {
+        rollback(SBUF("XApay Error(Recharge): Invalid signature length."), ERROR_ALLOWANCE_VERIFICATION_FAILED);
+    }
 
     // 6. 署名を検証
-    uint8_t operator_raddr[35];
-    util_accid(operator_raddr, sizeof(operator_raddr), OPERATOR_ACCID, 20);
-
-    uint8_t user_raddr[35];
-    util_accid(user_raddr, sizeof(user_raddr), user_accid, 20);
-
-    uint8_t message[256];
-    uint8_t* ptr = message;
-    COPY(ptr, user_raddr, 34); ptr += 34;
-    ptr[0] = ':'; ptr++;
-    COPY(ptr, operator_raddr, 34); ptr += 34;
-    ptr[0] = ':'; ptr++;
-    COPY(ptr, new_allowance_str, new_allowance_len);
-    int64_t message_len = 34 + 1 + 34 + 1 + new_allowance_len;
-
-    uint8_t signature[74];
-    int64_t signature_len = util_hex_to_byte(signature, sizeof(signature), signature_hex, signature_hex_len);
-
-    uint8_t user_pubkey[33];
-    int64_t kl_ret = util_keylet(user_pubkey, sizeof(user_pubkey), KEYLET_ACCOUNT, user_accid, 20, 0,0,0,0);
-    int64_t slot_no = slot_set(user_pubkey, kl_ret);
-    int64_t pubkey_len = slot_subfield(slot_no, sfRegularKey, user_pubkey, sizeof(user_pubkey));
-    if (pubkey_len <= 0) pubkey_len = slot_subfield(slot_no, sfAccount, user_pubkey, sizeof(user_pubkey));
-
-    if (util_verify(message, message_len, signature, signature_len, user_pubkey, pubkey_len) != 1) {
+    XAPAY_TRACE_STEP(6, new_allowance);
+    if (verify_allowance_signature(user_accid, new_allowance_str, new_allowance_len,
+                                   signature, signature_len) != 1) {
         rollback(SBUF("XApay Error(Recharge): Signature verification failed."), ERROR_ALLOWANCE_VERIFICATION_FAILED);
     }
 
-    // 7. 残高を更新
-    uint8_t user_balance_key[21];
-    user_balance_key[0] = PREFIX_USER_BALANCE;
-    COPY(user_balance_key + 1, user_accid, 20);
+    // 7. 残高と利用許可を更新 (新しい世代の利用許可として使用済み金額を0から数え直す)
+    XAPAY_TRACE_STEP(7, 0);
+    uint8_t record_key[21];
+    xapay_record_t record;
+    xapay_record_load(&record, record_key, user_accid);
 
-    int64_t current_balance = 0;
-    state_get(&current_balance, sizeof(current_balance), SBUF(user_balance_key));
-    int64_t new_balance = current_balance + charge_amount;
-    state_set(&new_balance, sizeof(new_balance), SBUF(user_balance_key));
+    if (xapay_yen_add(&record.balance, record.balance, charge_amount) < 0) {
+        rollback(SBUF("XApay Error(Recharge): Balance overflow."), ERROR_INVALID_AMOUNT);
+    }
 
-    // 8. 新しい利用許可枠を保存
-    uint8_t allowance_key[21];
-    allowance_key[0] = PREFIX_ALLOWANCE;
-    COPY(allowance_key + 1, user_accid, 20);
+    allowance_digest(record.allowance_hash, user_accid, new_allowance_str, new_allowance_len, signature, signature_len);
+    record.allowance = new_allowance;
+    record.spent = 0;
+    record.allowance_generation++;
+    record.flags |= XAPAY_RECORD_HAS_ALLOWANCE;
 
-    state_set(new_allowance_str, new_allowance_len, SBUF(allowance_key));
-    state_set(signature_hex, signature_hex_len, SBUF(allowance_key) + 20);
+    xapay_record_store(&record, record_key);
 
     accept(SBUF("XApay: Recharge and allowance update successful."), SUCCESS);
     return 0;
 }
 
 /**
- * @brief 残高引き出しを処理する
+ * @brief 残高引き出しを受け付ける
+ *
+ * 残高は直ちに減らし、引き出し額は宛先ごとのキューに積む。Payment は運営者の
+ * フラッシュ (handle_withdrawal_flush) でまとめて発行する。
+ * @param memo 解析済みのMemo
  * @return 承認または拒否コード
  */
-int64_t handle_withdrawal()
+int64_t handle_withdrawal(xapay_memo_t* memo)
 {
-    TRACESTR("XApay Hook: Handling Withdrawal.");
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_WITHDRAWAL, "XApay Hook: Handling Withdrawal.");
 
     // 1. ユーザーのアカウントIDを取得
+    XAPAY_TRACE_STEP(1, 0);
     uint8_t user_accid[20];
     otxn_field(SBUF(user_accid), sfAccount);
 
     // 2. Memoから引き出し額を取得
-    uint8_t memo_data[1024];
-    int64_t memo_len = otxn_memo(0, SBUF(memo_data));
-    if (memo_len < 0) {
-        rollback(SBUF("XApay Error(Withdraw): Could not get memo."), ERROR_INVALID_MEMO);
-    }
-
-    uint8_t amount_str[32];
-    int64_t amount_len = sto_from_json(amount_str, sizeof(amount_str), memo_data, memo_len, "amount");
-    if (amount_len <= 0) {
+    XAPAY_TRACE_STEP(2, 0);
+    if (memo->amount.len <= 0) {
         rollback(SBUF("XApay Error(Withdraw): Could not get amount."), ERROR_MISSING_FIELD);
     }
 
     // 3. 引き出し額を数値に変換
+    XAPAY_TRACE_STEP(3, 0);
     int64_t withdraw_amount;
-    if (sto_int64(&withdraw_amount, amount_str, amount_len) < 0) {
+    if (xapay_yen_parse(&withdraw_amount, memo->amount.ptr, memo->amount.len) < 0) {
         rollback(SBUF("XApay Error(Withdraw): Invalid amount format."), ERROR_INVALID_TRANSACTION);
     }
     if (withdraw_amount <= 0) {
         rollback(SBUF("XApay Error(Withdraw): Amount must be positive."), ERROR_INVALID_TRANSACTION);
     }
 
-    // 4. ユーザーの残高を取得
-    uint8_t user_balance_key[21];
-    user_balance_key[0] = PREFIX_USER_BALANCE;
-    COPY(user_balance_key + 1, user_accid, 20);
-
-    int64_t current_balance = 0;
-    state_get(&current_balance, sizeof(current_balance), SBUF(user_balance_key));
+    // 4. ユーザーのレコードを取得
+    XAPAY_TRACE_STEP(4, withdraw_amount);
+    uint8_t record_key[21];
+    xapay_record_t record;
+    xapay_record_load(&record, record_key, user_accid);
 
     // 5. 残高が十分か検証
-    if (current_balance < withdraw_amount) {
+    XAPAY_TRACE_STEP(5, 0);
+    if (xapay_yen_sub(&record.balance, record.balance, withdraw_amount) < 0) {
         rollback(SBUF("XApay Error(Withdraw): Insufficient balance."), ERROR_INSUFFICIENT_BALANCE);
     }
 
-    // 6. Emitted Transactionの準備
-    uint8_t emit_txn_buf[128];
-    etxn_details(SBUF(emit_txn_buf));
+    // 6. 引き出し待ちを取得 (なければキューの末尾に宛先を追加)
+    XAPAY_TRACE_STEP(6, 0);
+    uint8_t pending_key[21];
+    xapay_withdraw_t pending;
+    xapay_state_key(pending_key, PREFIX_WITHDRAW_PENDING, user_accid);
+    if (state(&pending, sizeof(pending), SBUF(pending_key)) != sizeof(pending)) {
+        xapay_withdraw_queue_t queue;
+        xapay_withdraw_queue_load(&queue);
+        if (queue.tail - queue.head >= XAPAY_WITHDRAW_QUEUE_SIZE) {
+            rollback(SBUF("XApay Error(Withdraw): Withdrawal queue is full."), ERROR_WITHDRAW_QUEUE_FULL);
+        }
+
+        uint8_t slot_key[5];
+        xapay_withdraw_slot_key(slot_key, queue.tail);
+        state_set(user_accid, 20, SBUF(slot_key));
+
+        pending = (xapay_withdraw_t){ .position = queue.tail };
+        queue.tail++;
+        xapay_withdraw_queue_store(&queue);
+    }
+
+    // 7. 同じ宛先の引き出しを合算 (1件の Payment で発行できる額まで)
+    XAPAY_TRACE_STEP(7, 0);
+    if (xapay_yen_add(&pending.amount, pending.amount, withdraw_amount) < 0 || pending.amount > XAPAY_YEN_MAX_EXACT) {
+        rollback(SBUF("XApay Error(Withdraw): Pending withdrawal too large."), ERROR_INVALID_AMOUNT);
+    }
+    pending.requests++;
+
+    // 8. Stateを更新
+    XAPAY_TRACE_STEP(8, 0);
+    state_set(&pending, sizeof(pending), SBUF(pending_key));
+    xapay_record_store(&record, record_key);
+
+    accept(SBUF("XApay: Withdrawal queued."), SUCCESS);
+    return 0;
+}
+
+/**
+ * @brief 引き出しキューから宛先ごとに1件の Payment をまとめて発行する (運営者のみ)
+ * @param memo 解析済みのMemo (AMOUNT: 発行する最大件数、省略時は XAPAY_WITHDRAW_FLUSH_MAX)
+ * @return 承認または拒否コード
+ */
+int64_t handle_withdrawal_flush(xapay_memo_t* memo)
+{
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_WITHDRAWAL_FLUSH, "XApay Hook: Handling Withdrawal Flush.");
+
+    // 1. 送信元が運営アカウントであることを検証
+    XAPAY_TRACE_STEP(1, 0);
+    uint8_t source_accid[20];
+    otxn_field(SBUF(source_accid), sfAccount);
+    if (!BUFFER_EQUAL(source_accid, OPERATOR_ACCID, 20)) {
+        rollback(SBUF("XApay Error(Flush): Unauthorized trigger."), ERROR_WITHDRAW_UNAUTHORIZED);
+    }
+
+    // 2. 発行する件数を決める
+    XAPAY_TRACE_STEP(2, 0);
+    int64_t limit = XAPAY_WITHDRAW_FLUSH_MAX;
+    if (memo->amount.len > 0) {
+        if (xapay_yen_parse(&limit, memo->amount.ptr, memo->amount.len) < 0 || limit <= 0) {
+            rollback(SBUF("XApay Error(Flush): Invalid count."), ERROR_INVALID_AMOUNT);
+        }
+        if (limit > XAPAY_WITHDRAW_FLUSH_MAX)
+            limit = XAPAY_WITHDRAW_FLUSH_MAX;
+    }
+
+    xapay_withdraw_queue_t queue;
+    xapay_withdraw_queue_load(&queue);
+    int64_t count = queue.tail - queue.head;
+    if (count > limit)
+        count = limit;
+    if (count == 0) {
+        accept(SBUF("XApay: No queued withdrawals."), SUCCESS);
+    }
+
+    // 3. キューの先頭から引き出し待ちの残っている宛先を集める
+    //    (引き出し待ちが別の位置に移った・削除された位置は発行せずに読み飛ばす)
+    XAPAY_TRACE_STEP(3, count);
+    uint8_t live_accid[XAPAY_WITHDRAW_FLUSH_MAX][20];
+    int64_t live_amount[XAPAY_WITHDRAW_FLUSH_MAX];
+    int64_t live = 0;
+    for (int64_t i = 0; GUARD(XAPAY_WITHDRAW_FLUSH_MAX), i < count; ++i) {
+        uint32_t position = queue.head + (uint32_t)i;
+        uint8_t slot_key[5];
+        xapay_withdraw_slot_key(slot_key, position);
+        if (state(live_accid[live], 20, SBUF(slot_key)) != 20)
+            continue;
+
+        uint8_t pending_key[21];
+        xapay_withdraw_t pending;
+        xapay_state_key(pending_key, PREFIX_WITHDRAW_PENDING, live_accid[live]);
+        if (state(&pending, sizeof(pending), SBUF(pending_key)) != sizeof(pending) || pending.position != position)
+            continue;
+        live_amount[live++] = pending.amount;
+    }
 
-    // 7. 送金する額を設定
+    // 4. 発行する件数だけ発行枠を予約
+    XAPAY_TRACE_STEP(4, live);
+    if (live > 0) {
+        int64_t reserved = etxn_reserve(live);
+        if (reserved < 0) {
+            XAPAY_TRACE_ERROR("XApay Hook: etxn_reserve failed", reserved);
+            rollback(SBUF("XApay Error(Flush): Could not reserve emissions."), ERROR_WITHDRAW_EMIT_FAILED);
+        }
+    }
+
+    // 5. 宛先ごとに Payment を発行し、引き出し待ちを削除 (送金額のうち通貨・発行者は共通)
+    XAPAY_TRACE_STEP(5, 0);
     uint8_t amount_buf[48];
-    uint8_t* ptr = amount_buf;
-    COPY(ptr, CURRENCY_JPY, 20); ptr += 20;
-    COPY(ptr, ISSUER_ACCID, 20); ptr += 20;
-    COPY(ptr, &withdraw_amount, 8);
+    COPY(amount_buf + 8, CURRENCY_JPY, 20);
+    COPY(amount_buf + 28, ISSUER_ACCID, 20);
+    for (int64_t i = 0; GUARD(XAPAY_WITHDRAW_FLUSH_MAX), i < live; ++i) {
+        if (xapay_yen_to_amount(amount_buf, live_amount[i]) < 0) {
+            rollback(SBUF("XApay Error(Flush): Invalid pending amount."), ERROR_INVALID_AMOUNT);
+        }
+        XAPAY_TRACE_ITEM(5, live_amount[i]);
 
-    // 8. Paymentトランザクションを発行
-    uint8_t* tx_params[] = {
-        user_accid,    // Destination: ユーザーのアドレス
-        amount_buf     // Amount: 引き出し額
-    };
-    uint32_t tx_param_lens[] = { 20, 48 };
+        int64_t emitted = emit_payment(live_accid[i], amount_buf);
+        if (emitted < 0) {
+            XAPAY_TRACE_ERROR("XApay Hook: emit failed", emitted);
+            rollback(SBUF("XApay Error(Flush): Failed to emit withdrawal transaction."), ERROR_WITHDRAW_EMIT_FAILED);
+        }
 
-    int64_t emit_result = emit(SBUF(emit_txn_buf), SBUF("Payment"), tx_params, tx_param_lens);
-    if (emit_result < 0) {
-        rollback(SBUF("XApay Error(Withdraw): Failed to emit withdrawal transaction."), ERROR_INVALID_TRANSACTION);
+        uint8_t pending_key[21];
+        xapay_state_key(pending_key, PREFIX_WITHDRAW_PENDING, live_accid[i]);
+        state_set(0, 0, SBUF(pending_key));
     }
 
-    // 9. 残高を更新
-    int64_t new_balance = current_balance - withdraw_amount;
-    state_set(&new_balance, sizeof(new_balance), SBUF(user_balance_key));
+    // 6. キューの先頭を進める (読み飛ばした位置を含む)
+    XAPAY_TRACE_STEP(6, count);
+    queue.head += (uint32_t)count;
+    xapay_withdraw_queue_store(&queue);
 
-    accept(SBUF("XApay: Withdrawal successful."), SUCCESS);
+    accept(SBUF("XApay: Withdrawals emitted."), SUCCESS);
     return 0;
-}
\ No newline at end of file
+}
+
+// 1回のコンパクションで扱うユーザー数の上限 (ユーザーあたり最大4件の変更)
+#define COMPACT_MAX_USERS 48
+
+/**
+ * @brief Memoからコンパクション対象のユーザーを取り出して users に追加する
+ */
+static void collect_compact_users(xapay_memo_t* memo, const uint8_t** users, int64_t* user_count)
+{
+    if (memo->type != XAPAY_MEMO_TYPE_COMPACT)
+        rollback(SBUF("XApay Error(Compact): Unexpected memo."), ERROR_INVALID_MEMO);
+    for (int64_t i = 0; GUARD(XAPAY_MEMO_MAX_COUNT * XAPAY_MEMO_MAX_ENTRIES), i < memo->entry_count; ++i) {
+        if (*user_count >= COMPACT_MAX_USERS)
+            rollback(SBUF("XApay Error(Compact): Too many users."), ERROR_INVALID_MEMO);
+        users[(*user_count)++] = memo->entries[i].user_accid;
+    }
+}
+
+/**
+ * @brief 旧形式のキーがあれば削除し、削除したバイト数と件数を加算する
+ */
+static void compact_legacy_key(uint8_t prefix, const uint8_t* accid, int64_t* reclaimed, int64_t* removed)
+{
+    uint8_t key[21];
+    xapay_state_key(key, prefix, accid);
+    int64_t len = xapay_state_delete(SBUF(key));
+    if (len >= 0) {
+        *reclaimed += len;
+        (*removed)++;
+    }
+}
+
+/**
+ * @brief 不要になった State を削除する (運営者のみ)
+ *
+ * Memo の ENTRY に並べたユーザーごとに、旧形式のキー ('U' 'A') と、入れ替え済みの利用許可に対する
+ * 累積請求 ('C') を削除する。旧キーしかないユーザーは、先にレコードへ移行してから削除する。
+ * (使用済み額とノンスはレコードの中にあり、利用許可の入れ替えで上書きされる)
+ * 続けて、発行済みの引き出しキューの位置 ('Q'+位置) を変更数の上限まで削除する。
+ * 残りは次回のコンパクションで続きから削除する。
+ * accept のコードは削除したデータのバイト数 (移行で書き込んだレコード分を差し引いた値)。
+ * @param memo 解析済みのMemo 0
+ * @param memos_slot sfMemos を置いたスロット
+ * @return 承認または拒否コード
+ */
+int64_t handle_compact(xapay_memo_t* memo, int64_t memos_slot)
+{
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_COMPACT, "XApay Hook: Handling Compaction.");
+
+    // 1. 送信元が運営アカウントであることを検証
+    XAPAY_TRACE_STEP(1, 0);
+    uint8_t source_accid[20];
+    otxn_field(SBUF(source_accid), sfAccount);
+    if (!BUFFER_EQUAL(source_accid, OPERATOR_ACCID, 20)) {
+        rollback(SBUF("XApay Error(Compact): Unauthorized trigger."), ERROR_COMPACT_UNAUTHORIZED);
+    }
+
+    // 2. 全Memoから対象ユーザーを集める
+    XAPAY_TRACE_STEP(2, 0);
+    const uint8_t* users[COMPACT_MAX_USERS];
+    int64_t user_count = 0;
+    collect_compact_users(memo, users, &user_count);
+
+    int64_t memo_count = slot_count(memos_slot);
+    if (memo_count > XAPAY_MEMO_MAX_COUNT)
+        rollback(SBUF("XApay Error(Compact): Too many memos."), ERROR_INVALID_MEMO);
+
+    uint8_t extra_buf[XAPAY_MEMO_MAX_COUNT - 1][XAPAY_MEMO_BUFFER_SIZE];
+    xapay_memo_t extra_memo[XAPAY_MEMO_MAX_COUNT - 1];
+    for (int64_t i = 1; GUARD(XAPAY_MEMO_MAX_COUNT), i < memo_count; ++i) {
+        const uint8_t* data;
+        int64_t len = xapay_memo_data(&data, extra_buf[i - 1], XAPAY_MEMO_BUFFER_SIZE, memos_slot, (uint32_t)i);
+        if (len <= 0 || xapay_memo_decode(&extra_memo[i - 1], data, len) < 0)
+            rollback(SBUF("XApay Error(Compact): Malformed memo."), ERROR_INVALID_MEMO);
+        collect_compact_users(&extra_memo[i - 1], users, &user_count);
+    }
+
+    // 3. ユーザーごとに旧形式のキーと古い世代の累積請求を削除 (旧キーしかなければレコードに移行)
+    XAPAY_TRACE_STEP(3, user_count);
+    int64_t reclaimed = 0;
+    int64_t removed = 0;
+    for (int64_t i = 0; GUARD(COMPACT_MAX_USERS), i < user_count; ++i) {
+        uint8_t record_key[21];
+        xapay_record_t record;
+        xapay_record_load(&record, record_key, users[i]);
+
+        if (record.flags & XAPAY_RECORD_MIGRATED) {
+            compact_legacy_key(PREFIX_USER_BALANCE, users[i], &reclaimed, &removed);
+            compact_legacy_key(PREFIX_ALLOWANCE, users[i], &reclaimed, &removed);
+            record.flags &= ~XAPAY_RECORD_MIGRATED;
+            state_set(&record, sizeof(record), SBUF(record_key));
+            reclaimed -= XAPAY_RECORD_SIZE;
+        }
+
+        uint8_t claim_key[21];
+        xapay_claim_t claim;
+        xapay_state_key(claim_key, PREFIX_CLAIM, users[i]);
+        if (state(&claim, sizeof(claim), SBUF(claim_key)) == sizeof(claim) &&
+            claim.allowance_generation < record.allowance_generation)
+            compact_legacy_key(PREFIX_CLAIM, users[i], &reclaimed, &removed);
+    }
+
+    // 4. 削除する範囲を決める (ユーザー分とヘッダの書き込み1件を残して変更数の上限まで)
+    //    (tail - XAPAY_WITHDRAW_QUEUE_SIZE より前の位置は次の周回で上書き済み)
+    XAPAY_TRACE_STEP(4, removed);
+    xapay_withdraw_queue_t queue;
+    xapay_withdraw_queue_load(&queue);
+    uint32_t from = queue.swept;
+    if (queue.tail - from > XAPAY_WITHDRAW_QUEUE_SIZE)
+        from = queue.tail - XAPAY_WITHDRAW_QUEUE_SIZE;
+
+    int64_t budget = XAPAY_STATE_MAX_MODS - 1 - 4 * user_count;
+    int64_t sweep = (int64_t)(queue.head - from);
+    if (sweep > budget)
+        sweep = budget;
+
+    // 5. 発行済みの引き出しキューの位置を削除
+    XAPAY_TRACE_STEP(5, sweep);
+    if (sweep > 0) {
+        for (int64_t i = 0; GUARD(XAPAY_STATE_MAX_MODS), i < sweep; ++i) {
+            uint8_t slot_key[5];
+            xapay_withdraw_slot_key(slot_key, from + (uint32_t)i);
+            int64_t len = xapay_state_delete(SBUF(slot_key));
+            if (len >= 0) {
+                reclaimed += len;
+                removed++;
+            }
+        }
+        queue.swept = from + (uint32_t)sweep;
+        xapay_withdraw_queue_store(&queue);
+    }
+
+    XAPAY_TRACE_DEBUG("XApay Hook: Compaction done.");
+    XAPAY_TRACE_NUM("XApay Hook: State entries removed", removed);
+    accept(SBUF("XApay: State compacted."), reclaimed);
+    return 0;
+}
+
+/**
+ * @brief 加盟店の未精算額を閾値によらず精算する (運営者のみ)
+ *
+ * Memo の MERCHANT と ENTRY の USER に並べた加盟店のうち、未精算額のあるものに
+ * 1件ずつ精算の Payment を発行する。accept のコードは発行した Payment の数。
+ * 支払いを受けたことのない (未精算額の記録がない) アカウントが含まれていればロールバックする。
+ * @param memo 解析済みのMemo
+ * @return 承認または拒否コード
+ */
+int64_t handle_merchant_settle(xapay_memo_t* memo)
+{
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_MERCHANT_SETTLE, "XApay Hook: Handling Merchant Settlement.");
+
+    // 1. 送信元が運営アカウントであることを検証
+    XAPAY_TRACE_STEP(1, 0);
+    uint8_t source_accid[20];
+    otxn_field(SBUF(source_accid), sfAccount);
+    if (!BUFFER_EQUAL(source_accid, OPERATOR_ACCID, 20)) {
+        rollback(SBUF("XApay Error(Settle): Unauthorized trigger."), ERROR_SETTLE_UNAUTHORIZED);
+    }
+
+    // 2. 対象の加盟店の未精算額を読み込む
+    XAPAY_TRACE_STEP(2, 0);
+    batch_merchant_t merchants[BATCH_MAX_MERCHANTS];
+    int64_t merchant_count = 0;
+    if (memo->has_merchant)
+        batch_merchant(merchants, &merchant_count, memo->merchant_accid);
+    for (int64_t i = 0; GUARD(XAPAY_MEMO_MAX_ENTRIES), i < memo->entry_count; ++i) {
+        batch_merchant(merchants, &merchant_count, memo->entries[i].user_accid);
+    }
+
+    int64_t due = 0;
+    for (int64_t i = 0; GUARD(BATCH_MAX_MERCHANTS), i < merchant_count; ++i) {
+        if (!merchants[i].exists)
+            rollback(SBUF("XApay Error(Settle): Not a merchant."), ERROR_SETTLE_NOT_MERCHANT);
+        if (merchants[i].merchant.accrued > 0)
+            due++;
+    }
+    if (due == 0) {
+        accept(SBUF("XApay: Nothing to settle."), 0);
+    }
+
+    // 3. 発行枠を予約し、未精算額のある加盟店ごとに Payment を発行
+    XAPAY_TRACE_STEP(3, due);
+    int64_t reserved = etxn_reserve(due);
+    if (reserved < 0) {
+        XAPAY_TRACE_ERROR("XApay Hook: etxn_reserve failed", reserved);
+        rollback(SBUF("XApay Error(Settle): Could not reserve settlements."), ERROR_SETTLE_EMIT_FAILED);
+    }
+    for (int64_t i = 0; GUARD(BATCH_MAX_MERCHANTS), i < merchant_count; ++i) {
+        if (merchants[i].merchant.accrued <= 0)
+            continue;
+        merchant_settle(&merchants[i].merchant, merchants[i].accid);
+        xapay_merchant_store(&merchants[i].merchant, merchants[i].key);
+    }
+
+    accept(SBUF("XApay: Merchants settled."), due);
+    return 0;
+}
+
+/**
+ * @brief 累積請求を引き落とす (運営者のみ)
+ *
+ * ユーザーはオフレジャーで累積請求額が単調に増える請求に署名し、運営者は最新の請求だけを
+ * 保持してまとめて送信する。ユーザーの現在の利用許可の世代で引き落とし済みの累積請求額との差分だけを
+ * 残高から引き落とし、使用済み金額に加える (加盟店が指定されていればその未精算額に加算する)。
+ * 引き落とし済みと同じ累積請求額の請求は何もしない (再送しても二重に引き落とさない)。
+ * 請求は利用許可の世代に対して署名され、現在の世代以外の請求は拒否する。
+ * accept のコードは今回引き落とした合計額。
+ * @param memo 解析済みのMemo (単一の請求、または ENTRY に並べた請求)
+ * @return 承認または拒否コード
+ */
+int64_t handle_claim_redeem(xapay_memo_t* memo)
+{
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_CLAIM_REDEEM, "XApay Hook: Handling Claim Redemption.");
+
+    // 1. 送信元が運営アカウントであることを検証
+    XAPAY_TRACE_STEP(1, 0);
+    uint8_t source_accid[20];
+    otxn_field(SBUF(source_accid), sfAccount);
+    if (!BUFFER_EQUAL(source_accid, OPERATOR_ACCID, 20)) {
+        rollback(SBUF("XApay Error(Claim): Unauthorized trigger."), ERROR_CLAIM_UNAUTHORIZED);
+    }
+
+    // 2. 請求を集める (加盟店を省略した ENTRY は Memo の加盟店)
+    XAPAY_TRACE_STEP(2, 0);
+    xapay_entry_t claims[XAPAY_MEMO_MAX_ENTRIES];
+    int64_t claim_count = 0;
+    if (memo->entry_count > 0) {
+        for (int64_t i = 0; GUARD(XAPAY_MEMO_MAX_ENTRIES), i < memo->entry_count; ++i) {
+            claims[i] = memo->entries[i];
+            if (!claims[i].merchant_accid && memo->has_merchant)
+                claims[i].merchant_accid = memo->merchant_accid;
+        }
+        claim_count = memo->entry_count;
+    } else {
+        if (!memo->has_user)
+            rollback(SBUF("XApay Error(Claim): 'user' missing."), ERROR_MISSING_FIELD);
+        claims[0].user_accid = memo->user_accid;
+        claims[0].amount = memo->amount;
+        claims[0].signature = memo->signature;
+        claims[0].merchant_accid = memo->has_merchant ? memo->merchant_accid : 0;
+        claims[0].generation = memo->generation;
+        claim_count = 1;
+    }
+
+    // 3. 請求を順に適用する (Stateの書き込みは最後にまとめて行う)
+    XAPAY_TRACE_STEP(3, claim_count);
+    batch_user_t users[BATCH_MAX_USERS];
+    int64_t user_count = 0;
+    uint8_t claim_keys[BATCH_MAX_USERS][21];
+    xapay_claim_t claim_states[BATCH_MAX_USERS];
+    batch_merchant_t merchants[BATCH_MAX_MERCHANTS];
+    int64_t merchant_count = 0;
+    int64_t debited = 0;
+
+    for (int64_t i = 0; GUARD(XAPAY_MEMO_MAX_ENTRIES), i < claim_count; ++i) {
+        xapay_entry_t* entry = &claims[i];
+
+        int64_t total;
+        if (entry->amount.len <= 0)
+            rollback(SBUF("XApay Error(Claim): 'amount' missing."), ERROR_MISSING_FIELD);
+        if (xapay_yen_parse(&total, entry->amount.ptr, entry->amount.len) < 0 || total <= 0)
+            rollback(SBUF("XApay Error(Claim): Invalid claim total."), ERROR_INVALID_AMOUNT);
+        if (entry->signature.len <= 0 || entry->signature.len > 74)
+            rollback(SBUF("XApay Error(Claim): Invalid signature length."), ERROR_CLAIM_VERIFICATION_FAILED);
+        int64_t generation;
+        if (entry->generation.len <= 0)
+            rollback(SBUF("XApay Error(Claim): 'generation' missing."), ERROR_MISSING_FIELD);
+        if (xapay_yen_parse(&generation, entry->generation.ptr, entry->generation.len) < 0)
+            rollback(SBUF("XApay Error(Claim): Invalid generation."), ERROR_CLAIM_VERIFICATION_FAILED);
+
+        // ユーザーのレコードと、現在の利用許可の世代での引き落とし済み額 (初出のユーザーのみ読み込む)
+        int64_t seen = user_count;
+        int64_t u = batch_user(users, &user_count, entry->user_accid);
+        xapay_record_t* rec = &users[u].record;
+        if (!(rec->flags & XAPAY_RECORD_HAS_ALLOWANCE))
+            rollback(SBUF("XApay Error(Claim): No active allowance."), ERROR_CLAIM_VERIFICATION_FAILED);
+        if (u == seen)
+            xapay_claim_load(&claim_states[u], claim_keys[u], entry->user_accid, rec->allowance_generation);
+        xapay_claim_t* claim = &claim_states[u];
+
+        // 古い世代の請求は拒否する (新しい世代の請求はまだ存在しない利用許可に対するもの)
+        if (generation < rec->allowance_generation || claim->allowance_generation != rec->allowance_generation)
+            rollback(SBUF("XApay Error(Claim): Claim is for an older allowance."), ERROR_CLAIM_STALE);
+        if (generation > rec->allowance_generation)
+            rollback(SBUF("XApay Error(Claim): Unknown allowance generation."), ERROR_CLAIM_VERIFICATION_FAILED);
+
+        if (total < claim->redeemed)
+            rollback(SBUF("XApay Error(Claim): Claim total below redeemed total."), ERROR_CLAIM_STALE);
+        if (total == claim->redeemed)
+            continue;
+
+        if (verify_claim_signature(entry->user_accid, rec->allowance_hash, entry->generation.ptr, entry->generation.len,
+                                   entry->amount.ptr, entry->amount.len,
+                                   entry->signature.ptr, entry->signature.len) != 1) {
+            rollback(SBUF("XApay Error(Claim): Signature verification failed."), ERROR_CLAIM_VERIFICATION_FAILED);
+        }
+
+        // 差分を利用上限と残高の範囲で引き落とす
+        int64_t delta = total - claim->redeemed;
+        int64_t new_spent;
+        if (xapay_yen_add(&new_spent, rec->spent, delta) < 0 || new_spent > rec->allowance) {
+            rollback(SBUF("XApay Error(Claim): Amount exceeds allowance."), ERROR_ALLOWANCE_EXCEEDED);
+        }
+        if (xapay_yen_sub(&rec->balance, rec->balance, delta) < 0) {
+            rollback(SBUF("XApay Error(Claim): Insufficient balance."), ERROR_INSUFFICIENT_BALANCE);
+        }
+        rec->spent = new_spent;
+        claim->redeemed = total;
+        debited += delta;
+        XAPAY_TRACE_ITEM(3, delta);
+
+        if (entry->merchant_accid) {
+            int64_t m = batch_merchant(merchants, &merchant_count, entry->merchant_accid);
+            merchant_credit(&merchants[m].merchant, delta);
+        }
+    }
+
+    // 4. 閾値に達した加盟店に精算の Payment を発行
+    XAPAY_TRACE_STEP(4, merchant_count);
+    batch_settle_merchants(merchants, merchant_count);
+
+    // 5. Stateの更新
+    XAPAY_TRACE_STEP(5, debited);
+    for (int64_t i = 0; GUARD(BATCH_MAX_USERS), i < user_count; ++i) {
+        xapay_record_store(&users[i].record, users[i].record_key);
+        xapay_claim_store(&claim_states[i], claim_keys[i]);
+    }
+    for (int64_t i = 0; GUARD(BATCH_MAX_MERCHANTS), i < merchant_count; ++i) {
+        xapay_merchant_store(&merchants[i].merchant, merchants[i].key);
+    }
+
+    accept(SBUF("XApay: Claims redeemed."), debited);
+    return 0;
+}
+
+/**
+ * @brief 署名の検証に使う公開鍵を登録する (ユーザー本人の Invoke)
+ *
+ * 元トランザクションの SigningPubKey は台帳がこのアカウントの署名鍵 (マスターキーまたは
+ * RegularKey) として検証済みのため、そのまま登録できる。鍵の種類は先頭バイトで判定して一緒に保存する。
+ * 登録済みの場合は上書きする (RegularKey を変更したときは、新しい鍵で署名して登録し直す)。
+ * @param memo 解析済みのMemo (フィールドなし)
+ * @return 承認または拒否コード
+ */
+int64_t handle_register_key(xapay_memo_t* memo)
+{
+    XAPAY_TRACE_ENTER(XAPAY_HANDLER_REGISTER_KEY, "XApay Hook: Handling Key Registration.");
+    (void)memo;
+
+    // 1. ユーザーのアカウントIDを取得
+    XAPAY_TRACE_STEP(1, 0);
+    uint8_t user_accid[20];
+    otxn_field(SBUF(user_accid), sfAccount);
+
+    // 2. 署名に使われた公開鍵を取得 (マルチシグの場合は空になり登録できない)
+    //    otxn_field は Blob を長さの接頭辞 (1バイト) 付きで書き込む
+    XAPAY_TRACE_STEP(2, 0);
+    uint8_t pubkey_field[1 + XAPAY_PUBKEY_SIZE];
+    int64_t pubkey_len = otxn_field(SBUF(pubkey_field), sfSigningPubKey);
+    if (pubkey_len > 0 && pubkey_field[0] == pubkey_len - 1)
+        pubkey_len--;
+    else
+        pubkey_len = -1;
+    xapay_pubkey_t key;
+    COPY(key.pubkey, pubkey_field + 1, XAPAY_PUBKEY_SIZE);
+
+    // 3. 鍵の種類を判定
+    XAPAY_TRACE_STEP(3, pubkey_len);
+    int64_t key_type = xapay_pubkey_type(key.pubkey, pubkey_len);
+    if (key_type < 0) {
+        rollback(SBUF("XApay Error(RegisterKey): Invalid signing key."), ERROR_KEY_INVALID);
+    }
+    key.key_type = (uint8_t)key_type;
+
+    // 4. Stateを更新
+    XAPAY_TRACE_STEP(4, 0);
+    xapay_pubkey_store(&key, user_accid);
+
+    accept(SBUF("XApay: Signing key registered."), SUCCESS);
+    return 0;
+}
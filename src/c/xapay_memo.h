@@ -0,0 +1,452 @@
+/**
+ * XApay Hook - Memoデコーダ
+ *
+ * Invoke の Memo を hook() で一度だけ解析し、各ハンドラに渡す固定構造体にまとめます。
+ *
+ * バイナリTLV形式 (推奨):
+ *   [0]   'X' (XAPAY_MEMO_MAGIC)
+ *   [1]   バージョン (XAPAY_MEMO_VERSION)
+ *   [2..] タグ(1バイト) 長さ(1バイト) 値 の繰り返し
+ *
+ *   TYPE             1バイト (XAPAY_MEMO_TYPE_*)
+ *   USER             ユーザーのアカウントID (20バイト)
+ *   AMOUNT           支払い額・引き出し額・累積請求額 (10進文字列)
+ *   ALLOWANCE_AMOUNT 利用許可額 (10進文字列、署名対象と同じバイト列)
+ *   SIGNATURE        利用許可署名・請求署名 (バイナリ)
+ *   ENTRY            一括決済の1件分 (値は USER/AMOUNT/ALLOWANCE_AMOUNT/SIGNATURE/MERCHANT/GENERATION のTLV)
+ *   MERCHANT         支払い先の加盟店のアカウントID (20バイト、省略可)
+ *   GENERATION       累積請求の対象の利用許可の世代番号 (10進文字列、署名対象と同じバイト列)
+ *   NONCE            ノンス付きの支払いのユーザーごとの連番 (10進文字列、1以上、署名対象と同じバイト列)
+ *
+ * 一括決済 (TYPE=PAYMENT_BATCH) では ENTRY を支払い順に並べます。ENTRY の
+ * ALLOWANCE_AMOUNT と SIGNATURE は省略でき、その場合はユーザーの現在の利用許可
+ * (Stateに保存済みのもの) を使います。指定する場合も現在の利用許可と同じでなければなりません。
+ * ENTRY の MERCHANT を省略した場合は Memo の MERCHANT を使います (どちらもなければ加盟店への入金なし)。
+ *
+ * 先頭が MAGIC でない Memo は従来のJSON形式として解析します。
+ *
+ * Memo は元トランザクションをスロットに読み込み、sfMemos の各要素の sfMemoData を取り出します
+ * (xapay_memo_slot / xapay_memo_data)。
+ */
+
+#ifndef XAPAY_MEMO_H
+#define XAPAY_MEMO_H
+
+#include <stdint.h>
+
+#define XAPAY_MEMO_MAGIC   0x58 // 'X'
+#define XAPAY_MEMO_VERSION 0x01
+#define XAPAY_MEMO_MAX_FIELDS 16
+#define XAPAY_MEMO_MAX_ENTRIES 16
+#define XAPAY_MEMO_MAX_COUNT  4  // 1回の実行で解析するMemoの最大数
+#define XAPAY_MEMO_DATA_SIZE  1024 // MemoData の最大長
+// Memo オブジェクト (MemoData とフィールドヘッダ・長さ) を読み込む領域の大きさ
+#define XAPAY_MEMO_BUFFER_SIZE (XAPAY_MEMO_DATA_SIZE + 16)
+// JSON形式の1つのMemoで値を探す回数の上限 (入れ子のキーを含む)
+#define XAPAY_MEMO_JSON_LOOKUPS 10
+
+// TLVタグ
+#define XAPAY_TLV_TYPE             0x01
+#define XAPAY_TLV_USER             0x02
+#define XAPAY_TLV_AMOUNT           0x03
+#define XAPAY_TLV_ALLOWANCE_AMOUNT 0x04
+#define XAPAY_TLV_SIGNATURE        0x05
+#define XAPAY_TLV_ENTRY            0x06
+#define XAPAY_TLV_MERCHANT         0x07
+#define XAPAY_TLV_GENERATION       0x08
+#define XAPAY_TLV_NONCE            0x09
+
+// Memoの種類
+#define XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT 1
+#define XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE  2
+#define XAPAY_MEMO_TYPE_WITHDRAW          3
+#define XAPAY_MEMO_TYPE_PAYMENT_BATCH     4
+#define XAPAY_MEMO_TYPE_WITHDRAW_FLUSH    5 // 運営者のみ、TLVのみ (AMOUNT: 発行する最大件数、省略可)
+#define XAPAY_MEMO_TYPE_COMPACT           6 // 運営者のみ、TLVのみ (ENTRY: 対象ユーザーの USER のみ、省略可)
+#define XAPAY_MEMO_TYPE_MERCHANT_SETTLE   7 // 運営者のみ、TLVのみ (MERCHANT または ENTRY の USER: 精算する加盟店)
+#define XAPAY_MEMO_TYPE_CLAIM_REDEEM      8 // 運営者のみ、TLVのみ (USER/AMOUNT/GENERATION/SIGNATURE/MERCHANT または ENTRY: 累積請求)
+#define XAPAY_MEMO_TYPE_REGISTER_KEY      9 // ユーザー本人のみ、TLVのみ (フィールドなし: SigningPubKey を登録)
+#define XAPAY_MEMO_TYPE_NONCE_PAYMENT    10 // 運営者のみ、TLVのみ (USER/AMOUNT/NONCE/SIGNATURE と任意の MERCHANT: ノンス付きの支払い)
+#define XAPAY_MEMO_TYPE_LAST              XAPAY_MEMO_TYPE_NONCE_PAYMENT
+
+typedef struct {
+    const uint8_t* ptr;
+    int64_t len;    // 0以下: 値なし
+} xapay_view_t;
+
+// 一括決済の1件分
+typedef struct {
+    const uint8_t* user_accid;     // 20バイト
+    xapay_view_t amount;
+    xapay_view_t allowance_amount; // 省略時は len 0
+    xapay_view_t signature;        // 省略時は len 0
+    const uint8_t* merchant_accid; // 20バイト、省略時は 0
+    xapay_view_t generation;       // 累積請求のみ、省略時は len 0
+} xapay_entry_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t has_user;              // user_accid が有効
+    uint8_t user_accid[20];
+    int64_t user_raddr_len;        // JSONの user_address の長さ (0以下: 指定なし)
+    xapay_view_t amount;
+    xapay_view_t allowance_amount;
+    xapay_view_t signature;
+    uint8_t has_merchant;          // merchant_accid が有効
+    uint8_t merchant_accid[20];
+    xapay_view_t generation;
+    xapay_view_t nonce;
+
+    // 一括決済 (TYPE=PAYMENT_BATCH) のエントリ
+    xapay_entry_t entries[XAPAY_MEMO_MAX_ENTRIES];
+    int64_t entry_count;
+
+    // JSONフォールバック時の署名 (16進数から変換したもの。signature はここを指す)
+    uint8_t json_signature[74];
+} xapay_memo_t;
+
+static inline void xapay_view_set(xapay_view_t* view, const uint8_t* ptr, int64_t len)
+{
+    view->ptr = ptr;
+    view->len = len;
+}
+
+static inline int64_t xapay_memo_decode_entry(xapay_entry_t* entry, const uint8_t* data, int64_t len)
+{
+    entry->user_accid = 0;
+    entry->merchant_accid = 0;
+    xapay_view_set(&entry->amount, 0, 0);
+    xapay_view_set(&entry->allowance_amount, 0, 0);
+    xapay_view_set(&entry->signature, 0, 0);
+    xapay_view_set(&entry->generation, 0, 0);
+
+    int64_t pos = 0;
+    for (int i = 0; GUARD(XAPAY_MEMO_MAX_COUNT * XAPAY_MEMO_MAX_ENTRIES * XAPAY_MEMO_MAX_FIELDS), i < XAPAY_MEMO_MAX_FIELDS && pos < len; ++i) {
+        if (pos + 2 > len)
+            return -1;
+        uint8_t tag = data[pos];
+        int64_t field_len = data[pos + 1];
+        const uint8_t* value = data + pos + 2;
+        pos += 2 + field_len;
+        if (pos > len)
+            return -1;
+
+        if (tag == XAPAY_TLV_USER) {
+            if (field_len != 20) return -1;
+            entry->user_accid = value;
+        }
+        else if (tag == XAPAY_TLV_AMOUNT)
+            xapay_view_set(&entry->amount, value, field_len);
+        else if (tag == XAPAY_TLV_ALLOWANCE_AMOUNT)
+            xapay_view_set(&entry->allowance_amount, value, field_len);
+        else if (tag == XAPAY_TLV_SIGNATURE)
+            xapay_view_set(&entry->signature, value, field_len);
+        else if (tag == XAPAY_TLV_MERCHANT) {
+            if (field_len != 20) return -1;
+            entry->merchant_accid = value;
+        }
+        else if (tag == XAPAY_TLV_GENERATION)
+            xapay_view_set(&entry->generation, value, field_len);
+    }
+    if (pos != len || !entry->user_accid)
+        return -1;
+    return 0;
+}
+
+static inline int64_t xapay_memo_decode_tlv(xapay_memo_t* memo, const uint8_t* data, int64_t len)
+{
+    if (len < 2 || data[1] != XAPAY_MEMO_VERSION)
+        return -1;
+
+    int64_t pos = 2;
+    for (int i = 0; GUARD(XAPAY_MEMO_MAX_COUNT * (XAPAY_MEMO_MAX_FIELDS + XAPAY_MEMO_MAX_ENTRIES)),
+         i < XAPAY_MEMO_MAX_FIELDS + XAPAY_MEMO_MAX_ENTRIES && pos < len; ++i) {
+        if (pos + 2 > len)
+            return -1;
+        uint8_t tag = data[pos];
+        int64_t field_len = data[pos + 1];
+        const uint8_t* value = data + pos + 2;
+        pos += 2 + field_len;
+        if (pos > len)
+            return -1;
+
+        switch (tag) {
+        case XAPAY_TLV_TYPE:
+            if (field_len != 1) return -1;
+            memo->type = value[0];
+            break;
+        case XAPAY_TLV_USER:
+            if (field_len != 20) return -1;
+            COPY(memo->user_accid, value, 20);
+            memo->has_user = 1;
+            break;
+        case XAPAY_TLV_AMOUNT:
+            xapay_view_set(&memo->amount, value, field_len);
+            break;
+        case XAPAY_TLV_ALLOWANCE_AMOUNT:
+            xapay_view_set(&memo->allowance_amount, value, field_len);
+            break;
+        case XAPAY_TLV_SIGNATURE:
+            xapay_view_set(&memo->signature, value, field_len);
+            break;
+        case XAPAY_TLV_MERCHANT:
+            if (field_len != 20) return -1;
+            COPY(memo->merchant_accid, value, 20);
+            memo->has_merchant = 1;
+            break;
+        case XAPAY_TLV_GENERATION:
+            xapay_view_set(&memo->generation, value, field_len);
+            break;
+        case XAPAY_TLV_NONCE:
+            xapay_view_set(&memo->nonce, value, field_len);
+            break;
+        case XAPAY_TLV_ENTRY:
+            if (memo->entry_count >= XAPAY_MEMO_MAX_ENTRIES) return -1;
+            if (xapay_memo_decode_entry(&memo->entries[memo->entry_count], value, field_len) < 0) return -1;
+            memo->entry_count++;
+            break;
+        default:
+            // 未知のタグは読み飛ばす (後方互換)
+            break;
+        }
+    }
+    if (pos != len)
+        return -1;
+
+    if (memo->type < XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT || memo->type > XAPAY_MEMO_TYPE_LAST)
+        return -1;
+    if (memo->type == XAPAY_MEMO_TYPE_PAYMENT_BATCH && memo->entry_count == 0)
+        return -1;
+    return 0;
+}
+
+static inline int64_t xapay_json_is_space(uint8_t c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline int64_t xapay_json_skip_space(const uint8_t* data, int64_t len, int64_t pos)
+{
+    for (; GUARD(XAPAY_MEMO_MAX_COUNT * XAPAY_MEMO_JSON_LOOKUPS * XAPAY_MEMO_DATA_SIZE),
+         pos < len && xapay_json_is_space(data[pos]); ++pos)
+        ;
+    return pos;
+}
+
+/**
+ * @brief pos から始まるJSONの値の直後の位置を返す
+ *
+ * 文字列・オブジェクト・配列は閉じ記号まで、それ以外は区切り文字の手前まで進める。
+ * @return 値の直後の位置 (負数: 値が閉じていない)
+ */
+static inline int64_t xapay_json_skip_value(const uint8_t* data, int64_t len, int64_t pos)
+{
+    int64_t depth = 0;
+    int64_t in_string = 0;
+    for (; GUARD(XAPAY_MEMO_MAX_COUNT * XAPAY_MEMO_JSON_LOOKUPS * XAPAY_MEMO_DATA_SIZE), pos < len; ++pos) {
+        uint8_t c = data[pos];
+        if (in_string) {
+            if (c == '\\')
+                ++pos;
+            else if (c == '"') {
+                in_string = 0;
+                if (depth == 0)
+                    return pos + 1;
+            }
+        }
+        else if (c == '"')
+            in_string = 1;
+        else if (c == '{' || c == '[')
+            ++depth;
+        else if (c == '}' || c == ']') {
+            if (depth == 0)
+                return pos;
+            if (--depth == 0)
+                return pos + 1;
+        }
+        else if (depth == 0 && (c == ',' || xapay_json_is_space(c)))
+            return pos;
+    }
+    return (in_string || depth > 0) ? -1 : pos;
+}
+
+/**
+ * @brief JSONオブジェクトのトップレベルから key の値を探す
+ *
+ * 文字列の値は引用符の内側 (エスケープはそのまま)、それ以外は値の全体を value に設定する。
+ * @return 値の長さ (負数: キーがない・不正なJSON)
+ */
+static inline int64_t xapay_json_find(xapay_view_t* value, const uint8_t* data, int64_t len,
+                                      const char* key, int64_t key_len)
+{
+    xapay_view_set(value, 0, -1);
+    int64_t pos = xapay_json_skip_space(data, len, 0);
+    if (pos >= len || data[pos] != '{')
+        return -1;
+    ++pos;
+    for (int i = 0; GUARD(XAPAY_MEMO_MAX_COUNT * XAPAY_MEMO_JSON_LOOKUPS * XAPAY_MEMO_MAX_FIELDS),
+         i < XAPAY_MEMO_MAX_FIELDS; ++i) {
+        pos = xapay_json_skip_space(data, len, pos);
+        if (pos >= len || data[pos] != '"')
+            return -1;
+        int64_t key_start = pos + 1;
+        pos = xapay_json_skip_value(data, len, pos);
+        if (pos < 0)
+            return -1;
+        int64_t found = pos - 1 - key_start == key_len && BUFFER_EQUAL(data + key_start, key, key_len);
+
+        pos = xapay_json_skip_space(data, len, pos);
+        if (pos >= len || data[pos] != ':')
+            return -1;
+        int64_t value_start = xapay_json_skip_space(data, len, pos + 1);
+        pos = xapay_json_skip_value(data, len, value_start);
+        if (pos <= value_start)
+            return -1;
+        if (found) {
+            if (data[value_start] == '"')
+                xapay_view_set(value, data + value_start + 1, pos - value_start - 2);
+            else
+                xapay_view_set(value, data + value_start, pos - value_start);
+            return value->len;
+        }
+
+        pos = xapay_json_skip_space(data, len, pos);
+        if (pos >= len || data[pos] != ',')
+            return -1;
+        ++pos;
+    }
+    return -1;
+}
+
+#define XAPAY_JSON_FIND(value, data, len, key) xapay_json_find((value), (data), (len), (key), sizeof(key) - 1)
+
+static inline int64_t xapay_hex_nibble(uint8_t c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ * @brief 16進数文字列をバイト列に変換する
+ * @return 変換したバイト数 (負数: 奇数桁・16進数以外の文字・領域不足)
+ */
+static inline int64_t xapay_hex_decode(uint8_t* out, int64_t out_len, const uint8_t* hex, int64_t hex_len)
+{
+    if (hex_len < 0 || hex_len % 2 || hex_len / 2 > out_len)
+        return -1;
+    for (int64_t i = 0; GUARD(XAPAY_MEMO_MAX_COUNT * 74), i < hex_len / 2; ++i) {
+        int64_t hi = xapay_hex_nibble(hex[i * 2]);
+        int64_t lo = xapay_hex_nibble(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0)
+            return -1;
+        out[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return hex_len / 2;
+}
+
+static inline int64_t xapay_memo_decode_json(xapay_memo_t* memo, const uint8_t* data, int64_t len)
+{
+    // typeが無い・不明な場合は従来どおり利用許可決済として扱う
+    xapay_view_t type;
+    XAPAY_JSON_FIND(&type, data, len, "type");
+    memo->type = XAPAY_MEMO_TYPE_ALLOWANCE_PAYMENT;
+    if (type.len == 16 && BUFFER_EQUAL(type.ptr, "update_allowance", 16))
+        memo->type = XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE;
+    else if (type.len == 8 && BUFFER_EQUAL(type.ptr, "withdraw", 8))
+        memo->type = XAPAY_MEMO_TYPE_WITHDRAW;
+
+    xapay_view_t sig_hex;
+    xapay_view_set(&sig_hex, 0, 0);
+
+    if (memo->type == XAPAY_MEMO_TYPE_WITHDRAW) {
+        XAPAY_JSON_FIND(&memo->amount, data, len, "amount");
+        return 0;
+    }
+
+    if (memo->type == XAPAY_MEMO_TYPE_UPDATE_ALLOWANCE) {
+        XAPAY_JSON_FIND(&memo->allowance_amount, data, len, "allowance");
+        XAPAY_JSON_FIND(&sig_hex, data, len, "signature");
+    } else {
+        xapay_view_t raddr;
+        memo->user_raddr_len = XAPAY_JSON_FIND(&raddr, data, len, "user_address");
+        if (memo->user_raddr_len > 0 &&
+            util_accid(memo->user_accid, sizeof(memo->user_accid), raddr.ptr, raddr.len) == 20)
+            memo->has_user = 1;
+
+        if (XAPAY_JSON_FIND(&raddr, data, len, "merchant_address") > 0) {
+            if (util_accid(memo->merchant_accid, sizeof(memo->merchant_accid), raddr.ptr, raddr.len) != 20)
+                return -1;
+            memo->has_merchant = 1;
+        }
+
+        XAPAY_JSON_FIND(&memo->amount, data, len, "payment_amount");
+        xapay_view_t allowance;
+        if (XAPAY_JSON_FIND(&allowance, data, len, "allowance") > 0) {
+            XAPAY_JSON_FIND(&memo->allowance_amount, allowance.ptr, allowance.len, "amount");
+            XAPAY_JSON_FIND(&sig_hex, allowance.ptr, allowance.len, "signature");
+        }
+    }
+
+    if (sig_hex.len > 0)
+        xapay_view_set(&memo->signature, memo->json_signature,
+            xapay_hex_decode(memo->json_signature, sizeof(memo->json_signature), sig_hex.ptr, sig_hex.len));
+    return 0;
+}
+
+/**
+ * @brief Memoを解析して構造体に格納する
+ * @return 0: 成功, 負数: 不正なTLV
+ */
+static inline int64_t xapay_memo_decode(xapay_memo_t* memo, const uint8_t* data, int64_t len)
+{
+    memo->type = 0;
+    memo->has_user = 0;
+    memo->has_merchant = 0;
+    memo->user_raddr_len = 0;
+    memo->entry_count = 0;
+    xapay_view_set(&memo->amount, 0, 0);
+    xapay_view_set(&memo->allowance_amount, 0, 0);
+    xapay_view_set(&memo->signature, 0, 0);
+    xapay_view_set(&memo->generation, 0, 0);
+    xapay_view_set(&memo->nonce, 0, 0);
+
+    if (len > 0 && data[0] == XAPAY_MEMO_MAGIC)
+        return xapay_memo_decode_tlv(memo, data, len);
+    return xapay_memo_decode_json(memo, data, len);
+}
+
+/**
+ * @brief 元トランザクションをスロットに読み込み、その sfMemos のスロットを返す
+ * @return sfMemos のスロット番号 (負数: Memo がない)
+ */
+static inline int64_t xapay_memo_slot(void)
+{
+    int64_t txn_slot = otxn_slot(0);
+    if (txn_slot < 0)
+        return txn_slot;
+    return slot_subfield(txn_slot, sfMemos, 0);
+}
+
+/**
+ * @brief index 番目の Memo を buf に読み込み、その MemoData の位置を data に設定する
+ * @return MemoData の長さ (負数: Memo・MemoData がない、または buf に収まらない)
+ */
+static inline int64_t xapay_memo_data(const uint8_t** data, uint8_t* buf, uint32_t buf_len,
+                                      int64_t memos_slot, uint32_t index)
+{
+    int64_t memo_slot = slot_subarray(memos_slot, index, 0);
+    if (memo_slot < 0)
+        return memo_slot;
+    int64_t memo_len = slot(buf, buf_len, memo_slot);
+    if (memo_len < 0)
+        return memo_len;
+    int64_t found = sto_subfield(buf, memo_len, sfMemoData);
+    if (found < 0)
+        return found;
+    *data = buf + SUB_OFFSET(found);
+    return SUB_LENGTH(found);
+}
+
+#endif
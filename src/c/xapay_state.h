@@ -0,0 +1,341 @@
+/**
+ * XApay Hook - Stateのレイアウト
+ *
+ * ユーザーごとのデータは 'R'+アカウントID (21バイト) の固定長レコード1件にまとめ、
+ * 1回のトランザクションで1回だけ読み込み、1回だけ書き込みます。
+ *
+ * レコード (XAPAY_RECORD_SIZE バイト、リトルエンディアン):
+ *   version               レイアウトのバージョン (XAPAY_RECORD_VERSION)
+ *   flags                 XAPAY_RECORD_HAS_ALLOWANCE など
+ *   allowance_generation  利用許可が入れ替わるたびに増える世代番号
+ *   balance               残高
+ *   allowance             現在の利用許可の上限額 (円)
+ *   spent                 現在の利用許可で使用済みの金額 (円)
+ *   nonce_high            使用済みNonceの最大値
+ *   nonce_window          nonce_high から遡って64個分の使用済みビットマップ (bit i = nonce_high - i)
+ *   allowance_hash        現在の利用許可 (ユーザー・許可額・署名) のダイジェスト
+ *
+ * バージョンまたは長さが一致しないデータはレコードとして扱いません (新規ユーザーと同じ)。
+ *
+ * 旧形式のキー ('U' 残高 int64, 'A' 利用許可額の10進文字列) しか持たないユーザーは、
+ * 初回の読み込みで旧キーからレコードを組み立て、書き込み時に旧キーを削除します (1回限りの移行)。
+ * 旧形式の利用許可は署名のダイジェストを持たないため、移行したレコードに
+ * XAPAY_RECORD_HAS_ALLOWANCE は立てず、次のチャージ＋利用許可枠更新で改めて設定します。
+ * (旧形式の署名・使用済み金額はキーが32バイトを超えるため保存されておらず、移行対象はありません)
+ *
+ * Nonceはユーザーごとのスライディングウィンドウで再利用を防ぎます。nonce_high より大きい
+ * Nonceと、nonce_high から XAPAY_NONCE_WINDOW 未満の範囲で未使用のNonceを受け付けるため、
+ * 順不同で届いた支払いも処理でき、Stateの大きさはNonceの数によらず一定です。
+ *
+ * 引き出しキュー:
+ *   'W'+アカウントID  引き出し待ち (xapay_withdraw_t)。同じ宛先への引き出しは合算する
+ *   'Q'               キューのヘッダ (xapay_withdraw_queue_t)
+ *   'Q'+位置 (u32)    引き出し待ちの宛先 (アカウントID)。位置は XAPAY_WITHDRAW_QUEUE_SIZE の
+ *                     リングバッファで、発行済みのエントリは削除せず次の周回で上書きする
+ *                     (フラッシュで変更するキーを 'W' の削除とヘッダだけに抑えるため)。
+ *                     発行済みのエントリは運営者のコンパクション (handle_compact) で削除する
+ *
+ * 加盟店:
+ *   'M'+アカウントID  加盟店の未精算額 (xapay_merchant_t)。支払いと同じ実行で加算し、
+ *                     閾値 (xapay_config.h) に達するか運営者が精算を指示したときに
+ *                     まとめて1件の Payment で精算する
+ *
+ * 累積請求 (ストリーミング決済):
+ *   'C'+アカウントID  利用許可の世代ごとの引き落とし済みの累積請求額 (xapay_claim_t)。
+ *                     世代はユーザー本人のチャージ＋利用許可枠更新でしか進まないため、
+ *                     世代が進んだときだけ0から数え直し、古い世代の請求は受け付けない
+ *
+ * 登録済みの公開鍵:
+ *   'K'+アカウントID  ユーザーの署名の検証に使う公開鍵と鍵の種類 (xapay_pubkey_t)。
+ *                     ユーザー自身の Invoke (XAPAY_MEMO_TYPE_REGISTER_KEY) の SigningPubKey を
+ *                     登録する。署名の検証はこのキーを1回読むだけで、台帳のアカウントは参照しない
+ */
+
+#ifndef XAPAY_STATE_H
+#define XAPAY_STATE_H
+
+#include <stdint.h>
+#include "xapay_yen.h"
+
+// Stateキーのプレフィックス
+#define PREFIX_USER_RECORD  0x52 // 'R'
+
+// 旧形式のプレフィックス (移行のためにのみ参照)
+#define PREFIX_USER_BALANCE 0x55 // 'U'
+#define PREFIX_ALLOWANCE    0x41 // 'A'
+
+#define XAPAY_RECORD_VERSION 1
+#define XAPAY_RECORD_SIZE    80
+
+#define XAPAY_NONCE_WINDOW 64
+
+#define XAPAY_RECORD_HAS_ALLOWANCE 0x01
+#define XAPAY_RECORD_MIGRATED      0x80 // 旧キーから組み立てた (読み込み中のみ、書き込み時に旧キーを削除して外す)
+
+// 1回の実行で変更 (書き込み・削除) できる State のキー数
+#define XAPAY_STATE_MAX_MODS 256
+
+// 引き出しキュー
+#define PREFIX_WITHDRAW_PENDING 0x57 // 'W'
+#define PREFIX_WITHDRAW_QUEUE   0x51 // 'Q'
+
+#define XAPAY_WITHDRAW_QUEUE_SIZE 4096 // 同時に引き出し待ちにできる宛先の数
+// 1回のフラッシュで発行する Payment の最大数 (etxn_reserve の上限)。
+// 変更する State は 'W' の削除 255件 + ヘッダ1件で、1回の実行の上限 (256) に収まる
+#define XAPAY_WITHDRAW_FLUSH_MAX  255
+
+// 加盟店
+#define PREFIX_MERCHANT 0x4D // 'M'
+
+// 累積請求
+#define PREFIX_CLAIM 0x43 // 'C'
+
+// 登録済みの公開鍵
+#define PREFIX_PUBKEY 0x4B // 'K'
+
+#define XAPAY_KEY_TYPE_SECP256K1 0 // 先頭バイトが 0x02 / 0x03 の圧縮公開鍵
+#define XAPAY_KEY_TYPE_ED25519   1 // 先頭バイトが 0xED
+#define XAPAY_PUBKEY_SIZE        33
+
+typedef struct {
+    uint8_t version;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t allowance_generation;
+    int64_t balance;
+    int64_t allowance;
+    int64_t spent;
+    uint64_t nonce_high;
+    uint64_t nonce_window;
+    uint8_t allowance_hash[32];
+} xapay_record_t;
+
+typedef char xapay_record_size_check[sizeof(xapay_record_t) == XAPAY_RECORD_SIZE ? 1 : -1];
+
+typedef struct {
+    int64_t amount;     // 引き出し待ちの合計額 (円)
+    uint32_t requests;  // 合算した引き出し要求の数
+    uint32_t position;  // キュー内の位置 (xapay_withdraw_queue_t の tail の値)
+} xapay_withdraw_t;
+
+typedef struct {
+    uint32_t head;      // 次に発行する位置 (通算)
+    uint32_t tail;      // 次に追加する位置 (通算)。tail - head が引き出し待ちの宛先数
+    uint32_t swept;     // この位置より前の発行済みエントリは削除済み
+} xapay_withdraw_queue_t;
+
+typedef struct {
+    int64_t accrued;       // 未精算の合計額 (円)
+    int64_t settled;       // 精算済みの累計額 (円)
+    uint32_t payments;     // 未精算の支払い数
+    uint32_t settlements;  // 精算の回数
+} xapay_merchant_t;
+
+typedef struct {
+    uint32_t allowance_generation; // 請求の対象の利用許可の世代 (xapay_record_t の allowance_generation)
+    uint32_t reserved;
+    int64_t redeemed;              // 引き落とし済みの累積請求額 (円)
+} xapay_claim_t;
+
+typedef struct {
+    uint8_t key_type;                   // XAPAY_KEY_TYPE_*
+    uint8_t pubkey[XAPAY_PUBKEY_SIZE];  // SigningPubKey (33バイト)
+} xapay_pubkey_t;
+
+static inline void xapay_state_key(uint8_t* key, uint8_t prefix, const uint8_t* accid)
+{
+    key[0] = prefix;
+    COPY(key + 1, accid, 20);
+}
+
+/**
+ * @brief ユーザーのレコードを読み込む (なければ旧キーから移行し、それもなければ新規のレコード)
+ * @param key 'R'+アカウントID を書き込む21バイトの領域
+ * @return 1: 読み込んだ (旧キーから移行した場合を含む), 0: 新規
+ */
+static inline int64_t xapay_record_load(xapay_record_t* rec, uint8_t* key, const uint8_t* accid)
+{
+    xapay_state_key(key, PREFIX_USER_RECORD, accid);
+    if (state(rec, sizeof(xapay_record_t), key, 21) == XAPAY_RECORD_SIZE && rec->version == XAPAY_RECORD_VERSION)
+        return 1;
+    *rec = (xapay_record_t){ .version = XAPAY_RECORD_VERSION };
+
+    uint8_t legacy_key[21];
+    int64_t found = 0;
+
+    int64_t balance = 0;
+    xapay_state_key(legacy_key, PREFIX_USER_BALANCE, accid);
+    if (state(&balance, sizeof(balance), SBUF(legacy_key)) == sizeof(balance)) {
+        found = 1;
+        if (balance > 0)
+            rec->balance = balance;
+    }
+
+    uint8_t allowance_str[32];
+    xapay_state_key(legacy_key, PREFIX_ALLOWANCE, accid);
+    int64_t allowance_len = state(SBUF(allowance_str), SBUF(legacy_key));
+    if (allowance_len >= 0) {
+        found = 1;
+        xapay_yen_parse(&rec->allowance, allowance_str, allowance_len);
+    }
+
+    if (!found)
+        return 0;
+    rec->flags |= XAPAY_RECORD_MIGRATED;
+    return 1;
+}
+
+/**
+ * @brief ユーザーのレコードを書き込む (旧キーから移行したレコードなら旧キーを削除する)
+ */
+static inline int64_t xapay_record_store(xapay_record_t* rec, const uint8_t* key)
+{
+    if (rec->flags & XAPAY_RECORD_MIGRATED) {
+        uint8_t legacy_key[21];
+        xapay_state_key(legacy_key, PREFIX_USER_BALANCE, key + 1);
+        state_set(0, 0, SBUF(legacy_key));
+        xapay_state_key(legacy_key, PREFIX_ALLOWANCE, key + 1);
+        state_set(0, 0, SBUF(legacy_key));
+        rec->flags &= ~XAPAY_RECORD_MIGRATED;
+    }
+    return state_set(rec, sizeof(xapay_record_t), key, 21);
+}
+
+/**
+ * @brief 加盟店の未精算額を読み込む (なければ0)
+ * @param key 'M'+アカウントID を書き込む21バイトの領域
+ * @return 1: 読み込んだ, 0: 新規
+ */
+static inline int64_t xapay_merchant_load(xapay_merchant_t* merchant, uint8_t* key, const uint8_t* accid)
+{
+    xapay_state_key(key, PREFIX_MERCHANT, accid);
+    if (state(merchant, sizeof(xapay_merchant_t), key, 21) == sizeof(xapay_merchant_t))
+        return 1;
+    *merchant = (xapay_merchant_t){ 0 };
+    return 0;
+}
+
+static inline int64_t xapay_merchant_store(const xapay_merchant_t* merchant, const uint8_t* key)
+{
+    return state_set(merchant, sizeof(xapay_merchant_t), key, 21);
+}
+
+/**
+ * @brief 累積請求の状態を読み込む
+ *
+ * 保存済みの世代が generation より古い (利用許可が入れ替わった) 場合だけ、generation の状態として
+ * 引き落とし済みを0から数え直す。保存済みの世代が新しい場合はそのまま返す (呼び出し側で拒否する)。
+ * @param key 'C'+アカウントID を書き込む21バイトの領域
+ */
+static inline void xapay_claim_load(xapay_claim_t* claim, uint8_t* key, const uint8_t* accid, uint32_t generation)
+{
+    xapay_state_key(key, PREFIX_CLAIM, accid);
+    if (state(claim, sizeof(xapay_claim_t), key, 21) == sizeof(xapay_claim_t) &&
+        claim->allowance_generation >= generation)
+        return;
+    *claim = (xapay_claim_t){ .allowance_generation = generation };
+}
+
+static inline int64_t xapay_claim_store(const xapay_claim_t* claim, const uint8_t* key)
+{
+    return state_set(claim, sizeof(xapay_claim_t), key, 21);
+}
+
+/**
+ * @brief SigningPubKey の先頭バイトから鍵の種類を判定する
+ * @return XAPAY_KEY_TYPE_*、公開鍵として扱えない場合は -1
+ */
+static inline int64_t xapay_pubkey_type(const uint8_t* pubkey, int64_t pubkey_len)
+{
+    if (pubkey_len != XAPAY_PUBKEY_SIZE)
+        return -1;
+    if (pubkey[0] == 0xED)
+        return XAPAY_KEY_TYPE_ED25519;
+    if (pubkey[0] == 0x02 || pubkey[0] == 0x03)
+        return XAPAY_KEY_TYPE_SECP256K1;
+    return -1;
+}
+
+/**
+ * @brief ユーザーの登録済みの公開鍵を読み込む
+ * @return 1: 登録済み, 0: 未登録
+ */
+static inline int64_t xapay_pubkey_load(xapay_pubkey_t* key, const uint8_t* accid)
+{
+    uint8_t state_key[21];
+    xapay_state_key(state_key, PREFIX_PUBKEY, accid);
+    return state(key, sizeof(xapay_pubkey_t), SBUF(state_key)) == sizeof(xapay_pubkey_t);
+}
+
+static inline int64_t xapay_pubkey_store(const xapay_pubkey_t* key, const uint8_t* accid)
+{
+    uint8_t state_key[21];
+    xapay_state_key(state_key, PREFIX_PUBKEY, accid);
+    return state_set(key, sizeof(xapay_pubkey_t), SBUF(state_key));
+}
+
+/**
+ * @brief キーがあれば削除する
+ * @return 削除したデータのバイト数 (キーがなければ負数)
+ */
+static inline int64_t xapay_state_delete(const uint8_t* key, uint32_t key_len)
+{
+    uint8_t data[256];
+    int64_t len = state(SBUF(data), key, key_len);
+    if (len < 0)
+        return len;
+    state_set(0, 0, key, key_len);
+    return len;
+}
+
+/**
+ * @brief 引き出しキューの位置に対応するキー ('Q'+リング内の位置) を作る
+ */
+static inline void xapay_withdraw_slot_key(uint8_t* key, uint32_t position)
+{
+    uint32_t slot = position % XAPAY_WITHDRAW_QUEUE_SIZE;
+    key[0] = PREFIX_WITHDRAW_QUEUE;
+    COPY(key + 1, &slot, 4);
+}
+
+/**
+ * @brief 引き出しキューのヘッダを読み込む (なければ空のキュー)
+ */
+static inline void xapay_withdraw_queue_load(xapay_withdraw_queue_t* queue)
+{
+    uint8_t key[1] = { PREFIX_WITHDRAW_QUEUE };
+    if (state(queue, sizeof(xapay_withdraw_queue_t), SBUF(key)) != sizeof(xapay_withdraw_queue_t))
+        *queue = (xapay_withdraw_queue_t){ 0 };
+}
+
+static inline int64_t xapay_withdraw_queue_store(const xapay_withdraw_queue_t* queue)
+{
+    uint8_t key[1] = { PREFIX_WITHDRAW_QUEUE };
+    return state_set(queue, sizeof(xapay_withdraw_queue_t), SBUF(key));
+}
+
+/**
+ * @brief Nonceが未使用なら使用済みにする
+ * @return 0: 未使用だった, -1: 使用済み, -2: ウィンドウより古い
+ */
+static inline int64_t xapay_nonce_use(xapay_record_t* rec, uint64_t nonce)
+{
+    if (nonce > rec->nonce_high) {
+        uint64_t shift = nonce - rec->nonce_high;
+        rec->nonce_window = shift >= XAPAY_NONCE_WINDOW ? 0 : rec->nonce_window << shift;
+        rec->nonce_window |= 1;
+        rec->nonce_high = nonce;
+        return 0;
+    }
+
+    // Nonce 0 は初期値の nonce_high と区別できないため使えない
+    uint64_t age = rec->nonce_high - nonce;
+    if (nonce == 0 || age >= XAPAY_NONCE_WINDOW)
+        return -2;
+    if (rec->nonce_window & (1ULL << age))
+        return -1;
+    rec->nonce_window |= 1ULL << age;
+    return 0;
+}
+
+#endif
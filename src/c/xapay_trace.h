@@ -0,0 +1,97 @@
+/**
+ * XApay Hook - トレース
+ *
+ * トレースの出力はコンパイル時のレベル (XAPAY_TRACE_LEVEL) で選び、既定 (OFF) では
+ * trace の呼び出しも文字列もすべて取り除かれます。レベルは -DXAPAY_TRACE_LEVEL=2 のように指定します。
+ *
+ *   OFF     (0)  なし (デプロイ用)
+ *   ERROR   (1)  ロールバックのメッセージに含まれないホスト関数の失敗コード (emit など)
+ *   DEBUG   (2)  ハンドラの開始・各ステップのトレースポイントと、従来の文字列のトレース
+ *   VERBOSE (3)  一括処理のエントリごとのトレースポイント
+ *
+ * トレースポイントは trace(XAPAY_TRACE_POINT_TAG, [ハンドラID, ステップ, 値 (int64 LE)], 16進数) で出力します。
+ * ネイティブエミュレータ (src/c/emu) と wasm の再生 (build/hook_replay.js) はこれを読み取り、
+ * ハンドラ別の実行数・拒否理由 (ロールバックのコード) 別の件数と、ステップ別のホスト関数呼び出し数・
+ * 命令数を集計します。ステップの区間は、そのトレースポイントから次のトレースポイント (または終了) までです。
+ */
+
+#ifndef XAPAY_TRACE_H
+#define XAPAY_TRACE_H
+
+#include <stdint.h>
+
+#define XAPAY_TRACE_LEVEL_OFF     0
+#define XAPAY_TRACE_LEVEL_ERROR   1
+#define XAPAY_TRACE_LEVEL_DEBUG   2
+#define XAPAY_TRACE_LEVEL_VERBOSE 3
+
+#ifndef XAPAY_TRACE_LEVEL
+#define XAPAY_TRACE_LEVEL XAPAY_TRACE_LEVEL_OFF
+#endif
+
+// トレースポイントの形式 (src/c/emu/emu.h と build/hook_replay.js と一致させること)
+#define XAPAY_TRACE_POINT_TAG  "XApay:tp"
+#define XAPAY_TRACE_POINT_SIZE 10   // ハンドラID (1) + ステップ (1) + 値 (8)
+#define XAPAY_TRACE_ITEM_FLAG  0x80 // エントリごとのトレースポイント (ステップの区間は区切らない)
+
+// ハンドラID (build/hook_replay.js の HANDLER_NAMES と一致させること)
+#define XAPAY_HANDLERS(X) \
+    X(HOOK, hook) \
+    X(CHARGE, charge) \
+    X(PAYMENT, payment) \
+    X(ALLOWANCE_PAYMENT, allowance_payment) \
+    X(RECHARGE, recharge_allowance) \
+    X(WITHDRAWAL, withdrawal) \
+    X(WITHDRAWAL_FLUSH, withdrawal_flush) \
+    X(COMPACT, compact) \
+    X(MERCHANT_SETTLE, merchant_settle) \
+    X(CLAIM_REDEEM, claim_redeem) \
+    X(REGISTER_KEY, register_key)
+
+#define XAPAY_HANDLER_ENUM(id, name) XAPAY_HANDLER_##id,
+enum xapay_handler { XAPAY_HANDLERS(XAPAY_HANDLER_ENUM) XAPAY_HANDLER_COUNT };
+#undef XAPAY_HANDLER_ENUM
+
+// --- ERROR ---
+#if XAPAY_TRACE_LEVEL >= XAPAY_TRACE_LEVEL_ERROR
+#define XAPAY_TRACE_ERROR(msg, value) trace_num((msg), sizeof(msg) - 1, (value))
+#else
+#define XAPAY_TRACE_ERROR(msg, value) ((void)0)
+#endif
+
+// --- DEBUG ---
+#if XAPAY_TRACE_LEVEL >= XAPAY_TRACE_LEVEL_DEBUG
+
+static inline void xapay_trace_point(uint8_t handler, uint8_t step, int64_t value)
+{
+    uint8_t point[XAPAY_TRACE_POINT_SIZE];
+    point[0] = handler;
+    point[1] = step;
+    COPY(point + 2, &value, 8);
+    trace(XAPAY_TRACE_POINT_TAG, sizeof(XAPAY_TRACE_POINT_TAG) - 1, point, sizeof(point), 1);
+}
+
+// ハンドラの先頭で1回だけ使う (以降の XAPAY_TRACE_STEP / XAPAY_TRACE_ITEM はこのハンドラIDを使う)
+#define XAPAY_TRACE_ENTER(handler, msg) \
+    const uint8_t xapay_trace_handler = (handler); \
+    trace((msg), sizeof(msg) - 1, 0, 0, 0); \
+    xapay_trace_point(xapay_trace_handler, 0, 0)
+#define XAPAY_TRACE_STEP(step, value) xapay_trace_point(xapay_trace_handler, (step), (value))
+#define XAPAY_TRACE_DEBUG(msg) trace((msg), sizeof(msg) - 1, 0, 0, 0)
+#define XAPAY_TRACE_NUM(msg, value) trace_num((msg), sizeof(msg) - 1, (value))
+
+#else
+#define XAPAY_TRACE_ENTER(handler, msg) ((void)0)
+#define XAPAY_TRACE_STEP(step, value) ((void)0)
+#define XAPAY_TRACE_DEBUG(msg) ((void)0)
+#define XAPAY_TRACE_NUM(msg, value) ((void)0)
+#endif
+
+// --- VERBOSE ---
+#if XAPAY_TRACE_LEVEL >= XAPAY_TRACE_LEVEL_VERBOSE
+#define XAPAY_TRACE_ITEM(step, value) xapay_trace_point(xapay_trace_handler, (step) | XAPAY_TRACE_ITEM_FLAG, (value))
+#else
+#define XAPAY_TRACE_ITEM(step, value) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * XApay Hook - 円の整数演算
+ *
+ * JPYSC は 1トークン = 1円 で小数を持たないため、フック内の金額はすべて int64 の円で扱います。
+ * Memo の金額 (10進文字列) はここで解析し、ホスト関数の float_* や sto_* は使いません。
+ * XFL を扱うのは IOU の Amount フィールドとの境界だけです。
+ *
+ * 加算・減算はオーバーフローと負の結果を検出し、失敗時は負数を返します。
+ */
+
+#ifndef XAPAY_YEN_H
+#define XAPAY_YEN_H
+
+#include <stdint.h>
+
+#define XAPAY_YEN_MAX_DIGITS 18     // 18桁までなら int64 に収まる
+#define XAPAY_YEN_MAX_PARSES 256    // 1回の実行で解析する金額の最大数 (ガード用)
+#define XAPAY_YEN_MAX_AMOUNTS 256   // 1回の実行でシリアライズする Amount の最大数 (ガード用)
+#define XAPAY_YEN_MAX_EXACT  9999999999999999LL // XFL の仮数 (16桁) で丸めずに表せる上限
+
+#define XAPAY_YEN_OK        0
+#define XAPAY_YEN_INVALID  -1       // 数字以外・空・桁数超過
+#define XAPAY_YEN_OVERFLOW -2
+#define XAPAY_YEN_NEGATIVE -3       // 減算の結果が負になる
+
+/**
+ * @brief 10進文字列 (数字のみ、最大18桁) を円に変換する
+ */
+static inline int64_t xapay_yen_parse(int64_t* out, const uint8_t* str, int64_t len)
+{
+    if (len <= 0 || len > XAPAY_YEN_MAX_DIGITS)
+        return XAPAY_YEN_INVALID;
+
+    int64_t value = 0;
+    for (int64_t i = 0; GUARD(XAPAY_YEN_MAX_DIGITS * XAPAY_YEN_MAX_PARSES), i < len; ++i) {
+        uint8_t c = str[i] - '0';
+        if (c > 9)
+            return XAPAY_YEN_INVALID;
+        value = value * 10 + c;
+    }
+    *out = value;
+    return XAPAY_YEN_OK;
+}
+
+/**
+ * @brief a + b (どちらも0以上)
+ */
+static inline int64_t xapay_yen_add(int64_t* out, int64_t a, int64_t b)
+{
+    if (a < 0 || b < 0)
+        return XAPAY_YEN_NEGATIVE;
+    if (a > INT64_MAX - b)
+        return XAPAY_YEN_OVERFLOW;
+    *out = a + b;
+    return XAPAY_YEN_OK;
+}
+
+/**
+ * @brief a - b (結果が負になる場合は失敗)
+ */
+static inline int64_t xapay_yen_sub(int64_t* out, int64_t a, int64_t b)
+{
+    if (a < 0 || b < 0 || a < b)
+        return XAPAY_YEN_NEGATIVE;
+    *out = a - b;
+    return XAPAY_YEN_OK;
+}
+
+/**
+ * @brief 円を IOU の Amount の値 (先頭8バイト、ビッグエンディアン) にシリアライズする
+ *
+ * bit63 = 1 (IOU)、以降は XFL と同じ。丸めが生じる額 (XAPAY_YEN_MAX_EXACT 超) は失敗とする。
+ */
+static inline int64_t xapay_yen_to_amount(uint8_t* out, int64_t yen)
+{
+    if (yen < 0)
+        return XAPAY_YEN_NEGATIVE;
+    if (yen > XAPAY_YEN_MAX_EXACT)
+        return XAPAY_YEN_OVERFLOW;
+
+    uint64_t value = 1ULL << 63;
+    if (yen != 0) {
+        int64_t mantissa = yen;
+        int64_t exponent = 0;
+        for (int i = 0; GUARD(15 * XAPAY_YEN_MAX_AMOUNTS), i < 15 && mantissa < 1000000000000000LL; ++i) {
+            mantissa *= 10;
+            exponent--;
+        }
+        value |= (1ULL << 62) | ((uint64_t)(exponent + 97) << 54) | (uint64_t)mantissa;
+    }
+    out[0] = (uint8_t)(value >> 56);
+    out[1] = (uint8_t)(value >> 48);
+    out[2] = (uint8_t)(value >> 40);
+    out[3] = (uint8_t)(value >> 32);
+    out[4] = (uint8_t)(value >> 24);
+    out[5] = (uint8_t)(value >> 16);
+    out[6] = (uint8_t)(value >> 8);
+    out[7] = (uint8_t)value;
+    return XAPAY_YEN_OK;
+}
+
+#endif
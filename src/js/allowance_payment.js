@@ -1,7 +1,184 @@
 // Hocks/allowance_payment.js (新規作成を想定)
 const { xrpl, ISSUER_ADDRESS, CURRENCY_CODE, initClient } = require("./hocks");
+const { signAllowance } = require("./signature_pool");
+const { PrecheckError, PRECHECK_ERROR } = require("./state_mirror");
 require("dotenv").config({ path: "../.env" });
 
+// バイナリTLV Memo の定義 (src/c/xapay_memo.h と一致させること)
+const MEMO_TLV_MAGIC = 0x58; // 'X'
+const MEMO_TLV_VERSION = 0x01;
+const MEMO_TLV_TAG = {
+  TYPE: 0x01,
+  USER: 0x02,
+  AMOUNT: 0x03,
+  ALLOWANCE_AMOUNT: 0x04,
+  SIGNATURE: 0x05,
+  ENTRY: 0x06,
+  MERCHANT: 0x07,
+  GENERATION: 0x08,
+  NONCE: 0x09,
+};
+const MEMO_TYPE = {
+  allowance_payment: 1,
+  update_allowance: 2,
+  withdraw: 3,
+  payment_batch: 4,
+  withdraw_flush: 5,
+  compact: 6,
+  merchant_settle: 7,
+  claim_redeem: 8,
+  register_key: 9,
+  nonce_payment: 10,
+};
+
+// 一括決済の上限 (src/c/xapay_hock.c の XAPAY_MEMO_MAX_ENTRIES / BATCH_MAX_USERS / BATCH_MAX_MERCHANTS と一致させること)
+const BATCH_MAX_ENTRIES = 16;
+const BATCH_MAX_USERS = 16;
+const BATCH_MAX_MERCHANTS = 16;
+// コンパクションの上限 (src/c/xapay_hock.c の COMPACT_MAX_USERS と一致させること)
+const COMPACT_MAX_USERS = 48;
+// XRPLのMemos全体の上限は1KB。Memo自体のヘッダ分を差し引いた値
+const BATCH_MAX_MEMO_BYTES = 960;
+const MEMO_FORMAT_TLV = "application/x-xapay-tlv";
+const MEMO_FORMAT_JSON = "application/json";
+
+/**
+ * Memoの内容をバイナリTLV形式にエンコードします。
+ * @param {Object} fields - Memoの内容
+ * @param {string} fields.type - "allowance_payment" | "update_allowance" | "withdraw" | "withdraw_flush"
+ * @param {string} [fields.userAddress] - 支払いを行うユーザーのアドレス
+ * @param {string} [fields.amount] - 支払い額・引き出し額（withdraw_flush では発行する最大件数）
+ * @param {string} [fields.allowanceAmount] - 利用許可額（署名対象と同じ文字列）
+ * @param {string} [fields.signature] - 利用許可署名（16進数）
+ * @param {string} [fields.merchantAddress] - 支払い先の加盟店のアドレス
+ * @param {string} [fields.nonce] - ノンス付きの支払いのノンス（署名対象と同じ文字列）
+ * @returns {string} MemoData に設定する16進数文字列
+ */
+function encodeTlvMemo({ type, userAddress, amount, allowanceAmount, signature, merchantAddress, nonce }) {
+  if (!(type in MEMO_TYPE)) {
+    throw new Error(`不明なMemoタイプです: ${type}`);
+  }
+
+  const parts = [Buffer.from([MEMO_TLV_MAGIC, MEMO_TLV_VERSION])];
+  const put = (tag, value) => {
+    if (value.length > 255) {
+      throw new Error(`TLVフィールドが長すぎます (tag=${tag})`);
+    }
+    parts.push(Buffer.from([tag, value.length]), value);
+  };
+
+  put(MEMO_TLV_TAG.TYPE, Buffer.from([MEMO_TYPE[type]]));
+  if (userAddress !== undefined) {
+    put(MEMO_TLV_TAG.USER, Buffer.from(xrpl.decodeAccountID(userAddress)));
+  }
+  if (amount !== undefined) {
+    put(MEMO_TLV_TAG.AMOUNT, Buffer.from(String(amount), "ascii"));
+  }
+  if (allowanceAmount !== undefined) {
+    put(MEMO_TLV_TAG.ALLOWANCE_AMOUNT, Buffer.from(String(allowanceAmount), "ascii"));
+  }
+  if (signature !== undefined) {
+    put(MEMO_TLV_TAG.SIGNATURE, Buffer.from(signature, "hex"));
+  }
+  if (merchantAddress !== undefined) {
+    put(MEMO_TLV_TAG.MERCHANT, Buffer.from(xrpl.decodeAccountID(merchantAddress)));
+  }
+  if (nonce !== undefined) {
+    put(MEMO_TLV_TAG.NONCE, Buffer.from(String(nonce), "ascii"));
+  }
+  return Buffer.concat(parts).toString("hex").toUpperCase();
+}
+
+/**
+ * 一括決済の支払いリストをバイナリTLV形式にエンコードします。
+ * 同じユーザー・同じ利用許可の2件目以降は、利用許可額と署名を省略します。
+ * @param {Array<Object>} payments - 支払いリスト
+ * @param {string} payments[].userAddress - 支払いを行うユーザーのアドレス
+ * @param {string} payments[].amount - 支払い額
+ * @param {string} payments[].allowanceAmount - 利用許可額
+ * @param {string} payments[].signature - 利用許可署名（16進数）
+ * @param {string} [payments[].merchantAddress] - 支払い先の加盟店のアドレス
+ * @returns {Buffer} MemoData のバイト列
+ */
+function encodeTlvBatchMemo(payments) {
+  const parts = [
+    Buffer.from([MEMO_TLV_MAGIC, MEMO_TLV_VERSION]),
+    Buffer.from([MEMO_TLV_TAG.TYPE, 1, MEMO_TYPE.payment_batch]),
+  ];
+  const field = (tag, value) => Buffer.concat([Buffer.from([tag, value.length]), value]);
+  const lastAllowance = new Map();
+
+  for (const p of payments) {
+    const signature = p.signature.toUpperCase();
+    const allowanceKey = `${p.allowanceAmount}:${signature}`;
+    const entry = [
+      field(MEMO_TLV_TAG.USER, Buffer.from(xrpl.decodeAccountID(p.userAddress))),
+      field(MEMO_TLV_TAG.AMOUNT, Buffer.from(String(p.amount), "ascii")),
+    ];
+    if (p.merchantAddress !== undefined) {
+      entry.push(field(MEMO_TLV_TAG.MERCHANT, Buffer.from(xrpl.decodeAccountID(p.merchantAddress))));
+    }
+    if (lastAllowance.get(p.userAddress) !== allowanceKey) {
+      entry.push(
+        field(MEMO_TLV_TAG.ALLOWANCE_AMOUNT, Buffer.from(String(p.allowanceAmount), "ascii")),
+        field(MEMO_TLV_TAG.SIGNATURE, Buffer.from(signature, "hex"))
+      );
+      lastAllowance.set(p.userAddress, allowanceKey);
+    }
+    const value = Buffer.concat(entry);
+    if (value.length > 255) {
+      throw new Error("一括決済のエントリが長すぎます");
+    }
+    parts.push(field(MEMO_TLV_TAG.ENTRY, value));
+  }
+  return Buffer.concat(parts);
+}
+
+/**
+ * 従来のJSON形式のMemoオブジェクトを構築します。
+ * @param {Object} fields - encodeTlvMemo と同じ内容
+ * @returns {Object} JSON.stringify して MemoData に設定するオブジェクト
+ */
+function toJsonMemo({ type, userAddress, amount, allowanceAmount, signature, merchantAddress }) {
+  switch (type) {
+    case "update_allowance":
+      return { type, allowance: allowanceAmount, signature };
+    case "withdraw":
+      return { type, amount };
+    default:
+      return {
+        type,
+        user_address: userAddress,
+        payment_amount: amount,
+        allowance: { amount: allowanceAmount, signature },
+        merchant_address: merchantAddress,
+      };
+  }
+}
+
+/**
+ * トランザクションの Memos に設定する Memo を構築します。
+ * @param {Object} fields - Memoの内容（encodeTlvMemo を参照）
+ * @param {string} [encoding="tlv"] - "tlv" または "json"
+ * @returns {Object} Memos 配列の要素
+ */
+function buildMemo(fields, encoding = "tlv") {
+  if (encoding === "json") {
+    return {
+      Memo: {
+        MemoData: xrpl.convertStringToHex(JSON.stringify(toJsonMemo(fields))),
+        MemoFormat: xrpl.convertStringToHex(MEMO_FORMAT_JSON),
+      },
+    };
+  }
+  return {
+    Memo: {
+      MemoData: encodeTlvMemo(fields),
+      MemoFormat: xrpl.convertStringToHex(MEMO_FORMAT_TLV),
+    },
+  };
+}
+
 /**
  * ユーザーが運営者に対して、指定した上限金額までの支払いを許可する署名を生成します。
  * @param {xrpl.Wallet} userWallet - ユーザーのウォレット
@@ -16,14 +193,55 @@ function createAllowanceSignature(
 ) {
   console.log("--- 利用許可署名を生成中 ---");
   // 署名対象のメッセージ: <ユーザーアドレス>:<運営者アドレス>:<許可金額>
-  const messageToSign = `${userWallet.address}:${operatorAddress}:${allowanceAmount}`;
-  const signature = userWallet.sign(
-    xrpl.convertStringToHex(messageToSign)
-  ).signature;
+  // (Wallet.sign はトランザクション用のため、メッセージはユーザーの鍵で直接署名する)
+  const signature = signAllowance({
+    userAddress: userWallet.address,
+    privateKey: userWallet.privateKey,
+    operatorAddress,
+    allowanceAmount,
+  });
   console.log(`生成された利用許可署名: ${signature}`);
   return signature;
 }
 
+/**
+ * ユーザーの署名鍵をフックに登録します（利用許可署名・請求署名の検証に使われます）。
+ * フックはこのトランザクションの SigningPubKey を鍵の種類（secp256k1 / ed25519）とともに保存するため、
+ * 利用許可に署名するのと同じ鍵（マスターキーまたは RegularKey）で署名してください。
+ * 鍵を変更した場合は、新しい鍵で登録し直します。
+ * @param {xrpl.Wallet} userWallet - ユーザーのウォレット
+ * @param {string} hookAddress - 決済フックのアカウントアドレス
+ * @param {xrpl.Client|ClientPool} [client] - 接続済みのクライアント（省略時は新たに接続）
+ * @returns {Promise<Object>} トランザクション結果
+ */
+async function registerPublicKey(userWallet, hookAddress, client) {
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
+
+  try {
+    const tx = {
+      TransactionType: "Invoke",
+      Account: userWallet.address,
+      Destination: hookAddress,
+      // 鍵の登録はバイナリTLV形式のみ対応
+      Memos: [buildMemo({ type: "register_key" }, "tlv")],
+    };
+
+    console.log("--- 署名鍵の登録を送信中 ---");
+    const signedTx = userWallet.sign(await client.autofill(tx));
+    const result = await client.submitAndWait(signedTx.tx_blob);
+    console.log("--- トランザクション結果 ---");
+    console.log(result);
+    return result;
+  } finally {
+    if (ownClient) {
+      await client.disconnect();
+    }
+  }
+}
+
 /**
  * 指定された額をチャージし、利用許可枠（アローワンス）を動的に更新するトランザクションを送信します。
  * @param {xrpl.Wallet} userWallet - ユーザーのウォレット
@@ -31,16 +249,26 @@ function createAllowanceSignature(
  * @param {string} operatorAddress - サービス運営者のアドレス
  * @param {string} chargeAmount - チャージするJPYSCの額
  * @param {string} remainingAllowance - 現在の利用許可枠の残額
- * @returns {Promise<Object>} トランザクション結果
+ * @param {string} [memoEncoding="tlv"] - Memoの形式 ("tlv" または "json")
+ * @param {xrpl.Client|ClientPool} [client] - 接続済みのクライアント（省略時は新たに接続）
+ * @param {SignaturePool} [signaturePool] - 指定すると利用許可署名をワーカースレッドで生成する
+ * @returns {Promise<Object>} トランザクション結果に、新しい利用許可の allowanceAmount と signature を加えたもの
+ *   （以後の支払いには、この利用許可を使う）
  */
 async function chargeAndUpdateAllowance(
   userWallet,
   hookAddress,
   operatorAddress,
   chargeAmount,
-  remainingAllowance
+  remainingAllowance,
+  memoEncoding = "tlv",
+  client,
+  signaturePool
 ) {
-  const client = await initClient();
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
   try {
     // 1. 新しい利用許可枠の合計額を計算
     const newAllowanceAmount = (
@@ -48,11 +276,11 @@ async function chargeAndUpdateAllowance(
     ).toString();
 
     // 2. 新しい利用許可枠に対する署名を生成
-    const newSignature = createAllowanceSignature(
-      userWallet,
-      operatorAddress,
-      newAllowanceAmount
-    );
+    const newSignature = signaturePool
+      ? (await signaturePool.signAllowances([
+          { wallet: userWallet, operatorAddress, allowanceAmount: newAllowanceAmount },
+        ]))[0]
+      : createAllowanceSignature(userWallet, operatorAddress, newAllowanceAmount);
 
     // 3. トランザクションを構築
     const tx = {
@@ -65,18 +293,14 @@ async function chargeAndUpdateAllowance(
         value: chargeAmount,
       },
       Memos: [
-        {
-          Memo: {
-            MemoData: xrpl.convertStringToHex(
-              JSON.stringify({
-                type: "update_allowance",
-                allowance: newAllowanceAmount,
-                signature: newSignature,
-              })
-            ),
-            MemoFormat: xrpl.convertStringToHex("application/json"),
+        buildMemo(
+          {
+            type: "update_allowance",
+            allowanceAmount: newAllowanceAmount,
+            signature: newSignature,
           },
-        },
+          memoEncoding
+        ),
       ],
     };
 
@@ -91,12 +315,14 @@ async function chargeAndUpdateAllowance(
 
     console.log("--- トランザクション結果 ---");
     console.log(result);
-    return result;
+    return { ...result, allowanceAmount: newAllowanceAmount, signature: newSignature };
   } catch (error) {
     console.error("エラー:", error);
     throw error;
   } finally {
-    await client.disconnect();
+    if (ownClient) {
+      await client.disconnect();
+    }
   }
 }
 
@@ -108,6 +334,12 @@ async function chargeAndUpdateAllowance(
  * @param {string} allowanceSignature - 事前にユーザーから得た利用許可署名
  * @param {string} allowanceAmount - 許可された上限金額
  * @param {string} paymentAmount - 今回の支払い金額
+ * @param {string} [memoEncoding="tlv"] - Memoの形式 ("tlv" または "json")
+ * @param {xrpl.Client|ClientPool} [client] - 接続済みのクライアント（省略時は新たに接続）
+ * @param {StateMirror} [mirror] - フックのStateのミラー。指定するとフックで失敗する支払いを
+ *   送信前に PrecheckError で弾き、送信した支払いを検証されるまで仮押さえする
+ * @param {string} [merchantAddress] - 支払い先の加盟店のアドレス（フックが加盟店の未精算額に加算する）
+ * @returns {Promise<Object>} トランザクション結果
  */
 async function sendPaymentWithAllowance(
   operatorWallet,
@@ -115,58 +347,329 @@ async function sendPaymentWithAllowance(
   userAddress,
   allowanceSignature,
   allowanceAmount,
-  paymentAmount
+  paymentAmount,
+  memoEncoding = "tlv",
+  client,
+  mirror,
+  merchantAddress
 ) {
-  const client = await initClient();
+  const payment = {
+    userAddress,
+    amount: paymentAmount,
+    allowanceAmount,
+    signature: allowanceSignature.toUpperCase(),
+    merchantAddress,
+  };
+  if (mirror) {
+    mirror.precheck(payment);
+  }
+
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
 
   console.log("--- 利用許可署名を使った決済トランザクションを準備中 ---");
 
   // Memoに格納するデータを構築
-  const memoData = {
-    // この決済が「利用許可モデル」であることを示すタイプ
-    type: "allowance_payment",
-    user_address: userAddress,
-    payment_amount: paymentAmount,
-    allowance: {
-      amount: allowanceAmount,
-      signature: allowanceSignature.toUpperCase(),
+  const memo = buildMemo(
+    {
+      // この決済が「利用許可モデル」であることを示すタイプ
+      type: "allowance_payment",
+      ...payment,
     },
-  };
+    memoEncoding
+  );
 
   const invokeTx = {
     TransactionType: "Invoke",
     Account: operatorWallet.address,
     Destination: hookAddress,
+    Memos: [memo],
+  };
+
+  let hash;
+  try {
+    const signedTx = operatorWallet.sign(await client.autofill(invokeTx));
+    if (mirror) {
+      hash = xrpl.hashes.hashSignedTx(signedTx.tx_blob);
+      mirror.reserve(hash, payment);
+    }
+    const result = await client.submitAndWait(signedTx.tx_blob);
+
+    console.log("--- トランザクション結果 ---");
+    console.log(result);
+    return result;
+  } catch (error) {
+    if (hash) {
+      mirror.release(hash);
+    }
+    throw error;
+  } finally {
+    if (ownClient) {
+      await client.disconnect();
+    }
+  }
+}
+
+/**
+ * 一括決済の Invoke トランザクションを構築します。
+ * @param {string} operatorAddress - 運営者のアドレス
+ * @param {string} hookAddress - フックのアドレス
+ * @param {Array<Object>} payments - 支払いリスト（encodeTlvBatchMemo を参照）
+ * @returns {Object} トランザクション
+ */
+function buildBatchInvoke(operatorAddress, hookAddress, payments) {
+  return {
+    TransactionType: "Invoke",
+    Account: operatorAddress,
+    Destination: hookAddress,
     Memos: [
       {
         Memo: {
-          MemoData: xrpl.convertStringToHex(JSON.stringify(memoData)),
-          MemoFormat: xrpl.convertStringToHex("application/json"),
+          MemoData: encodeTlvBatchMemo(payments).toString("hex").toUpperCase(),
+          MemoFormat: xrpl.convertStringToHex(MEMO_FORMAT_TLV),
         },
       },
     ],
   };
+}
 
-  const signedTx = operatorWallet.sign(await client.autofill(invokeTx));
-  const result = await client.submitAndWait(signedTx.tx_blob);
+/**
+ * 複数の利用許可決済を1つのInvokeトランザクションで送信します（一括決済）。
+ * フックは支払いを順に適用し、1件でも失敗した場合はすべてロールバックします。
+ * @param {xrpl.Wallet} operatorWallet - 運営者のウォレット
+ * @param {string} hookAddress - フックのアドレス
+ * @param {Array<Object>} payments - 支払いリスト（encodeTlvBatchMemo を参照）
+ * @param {xrpl.Client|ClientPool} [client] - 接続済みのクライアント（省略時は新たに接続）
+ * @returns {Promise<Object>} トランザクション結果
+ */
+async function sendPaymentBatchWithAllowance(
+  operatorWallet,
+  hookAddress,
+  payments,
+  client
+) {
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
 
-  console.log("--- トランザクション結果 ---");
-  console.log(result);
-  await client.disconnect();
+  try {
+    const invokeTx = buildBatchInvoke(operatorWallet.address, hookAddress, payments);
+
+    console.log(`--- 一括決済トランザクションを送信中 (${payments.length}件) ---`);
+    const signedTx = operatorWallet.sign(await client.autofill(invokeTx));
+    const result = await client.submitAndWait(signedTx.tx_blob);
+    console.log("--- トランザクション結果 ---");
+    console.log(result);
+    return result;
+  } finally {
+    if (ownClient) {
+      await client.disconnect();
+    }
+  }
+}
+
+/**
+ * 利用許可決済を溜めておき、件数・Memoサイズ・経過時間のいずれかが上限に
+ * 達した時点で一括決済として送信します。
+ */
+class AllowancePaymentBatcher {
+  /**
+   * @param {xrpl.Wallet} operatorWallet - 運営者のウォレット
+   * @param {string} hookAddress - フックのアドレス
+   * @param {Object} [options]
+   * @param {number} [options.maxEntries=16] - 1トランザクションあたりの最大件数
+   * @param {number} [options.maxDelayMs=1000] - 最初の支払いを受け付けてから送信までの最大待ち時間
+   * @param {xrpl.Client|ClientPool} [options.client] - 接続済みのクライアント。ClientPool の場合は
+   *   前のバッチの検証を待たずに次のバッチを送信する（シーケンス順に適用される）
+   * @param {Function} [options.send] - 送信関数（既定は sendPaymentBatchWithAllowance）
+   * @param {SignaturePool} [options.signaturePool] - 指定すると送信前に利用許可署名を検証し、
+   *   無効な支払いだけを PrecheckError (302) で失敗させる（1件の無効な署名でバッチ全体が
+   *   ロールバックされるのを防ぐ）
+   * @param {Map|Function} [options.publicKeys] - ユーザーのアドレスから公開鍵を引く Map または関数
+   *   （Promise を返してもよい）。signaturePool を指定する場合は必須
+   */
+  constructor(operatorWallet, hookAddress, options = {}) {
+    this.operatorWallet = operatorWallet;
+    this.hookAddress = hookAddress;
+    this.maxEntries = Math.min(options.maxEntries || BATCH_MAX_ENTRIES, BATCH_MAX_ENTRIES);
+    this.maxDelayMs = options.maxDelayMs ?? 1000;
+    this.client = options.client;
+    this.send = options.send || sendPaymentBatchWithAllowance;
+    this.pipeline = !options.send && !!this.client && typeof this.client.submit === "function";
+    this.signaturePool = options.signaturePool;
+    this.publicKeys = options.publicKeys;
+    if (this.signaturePool && !this.publicKeys) {
+      throw new Error("signaturePool には publicKeys が必要です");
+    }
+    // 検証済みの利用許可 (ユーザー:許可額:署名)
+    this.verified = new Set();
+    this.pending = [];
+    this.timer = null;
+    // 送信の順序を保つためのチェーンと、検証待ちのバッチ
+    this.inFlight = Promise.resolve();
+    this.validating = new Set();
+  }
+
+  /**
+   * 支払いを追加します。バッチが送信されたときに、その結果で解決されます。
+   * @param {string} userAddress - 支払いを行うユーザーのアドレス
+   * @param {string} allowanceSignature - 利用許可署名
+   * @param {string} allowanceAmount - 利用許可額
+   * @param {string} paymentAmount - 今回の支払い額
+   * @param {string} [merchantAddress] - 支払い先の加盟店のアドレス
+   * @returns {Promise<Object>} 一括決済トランザクションの結果
+   */
+  add(userAddress, allowanceSignature, allowanceAmount, paymentAmount, merchantAddress) {
+    const payment = {
+      userAddress,
+      signature: allowanceSignature,
+      allowanceAmount,
+      amount: paymentAmount,
+      merchantAddress,
+    };
+
+    // 追加するとフックの上限を超える場合は、先に溜まっている分を送信する
+    if (this.pending.length > 0 && !this.fits(payment)) {
+      this.flush();
+    }
+
+    return new Promise((resolve, reject) => {
+      this.pending.push({ payment, resolve, reject });
+      if (this.pending.length >= this.maxEntries) {
+        this.flush();
+      } else if (!this.timer) {
+        this.timer = setTimeout(() => this.flush(), this.maxDelayMs);
+      }
+    });
+  }
+
+  fits(payment) {
+    const payments = this.pending.map((p) => p.payment).concat(payment);
+    const users = new Set(payments.map((p) => p.userAddress));
+    const merchants = new Set(payments.filter((p) => p.merchantAddress).map((p) => p.merchantAddress));
+    return (
+      payments.length <= this.maxEntries &&
+      users.size <= BATCH_MAX_USERS &&
+      merchants.size <= BATCH_MAX_MERCHANTS &&
+      encodeTlvBatchMemo(payments).length <= BATCH_MAX_MEMO_BYTES
+    );
+  }
+
+  /**
+   * 溜まっている支払いを直ちに送信します。送信は1バッチずつ順番に行い、
+   * ClientPool を使う場合は送信結果が出た時点で次のバッチに進みます。
+   * @returns {Promise<void>}
+   */
+  flush() {
+    if (this.timer) {
+      clearTimeout(this.timer);
+      this.timer = null;
+    }
+    if (this.pending.length === 0) {
+      return this.inFlight;
+    }
+
+    const pending = this.pending;
+    this.pending = [];
+    // 署名の検証は前のバッチの送信と並行して行う
+    const checked = this.verifySignatures(pending);
+    let batch = pending;
+    const submitted = Promise.all([checked, this.inFlight]).then(async ([valid]) => {
+      batch = valid;
+      if (batch.length === 0) {
+        return null;
+      }
+      const payments = batch.map((p) => p.payment);
+      if (!this.pipeline) {
+        return this.send(this.operatorWallet, this.hookAddress, payments, this.client);
+      }
+      const tx = buildBatchInvoke(this.operatorWallet.address, this.hookAddress, payments);
+      const { submitted, validated } = this.client.submit(tx, this.operatorWallet);
+      await submitted;
+      return { validated };
+    });
+    this.inFlight = submitted.then(() => {}, () => {});
+
+    const settled = submitted
+      .then((sent) => (this.pipeline && sent ? sent.validated : sent))
+      .then(
+        (result) => batch.forEach((p) => p.resolve(result)),
+        // バッチは一括でロールバックされるため、全件を失敗とする
+        (error) => batch.forEach((p) => p.reject(error))
+      )
+      .finally(() => this.validating.delete(settled));
+    this.validating.add(settled);
+    return this.inFlight;
+  }
+
+  /**
+   * signaturePool で利用許可署名を検証し、有効な支払いのみを返します。
+   * 無効な支払いはこの時点で PrecheckError で失敗させます。
+   */
+  async verifySignatures(batch) {
+    if (!this.signaturePool) {
+      return batch;
+    }
+    const keyOf = (p) => `${p.userAddress}:${p.allowanceAmount}:${p.signature.toUpperCase()}`;
+    const unchecked = [...new Set(batch.map((p) => keyOf(p.payment)))].filter((k) => !this.verified.has(k));
+    const payments = new Map(batch.map((p) => [keyOf(p.payment), p.payment]));
+    const lookup = (address) =>
+      typeof this.publicKeys === "function" ? this.publicKeys(address) : this.publicKeys.get(address);
+
+    const requests = await Promise.all(
+      unchecked.map(async (key) => {
+        const payment = payments.get(key);
+        return {
+          userAddress: payment.userAddress,
+          publicKey: (await lookup(payment.userAddress)) || "",
+          operatorAddress: this.operatorWallet.address,
+          allowanceAmount: payment.allowanceAmount,
+          signature: payment.signature,
+        };
+      })
+    );
+    const results = await this.signaturePool.verifyAllowances(requests);
+    unchecked.forEach((key, i) => results[i] && this.verified.add(key));
+
+    return batch.filter((p) => {
+      if (this.verified.has(keyOf(p.payment))) {
+        return true;
+      }
+      p.reject(new PrecheckError("Allowance signature verification failed.",
+        PRECHECK_ERROR.ALLOWANCE_VERIFICATION_FAILED));
+      return false;
+    });
+  }
+
+  /**
+   * 残りの支払いを送信し、送信中のバッチの完了を待ちます。
+   * @returns {Promise<void>}
+   */
+  async close() {
+    await this.flush();
+    await Promise.all([...this.validating]);
+  }
 }
 
 /**
  * フックに預けた残高の一部または全部を引き出すトランザクションを送信します。
+ * フックは残高を直ちに減らして引き出しをキューに積み、Payment は運営者の
+ * flushWithdrawals でまとめて発行されます。
  * @param {XrplClient} client - XRPLクライアント
  * @param {Account} userWallet - ユーザーのウォレット情報（アドレスと秘密鍵）
  * @param {string} hookAddress - 決済フックのアカウントアドレス
  * @param {string} withdrawAmount - 引き出すJPYSCの額
+ * @param {string} [memoEncoding="tlv"] - Memoの形式 ("tlv" または "json")
  */
-export async function withdrawBalance(
+async function withdrawBalance(
   client,
   userWallet,
   hookAddress,
-  withdrawAmount
+  withdrawAmount,
+  memoEncoding = "tlv"
 ) {
   // 1. トランザクションを構築
   const tx = {
@@ -175,16 +678,13 @@ export async function withdrawBalance(
     Destination: hookAddress,
     Memos: [
       // Memoフィールドに引き出し要求の情報を格納
-      {
-        Memo: {
-          MemoData: Buffer.from(
-            JSON.stringify({
-              type: "withdraw", // フック側で処理を識別するためのタイプ
-              amount: withdrawAmount,
-            })
-          ).toString("hex"),
+      buildMemo(
+        {
+          type: "withdraw", // フック側で処理を識別するためのタイプ
+          amount: withdrawAmount,
         },
-      },
+        memoEncoding
+      ),
     ],
   };
 
@@ -199,16 +699,287 @@ export async function withdrawBalance(
   return result;
 }
 
+/**
+ * 引き出しキューに溜まった引き出しを、宛先ごとに1件の Payment として発行させます（運営者のみ）。
+ * 1回で発行されるのは最大255件で、残りは次回のフラッシュで発行されます。
+ * @param {xrpl.Wallet} operatorWallet - 運営者のウォレット
+ * @param {string} hookAddress - フックのアドレス
+ * @param {number} [maxCount] - 発行する最大件数（省略時はフックの上限）
+ * @param {xrpl.Client|ClientPool} [client] - 接続済みのクライアント（省略時は新たに接続）
+ * @returns {Promise<Object>} トランザクション結果
+ */
+async function flushWithdrawals(operatorWallet, hookAddress, maxCount, client) {
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
+
+  try {
+    const fields = { type: "withdraw_flush" };
+    if (maxCount !== undefined) {
+      fields.amount = String(maxCount);
+    }
+    const tx = {
+      TransactionType: "Invoke",
+      Account: operatorWallet.address,
+      Destination: hookAddress,
+      // フラッシュはバイナリTLV形式のみ対応
+      Memos: [buildMemo(fields, "tlv")],
+    };
+
+    console.log("--- 引き出しキューのフラッシュを送信中 ---");
+    const signedTx = operatorWallet.sign(await client.autofill(tx));
+    const result = await client.submitAndWait(signedTx.tx_blob);
+    console.log("--- トランザクション結果 ---");
+    console.log(result);
+    return result;
+  } finally {
+    if (ownClient) {
+      await client.disconnect();
+    }
+  }
+}
+
+/**
+ * コンパクション対象のユーザーを Memos に分けます（1つの Memo に最大16件、Memos 全体で1KB以内）。
+ * @param {Array<string>} userAddresses - ユーザーのアドレス
+ * @returns {Array<Array<Object>>} トランザクションごとの Memos
+ */
+function buildCompactMemos(userAddresses) {
+  const header = [Buffer.from([MEMO_TLV_MAGIC, MEMO_TLV_VERSION, MEMO_TLV_TAG.TYPE, 1, MEMO_TYPE.compact])];
+  const toMemo = (entries) => ({
+    Memo: {
+      MemoData: Buffer.concat(header.concat(entries)).toString("hex").toUpperCase(),
+      MemoFormat: xrpl.convertStringToHex(MEMO_FORMAT_TLV),
+    },
+  });
+
+  const transactions = [];
+  let memos = [];
+  let entries = [];
+  let bytes = 0;
+  let users = 0;
+  const closeMemo = () => {
+    if (entries.length > 0) memos.push(toMemo(entries));
+    entries = [];
+  };
+  const closeTransaction = () => {
+    closeMemo();
+    if (memos.length > 0) transactions.push(memos);
+    memos = [];
+    bytes = 0;
+    users = 0;
+  };
+
+  for (const address of userAddresses) {
+    const user = Buffer.concat([Buffer.from([MEMO_TLV_TAG.USER, 20]), Buffer.from(xrpl.decodeAccountID(address))]);
+    const entry = Buffer.concat([Buffer.from([MEMO_TLV_TAG.ENTRY, user.length]), user]);
+    const memoHeader = entries.length === 0 ? header[0].length + MEMO_FORMAT_TLV.length : 0;
+    if (users >= COMPACT_MAX_USERS || bytes + memoHeader + entry.length > BATCH_MAX_MEMO_BYTES) {
+      closeTransaction();
+    } else if (entries.length >= BATCH_MAX_ENTRIES) {
+      closeMemo();
+    }
+    if (entries.length === 0) bytes += header[0].length + MEMO_FORMAT_TLV.length;
+    entries.push(entry);
+    bytes += entry.length;
+    users++;
+  }
+  closeTransaction();
+  // 対象ユーザーがいなくても、引き出しキューの削除のために1件送る
+  return transactions.length > 0 ? transactions : [[toMemo([])]];
+}
+
+/**
+ * 不要になったフックの State を削除させます（運営者のみ）。
+ * 指定したユーザーの旧形式のキー（'U' 'A'）、入れ替え済みの利用許可に対する累積請求（'C'）と、発行済みの引き出しキューのエントリを削除します。
+ * ユーザーが多い場合は複数の Invoke に分けて順に送信します。
+ * @param {xrpl.Wallet} operatorWallet - 運営者のウォレット
+ * @param {string} hookAddress - フックのアドレス
+ * @param {Array<string>} [userAddresses=[]] - 対象ユーザーのアドレス
+ * @param {xrpl.Client|ClientPool} [client] - 接続済みのクライアント（省略時は新たに接続）
+ * @returns {Promise<Object>} { results, reclaimedBytes, deletedEntries }
+ *   reclaimedBytes はフックの戻りコード（移行で書き込んだレコード分を差し引いたバイト数）の合計
+ */
+async function compactState(operatorWallet, hookAddress, userAddresses = [], client) {
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
+
+  try {
+    const summary = { results: [], reclaimedBytes: 0, deletedEntries: 0 };
+    for (const memos of buildCompactMemos(userAddresses)) {
+      const tx = {
+        TransactionType: "Invoke",
+        Account: operatorWallet.address,
+        Destination: hookAddress,
+        Memos: memos,
+      };
+      const signedTx = operatorWallet.sign(await client.autofill(tx));
+      const result = await client.submitAndWait(signedTx.tx_blob);
+      const meta = result.result.meta || {};
+      for (const { HookExecution: execution } of meta.HookExecutions || []) {
+        if (execution.HookAccount === hookAddress && execution.HookReturnCode !== undefined) {
+          summary.reclaimedBytes += Number(BigInt.asIntN(64, BigInt("0x" + execution.HookReturnCode)));
+        }
+      }
+      summary.deletedEntries += (meta.AffectedNodes || []).filter(
+        (node) => node.DeletedNode && node.DeletedNode.LedgerEntryType === "HookState"
+      ).length;
+      summary.results.push(result);
+    }
+    console.log(
+      `--- コンパクション完了: ${summary.results.length}件のトランザクション、` +
+        `${summary.deletedEntries}件の State を削除 (${summary.reclaimedBytes} バイト) ---`
+    );
+    return summary;
+  } finally {
+    if (ownClient) {
+      await client.disconnect();
+    }
+  }
+}
+
+/**
+ * 加盟店の未精算額を閾値によらず精算させます（運営者のみ）。
+ * 未精算額のある加盟店ごとに、フックが1件の Payment を発行します。
+ * 加盟店が多い場合は16件ずつ複数の Invoke に分けて順に送信します。
+ * @param {xrpl.Wallet} operatorWallet - 運営者のウォレット
+ * @param {string} hookAddress - フックのアドレス
+ * @param {Array<string>} merchantAddresses - 精算する加盟店のアドレス
+ * @param {xrpl.Client|ClientPool} [client] - 接続済みのクライアント（省略時は新たに接続）
+ * @returns {Promise<Object>} { results, settlements }（settlements は発行された Payment の数）
+ */
+async function settleMerchants(operatorWallet, hookAddress, merchantAddresses, client) {
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
+
+  try {
+    const summary = { results: [], settlements: 0 };
+    for (let i = 0; i < merchantAddresses.length; i += BATCH_MAX_MERCHANTS) {
+      const entries = merchantAddresses.slice(i, i + BATCH_MAX_MERCHANTS).map((address) => {
+        const user = Buffer.concat([Buffer.from([MEMO_TLV_TAG.USER, 20]), Buffer.from(xrpl.decodeAccountID(address))]);
+        return Buffer.concat([Buffer.from([MEMO_TLV_TAG.ENTRY, user.length]), user]);
+      });
+      const memoData = Buffer.concat([
+        Buffer.from([MEMO_TLV_MAGIC, MEMO_TLV_VERSION, MEMO_TLV_TAG.TYPE, 1, MEMO_TYPE.merchant_settle]),
+        ...entries,
+      ]);
+      const tx = {
+        TransactionType: "Invoke",
+        Account: operatorWallet.address,
+        Destination: hookAddress,
+        Memos: [
+          {
+            Memo: {
+              MemoData: memoData.toString("hex").toUpperCase(),
+              MemoFormat: xrpl.convertStringToHex(MEMO_FORMAT_TLV),
+            },
+          },
+        ],
+      };
+      const signedTx = operatorWallet.sign(await client.autofill(tx));
+      const result = await client.submitAndWait(signedTx.tx_blob);
+      const meta = result.result.meta || {};
+      for (const { HookExecution: execution } of meta.HookExecutions || []) {
+        if (execution.HookAccount === hookAddress && execution.HookReturnCode !== undefined) {
+          summary.settlements += Number(BigInt.asIntN(64, BigInt("0x" + execution.HookReturnCode)));
+        }
+      }
+      summary.results.push(result);
+    }
+    console.log(`--- 加盟店の精算完了: ${summary.settlements}件の Payment を発行 ---`);
+    return summary;
+  } finally {
+    if (ownClient) {
+      await client.disconnect();
+    }
+  }
+}
+
+/**
+ * 累積請求の引き落とし (claim_redeem) の Invoke を構築します。
+ * 1つの Invoke に入りきらない請求は複数の Invoke に分けます（最大16件、Memo は1KB以内）。
+ * @param {string} operatorAddress - 運営者のアドレス
+ * @param {string} hookAddress - フックのアドレス
+ * @param {Array<Object>} claims - { userAddress, generation, total, signature, merchantAddress } のリスト
+ * @returns {Array<Object>} { tx, claims } のリスト（claims はその Invoke に含めた請求）
+ */
+function buildClaimRedeemInvokes(operatorAddress, hookAddress, claims) {
+  const header = Buffer.from([MEMO_TLV_MAGIC, MEMO_TLV_VERSION, MEMO_TLV_TAG.TYPE, 1, MEMO_TYPE.claim_redeem]);
+  const field = (tag, value) => Buffer.concat([Buffer.from([tag, value.length]), value]);
+  const toInvoke = (entries, included) => ({
+    tx: {
+      TransactionType: "Invoke",
+      Account: operatorAddress,
+      Destination: hookAddress,
+      Memos: [
+        {
+          Memo: {
+            MemoData: Buffer.concat([header, ...entries]).toString("hex").toUpperCase(),
+            MemoFormat: xrpl.convertStringToHex(MEMO_FORMAT_TLV),
+          },
+        },
+      ],
+    },
+    claims: included,
+  });
+
+  const invokes = [];
+  let entries = [];
+  let included = [];
+  let bytes = header.length + MEMO_FORMAT_TLV.length;
+  let merchants = new Set();
+  for (const claim of claims) {
+    const parts = [
+      field(MEMO_TLV_TAG.USER, Buffer.from(xrpl.decodeAccountID(claim.userAddress))),
+      field(MEMO_TLV_TAG.AMOUNT, Buffer.from(String(claim.total), "ascii")),
+      field(MEMO_TLV_TAG.GENERATION, Buffer.from(String(claim.generation), "ascii")),
+      field(MEMO_TLV_TAG.SIGNATURE, Buffer.from(claim.signature, "hex")),
+    ];
+    if (claim.merchantAddress !== undefined) {
+      parts.push(field(MEMO_TLV_TAG.MERCHANT, Buffer.from(xrpl.decodeAccountID(claim.merchantAddress))));
+    }
+    const entry = field(MEMO_TLV_TAG.ENTRY, Buffer.concat(parts));
+    const nextMerchants = new Set(merchants);
+    if (claim.merchantAddress !== undefined) nextMerchants.add(claim.merchantAddress);
+    if (
+      entries.length > 0 &&
+      (entries.length >= BATCH_MAX_ENTRIES ||
+        bytes + entry.length > BATCH_MAX_MEMO_BYTES ||
+        nextMerchants.size > BATCH_MAX_MERCHANTS)
+    ) {
+      invokes.push(toInvoke(entries, included));
+      entries = [];
+      included = [];
+      bytes = header.length + MEMO_FORMAT_TLV.length;
+      merchants = new Set();
+    }
+    entries.push(entry);
+    included.push(claim);
+    bytes += entry.length;
+    if (claim.merchantAddress !== undefined) merchants.add(claim.merchantAddress);
+  }
+  if (entries.length > 0) invokes.push(toInvoke(entries, included));
+  return invokes;
+}
+
 // --- 実行部分 ---
 async function main() {
   const operatorWallet = xrpl.Wallet.fromSeed(process.env.OPERATOR_SEED);
   const hookAddress = xrpl.Wallet.fromSeed(process.env.HOOK_SEED).address;
   const userWallet = xrpl.Wallet.fromSeed(process.env.USER_SEED_1);
 
+  // 署名鍵の登録（初回のみ）
+  await registerPublicKey(userWallet, hookAddress);
+
   // スマートチャージの例
   const chargeAmount = "2000";
   const currentAllowance = "5000";
-  await chargeAndUpdateAllowance(
+  const { allowanceAmount, signature: allowanceSignature } = await chargeAndUpdateAllowance(
     userWallet,
     hookAddress,
     operatorWallet.address,
@@ -216,14 +987,7 @@ async function main() {
     currentAllowance
   );
 
-  // 従来の支払い処理の例
-  const allowanceAmount = "10000";
-  const allowanceSignature = createAllowanceSignature(
-    userWallet,
-    operatorWallet.address,
-    allowanceAmount
-  );
-
+  // 従来の支払い処理の例（フックが受け付けるのは、直前のチャージで設定した現在の利用許可だけ）
   const paymentAmount = "500";
   await sendPaymentWithAllowance(
     operatorWallet,
@@ -241,8 +1005,20 @@ if (require.main === module) {
 }
 
 module.exports = {
+  encodeTlvMemo,
+  buildMemo,
+  encodeTlvBatchMemo,
+  buildBatchInvoke,
   createAllowanceSignature,
+  registerPublicKey,
   sendPaymentWithAllowance,
+  sendPaymentBatchWithAllowance,
+  AllowancePaymentBatcher,
   chargeAndUpdateAllowance,
   withdrawBalance,
+  flushWithdrawals,
+  buildCompactMemos,
+  compactState,
+  settleMerchants,
+  buildClaimRedeemInvokes,
 };
@@ -0,0 +1,256 @@
+// Hocks/balance_cache.js
+// JPY の残高 (発行者とのトラストライン) のオフチェーンキャッシュ
+//
+// 起動時に発行者の account_lines を marker でページ単位にすべて読み込み (1回だけ)、以後は
+// 発行者・フックのアカウントを購読して、検証済みトランザクションのメタデータ (RippleState の
+// 作成・更新・削除) から残高を順に更新します。残高の参照はネットワークに問い合わせません。
+//
+// replay() で記録済みのストリーム (NDJSON) を流し込めるため、ネットワークなしで試験できます。
+// 記録: node src/js/balance_cache.js record <出力ファイル> [フックのアドレス...]
+const { EventEmitter } = require("events");
+const fs = require("fs");
+const readline = require("readline");
+const { ISSUER_ADDRESS, CURRENCY_CODE } = require("./hocks");
+
+// account_lines の1ページの件数 (xahaud の上限は 400)
+const DEFAULT_PAGE_SIZE = 400;
+
+/** 10進文字列の符号を反転します ("0" はそのまま)。 */
+function negate(value) {
+  if (value.startsWith("-")) return value.slice(1);
+  return /^[0.]*$/.test(value) ? value : "-" + value;
+}
+
+/**
+ * 発行者の残高のキャッシュ
+ */
+class BalanceCache extends EventEmitter {
+  /**
+   * @param {xrpl.Client|ClientPool} client - 接続済みのクライアント (replay のみなら null)
+   * @param {Object} [options]
+   * @param {string} [options.issuer] - 発行者のアドレス (既定は ISSUER_ADDRESS)
+   * @param {string} [options.currency] - 通貨コード (既定は CURRENCY_CODE)
+   * @param {Array<string>} [options.accounts] - 発行者とあわせて購読するアカウント (フックのアドレスなど)
+   * @param {number} [options.pageSize=400] - account_lines の1ページの件数
+   */
+  constructor(client, options = {}) {
+    super();
+    this.client = client;
+    this.issuer = options.issuer || ISSUER_ADDRESS;
+    this.currency = options.currency || CURRENCY_CODE;
+    this.accounts = [this.issuer, ...(options.accounts || []).filter((a) => a !== this.issuer)];
+    this.pageSize = options.pageSize || DEFAULT_PAGE_SIZE;
+
+    this.balances = new Map(); // 保有者のアドレス => 残高 (10進文字列、保有者から見た値)
+    this.ledgerIndex = 0;
+    // account_lines を読み込んだレジャー (これ以前のトランザクションは反映済み)
+    this.baseLedger = 0;
+    this.buffered = null;
+    this.stats = { pages: 0, transactions: 0, updates: 0 };
+    this.onTransaction = (event) => this.handleStream(event);
+    this.onLedgerClosed = (ledger) => this.handleStream({ type: "ledgerClosed", ...ledger });
+  }
+
+  /**
+   * ストリームを購読してから account_lines を読み込み、その間に届いたトランザクションを適用します。
+   */
+  async start() {
+    this.buffered = [];
+    this.client.on("transaction", this.onTransaction);
+    this.client.on("ledgerClosed", this.onLedgerClosed);
+    await this.client.request({ command: "subscribe", accounts: this.accounts, streams: ["ledger"] });
+
+    await this.bootstrap();
+
+    const buffered = this.buffered;
+    this.buffered = null;
+    buffered.forEach((message) => this.handleStream(message));
+  }
+
+  async stop() {
+    this.client.off("transaction", this.onTransaction);
+    this.client.off("ledgerClosed", this.onLedgerClosed);
+    await this.client.request({ command: "unsubscribe", accounts: this.accounts, streams: ["ledger"] });
+  }
+
+  /** 検証済みレジャーの発行者のトラストラインをすべて読み込みます。 */
+  async bootstrap() {
+    const { ledgerIndex, lines, pages } = await fetchAccountLines(this.client, this.issuer, this.pageSize);
+    this.stats.pages += pages;
+    this.load(ledgerIndex, lines);
+    this.emit("bootstrapped", { ledgerIndex, holders: this.balances.size, pages });
+  }
+
+  /** 発行者の account_lines の内容で置き換えます。 */
+  load(ledgerIndex, lines) {
+    this.balances.clear();
+    for (const line of lines) {
+      // 発行者から見た残高 (負の値が保有者の残高)
+      if (line.currency === this.currency) this.balances.set(line.account, negate(line.balance));
+    }
+    this.baseLedger = ledgerIndex;
+    this.ledgerIndex = Math.max(this.ledgerIndex, ledgerIndex);
+  }
+
+  handleStream(message) {
+    if (this.buffered) {
+      this.buffered.push(message);
+      return;
+    }
+    if (message.type === "ledgerClosed") {
+      if (message.ledger_index > this.ledgerIndex) this.ledgerIndex = message.ledger_index;
+    } else if (message.type === "transaction" || message.transaction || message.tx_json) {
+      this.applyTransaction(message);
+    }
+  }
+
+  /**
+   * 検証済みトランザクションのメタデータから発行者のトラストラインの変更を適用します。
+   * 読み込み時点より前のレジャーのものは無視します。購読した複数のアカウントに同じトランザクションが
+   * 届いても、RippleState の最終値を設定するだけなので結果は変わりません。
+   */
+  applyTransaction(event) {
+    if (!event.validated || event.ledger_index <= this.baseLedger) return;
+    if (!event.meta || typeof event.meta !== "object") return;
+
+    const changed = [];
+    for (const node of event.meta.AffectedNodes || []) {
+      const [kind, entry] = Object.entries(node)[0];
+      if (entry.LedgerEntryType !== "RippleState") continue;
+      const fields = entry.NewFields || entry.FinalFields || {};
+      const { Balance: balance, HighLimit: high, LowLimit: low } = fields;
+      if (!balance || !high || !low || balance.currency !== this.currency) continue;
+
+      // Balance は Low 側から見た値
+      let holder;
+      let value;
+      if (high.issuer === this.issuer) {
+        holder = low.issuer;
+        value = balance.value;
+      } else if (low.issuer === this.issuer) {
+        holder = high.issuer;
+        value = negate(balance.value);
+      } else {
+        continue;
+      }
+      if (kind === "DeletedNode") this.balances.delete(holder);
+      else this.balances.set(holder, value);
+      changed.push(holder);
+    }
+    this.stats.transactions++;
+    this.stats.updates += changed.length;
+    if (event.ledger_index > this.ledgerIndex) this.ledgerIndex = event.ledger_index;
+    if (changed.length > 0) {
+      const tx = event.transaction || event.tx_json || {};
+      this.emit("changed", { hash: tx.hash || event.hash, ledgerIndex: event.ledger_index, accounts: changed });
+    }
+  }
+
+  /**
+   * 記録済みのストリーム (1行1メッセージの NDJSON、または配列・非同期イテレータ) を適用します。
+   * ファイルの先頭に { "type": "account_lines", "ledger_index", "lines" } があれば初期状態として読み込みます。
+   */
+  async replay(source) {
+    const messages = typeof source === "string"
+      ? readline.createInterface({ input: fs.createReadStream(source), crlfDelay: Infinity })
+      : source;
+    for await (const line of messages) {
+      if (typeof line === "string" && line.trim() === "") continue;
+      const message = typeof line === "string" ? JSON.parse(line) : line;
+      if (message.type === "account_lines") this.load(message.ledger_index, message.lines);
+      else this.handleStream(message);
+    }
+  }
+
+  /**
+   * 保有者の残高 (10進文字列) を返します。トラストラインがなければ "0"。
+   * @param {string} address - 保有者のアドレス
+   */
+  balance(address) {
+    return this.balances.get(address) ?? "0";
+  }
+
+  /**
+   * 複数の保有者の残高をまとめて返します。
+   * @param {Array<string>} addresses - 保有者のアドレス
+   * @returns {Map<string, string>} アドレス => 残高
+   */
+  lookup(addresses) {
+    return new Map(addresses.map((address) => [address, this.balance(address)]));
+  }
+
+  /**
+   * checkBalance と同じ形 (account_lines の lines) で返します。発行者とのトラストラインのみです。
+   * @param {string} address - 保有者のアドレス
+   */
+  lines(address) {
+    if (!this.balances.has(address)) return [];
+    return [{ account: this.issuer, balance: this.balances.get(address), currency: this.currency }];
+  }
+
+  /** トラストラインのある保有者の数 */
+  get holders() {
+    return this.balances.size;
+  }
+}
+
+/**
+ * アカウントのトラストラインをページ単位ですべて読み込みます。2ページ目以降は同じレジャーに固定します。
+ * @param {string} [ledgerIndex="validated"] - 読み込むレジャー
+ */
+async function fetchAccountLines(client, address, pageSize = DEFAULT_PAGE_SIZE, ledgerIndex = "validated") {
+  const lines = [];
+  let pages = 0;
+  let marker;
+  do {
+    const response = await client.request({
+      command: "account_lines",
+      account: address,
+      ledger_index: ledgerIndex,
+      limit: pageSize,
+      marker,
+    });
+    // 検証済みレジャーなら番号に固定する ("current" は固定できないためそのまま)
+    if (response.result.ledger_index !== undefined) ledgerIndex = response.result.ledger_index;
+    lines.push(...response.result.lines);
+    marker = response.result.marker;
+    pages++;
+  } while (marker);
+  return { ledgerIndex, lines, pages };
+}
+
+/**
+ * 試験用に、発行者の account_lines と購読したアカウントのストリームを NDJSON に記録します。
+ */
+async function recordStream(client, output, options = {}) {
+  const issuer = options.issuer || ISSUER_ADDRESS;
+  const accounts = [issuer, ...(options.accounts || [])];
+  const out = fs.createWriteStream(output);
+  const write = (message) => out.write(JSON.stringify(message) + "\n");
+  // 購読を先に始め、読み込み中のトランザクションも記録する (replay 側で古いものは無視される)
+  client.on("transaction", write);
+  client.on("ledgerClosed", (ledger) => write({ type: "ledgerClosed", ...ledger }));
+  await client.request({ command: "subscribe", accounts, streams: ["ledger"] });
+  const { ledgerIndex, lines } = await fetchAccountLines(client, issuer, options.pageSize);
+  write({ type: "account_lines", ledger_index: ledgerIndex, lines });
+  return out;
+}
+
+// 使い方: node src/js/balance_cache.js record <出力ファイル> [フックのアドレス...]
+if (require.main === module) {
+  const [command, output, ...accounts] = process.argv.slice(2);
+  if (command !== "record" || !output) {
+    console.error("usage: node src/js/balance_cache.js record <output.ndjson> [hookAddress...]");
+    process.exit(1);
+  }
+  const { initClient } = require("./hocks");
+  initClient()
+    .then((client) => recordStream(client, output, { accounts }))
+    .then(() => console.log(`recording to ${output} (Ctrl-C to stop)`));
+}
+
+module.exports = {
+  BalanceCache,
+  fetchAccountLines,
+  recordStream,
+};
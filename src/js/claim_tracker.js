@@ -0,0 +1,191 @@
+// src/js/claim_tracker.js
+// 累積請求 (ストリーミング決済): ユーザーはオフレジャーで累積請求額が単調に増える請求に署名し、
+// 運営者はそれを検証して最新の請求だけを保持し、定期的にまとめてフックで引き落とす。
+// フックは引き落とし済みの累積請求額との差分だけを残高から引くため、
+// 何千回の少額課金も1回の実行にまとまる。
+const { xrpl, initClient } = require("./hocks");
+const { signClaim, verifyClaim } = require("./signature_pool");
+const { buildClaimRedeemInvokes } = require("./allowance_payment");
+const { PrecheckError, PRECHECK_ERROR, allowanceDigest } = require("./state_mirror");
+
+/**
+ * ユーザーが累積請求に署名します。
+ * @param {xrpl.Wallet} userWallet - ユーザーのウォレット
+ * @param {string} operatorAddress - 運営者のアドレス
+ * @param {string} allowanceAmount - 現在の利用許可額
+ * @param {string} allowanceSignature - 現在の利用許可署名
+ * @param {number} generation - 現在の利用許可の世代（StateMirror のレコードの generation）
+ * @param {string} total - これまでの累積請求額
+ * @param {string} [merchantAddress] - 支払い先の加盟店のアドレス
+ * @returns {Object} 請求 { userAddress, allowanceDigest, generation, total, signature, merchantAddress }
+ */
+function createClaim(userWallet, operatorAddress, allowanceAmount, allowanceSignature, generation, total, merchantAddress) {
+  // 請求はこのダイジェストの利用許可にのみ有効 (フックの allowance_digest と同じ計算)
+  const digest = allowanceDigest(xrpl.decodeAccountID(userWallet.address), String(allowanceAmount), allowanceSignature);
+  return {
+    userAddress: userWallet.address,
+    allowanceDigest: digest,
+    generation: Number(generation),
+    total: String(total),
+    signature: signClaim({
+      userAddress: userWallet.address,
+      privateKey: userWallet.privateKey,
+      operatorAddress,
+      allowanceDigest: digest,
+      generation: String(generation),
+      total: String(total),
+    }),
+    merchantAddress,
+  };
+}
+
+/** 同じ利用許可 (ダイジェストと世代が同じ) に対する請求か */
+function sameAllowance(a, b) {
+  return a.allowanceDigest === b.allowanceDigest && a.generation === b.generation;
+}
+
+/**
+ * 運営者側で、ユーザーごとに最新の累積請求と引き落とし済みの額を保持します。
+ */
+class ClaimTracker {
+  /**
+   * @param {xrpl.Wallet} operatorWallet - 運営者のウォレット
+   * @param {string} hookAddress - フックのアドレス
+   * @param {Object} options
+   * @param {Map|Function} options.publicKeys - ユーザーのアドレスから公開鍵を引く Map または関数
+   *   （Promise を返してもよい）
+   * @param {SignaturePool} [options.signaturePool] - 指定すると署名をワーカースレッドで検証する
+   * @param {xrpl.Client|ClientPool} [options.client] - 接続済みのクライアント（省略時は redeem のたびに接続）
+   */
+  constructor(operatorWallet, hookAddress, options = {}) {
+    if (!options.publicKeys) {
+      throw new Error("ClaimTracker には publicKeys が必要です");
+    }
+    this.operatorWallet = operatorWallet;
+    this.hookAddress = hookAddress;
+    this.publicKeys = options.publicKeys;
+    this.signaturePool = options.signaturePool;
+    this.client = options.client;
+    // ユーザーのアドレス -> { claim, redeemed (bigint) }
+    this.claims = new Map();
+  }
+
+  /**
+   * 請求を検証し、保持している請求より累積請求額が大きければ置き換えます。
+   * 署名が無効な請求は PrecheckError (702) になります。
+   * 保持している請求より古い世代の請求は PrecheckError (703) になります。別の利用許可の請求は、
+   * 保持している請求をすべて引き落とすまで受け付けません（フックは現在の世代の請求しか引き落とせないため）。
+   * @param {Object} claim - createClaim の戻り値
+   * @returns {Promise<boolean>} 保持した場合 true（古い請求なら false）
+   */
+  async accept(claim) {
+    if (!/^[0-9]+$/.test(String(claim.total)) || BigInt(claim.total) <= 0n) {
+      throw new PrecheckError("Invalid claim total.", PRECHECK_ERROR.INVALID_AMOUNT);
+    }
+    if (!Number.isSafeInteger(claim.generation) || claim.generation < 0) {
+      throw new PrecheckError("Invalid allowance generation.", PRECHECK_ERROR.CLAIM_VERIFICATION_FAILED);
+    }
+    const total = BigInt(claim.total);
+    const current = this.claims.get(claim.userAddress);
+    if (current && claim.generation < current.claim.generation) {
+      throw new PrecheckError("Claim is for an older allowance.", PRECHECK_ERROR.CLAIM_STALE);
+    }
+    if (current && sameAllowance(current.claim, claim) && total <= BigInt(current.claim.total)) {
+      return false;
+    }
+    if (current && !sameAllowance(current.claim, claim) && BigInt(current.claim.total) > current.redeemed) {
+      throw new PrecheckError("Unredeemed claim for the previous allowance.", PRECHECK_ERROR.CLAIM_STALE);
+    }
+
+    const publicKey =
+      (await (typeof this.publicKeys === "function"
+        ? this.publicKeys(claim.userAddress)
+        : this.publicKeys.get(claim.userAddress))) || "";
+    const request = {
+      userAddress: claim.userAddress,
+      publicKey,
+      operatorAddress: this.operatorWallet.address,
+      allowanceDigest: claim.allowanceDigest,
+      generation: String(claim.generation),
+      total: String(claim.total),
+      signature: claim.signature,
+    };
+    const valid = this.signaturePool
+      ? (await this.signaturePool.verifyClaims([request]))[0]
+      : verifyClaim(request);
+    if (!valid) {
+      throw new PrecheckError("Claim signature verification failed.", PRECHECK_ERROR.CLAIM_VERIFICATION_FAILED);
+    }
+
+    // 検証中に同じユーザーの新しい請求が入った場合は大きい方を残す
+    const latest = this.claims.get(claim.userAddress);
+    if (latest && (claim.generation < latest.claim.generation ||
+        (sameAllowance(latest.claim, claim) && total <= BigInt(latest.claim.total)))) {
+      return false;
+    }
+    const redeemed = latest && sameAllowance(latest.claim, claim) ? latest.redeemed : 0n;
+    this.claims.set(claim.userAddress, { claim: { ...claim, total: String(claim.total) }, redeemed });
+    return true;
+  }
+
+  /**
+   * まだ引き落としていない請求を返します。
+   * @returns {Array<Object>} { claim, amount (bigint) } のリスト
+   */
+  pending() {
+    return [...this.claims.values()]
+      .filter(({ claim, redeemed }) => BigInt(claim.total) > redeemed)
+      .map(({ claim, redeemed }) => ({ claim, amount: BigInt(claim.total) - redeemed }));
+  }
+
+  /**
+   * 保持している最新の請求をフックで引き落とします（運営者のみ）。
+   * Invoke に入りきらない場合は分けて順に送信し、成功した Invoke の請求だけを引き落とし済みにします。
+   * @returns {Promise<Object>} { results, redeemed (円), failed (件数) }
+   */
+  async redeem() {
+    const claims = this.pending().map((p) => p.claim);
+    const summary = { results: [], redeemed: 0n, failed: 0 };
+    if (claims.length === 0) {
+      return summary;
+    }
+
+    let client = this.client;
+    const ownClient = !client;
+    if (ownClient) {
+      client = await initClient();
+    }
+    try {
+      for (const { tx, claims: included } of buildClaimRedeemInvokes(this.operatorWallet.address, this.hookAddress, claims)) {
+        const signedTx = this.operatorWallet.sign(await client.autofill(tx));
+        const result = await client.submitAndWait(signedTx.tx_blob);
+        summary.results.push(result);
+        const meta = result.result.meta || {};
+        if (meta.TransactionResult !== "tesSUCCESS") {
+          summary.failed += included.length;
+          continue;
+        }
+        for (const claim of included) {
+          const entry = this.claims.get(claim.userAddress);
+          if (!entry || !sameAllowance(entry.claim, claim)) continue;
+          const total = BigInt(claim.total);
+          if (total > entry.redeemed) {
+            summary.redeemed += total - entry.redeemed;
+            entry.redeemed = total;
+          }
+        }
+      }
+      console.log(`--- 累積請求の引き落とし完了: ${summary.redeemed} 円 (失敗 ${summary.failed}件) ---`);
+      return summary;
+    } finally {
+      if (ownClient) {
+        await client.disconnect();
+      }
+    }
+  }
+}
+
+module.exports = {
+  createClaim,
+  ClaimTracker,
+};
@@ -0,0 +1,452 @@
+// Hocks/client_pool.js
+// 常時接続のクライアントプールと、アカウントごとのシーケンス・Ticket管理によるパイプライン送信
+//
+// トランザクションごとに接続・autofill・submitAndWait・切断を繰り返す代わりに、
+//   - 接続は起動時に張ったものを使い回す (複数接続をラウンドロビン)
+//   - Sequence / TicketSequence はローカルで採番し、検証を待たずに次を送信する
+//   - Fee・LastLedgerSequence・NetworkID はキャッシュから埋める (ledger ストリームで更新)
+//   - 結果はアカウントの transaction ストリームで非同期に受け取る
+// ことで、1アカウントから多数のトランザクションを同時に送信できるようにします。
+//
+// ClientPool は autofill / submitAndWait / request / disconnect を持つため、
+// xrpl.Client を受け取る既存の関数 (sendPaymentBatchWithAllowance など) にそのまま渡せます。
+const { EventEmitter } = require("events");
+const { xrpl, XAHAU_TESTNET_URL } = require("./hocks");
+
+const DEFAULT_POOL_SIZE = 2;
+// LastLedgerSequence = 最新の検証済みレジャー + この値
+const LAST_LEDGER_OFFSET = 20;
+const FEE_TTL_MS = 10000;
+// TicketCreate 1回で作成できる最大数
+const TICKET_CREATE_MAX = 250;
+
+/**
+ * 送信時のエンジン結果を分類します。
+ * @returns {"pending"|"resync"|"retry"|"failed"} pending: 検証待ち、resync: シーケンスを取り直して再送、
+ *   retry: 手数料を取り直して再送、failed: 失敗 (シーケンスは消費されない)
+ */
+function classifyEngineResult(engineResult) {
+  if (/^(tes|tec)/.test(engineResult) || engineResult === "terQUEUED" || engineResult === "terPRE_SEQ") {
+    return "pending";
+  }
+  if (engineResult === "tefPAST_SEQ" || engineResult === "tefNO_TICKET") return "resync";
+  if (engineResult === "telINSUF_FEE_P" || engineResult === "telCAN_NOT_QUEUE_FEE") return "retry";
+  return "failed";
+}
+
+class SubmitError extends Error {
+  constructor(message, engineResult, response) {
+    super(message);
+    this.name = "SubmitError";
+    this.engineResult = engineResult;
+    this.response = response;
+  }
+}
+
+/**
+ * アカウントごとのシーケンス・Ticket管理
+ */
+class AccountSequencer {
+  constructor(pool, address, options = {}) {
+    this.pool = pool;
+    this.address = address;
+    this.useTickets = !!options.useTickets;
+    this.ticketBatch = Math.min(options.ticketBatch || 50, TICKET_CREATE_MAX);
+    this.nextSequence = null;
+    this.loading = null;
+    this.tickets = [];
+    // 取り出したが、まだ検証・失敗が確定していないTicket
+    this.takenTickets = new Set();
+    this.ticketsLoading = null;
+  }
+
+  async sync() {
+    if (!this.loading) {
+      this.loading = this.pool
+        .request({ command: "account_info", account: this.address, ledger_index: "current" })
+        .then((response) => {
+          this.nextSequence = response.result.account_data.Sequence;
+        })
+        .finally(() => {
+          this.loading = null;
+        });
+    }
+    return this.loading;
+  }
+
+  /** 次回の採番でシーケンスをレジャーから取り直します。 */
+  invalidate() {
+    this.nextSequence = null;
+  }
+
+  async takeSequence() {
+    while (this.nextSequence === null) await this.sync();
+    return this.nextSequence++;
+  }
+
+  async loadTickets() {
+    const response = await this.pool.request({
+      command: "account_objects",
+      account: this.address,
+      type: "ticket",
+      ledger_index: "validated",
+      limit: 400,
+    });
+    this.tickets = response.result.account_objects
+      .map((obj) => obj.TicketSequence)
+      .filter((seq) => !this.takenTickets.has(seq))
+      .sort((a, b) => a - b);
+  }
+
+  /**
+   * 未使用のTicketを1つ取り出します。足りなければ TicketCreate で補充します。
+   * @param {xrpl.Wallet} [wallet] - 補充に使うウォレット (省略時は補充しない)
+   */
+  async takeTicket(wallet) {
+    for (;;) {
+      if (this.tickets.length > 0) {
+        const ticket = this.tickets.shift();
+        this.takenTickets.add(ticket);
+        return ticket;
+      }
+      if (!this.ticketsLoading) {
+        this.ticketsLoading = (async () => {
+          await this.loadTickets();
+          if (this.tickets.length === 0 && wallet) {
+            await this.pool.submit({ TransactionType: "TicketCreate", TicketCount: this.ticketBatch }, wallet, {
+              useTickets: false,
+            }).validated;
+            await this.loadTickets();
+          }
+        })().finally(() => {
+          this.ticketsLoading = null;
+        });
+      }
+      await this.ticketsLoading;
+      if (this.tickets.length === 0 && !wallet) {
+        throw new Error(`利用可能なTicketがありません: ${this.address}`);
+      }
+    }
+  }
+
+  /** 検証済みのTicketを管理対象から外します。 */
+  consumeTicket(ticket) {
+    this.takenTickets.delete(ticket);
+  }
+
+  /** 送信されなかったTicketを戻します。 */
+  releaseTicket(ticket) {
+    this.takenTickets.delete(ticket);
+    if (!this.tickets.includes(ticket)) {
+      this.tickets.push(ticket);
+      this.tickets.sort((a, b) => a - b);
+    }
+  }
+}
+
+/**
+ * 常時接続のクライアントプール
+ */
+class ClientPool extends EventEmitter {
+  /**
+   * @param {Object} [options]
+   * @param {string} [options.url] - 接続先 (既定は Xahau テストネット)
+   * @param {number} [options.size=2] - 接続数
+   * @param {Function} [options.createClient] - (url) => クライアント (テスト用に差し替え可能)
+   * @param {number} [options.lastLedgerOffset=20] - LastLedgerSequence の余裕
+   * @param {number} [options.feeTtlMs=10000] - 手数料キャッシュの有効期間
+   * @param {number} [options.feeMultiplier=1] - 手数料に掛ける係数 (フック実行手数料の余裕)
+   * @param {boolean} [options.useTickets=false] - 既定で Ticket を使って送信する
+   * @param {number} [options.ticketBatch=50] - Ticket 補充時に作成する数
+   */
+  constructor(options = {}) {
+    super();
+    this.url = options.url || XAHAU_TESTNET_URL;
+    this.size = options.size || DEFAULT_POOL_SIZE;
+    this.createClient = options.createClient || ((url) => new xrpl.Client(url));
+    this.lastLedgerOffset = options.lastLedgerOffset ?? LAST_LEDGER_OFFSET;
+    this.feeTtlMs = options.feeTtlMs ?? FEE_TTL_MS;
+    this.feeMultiplier = options.feeMultiplier ?? 1;
+    this.sequencerOptions = { useTickets: options.useTickets, ticketBatch: options.ticketBatch };
+
+    this.clients = [];
+    this.cursor = 0;
+    this.networkId = undefined;
+    this.ledgerIndex = null;
+    this.feeCache = new Map();
+    this.sequencers = new Map();
+    // address => 購読リクエストの Promise (全員が同じ Promise を待つことで送信順を保つ)
+    this.subscribedAccounts = new Map();
+    // hash => { account, lastLedger, ticket, resolve, reject }
+    this.pending = new Map();
+    this.connecting = null;
+  }
+
+  /** すべての接続を開き、ledger ストリームを購読します。 */
+  async connect() {
+    if (!this.connecting) {
+      this.connecting = (async () => {
+        this.clients = Array.from({ length: this.size }, () => this.createClient(this.url));
+        await Promise.all(this.clients.map((client) => client.connect()));
+
+        const primary = this.clients[0];
+        primary.on("ledgerClosed", (ledger) => this.onLedgerClosed(ledger));
+        primary.on("transaction", (event) => this.onTransaction(event));
+        // 再接続したら購読し直す
+        primary.on("connected", () => this.subscribe().catch((error) => this.emit("error", error)));
+
+        const info = await primary.request({ command: "server_info" });
+        this.networkId = info.result.info.network_id;
+        await this.subscribe();
+      })();
+    }
+    return this.connecting;
+  }
+
+  async subscribe() {
+    const primary = this.clients[0];
+    const response = await primary.request({
+      command: "subscribe",
+      streams: ["ledger"],
+      accounts: this.subscribedAccounts.size > 0 ? [...this.subscribedAccounts.keys()] : undefined,
+    });
+    if (response.result.ledger_index) this.ledgerIndex = response.result.ledger_index;
+  }
+
+  watchAccount(address) {
+    if (!this.subscribedAccounts.has(address)) {
+      this.subscribedAccounts.set(address, this.clients[0].request({ command: "subscribe", accounts: [address] }));
+    }
+    return this.subscribedAccounts.get(address);
+  }
+
+  /** 接続済みのクライアントをラウンドロビンで返します。 */
+  client() {
+    for (let i = 0; i < this.clients.length; i++) {
+      const client = this.clients[this.cursor++ % this.clients.length];
+      if (client.isConnected()) return client;
+    }
+    throw new Error("接続中のクライアントがありません");
+  }
+
+  async request(request) {
+    await this.connect();
+    // ストリームはプライマリの接続で受け取る
+    if (request.command === "subscribe" || request.command === "unsubscribe") {
+      return this.clients[0].request(request);
+    }
+    return this.client().request(request);
+  }
+
+  /** プール内のすべての接続を閉じます。検証待ちのトランザクションは失敗にします。 */
+  async close() {
+    const clients = this.clients;
+    this.clients = [];
+    this.connecting = null;
+    for (const [hash, entry] of this.pending) {
+      entry.reject(new Error(`接続を閉じたため結果を確認できません: ${hash}`));
+    }
+    this.pending.clear();
+    await Promise.all(clients.map((client) => client.disconnect()));
+  }
+
+  async disconnect() {
+    await this.close();
+  }
+
+  sequencer(address) {
+    if (!this.sequencers.has(address)) {
+      this.sequencers.set(address, new AccountSequencer(this, address, this.sequencerOptions));
+    }
+    return this.sequencers.get(address);
+  }
+
+  async currentLedger() {
+    if (this.ledgerIndex === null) {
+      const response = await this.request({ command: "ledger", ledger_index: "validated" });
+      this.ledgerIndex = response.result.ledger_index;
+    }
+    return this.ledgerIndex;
+  }
+
+  /**
+   * 手数料 (drops) を返します。トランザクションの種類と宛先ごとにキャッシュします。
+   * xahaud はフックの実行手数料を含む額を tx_blob 付きの fee で返すため、作れればそれを使います。
+   */
+  async fee(tx) {
+    const key = `${tx.TransactionType}:${tx.Destination || ""}`;
+    const cached = this.feeCache.get(key);
+    if (cached && cached.expires > Date.now()) return cached.fee;
+
+    const request = { command: "fee" };
+    try {
+      request.tx_blob = xrpl.encode({ ...tx, Fee: "0", SigningPubKey: "", Sequence: tx.Sequence || 0 });
+    } catch (error) {
+      // エンコードできない場合は基本手数料のみ
+    }
+    // 同時に呼ばれても問い合わせは1回にする
+    const fee = this.request(request).then(({ result: { drops } }) => {
+      const base = Math.max(Number(drops.base_fee), Number(drops.open_ledger_fee || 0));
+      return String(Math.ceil(base * this.feeMultiplier));
+    });
+    this.feeCache.set(key, { fee, expires: Date.now() + this.feeTtlMs });
+    fee.catch(() => this.feeCache.delete(key));
+    return fee;
+  }
+
+  /**
+   * Fee・Sequence (または TicketSequence)・LastLedgerSequence・NetworkID を埋めます。
+   * xrpl.Client#autofill と異なり、シーケンスはローカルで採番するため送信を待たずに連続して呼べます。
+   * @param {Object} tx - トランザクション
+   * @param {Object} [options]
+   * @param {boolean} [options.useTickets] - Ticket を使う
+   * @param {xrpl.Wallet} [options.wallet] - Ticket 補充に使うウォレット
+   */
+  async autofill(tx, options = {}) {
+    await this.connect();
+    const prepared = { ...tx };
+    const sequencer = this.sequencer(prepared.Account);
+    const useTickets = options.useTickets ?? sequencer.useTickets;
+
+    if (prepared.NetworkID === undefined && this.networkId > 1024) prepared.NetworkID = this.networkId;
+    if (prepared.LastLedgerSequence === undefined) {
+      prepared.LastLedgerSequence = (await this.currentLedger()) + this.lastLedgerOffset;
+    }
+    if (prepared.Fee === undefined) prepared.Fee = await this.fee(prepared);
+    if (prepared.Sequence === undefined && prepared.TicketSequence === undefined) {
+      if (useTickets) {
+        prepared.Sequence = 0;
+        prepared.TicketSequence = await sequencer.takeTicket(options.wallet);
+      } else {
+        prepared.Sequence = await sequencer.takeSequence();
+        // TicketCreate は作成するTicketの分だけシーケンスを進める
+        if (prepared.TransactionType === "TicketCreate") sequencer.nextSequence += prepared.TicketCount;
+      }
+    }
+    return prepared;
+  }
+
+  /**
+   * 署名済みトランザクションを送信し、検証結果を待つ Promise を返します (submitAndWait 互換)。
+   * @param {string} txBlob - 署名済みトランザクション
+   * @returns {Promise<Object>} { result: 検証済みトランザクション }
+   */
+  async submitAndWait(txBlob) {
+    const { validated } = await this.submitSigned(txBlob);
+    return validated;
+  }
+
+  /**
+   * 署名済みトランザクションを送信します。送信結果が出た時点で解決し、
+   * 検証結果は返り値の validated で受け取ります。
+   */
+  async submitSigned(txBlob) {
+    await this.connect();
+    const tx = xrpl.decode(txBlob);
+    const hash = xrpl.hashes.hashSignedTx(txBlob);
+    const sequencer = this.sequencer(tx.Account);
+    await this.watchAccount(tx.Account);
+
+    // 送信より先に登録し、ストリームの通知を取りこぼさないようにする
+    let entry;
+    const validated = new Promise((resolve, reject) => {
+      entry = { account: tx.Account, lastLedger: tx.LastLedgerSequence, ticket: tx.TicketSequence, resolve, reject };
+    });
+    validated.catch(() => {});
+    this.pending.set(hash, entry);
+
+    let response;
+    try {
+      response = await this.client().request({ command: "submit", tx_blob: txBlob });
+    } catch (error) {
+      this.pending.delete(hash);
+      sequencer.invalidate();
+      throw error;
+    }
+
+    const engineResult = response.result.engine_result;
+    const outcome = classifyEngineResult(engineResult);
+    if (outcome !== "pending") {
+      this.pending.delete(hash);
+      // 適用されなかったシーケンス・Ticket は次の採番で使い直す
+      if (tx.TicketSequence) sequencer.releaseTicket(tx.TicketSequence);
+      else sequencer.invalidate();
+      if (outcome === "retry") this.feeCache.clear();
+      throw new SubmitError(`送信に失敗しました: ${engineResult}`, engineResult, response);
+    }
+    return { hash, engineResult, validated };
+  }
+
+  /**
+   * トランザクションを採番・署名・送信します。シーケンスの不一致・手数料不足の場合は1回だけ再送します。
+   * @param {Object} tx - トランザクション (Account は省略時ウォレットのアドレス)
+   * @param {xrpl.Wallet} wallet - 署名するウォレット
+   * @param {Object} [options] - autofill のオプション
+   * @returns {{ hash: Promise<string>, submitted: Promise<Object>, validated: Promise<Object> }}
+   */
+  submit(tx, wallet, options = {}) {
+    const run = async (attempt) => {
+      const prepared = await this.autofill({ Account: wallet.address, ...tx }, { ...options, wallet });
+      const signed = wallet.sign(prepared);
+      try {
+        return await this.submitSigned(signed.tx_blob);
+      } catch (error) {
+        if (attempt === 0 && error instanceof SubmitError && error.engineResult !== undefined &&
+            classifyEngineResult(error.engineResult) !== "failed") {
+          return run(attempt + 1);
+        }
+        throw error;
+      }
+    };
+    const submitted = run(0);
+    const hash = submitted.then((s) => s.hash);
+    const validated = submitted.then((s) => s.validated);
+    // submitted だけを待つ呼び出し元がいるため、失敗は未処理の拒否にしない
+    hash.catch(() => {});
+    validated.catch(() => {});
+    return { hash, submitted, validated };
+  }
+
+  onTransaction(event) {
+    this.emit("transaction", event);
+    const tx = event.transaction || event.tx_json || {};
+    const hash = tx.hash || event.hash;
+    const entry = this.pending.get(hash);
+    if (!entry || !event.validated) return;
+    this.pending.delete(hash);
+    if (entry.ticket) this.sequencer(entry.account).consumeTicket(entry.ticket);
+    entry.resolve({ result: { ...tx, hash, meta: event.meta, validated: true, ledger_index: event.ledger_index } });
+  }
+
+  onLedgerClosed(ledger) {
+    this.ledgerIndex = ledger.ledger_index;
+    this.emit("ledgerClosed", ledger);
+
+    // LastLedgerSequence を過ぎたものは、通知を取りこぼしていないか確認してから失敗にする
+    for (const [hash, entry] of this.pending) {
+      if (entry.lastLedger === undefined || ledger.ledger_index <= entry.lastLedger || entry.checking) continue;
+      entry.checking = true;
+      this.request({ command: "tx", transaction: hash })
+        .then((response) => {
+          if (!response.result.validated) throw new Error("not validated");
+          this.onTransaction({ transaction: response.result, meta: response.result.meta, validated: true,
+            ledger_index: response.result.ledger_index });
+        })
+        .catch(() => {
+          if (!this.pending.has(hash)) return;
+          this.pending.delete(hash);
+          const sequencer = this.sequencer(entry.account);
+          if (entry.ticket) sequencer.releaseTicket(entry.ticket);
+          else sequencer.invalidate();
+          entry.reject(new SubmitError(`LastLedgerSequence を過ぎても検証されませんでした: ${hash}`, "tefMAX_LEDGER"));
+        });
+    }
+  }
+}
+
+module.exports = {
+  ClientPool,
+  AccountSequencer,
+  SubmitError,
+  classifyEngineResult,
+};
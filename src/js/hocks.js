@@ -3,8 +3,13 @@ require("dotenv").config();
 
 // 共通設定
 const XAHAU_TESTNET_URL = "wss://xahau-test.net/";
-const ISSUER_ADDRESS = "rhyYNdxAyFQ7s2KYXhaTMJKF7NrkkZj1X9";
+// アドレスは .env で上書きできる (フック側の値は build/gen_config.js でここから生成する)
+const ISSUER_ADDRESS = process.env.ISSUER_ADDRESS || "rhyYNdxAyFQ7s2KYXhaTMJKF7NrkkZj1X9";
+const OPERATOR_ADDRESS = process.env.OPERATOR_ADDRESS || "rHzN5Fkw67xccV22UmeCLHFZy2aVLt55e8";
 const CURRENCY_CODE = "JPY";
+// 加盟店への精算の閾値 (未精算額・未精算の支払い数のどちらかに達すると、フックが精算の Payment を発行する)
+const MERCHANT_SETTLE_AMOUNT = process.env.MERCHANT_SETTLE_AMOUNT || "100000";
+const MERCHANT_SETTLE_COUNT = process.env.MERCHANT_SETTLE_COUNT || "100";
 
 // クライアントの初期化
 async function initClient() {
@@ -17,6 +22,9 @@ module.exports = {
   xrpl,
   XAHAU_TESTNET_URL,
   ISSUER_ADDRESS,
+  OPERATOR_ADDRESS,
   CURRENCY_CODE,
+  MERCHANT_SETTLE_AMOUNT,
+  MERCHANT_SETTLE_COUNT,
   initClient,
 };
@@ -1,8 +1,13 @@
 const { xrpl, ISSUER_ADDRESS, CURRENCY_CODE, initClient } = require("./hocks");
+const { BalanceCache, fetchAccountLines } = require("./balance_cache");
 
 // トークン発行
-async function issueToken(seed, amount = "1000000") {
-  const client = await initClient();
+async function issueToken(seed, amount = "1000000", client) {
+  // 接続済みのクライアント (ClientPool など) が渡されなければ新たに接続する
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
   try {
     const wallet = xrpl.Wallet.fromSeed(seed);
 
@@ -26,32 +31,40 @@ async function issueToken(seed, amount = "1000000") {
     console.error("エラー:", error);
     throw error;
   } finally {
-    await client.disconnect();
+    if (ownClient) {
+      await client.disconnect();
+    }
   }
 }
 
 // 残高確認
-async function checkBalance(address) {
-  const client = await initClient();
+// BalanceCache (src/js/balance_cache.js) を渡すとネットワークに問い合わせずにキャッシュから返す
+async function checkBalance(address, client) {
+  if (client instanceof BalanceCache) {
+    return client.lines(address);
+  }
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
   try {
-    const response = await client.request({
-      command: "account_lines",
-      account: address,
-      ledger_index: "current",
-    });
-
-    console.log("残高情報:", response.result.lines);
-    return response.result.lines;
+    // トラストラインの多いアカウント (発行者など) は複数ページになる
+    const { lines } = await fetchAccountLines(client, address, undefined, "current");
+
+    console.log("残高情報:", lines);
+    return lines;
   } catch (error) {
     console.error("エラー:", error);
     throw error;
   } finally {
-    await client.disconnect();
+    if (ownClient) {
+      await client.disconnect();
+    }
   }
 }
 
 // トークン送信
-async function sendToken(seed, destination, amount) {
+async function sendToken(seed, destination, amount, client) {
   // 小数点以下のバリデーション
   if (!Number.isInteger(Number(amount))) {
     throw new Error(
@@ -59,7 +72,10 @@ async function sendToken(seed, destination, amount) {
     );
   }
 
-  const client = await initClient();
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
   try {
     const wallet = xrpl.Wallet.fromSeed(seed);
 
@@ -84,12 +100,14 @@ async function sendToken(seed, destination, amount) {
     console.error("エラー:", error);
     throw error;
   } finally {
-    await client.disconnect();
+    if (ownClient) {
+      await client.disconnect();
+    }
   }
 }
 
 // トークン焼却（バーン）
-async function burnToken(seed, amount) {
+async function burnToken(seed, amount, client) {
   // 小数点以下のバリデーション
   if (!Number.isInteger(Number(amount))) {
     throw new Error(
@@ -97,7 +115,10 @@ async function burnToken(seed, amount) {
     );
   }
 
-  const client = await initClient();
+  const ownClient = !client;
+  if (ownClient) {
+    client = await initClient();
+  }
   try {
     const wallet = xrpl.Wallet.fromSeed(seed);
 
@@ -123,7 +144,9 @@ async function burnToken(seed, amount) {
     console.error("エラー:", error);
     throw error;
   } finally {
-    await client.disconnect();
+    if (ownClient) {
+      await client.disconnect();
+    }
   }
 }
 
@@ -0,0 +1,481 @@
+// Hocks/mock_xahaud.js
+// ClientPool の動作確認・負荷試験用の簡易 xahaud (WebSocket API の一部のみ)
+//
+// 対応コマンド: server_info, fee, ping, ledger, ledger_current, account_info,
+//   account_objects (ticket), account_lines, account_namespace, submit, tx, subscribe, unsubscribe
+// 一定間隔でレジャーを閉じ、ledger / accounts ストリームに通知します。
+// フックは実行せず、エンジン結果は options.engineResult で決めます。
+// 発行済みトークン (整数額) の Payment はトラストラインの残高を移し、RippleState の変更をメタデータに含めます
+// (限度額やパスは確認しません)。トラストラインは setTrustLine() で直接設定できます。
+// options.hook を指定すると、レジャーを閉じる際にトランザクションごとに呼び出し、
+// 返された HookState の変更を名前空間に反映してメタデータ (AffectedNodes) に含めます。
+//
+// 使い方:
+//   const mock = new MockXahaud();
+//   mock.fund(wallet.address);
+//   const pool = new ClientPool({ createClient: () => mock.createClient() }); // プロセス内
+//   const url = await mock.listen(6006);  // または WebSocket で待ち受け (ws パッケージが必要)
+const { EventEmitter } = require("events");
+const crypto = require("crypto");
+const { xrpl } = require("./hocks");
+
+class MockXahaudError extends Error {
+  constructor(error, message) {
+    super(message || error);
+    this.data = { error, error_message: message || error };
+  }
+}
+
+class MockXahaud extends EventEmitter {
+  /**
+   * @param {Object} [options]
+   * @param {number} [options.networkId=21338] - NetworkID (Xahau テストネットと同じ)
+   * @param {number} [options.baseFee=10] - 基本手数料 (drops)
+   * @param {number} [options.startLedger=1000] - 最初の検証済みレジャー番号
+   * @param {number} [options.closeIntervalMs=1000] - レジャーを閉じる間隔 (0 なら closeLedger() を手動で呼ぶ)
+   * @param {Function} [options.engineResult] - (tx) => エンジン結果 (既定は "tesSUCCESS")
+   * @param {Function} [options.hook] - (tx, mock) => { result, state: [{ account, namespace, key, data }] }
+   *   result を省略すると送信時のエンジン結果のまま、data が null ならキーを削除する
+   */
+  constructor(options = {}) {
+    super();
+    this.networkId = options.networkId ?? 21338;
+    this.baseFee = options.baseFee ?? 10;
+    this.validatedLedger = options.startLedger ?? 1000;
+    this.closeIntervalMs = options.closeIntervalMs ?? 1000;
+    this.engineResult = options.engineResult || (() => "tesSUCCESS");
+    this.hook = options.hook || null;
+
+    this.accounts = new Map(); // address => { sequence, tickets: Set, balance }
+    this.openTxs = []; // 次のレジャーに入るトランザクション
+    this.heldTxs = []; // terPRE_SEQ で保留中のトランザクション
+    this.txs = new Map(); // hash => { tx, meta, ledger_index }
+    this.hookState = new Map(); // "アカウント:名前空間" => Map(キー => データ) (いずれも16進数)
+    this.trustLines = new Map(); // "保有者:発行者:通貨" => 保有者から見た残高 (BigInt)
+    this.sessions = new Set();
+    this.stats = { submitted: 0, applied: 0, rejected: 0 };
+    this.timer = null;
+    this.wss = null;
+    if (this.closeIntervalMs > 0) this.start();
+  }
+
+  start() {
+    if (!this.timer) {
+      this.timer = setInterval(() => this.closeLedger(), this.closeIntervalMs);
+    }
+  }
+
+  /** アカウントを作成します。 */
+  fund(address, { sequence = 1, balance = "100000000000" } = {}) {
+    this.accounts.set(address, { sequence, tickets: new Set(), balance });
+  }
+
+  get currentLedger() {
+    return this.validatedLedger + 1;
+  }
+
+  /**
+   * リクエストを処理して result を返します。エラーは MockXahaudError を投げます。
+   * @param {Object} request - WebSocket API のリクエスト
+   * @param {Object} [session] - ストリームの購読先
+   */
+  handle(request, session) {
+    switch (request.command) {
+      case "ping":
+        return {};
+      case "server_info":
+        return {
+          info: {
+            build_version: "mock",
+            network_id: this.networkId,
+            complete_ledgers: `1-${this.validatedLedger}`,
+            load_factor: 1,
+            server_state: "full",
+            validated_ledger: { seq: this.validatedLedger, base_fee_xrp: this.baseFee / 1e6 },
+          },
+        };
+      case "fee":
+        return {
+          current_ledger_size: String(this.openTxs.length),
+          ledger_current_index: this.currentLedger,
+          drops: {
+            base_fee: String(this.baseFee),
+            median_fee: String(this.baseFee * 500),
+            minimum_fee: String(this.baseFee),
+            open_ledger_fee: String(this.baseFee),
+          },
+        };
+      case "ledger_current":
+        return { ledger_current_index: this.currentLedger };
+      case "ledger":
+        return { ledger_index: this.validatedLedger, ledger: { ledger_index: String(this.validatedLedger), closed: true },
+          validated: true };
+      case "account_info":
+        return {
+          account_data: { Account: request.account, Sequence: this.account(request.account).sequence,
+            Balance: this.account(request.account).balance, LedgerEntryType: "AccountRoot" },
+          ledger_current_index: this.currentLedger,
+          validated: false,
+        };
+      case "account_objects": {
+        const tickets = request.type === undefined || request.type === "ticket"
+          ? [...this.account(request.account).tickets].sort((a, b) => a - b)
+          : [];
+        return {
+          account: request.account,
+          account_objects: tickets.map((seq) => ({ LedgerEntryType: "Ticket", Account: request.account,
+            TicketSequence: seq })),
+          ledger_index: this.validatedLedger,
+          validated: true,
+        };
+      }
+      case "account_lines": {
+        // marker は次のページの先頭のインデックス
+        const lines = [];
+        for (const [id, balance] of [...this.trustLines.entries()].sort(([a], [b]) => a.localeCompare(b))) {
+          const [holder, issuer, currency] = id.split(":");
+          if (holder === request.account) {
+            lines.push({ account: issuer, balance: String(balance), currency, limit: "1000000000", limit_peer: "0" });
+          } else if (issuer === request.account) {
+            lines.push({ account: holder, balance: String(-balance), currency, limit: "0", limit_peer: "1000000000" });
+          }
+        }
+        const start = request.marker ? Number(request.marker) : 0;
+        const limit = Math.min(request.limit || 200, 400);
+        return {
+          account: request.account,
+          lines: lines.slice(start, start + limit),
+          ledger_index: this.validatedLedger,
+          marker: start + limit < lines.length ? String(start + limit) : undefined,
+          validated: true,
+        };
+      }
+      case "account_namespace": {
+        // marker は次のページの先頭のインデックス
+        const entries = [...this.namespace(request.account, request.namespace_id).entries()]
+          .sort(([a], [b]) => a.localeCompare(b));
+        const start = request.marker ? Number(request.marker) : 0;
+        const limit = request.limit || 256;
+        const page = entries.slice(start, start + limit);
+        return {
+          account: request.account,
+          namespace_id: request.namespace_id,
+          namespace_entries: page.map(([key, data]) => ({ LedgerEntryType: "HookState", HookStateKey: key,
+            HookStateData: data })),
+          ledger_index: this.validatedLedger,
+          marker: start + limit < entries.length ? String(start + limit) : undefined,
+          validated: true,
+        };
+      }
+      case "submit":
+        return this.submit(request.tx_blob);
+      case "tx": {
+        const found = this.txs.get(request.transaction);
+        if (!found) throw new MockXahaudError("txnNotFound", "Transaction not found.");
+        return { ...found.tx, hash: request.transaction, meta: found.meta, ledger_index: found.ledger_index,
+          validated: true };
+      }
+      case "subscribe":
+        if (session) {
+          for (const stream of request.streams || []) session.streams.add(stream);
+          for (const account of request.accounts || []) session.accounts.add(account);
+        }
+        return request.streams && request.streams.includes("ledger")
+          ? { ledger_index: this.validatedLedger, fee_base: this.baseFee, validated_ledgers: `1-${this.validatedLedger}` }
+          : {};
+      case "unsubscribe":
+        if (session) {
+          for (const stream of request.streams || []) session.streams.delete(stream);
+          for (const account of request.accounts || []) session.accounts.delete(account);
+        }
+        return {};
+      default:
+        throw new MockXahaudError("unknownCmd", `Unknown method: ${request.command}`);
+    }
+  }
+
+  namespace(account, namespace) {
+    const id = `${account}:${String(namespace).toUpperCase()}`;
+    if (!this.hookState.has(id)) this.hookState.set(id, new Map());
+    return this.hookState.get(id);
+  }
+
+  /** HookState を直接設定します (data が null なら削除)。 */
+  setState(account, namespace, key, data) {
+    const entries = this.namespace(account, namespace);
+    if (data === null) entries.delete(key.toUpperCase());
+    else entries.set(key.toUpperCase(), data.toUpperCase());
+  }
+
+  /**
+   * トラストラインの残高を直接設定します (balance が null なら削除)。
+   * @returns {Object} RippleState の AffectedNodes の要素
+   */
+  setTrustLine(holder, issuer, currency, balance) {
+    const id = `${holder}:${issuer}:${currency}`;
+    const existed = this.trustLines.has(id);
+    if (balance === null) this.trustLines.delete(id);
+    else this.trustLines.set(id, BigInt(balance));
+
+    // Balance は Low 側 (アカウントIDの小さい方) から見た値
+    const holderIsLow = Buffer.compare(Buffer.from(xrpl.decodeAccountID(holder)),
+      Buffer.from(xrpl.decodeAccountID(issuer))) < 0;
+    const value = balance === null ? 0n : BigInt(balance);
+    const limit = (account, limitValue) => ({ currency, issuer: account, value: limitValue });
+    const fields = {
+      Balance: { currency, issuer: "rrrrrrrrrrrrrrrrrrrrBZbvji", value: String(holderIsLow ? value : -value) },
+      HighLimit: holderIsLow ? limit(issuer, "0") : limit(holder, "1000000000"),
+      LowLimit: holderIsLow ? limit(holder, "1000000000") : limit(issuer, "0"),
+    };
+    if (balance === null) return { DeletedNode: { LedgerEntryType: "RippleState", FinalFields: fields } };
+    if (existed) return { ModifiedNode: { LedgerEntryType: "RippleState", FinalFields: fields } };
+    return { CreatedNode: { LedgerEntryType: "RippleState", NewFields: fields } };
+  }
+
+  // 発行済みトークンの Payment: 送信者・宛先のうち発行者でない側のトラストラインを増減する
+  applyIssuedPayment(tx) {
+    const amount = tx.Amount;
+    if (tx.TransactionType !== "Payment" || typeof amount !== "object" || !/^[0-9]+$/.test(amount.value)) return [];
+    const nodes = [];
+    const move = (holder, delta) => {
+      if (holder === amount.issuer) return;
+      const current = this.trustLines.get(`${holder}:${amount.issuer}:${amount.currency}`) || 0n;
+      nodes.push(this.setTrustLine(holder, amount.issuer, amount.currency, current + delta));
+    };
+    move(tx.Account, -BigInt(amount.value));
+    move(tx.Destination, BigInt(amount.value));
+    return nodes;
+  }
+
+  // options.hook を呼び出し、State の変更を AffectedNodes にする
+  runHook(tx) {
+    if (!this.hook) return { nodes: [] };
+    const { result, state = [] } = this.hook(tx, this) || {};
+    if (result && !/^tes/.test(result)) return { result, nodes: [] };
+
+    const nodes = state.map(({ account, namespace, key, data }) => {
+      const entries = this.namespace(account, namespace);
+      const existed = entries.has(key.toUpperCase());
+      this.setState(account, namespace, key, data);
+      const fields = { HookStateKey: key.toUpperCase(), HookStateData: data ? data.toUpperCase() : undefined };
+      if (data === null) return { DeletedNode: { LedgerEntryType: "HookState", FinalFields: fields } };
+      if (existed) return { ModifiedNode: { LedgerEntryType: "HookState", FinalFields: fields } };
+      return { CreatedNode: { LedgerEntryType: "HookState", NewFields: fields } };
+    });
+    return { result, nodes };
+  }
+
+  account(address) {
+    const account = this.accounts.get(address);
+    if (!account) throw new MockXahaudError("actNotFound", "Account not found.");
+    return account;
+  }
+
+  submit(txBlob) {
+    const tx = xrpl.decode(txBlob);
+    const hash = xrpl.hashes.hashSignedTx(txBlob);
+    this.stats.submitted++;
+    const engineResult = this.preflight(tx, hash);
+    if (engineResult === "terPRE_SEQ") {
+      this.heldTxs.push({ tx, hash });
+    } else if (!/^(tes|tec)/.test(engineResult)) {
+      this.stats.rejected++;
+    }
+    return {
+      engine_result: engineResult,
+      engine_result_message: engineResult,
+      tx_blob: txBlob,
+      tx_json: { ...tx, hash },
+      accepted: /^(tes|tec)/.test(engineResult),
+      applied: /^(tes|tec)/.test(engineResult),
+      broadcast: /^(tes|tec)/.test(engineResult),
+      kept: true,
+      queued: false,
+    };
+  }
+
+  /** シーケンス・Ticket・LastLedgerSequence を確認し、適用できれば次のレジャーに入れます。 */
+  preflight(tx, hash) {
+    const account = this.accounts.get(tx.Account);
+    if (!account) return "terNO_ACCOUNT";
+    if (this.txs.has(hash) || this.openTxs.some((t) => t.hash === hash)) return "tefALREADY";
+    if (tx.NetworkID !== undefined && tx.NetworkID !== this.networkId) return "telWRONG_NETWORK";
+    if (Number(tx.Fee) < this.baseFee) return "telINSUF_FEE_P";
+    if (tx.LastLedgerSequence !== undefined && tx.LastLedgerSequence < this.currentLedger) return "tefMAX_LEDGER";
+
+    if (tx.TicketSequence !== undefined) {
+      if (!account.tickets.has(tx.TicketSequence)) {
+        return tx.TicketSequence >= account.sequence ? "terPRE_TICKET" : "tefNO_TICKET";
+      }
+      account.tickets.delete(tx.TicketSequence);
+    } else {
+      if (tx.Sequence < account.sequence) return "tefPAST_SEQ";
+      if (tx.Sequence > account.sequence) return "terPRE_SEQ";
+      account.sequence++;
+    }
+
+    if (tx.TransactionType === "TicketCreate") {
+      for (let i = 0; i < tx.TicketCount; i++) account.tickets.add(account.sequence + i);
+      account.sequence += tx.TicketCount;
+    }
+
+    const engineResult = this.engineResult(tx);
+    this.openTxs.push({ tx, hash, engineResult });
+    this.stats.applied++;
+    this.releaseHeld(tx.Account);
+    return engineResult;
+  }
+
+  // 保留中のトランザクションのうち、シーケンスが追いついたものを適用する
+  releaseHeld(address) {
+    const account = this.accounts.get(address);
+    for (let i = 0; i < this.heldTxs.length; i++) {
+      const held = this.heldTxs[i];
+      if (held.tx.Account === address && held.tx.Sequence === account.sequence) {
+        this.heldTxs.splice(i, 1);
+        this.preflight(held.tx, held.hash);
+        return;
+      }
+    }
+  }
+
+  /** レジャーを1つ閉じ、含まれたトランザクションと ledgerClosed を通知します。 */
+  closeLedger() {
+    this.validatedLedger++;
+    const ledgerIndex = this.validatedLedger;
+    const txs = this.openTxs;
+    this.openTxs = [];
+    this.heldTxs = this.heldTxs.filter((h) => h.tx.LastLedgerSequence === undefined ||
+      h.tx.LastLedgerSequence > ledgerIndex);
+
+    txs.forEach(({ tx, hash, engineResult: submitResult }, index) => {
+      const hook = /^tes/.test(submitResult) ? this.runHook(tx) : { nodes: [] };
+      const engineResult = hook.result || submitResult;
+      const issued = /^tes/.test(engineResult) ? this.applyIssuedPayment(tx) : [];
+      const meta = { TransactionIndex: index, TransactionResult: engineResult, AffectedNodes: [...hook.nodes, ...issued] };
+      this.txs.set(hash, { tx, meta, ledger_index: ledgerIndex });
+      const event = {
+        type: "transaction",
+        transaction: { ...tx, hash },
+        meta,
+        engine_result: engineResult,
+        engine_result_message: engineResult,
+        ledger_index: ledgerIndex,
+        status: "closed",
+        validated: true,
+      };
+      const accounts = new Set([tx.Account, tx.Destination]);
+      if (issued.length > 0) accounts.add(tx.Amount.issuer);
+      this.broadcast(event, (session) => [...accounts].some((a) => session.accounts.has(a)));
+    });
+
+    const ledger = {
+      type: "ledgerClosed",
+      ledger_index: ledgerIndex,
+      ledger_hash: crypto.createHash("sha256").update(String(ledgerIndex)).digest("hex").toUpperCase(),
+      ledger_time: Math.floor(Date.now() / 1000) - 946684800,
+      fee_base: this.baseFee,
+      reserve_base: 1000000,
+      reserve_inc: 200000,
+      txn_count: txs.length,
+      validated_ledgers: `1-${ledgerIndex}`,
+    };
+    this.broadcast(ledger, (session) => session.streams.has("ledger"));
+    this.emit("ledgerClosed", ledger);
+  }
+
+  broadcast(message, filter) {
+    for (const session of this.sessions) {
+      if (filter(session)) session.send(message);
+    }
+  }
+
+  openSession(send) {
+    const session = { send, streams: new Set(), accounts: new Set() };
+    this.sessions.add(session);
+    return session;
+  }
+
+  /**
+   * プロセス内で接続するクライアントを返します (xrpl.Client の request / on / connect / disconnect 互換)。
+   */
+  createClient() {
+    const server = this;
+    const client = new EventEmitter();
+    let session = null;
+    client.isConnected = () => session !== null;
+    client.connect = async () => {
+      session = server.openSession((message) => setImmediate(() => client.emit(message.type, message)));
+      client.emit("connected");
+    };
+    client.disconnect = async () => {
+      server.sessions.delete(session);
+      session = null;
+      client.emit("disconnected", 1000);
+    };
+    client.request = async (request) => {
+      if (!session) throw new Error("NotConnectedError");
+      try {
+        return { id: request.id, type: "response", result: server.handle(request, session) };
+      } catch (error) {
+        if (error instanceof MockXahaudError) error.data = { ...error.data, request };
+        throw error;
+      }
+    };
+    return client;
+  }
+
+  /**
+   * WebSocket で待ち受けます (ws パッケージが必要)。
+   * @param {number} [port=0] - ポート (0 なら空いているポート)
+   * @returns {Promise<string>} 接続先 URL
+   */
+  async listen(port = 0) {
+    const { WebSocketServer } = require("ws");
+    this.wss = new WebSocketServer({ port });
+    this.wss.on("connection", (socket) => {
+      const session = this.openSession((message) => socket.send(JSON.stringify(message)));
+      socket.on("close", () => this.sessions.delete(session));
+      socket.on("message", (data) => {
+        let request;
+        try {
+          request = JSON.parse(data);
+        } catch (error) {
+          socket.send(JSON.stringify({ type: "response", status: "error", error: "invalidParams" }));
+          return;
+        }
+        let response;
+        try {
+          response = { id: request.id, type: "response", status: "success", result: this.handle(request, session) };
+        } catch (error) {
+          const data = error instanceof MockXahaudError ? error.data : { error: "internal", error_message: error.message };
+          response = { id: request.id, type: "response", status: "error", ...data, request };
+        }
+        socket.send(JSON.stringify(response));
+      });
+    });
+    await new Promise((resolve) => this.wss.once("listening", resolve));
+    return `ws://127.0.0.1:${this.wss.address().port}`;
+  }
+
+  async close() {
+    clearInterval(this.timer);
+    this.timer = null;
+    this.sessions.clear();
+    if (this.wss) {
+      await new Promise((resolve) => this.wss.close(resolve));
+      this.wss = null;
+    }
+  }
+}
+
+// 単体で起動した場合は WebSocket で待ち受ける
+// 使い方: node src/js/mock_xahaud.js [port] [address...]
+if (require.main === module) {
+  const [port = "6006", ...addresses] = process.argv.slice(2);
+  const mock = new MockXahaud();
+  addresses.forEach((address) => mock.fund(address));
+  mock.listen(Number(port)).then((url) => console.log(`mock xahaud listening on ${url}`));
+}
+
+module.exports = { MockXahaud, MockXahaudError };
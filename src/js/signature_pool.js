@@ -0,0 +1,339 @@
+// src/js/signature_pool.js
+// 利用許可署名 (<ユーザー>:<運営者>:<許可額>) と請求署名の生成と検証をワーカースレッドで並列に行う
+// (ノンス付きの支払いの署名とエミュレータの署名はワークロードの生成用)
+const os = require("os");
+const crypto = require("crypto");
+const { Worker, isMainThread, parentPort } = require("worker_threads");
+const keypairs = require("ripple-keypairs");
+
+const DEFAULT_CHUNK_SIZE = 64;
+
+/**
+ * 利用許可署名の対象メッセージ (16進数) を構築します。
+ * フックの verify_allowance_signature が検証するバイト列と同じです。
+ * @param {string} userAddress - ユーザーのアドレス
+ * @param {string} operatorAddress - 運営者のアドレス
+ * @param {string} allowanceAmount - 利用許可額
+ * @returns {string} 16進数文字列
+ */
+function allowanceMessage(userAddress, operatorAddress, allowanceAmount) {
+  return Buffer.from(`${userAddress}:${operatorAddress}:${allowanceAmount}`, "ascii")
+    .toString("hex")
+    .toUpperCase();
+}
+
+/**
+ * 利用許可署名を生成します（呼び出したスレッドで実行）。
+ * @param {Object} item
+ * @param {string} item.userAddress - ユーザーのアドレス
+ * @param {string} item.privateKey - ユーザーの秘密鍵
+ * @param {string} item.operatorAddress - 運営者のアドレス
+ * @param {string} item.allowanceAmount - 利用許可額
+ * @returns {string} 署名（16進数）
+ */
+function signAllowance({ userAddress, privateKey, operatorAddress, allowanceAmount }) {
+  return keypairs.sign(allowanceMessage(userAddress, operatorAddress, String(allowanceAmount)), privateKey);
+}
+
+/**
+ * 利用許可署名を検証します（呼び出したスレッドで実行）。形式が不正な署名・公開鍵は false になります。
+ * @param {Object} item
+ * @param {string} item.userAddress - ユーザーのアドレス
+ * @param {string} item.publicKey - ユーザーの公開鍵
+ * @param {string} item.operatorAddress - 運営者のアドレス
+ * @param {string} item.allowanceAmount - 利用許可額
+ * @param {string} item.signature - 署名（16進数）
+ * @returns {boolean} 署名が有効なら true
+ */
+function verifyAllowance({ userAddress, publicKey, operatorAddress, allowanceAmount, signature }) {
+  try {
+    return keypairs.verify(
+      allowanceMessage(userAddress, operatorAddress, String(allowanceAmount)),
+      signature,
+      publicKey
+    );
+  } catch (error) {
+    return false;
+  }
+}
+
+/**
+ * 累積請求の署名対象メッセージ (16進数) を構築します。
+ * フックの verify_claim_signature が検証するバイト列と同じです（ダイジェストは32バイトのまま入る）。
+ * @param {string} userAddress - ユーザーのアドレス
+ * @param {string} operatorAddress - 運営者のアドレス
+ * @param {string} allowanceDigest - 請求の対象の利用許可のダイジェスト（16進数）
+ * @param {string} generation - 請求の対象の利用許可の世代
+ * @param {string} total - 累積請求額
+ * @returns {string} 16進数文字列
+ */
+function claimMessage(userAddress, operatorAddress, allowanceDigest, generation, total) {
+  return Buffer.concat([
+    Buffer.from(`${userAddress}:${operatorAddress}:`, "ascii"),
+    Buffer.from(allowanceDigest, "hex"),
+    Buffer.from(`:${generation}:${total}`, "ascii"),
+  ])
+    .toString("hex")
+    .toUpperCase();
+}
+
+/**
+ * 累積請求に署名します（呼び出したスレッドで実行）。
+ * @param {Object} item - { userAddress, privateKey, operatorAddress, allowanceDigest, generation, total }
+ * @returns {string} 署名（16進数）
+ */
+function signClaim({ userAddress, privateKey, operatorAddress, allowanceDigest, generation, total }) {
+  return keypairs.sign(
+    claimMessage(userAddress, operatorAddress, allowanceDigest, String(generation), String(total)), privateKey);
+}
+
+/**
+ * 累積請求の署名を検証します（呼び出したスレッドで実行）。形式が不正な署名・公開鍵は false になります。
+ * @param {Object} item - { userAddress, publicKey, operatorAddress, allowanceDigest, generation, total, signature }
+ * @returns {boolean} 署名が有効なら true
+ */
+function verifyClaim({ userAddress, publicKey, operatorAddress, allowanceDigest, generation, total, signature }) {
+  try {
+    return keypairs.verify(
+      claimMessage(userAddress, operatorAddress, allowanceDigest, String(generation), String(total)), signature, publicKey);
+  } catch (error) {
+    return false;
+  }
+}
+
+/**
+ * ノンス付きの支払いの署名対象メッセージ (16進数) を構築します。
+ * フックの verify_payment_signature が検証するバイト列 (<ユーザー>:<運営者>:<ノンス>:<支払い額>) と同じです。
+ * @param {string} userAddress - ユーザーのアドレス
+ * @param {string} operatorAddress - 運営者のアドレス
+ * @param {string} nonce - ノンス
+ * @param {string} amount - 支払い額
+ * @returns {string} 16進数文字列
+ */
+function paymentMessage(userAddress, operatorAddress, nonce, amount) {
+  return Buffer.from(`${userAddress}:${operatorAddress}:${nonce}:${amount}`, "ascii")
+    .toString("hex")
+    .toUpperCase();
+}
+
+/**
+ * ノンス付きの支払いに署名します（呼び出したスレッドで実行）。
+ * @param {Object} item - { userAddress, privateKey, operatorAddress, nonce, amount }
+ * @returns {string} 署名（16進数）
+ */
+function signPayment({ userAddress, privateKey, operatorAddress, nonce, amount }) {
+  return keypairs.sign(paymentMessage(userAddress, operatorAddress, String(nonce), String(amount)), privateKey);
+}
+
+/**
+ * エミュレータ (src/c/emu の emu_sign と build/hook_replay.js の util_verify) が受理する署名を作ります。
+ * 実際の台帳では検証できません。
+ * @param {string} publicKey - 公開鍵（16進数）
+ * @param {string} message - 署名対象メッセージ（16進数）
+ * @returns {string} 署名（16進数、64バイト）
+ */
+function emuSign(publicKey, message) {
+  const key = Buffer.from(publicKey, "hex").subarray(0, 64);
+  const data = Buffer.from(message, "hex").subarray(0, 1024);
+  return crypto.createHash("sha512").update(Buffer.concat([key, data])).digest("hex").toUpperCase();
+}
+
+const OPERATIONS = { sign: signAllowance, verify: verifyAllowance, verifyClaim };
+
+/**
+ * 利用許可署名の生成・検証を行うワーカースレッドのプール。
+ * 要求はチャンクに分けて空いているワーカーに割り当て、結果は要求した順に返します。
+ */
+class SignaturePool {
+  /**
+   * @param {Object} [options]
+   * @param {number} [options.size] - ワーカー数（既定は CPU 数 - 1、0 ならメインスレッドで実行）
+   * @param {number} [options.chunkSize=64] - 1回にワーカーへ渡す件数
+   */
+  constructor(options = {}) {
+    const cpus = os.availableParallelism ? os.availableParallelism() : os.cpus().length;
+    this.size = options.size ?? Math.max(cpus - 1, 1);
+    this.chunkSize = options.chunkSize || DEFAULT_CHUNK_SIZE;
+    this.workers = [];
+    this.idle = [];
+    this.queue = [];
+    this.closed = false;
+    this.totals = {
+      sign: { count: 0, elapsedMs: 0 },
+      verify: { count: 0, elapsedMs: 0 },
+      verifyClaim: { count: 0, elapsedMs: 0 },
+    };
+  }
+
+  /**
+   * 利用許可署名をまとめて生成します。
+   * @param {Array<Object>} requests - { wallet, operatorAddress, allowanceAmount } のリスト
+   * @returns {Promise<string[]>} 署名（要求と同じ順）
+   */
+  signAllowances(requests) {
+    return this.run(
+      "sign",
+      requests.map(({ wallet, operatorAddress, allowanceAmount }) => ({
+        userAddress: wallet.address,
+        privateKey: wallet.privateKey,
+        operatorAddress,
+        allowanceAmount: String(allowanceAmount),
+      }))
+    );
+  }
+
+  /**
+   * 利用許可署名をまとめて検証します。
+   * @param {Array<Object>} requests - { userAddress, publicKey, operatorAddress, allowanceAmount, signature } のリスト
+   * @returns {Promise<boolean[]>} 検証結果（要求と同じ順）
+   */
+  verifyAllowances(requests) {
+    return this.run(
+      "verify",
+      requests.map((r) => ({ ...r, allowanceAmount: String(r.allowanceAmount) }))
+    );
+  }
+
+  /**
+   * 累積請求の署名をまとめて検証します。
+   * @param {Array<Object>} requests - { userAddress, publicKey, operatorAddress, allowanceDigest, generation, total, signature }
+   *   のリスト
+   * @returns {Promise<boolean[]>} 検証結果（要求と同じ順）
+   */
+  verifyClaims(requests) {
+    return this.run(
+      "verifyClaim",
+      requests.map((r) => ({ ...r, generation: String(r.generation), total: String(r.total) }))
+    );
+  }
+
+  /**
+   * これまでに処理した件数と1秒あたりの処理件数を返します。
+   * elapsedMs は各バッチの呼び出しから完了までの時間の合計です。
+   * @returns {Object} { sign: {count, elapsedMs, perSecond}, verify: {...}, verifyClaim: {...} }
+   */
+  stats() {
+    const rate = ({ count, elapsedMs }) => ({
+      count,
+      elapsedMs: Math.round(elapsedMs),
+      perSecond: elapsedMs > 0 ? Math.round((count * 1000) / elapsedMs) : 0,
+    });
+    return {
+      workers: this.size,
+      sign: rate(this.totals.sign),
+      verify: rate(this.totals.verify),
+      verifyClaim: rate(this.totals.verifyClaim),
+    };
+  }
+
+  async run(op, items) {
+    if (this.closed) {
+      throw new Error("SignaturePool は終了しています");
+    }
+    const started = process.hrtime.bigint();
+    let results;
+    if (this.size === 0) {
+      results = items.map(OPERATIONS[op]);
+    } else {
+      const chunks = [];
+      for (let i = 0; i < items.length; i += this.chunkSize) {
+        chunks.push(this.dispatch(op, items.slice(i, i + this.chunkSize)));
+      }
+      results = (await Promise.all(chunks)).flat();
+    }
+    const total = this.totals[op];
+    total.count += items.length;
+    total.elapsedMs += Number(process.hrtime.bigint() - started) / 1e6;
+    return results;
+  }
+
+  dispatch(op, items) {
+    return new Promise((resolve, reject) => {
+      this.queue.push({ op, items, resolve, reject });
+      this.drain();
+    });
+  }
+
+  drain() {
+    while (this.queue.length > 0) {
+      let worker = this.idle.pop();
+      if (!worker && this.workers.length < this.size) {
+        worker = this.spawn();
+      }
+      if (!worker) {
+        return;
+      }
+      const job = this.queue.shift();
+      worker.job = job;
+      worker.postMessage({ op: job.op, items: job.items });
+    }
+  }
+
+  spawn() {
+    const worker = new Worker(__filename);
+    worker.job = null;
+    worker.on("message", ({ results, error }) => {
+      const job = worker.job;
+      worker.job = null;
+      this.idle.push(worker);
+      if (error) job.reject(new Error(error));
+      else job.resolve(results);
+      this.drain();
+    });
+    worker.on("error", (error) => this.discard(worker, error));
+    worker.on("exit", (code) => {
+      if (!this.closed) {
+        this.discard(worker, new Error(`署名ワーカーが終了しました (code=${code})`));
+      }
+    });
+    this.workers.push(worker);
+    return worker;
+  }
+
+  // 異常終了したワーカーを取り除き、処理中の要求を失敗させる (次の要求では新しいワーカーを起動する)
+  discard(worker, error) {
+    this.workers = this.workers.filter((w) => w !== worker);
+    this.idle = this.idle.filter((w) => w !== worker);
+    if (worker.job) {
+      worker.job.reject(error);
+      worker.job = null;
+    }
+    this.drain();
+  }
+
+  /**
+   * すべてのワーカーを終了します。待機中の要求は失敗します。
+   * @returns {Promise<void>}
+   */
+  async close() {
+    this.closed = true;
+    this.queue.splice(0).forEach((job) => job.reject(new Error("SignaturePool は終了しています")));
+    await Promise.all(this.workers.map((w) => w.terminate()));
+    this.workers = [];
+    this.idle = [];
+  }
+}
+
+// ワーカースレッドとして起動された場合
+if (!isMainThread) {
+  parentPort.on("message", ({ op, items }) => {
+    try {
+      parentPort.postMessage({ results: items.map(OPERATIONS[op]) });
+    } catch (error) {
+      parentPort.postMessage({ error: error.message });
+    }
+  });
+}
+
+module.exports = {
+  SignaturePool,
+  allowanceMessage,
+  signAllowance,
+  verifyAllowance,
+  claimMessage,
+  signClaim,
+  verifyClaim,
+  paymentMessage,
+  signPayment,
+  emuSign,
+};
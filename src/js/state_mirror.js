@@ -0,0 +1,442 @@
+// Hocks/state_mirror.js
+// フックのState (ユーザーレコード) のオフチェーンミラーと、送信前の事前チェック
+//
+// 起動時に account_namespace でフックの名前空間をページ単位で読み込み、以後は
+// 検証済みトランザクションのメタデータ (HookState の作成・更新・削除) を順に適用します。
+// 送信前に precheck() でフックと同じ判定 (利用上限・残高) を行い、
+// オンレジャーでロールバックされる支払いを手数料を払う前に弾きます。
+//
+// 送信済みで未検証の支払いは reserve() で仮押さえし、検証結果が届いた時点で外します。
+// 連続して送信しても、まだ反映されていない支払いの分を二重に使わないようにするためです。
+//
+// replay() で記録済みのストリーム (NDJSON) を流し込めるため、ネットワークなしで試験できます。
+// 記録: node src/js/state_mirror.js record <フックのアドレス> <出力ファイル>
+const { EventEmitter } = require("events");
+const crypto = require("crypto");
+const fs = require("fs");
+const readline = require("readline");
+const { xrpl } = require("./hocks");
+
+// src/c/xapay_state.h と一致させること
+const PREFIX_USER_RECORD = 0x52; // 'R'
+const PREFIX_USER_BALANCE = 0x55; // 'U' (旧形式)
+const PREFIX_ALLOWANCE = 0x41; // 'A' (旧形式)
+const PREFIX_PUBKEY = 0x4B; // 'K'
+const PUBKEY_RECORD_SIZE = 34; // xapay_pubkey_t (鍵の種類1バイト + 公開鍵33バイト)
+const RECORD_VERSION = 1;
+const RECORD_SIZE = 80;
+const RECORD_HAS_ALLOWANCE = 0x01;
+// Stateキーは32バイトに左詰めのゼロで拡張される
+const STATE_KEY_SIZE = 32;
+const RECORD_KEY_SIZE = 21;
+
+// src/c/xapay_hock.c のエラーコードと一致させること
+const PRECHECK_ERROR = {
+  MISSING_FIELD: 103,
+  INVALID_AMOUNT: 105,
+  ALLOWANCE_VERIFICATION_FAILED: 302,
+  ALLOWANCE_EXCEEDED: 303,
+  INSUFFICIENT_BALANCE: 304,
+  CLAIM_VERIFICATION_FAILED: 702,
+  CLAIM_STALE: 703,
+  KEY_NOT_REGISTERED: 802,
+};
+
+const MAX_YEN_DIGITS = 18;
+const DEFAULT_PAGE_SIZE = 256;
+
+class PrecheckError extends Error {
+  constructor(message, code) {
+    super(message);
+    this.name = "PrecheckError";
+    this.code = code;
+  }
+}
+
+/**
+ * 10進文字列を円に変換します (src/c/xapay_yen.h の xapay_yen_parse と同じ規則)。
+ * @returns {bigint|null} 変換できない場合は null
+ */
+function parseYen(str) {
+  if (typeof str !== "string" || !/^[0-9]+$/.test(str) || str.length > MAX_YEN_DIGITS) return null;
+  return BigInt(str);
+}
+
+/**
+ * ユーザーレコード (HookStateData) をデコードします。
+ * @returns {Object|null} 認識できない場合は null
+ */
+function decodeRecord(data) {
+  if (data.length !== RECORD_SIZE || data[0] !== RECORD_VERSION) return null;
+  return {
+    flags: data[1],
+    generation: data.readUInt32LE(4),
+    balance: data.readBigInt64LE(8),
+    allowance: data.readBigInt64LE(16),
+    spent: data.readBigInt64LE(24),
+    nonceHigh: data.readBigUInt64LE(32),
+    nonceWindow: data.readBigUInt64LE(40),
+    allowanceHash: data.subarray(48, 80).toString("hex").toUpperCase(),
+  };
+}
+
+function emptyRecord() {
+  return { flags: 0, generation: 0, balance: 0n, allowance: 0n, spent: 0n, nonceHigh: 0n,
+    allowanceHash: "", nonceWindow: 0n };
+}
+
+/** フックの allowance_digest と同じダイジェスト (SHA-512 の先頭32バイト) */
+function allowanceDigest(accountId, allowanceAmount, signature) {
+  const amount = Buffer.from(allowanceAmount, "utf8");
+  return crypto
+    .createHash("sha512")
+    .update(Buffer.concat([Buffer.from(accountId), Buffer.from([amount.length]), amount,
+      Buffer.from(signature, "hex")]))
+    .digest()
+    .subarray(0, 32)
+    .toString("hex")
+    .toUpperCase();
+}
+
+/**
+ * 1件の支払いをレコードに適用します (handle_allowance_payment の判定と同じ順序)。
+ * 署名そのものは検証しません (フック側で検証されます)。
+ * @param {Object} record - 適用先 (書き換えます)
+ * @param {Object} payment - { userAddress, amount, allowanceAmount, signature }
+ */
+function applyPayment(record, accountId, payment) {
+  const amount = parseYen(payment.amount);
+  if (amount === null || amount <= 0n) {
+    throw new PrecheckError("Invalid payment amount.", PRECHECK_ERROR.INVALID_AMOUNT);
+  }
+
+  // 利用許可を入れ替えられるのはユーザー本人のチャージ＋利用許可枠更新だけ (支払いでは現在のものと照合する)
+  if (!(record.flags & RECORD_HAS_ALLOWANCE)) {
+    if (!payment.signature) {
+      throw new PrecheckError("'allowance.signature' missing.", PRECHECK_ERROR.MISSING_FIELD);
+    }
+    throw new PrecheckError("No active allowance.", PRECHECK_ERROR.ALLOWANCE_VERIFICATION_FAILED);
+  }
+  if (payment.signature) {
+    if (!payment.allowanceAmount || payment.allowanceAmount.length > 20) {
+      throw new PrecheckError("'allowance.amount' missing.", PRECHECK_ERROR.MISSING_FIELD);
+    }
+    if (payment.signature.length > 74 * 2) {
+      throw new PrecheckError("Invalid signature length.", PRECHECK_ERROR.ALLOWANCE_VERIFICATION_FAILED);
+    }
+    if (record.allowanceHash !== allowanceDigest(accountId, payment.allowanceAmount, payment.signature)) {
+      throw new PrecheckError("Allowance is not the current one.", PRECHECK_ERROR.ALLOWANCE_VERIFICATION_FAILED);
+    }
+  }
+
+  if (record.spent + amount > record.allowance) {
+    throw new PrecheckError("Amount exceeds allowance.", PRECHECK_ERROR.ALLOWANCE_EXCEEDED);
+  }
+  if (record.balance < amount) {
+    throw new PrecheckError("Insufficient balance.", PRECHECK_ERROR.INSUFFICIENT_BALANCE);
+  }
+  record.balance -= amount;
+  record.spent += amount;
+}
+
+/**
+ * フックのStateのミラー
+ */
+class StateMirror extends EventEmitter {
+  /**
+   * @param {xrpl.Client|ClientPool} client - 接続済みのクライアント (replay のみなら null)
+   * @param {string} hookAddress - フックのアドレス
+   * @param {Object} [options]
+   * @param {string} [options.namespace] - フックの名前空間 (64桁の16進数、既定は環境変数 HOOK_NAMESPACE)
+   * @param {number} [options.pageSize=256] - account_namespace の1ページの件数
+   */
+  constructor(client, hookAddress, options = {}) {
+    super();
+    this.client = client;
+    this.hookAddress = hookAddress;
+    this.namespace = options.namespace || process.env.HOOK_NAMESPACE;
+    this.pageSize = options.pageSize || DEFAULT_PAGE_SIZE;
+
+    this.records = new Map(); // アカウントID (16進数) => レコード
+    this.legacy = new Map(); // アカウントID (16進数) => { balance, allowance } (旧形式のキー)
+    this.publicKeys = new Map(); // アカウントID (16進数) => 登録済みの公開鍵 (16進数)
+    this.reserved = new Map(); // トランザクションハッシュ => [支払い]
+    this.ledgerIndex = 0;
+    // 名前空間を読み込んだレジャー (これ以前のトランザクションは反映済み)
+    this.baseLedger = 0;
+    this.buffered = null;
+    this.onTransaction = (event) => this.handleStream(event);
+    this.onLedgerClosed = (ledger) => this.handleStream({ type: "ledgerClosed", ...ledger });
+  }
+
+  /**
+   * ストリームを購読してから名前空間を読み込み、その間に届いたトランザクションを適用します。
+   */
+  async start() {
+    this.buffered = [];
+    this.client.on("transaction", this.onTransaction);
+    this.client.on("ledgerClosed", this.onLedgerClosed);
+    await this.client.request({ command: "subscribe", accounts: [this.hookAddress], streams: ["ledger"] });
+
+    await this.bootstrap();
+
+    const buffered = this.buffered;
+    this.buffered = null;
+    buffered.forEach((message) => this.handleStream(message));
+  }
+
+  async stop() {
+    this.client.off("transaction", this.onTransaction);
+    this.client.off("ledgerClosed", this.onLedgerClosed);
+    await this.client.request({ command: "unsubscribe", accounts: [this.hookAddress], streams: ["ledger"] });
+  }
+
+  /** 検証済みレジャーの名前空間をすべて読み込みます。 */
+  async bootstrap() {
+    if (!this.namespace) throw new Error("フックの名前空間 (HOOK_NAMESPACE) が指定されていません");
+    const { ledgerIndex, entries } = await dumpNamespace(this.client, this.hookAddress, this.namespace, this.pageSize);
+    this.load(ledgerIndex, entries);
+    this.emit("bootstrapped", { ledgerIndex, users: this.users().length });
+  }
+
+  /** 名前空間の内容で置き換えます。 */
+  load(ledgerIndex, entries) {
+    this.records.clear();
+    this.legacy.clear();
+    this.publicKeys.clear();
+    entries.forEach((entry) => this.applyState(entry.HookStateKey, entry.HookStateData));
+    this.baseLedger = ledgerIndex;
+    this.ledgerIndex = Math.max(this.ledgerIndex, ledgerIndex);
+  }
+
+  /**
+   * State 1件を反映します。
+   * @param {string} keyHex - HookStateKey
+   * @param {string|null} dataHex - HookStateData (削除なら null)
+   */
+  applyState(keyHex, dataHex) {
+    const key = Buffer.from(keyHex, "hex");
+    if (key.length !== STATE_KEY_SIZE || key.subarray(0, STATE_KEY_SIZE - RECORD_KEY_SIZE).some((b) => b !== 0)) {
+      return;
+    }
+    const prefix = key[STATE_KEY_SIZE - RECORD_KEY_SIZE];
+    const accountId = key.subarray(STATE_KEY_SIZE - 20).toString("hex").toUpperCase();
+    const data = dataHex ? Buffer.from(dataHex, "hex") : null;
+
+    if (prefix === PREFIX_USER_RECORD) {
+      const record = data && decodeRecord(data);
+      if (record) this.records.set(accountId, record);
+      else this.records.delete(accountId);
+    } else if (prefix === PREFIX_USER_BALANCE || prefix === PREFIX_ALLOWANCE) {
+      const legacy = this.legacy.get(accountId) || {};
+      if (prefix === PREFIX_USER_BALANCE) legacy.balance = data && data.length === 8 ? data.readBigInt64LE(0) : undefined;
+      else legacy.allowance = data ? parseYen(data.toString("utf8")) ?? 0n : undefined;
+      if (legacy.balance === undefined && legacy.allowance === undefined) this.legacy.delete(accountId);
+      else this.legacy.set(accountId, legacy);
+    } else if (prefix === PREFIX_PUBKEY) {
+      if (data && data.length === PUBKEY_RECORD_SIZE) {
+        this.publicKeys.set(accountId, data.subarray(1).toString("hex").toUpperCase());
+      } else {
+        this.publicKeys.delete(accountId);
+      }
+    }
+  }
+
+  handleStream(message) {
+    if (this.buffered) {
+      this.buffered.push(message);
+      return;
+    }
+    if (message.type === "ledgerClosed") {
+      if (message.ledger_index > this.ledgerIndex) this.ledgerIndex = message.ledger_index;
+    } else if (message.type === "transaction" || message.transaction || message.tx_json) {
+      this.applyTransaction(message);
+    }
+  }
+
+  /**
+   * 検証済みトランザクションのメタデータから HookState の変更を適用します。
+   * 名前空間の読み込み時点より前のレジャーのものは無視します。
+   */
+  applyTransaction(event) {
+    const tx = event.transaction || event.tx_json || {};
+    const hash = tx.hash || event.hash;
+    if (!event.validated) return;
+    this.reserved.delete(hash);
+    if (event.ledger_index <= this.baseLedger) return;
+    if (tx.Account !== this.hookAddress && tx.Destination !== this.hookAddress) return;
+
+    if (event.meta && event.meta.TransactionResult === "tesSUCCESS") {
+      for (const node of event.meta.AffectedNodes || []) {
+        const [kind, entry] = Object.entries(node)[0];
+        if (entry.LedgerEntryType !== "HookState") continue;
+        const fields = entry.NewFields || entry.FinalFields || {};
+        this.applyState(fields.HookStateKey, kind === "DeletedNode" ? null : fields.HookStateData);
+      }
+    }
+    if (event.ledger_index > this.ledgerIndex) this.ledgerIndex = event.ledger_index;
+    this.emit("transaction", { hash, result: event.meta && event.meta.TransactionResult });
+  }
+
+  /**
+   * 記録済みのストリーム (1行1メッセージの NDJSON、または配列・非同期イテレータ) を適用します。
+   * ファイルの先頭に { "type": "namespace", "ledger_index", "namespace_entries" } があれば初期状態として読み込みます。
+   */
+  async replay(source) {
+    const messages = typeof source === "string"
+      ? readline.createInterface({ input: fs.createReadStream(source), crlfDelay: Infinity })
+      : source;
+    for await (const line of messages) {
+      if (typeof line === "string" && line.trim() === "") continue;
+      const message = typeof line === "string" ? JSON.parse(line) : line;
+      if (message.type === "namespace") this.load(message.ledger_index, message.namespace_entries);
+      else this.handleStream(message);
+    }
+  }
+
+  /**
+   * 確定済みのレコードを返します (旧形式のキーしかなければフックの移行と同じく組み立て、
+   * どちらもなければ新規ユーザーと同じ空のレコード)。
+   */
+  confirmed(accountId) {
+    const publicKey = this.publicKeys.get(accountId);
+    const record = this.records.get(accountId);
+    if (record) return { ...record, publicKey };
+    const legacy = this.legacy.get(accountId);
+    const rebuilt = emptyRecord();
+    if (legacy) {
+      rebuilt.balance = legacy.balance > 0n ? legacy.balance : 0n;
+      rebuilt.allowance = legacy.allowance ?? 0n;
+    }
+    rebuilt.publicKey = publicKey;
+    return rebuilt;
+  }
+
+  /**
+   * フックに登録済みの公開鍵 (16進数) を返します。未登録なら undefined。
+   * AllowancePaymentBatcher / ClaimTracker の publicKeys にそのまま渡せます。
+   * @param {string} userAddress - ユーザーのアドレス
+   */
+  publicKey(userAddress) {
+    return this.publicKeys.get(Buffer.from(xrpl.decodeAccountID(userAddress)).toString("hex").toUpperCase());
+  }
+
+  /**
+   * 未検証の支払いを反映したレコードを返します。
+   * @param {string} userAddress - ユーザーのアドレス
+   */
+  view(userAddress) {
+    const accountId = Buffer.from(xrpl.decodeAccountID(userAddress)).toString("hex").toUpperCase();
+    const record = this.confirmed(accountId);
+    for (const payments of this.reserved.values()) {
+      for (const payment of payments) {
+        if (payment.userAddress !== userAddress) continue;
+        try {
+          applyPayment(record, xrpl.decodeAccountID(userAddress), payment);
+        } catch (error) {
+          // オンレジャーで失敗する見込みの支払いは反映しない
+        }
+      }
+    }
+    return record;
+  }
+
+  /**
+   * フックと同じ判定で支払いを事前チェックします。失敗すると PrecheckError を投げます。
+   * 複数件の場合は一括決済と同じく先頭から順に適用して判定します。
+   * @param {Object|Array<Object>} payments - { userAddress, amount, allowanceAmount, signature }
+   * @returns {Map<string, Object>} 適用後のユーザーごとのレコード
+   */
+  precheck(payments) {
+    const list = Array.isArray(payments) ? payments : [payments];
+    const records = new Map();
+    for (const payment of list) {
+      if (!xrpl.isValidClassicAddress(payment.userAddress)) {
+        throw new PrecheckError("Invalid user address.", PRECHECK_ERROR.MISSING_FIELD);
+      }
+      if (!records.has(payment.userAddress)) records.set(payment.userAddress, this.view(payment.userAddress));
+      applyPayment(records.get(payment.userAddress), xrpl.decodeAccountID(payment.userAddress), payment);
+    }
+    return records;
+  }
+
+  /**
+   * 送信した支払いを検証されるまで仮押さえします。
+   * @param {string} hash - トランザクションハッシュ
+   */
+  reserve(hash, payments) {
+    this.reserved.set(hash, Array.isArray(payments) ? payments : [payments]);
+  }
+
+  /** 送信に失敗した支払いの仮押さえを外します。 */
+  release(hash) {
+    this.reserved.delete(hash);
+  }
+
+  /** ミラーしているユーザーのアドレス一覧 */
+  users() {
+    const ids = new Set([...this.records.keys(), ...this.legacy.keys()]);
+    return [...ids].map((id) => xrpl.encodeAccountID(Buffer.from(id, "hex")));
+  }
+}
+
+/**
+ * 試験用に、名前空間の内容とフックのトランザクションのストリームを NDJSON に記録します。
+ */
+async function recordStream(client, hookAddress, output, options = {}) {
+  const namespace = options.namespace || process.env.HOOK_NAMESPACE;
+  const out = fs.createWriteStream(output);
+  const write = (message) => out.write(JSON.stringify(message) + "\n");
+  // 購読を先に始め、読み込み中のトランザクションも記録する (replay 側で古いものは無視される)
+  client.on("transaction", write);
+  client.on("ledgerClosed", (ledger) => write({ type: "ledgerClosed", ...ledger }));
+  await client.request({ command: "subscribe", accounts: [hookAddress], streams: ["ledger"] });
+  const { ledgerIndex, entries } = await dumpNamespace(client, hookAddress, namespace, DEFAULT_PAGE_SIZE);
+  write({ type: "namespace", ledger_index: ledgerIndex, namespace_entries: entries });
+  return out;
+}
+
+/**
+ * 検証済みレジャーの名前空間をページ単位ですべて読み込みます。2ページ目以降は同じレジャーに固定します。
+ */
+async function dumpNamespace(client, hookAddress, namespace, pageSize) {
+  const entries = [];
+  let ledgerIndex = "validated";
+  let marker;
+  do {
+    const response = await client.request({
+      command: "account_namespace",
+      account: hookAddress,
+      namespace_id: namespace,
+      ledger_index: ledgerIndex,
+      limit: pageSize,
+      marker,
+    });
+    ledgerIndex = response.result.ledger_index;
+    entries.push(...response.result.namespace_entries);
+    marker = response.result.marker;
+  } while (marker);
+  return { ledgerIndex, entries };
+}
+
+// 使い方: node src/js/state_mirror.js record <フックのアドレス> <出力ファイル>
+if (require.main === module) {
+  const [command, hookAddress, output] = process.argv.slice(2);
+  if (command !== "record" || !hookAddress || !output) {
+    console.error("usage: node src/js/state_mirror.js record <hookAddress> <output.ndjson>");
+    process.exit(1);
+  }
+  const { initClient } = require("./hocks");
+  initClient()
+    .then((client) => recordStream(client, hookAddress, output))
+    .then(() => console.log(`recording to ${output} (Ctrl-C to stop)`));
+}
+
+module.exports = {
+  StateMirror,
+  PrecheckError,
+  PRECHECK_ERROR,
+  decodeRecord,
+  allowanceDigest,
+  recordStream,
+};
@@ -0,0 +1,127 @@
+// Hocks/test/balance_cache.test.js
+// BalanceCache の試験 (account_lines のページ分割・RippleState の変更への追従・リプレイ)
+const test = require("node:test");
+const assert = require("node:assert");
+const crypto = require("crypto");
+const { xrpl } = require("../hocks");
+const { MockXahaud } = require("../mock_xahaud");
+const { BalanceCache, fetchAccountLines } = require("../balance_cache");
+
+const CURRENCY = "JPY";
+const address = (label) =>
+  xrpl.encodeAccountID(crypto.createHash("sha256").update(String(label)).digest().subarray(0, 20));
+const ISSUER = address("issuer");
+const HOOK = address("hook");
+
+// 発行済みトークンの Payment を次のレジャーに入れる
+function pay(mock, from, to, value, currency = CURRENCY) {
+  mock.openTxs.push({
+    tx: { TransactionType: "Payment", Account: from, Destination: to, Amount: { currency, issuer: ISSUER, value } },
+    hash: crypto.randomBytes(32).toString("hex").toUpperCase(),
+    engineResult: "tesSUCCESS",
+  });
+}
+
+const flush = () => new Promise((resolve) => setImmediate(resolve));
+
+async function startCache(mock, options = {}) {
+  const client = mock.createClient();
+  await client.connect();
+  const cache = new BalanceCache(client, { issuer: ISSUER, currency: CURRENCY, accounts: [HOOK], ...options });
+  await cache.start();
+  return { client, cache };
+}
+
+test("fetchAccountLines は marker をたどり、2ページ目以降を同じレジャーに固定する", async () => {
+  const mock = new MockXahaud({ closeIntervalMs: 0 });
+  for (let i = 0; i < 25; i++) mock.setTrustLine(address(i), ISSUER, CURRENCY, String(i));
+  const client = mock.createClient();
+  await client.connect();
+  const requests = [];
+  const request = client.request;
+  client.request = (req) => {
+    requests.push(req);
+    return request(req);
+  };
+
+  const { ledgerIndex, lines, pages } = await fetchAccountLines(client, ISSUER, 10);
+  assert.strictEqual(pages, 3);
+  assert.strictEqual(lines.length, 25);
+  assert.strictEqual(ledgerIndex, mock.validatedLedger);
+  assert.deepStrictEqual(requests.map((r) => r.ledger_index), ["validated", ledgerIndex, ledgerIndex]);
+  await client.disconnect();
+});
+
+test("起動時に発行者のトラストラインをすべて読み込み、保有者から見た残高を返す", async () => {
+  const mock = new MockXahaud({ closeIntervalMs: 0 });
+  for (let i = 0; i < 1000; i++) mock.setTrustLine(address(i), ISSUER, CURRENCY, String(i));
+  mock.setTrustLine(HOOK, ISSUER, CURRENCY, "5000");
+  mock.setTrustLine(address("usd"), ISSUER, "USD", "7");
+
+  const { client, cache } = await startCache(mock);
+  assert.strictEqual(cache.stats.pages, 3);
+  assert.strictEqual(cache.holders, 1001);
+  assert.strictEqual(cache.balance(address(999)), "999");
+  assert.strictEqual(cache.balance(address(0)), "0");
+  assert.strictEqual(cache.balance(HOOK), "5000");
+  assert.strictEqual(cache.balance(address("usd")), "0");
+  assert.strictEqual(cache.balance(address("none")), "0");
+  assert.deepStrictEqual(cache.lines(HOOK), [{ account: ISSUER, balance: "5000", currency: CURRENCY }]);
+  assert.deepStrictEqual(cache.lines(address("none")), []);
+  await cache.stop();
+  await client.disconnect();
+});
+
+test("検証済みの Payment のメタデータから残高を更新する (送金・発行・焼却)", async () => {
+  const mock = new MockXahaud({ closeIntervalMs: 0 });
+  for (let i = 0; i < 20; i++) mock.setTrustLine(address(i), ISSUER, CURRENCY, "100");
+  mock.setTrustLine(HOOK, ISSUER, CURRENCY, "5000");
+  const { client, cache } = await startCache(mock);
+  const changed = [];
+  cache.on("changed", (event) => changed.push(...event.accounts));
+
+  pay(mock, address(10), HOOK, "7");
+  pay(mock, ISSUER, address("new"), "100");
+  pay(mock, address(19), ISSUER, "100");
+  pay(mock, address(11), address(12), "1", "USD"); // 他の通貨は無視する
+  mock.closeLedger();
+  await flush();
+
+  assert.deepStrictEqual([...cache.lookup([address(10), HOOK, address("new"), address(19)]).values()],
+    ["93", "5007", "100", "0"]);
+  assert.strictEqual(cache.balance(address(11)), "100");
+  assert.deepStrictEqual(new Set(changed), new Set([address(10), HOOK, address("new"), address(19)]));
+  assert.strictEqual(cache.ledgerIndex, mock.validatedLedger);
+
+  // 残高はすべてレジャーの状態と一致する
+  const { lines } = await fetchAccountLines(client, ISSUER);
+  for (const line of lines.filter((l) => l.currency === CURRENCY)) {
+    assert.strictEqual(cache.balance(line.account), String(-BigInt(line.balance)), line.account);
+  }
+  await cache.stop();
+  await client.disconnect();
+});
+
+test("削除されたトラストラインを外し、読み込み以前のレジャーのトランザクションは無視する", async () => {
+  const mock = new MockXahaud({ closeIntervalMs: 0 });
+  const holder = address("holder");
+  const cache = new BalanceCache(null, { issuer: ISSUER, currency: CURRENCY });
+  const event = (ledgerIndex, node) => ({ type: "transaction", validated: true, ledger_index: ledgerIndex,
+    transaction: { hash: `H${ledgerIndex}` }, meta: { TransactionResult: "tesSUCCESS", AffectedNodes: [node] } });
+
+  await cache.replay([
+    event(99, mock.setTrustLine(holder, ISSUER, CURRENCY, "1")),
+    { type: "account_lines", ledger_index: 100, lines: [{ account: holder, balance: "-500", currency: CURRENCY }] },
+    event(100, mock.setTrustLine(holder, ISSUER, CURRENCY, "2")),
+    { ...event(101, mock.setTrustLine(holder, ISSUER, CURRENCY, "3")), validated: false },
+    { type: "ledgerClosed", ledger_index: 101 },
+  ]);
+  assert.strictEqual(cache.balance(holder), "500");
+  assert.strictEqual(cache.ledgerIndex, 101);
+
+  await cache.replay([event(102, mock.setTrustLine(holder, ISSUER, CURRENCY, "250"))]);
+  assert.strictEqual(cache.balance(holder), "250");
+  await cache.replay([event(103, mock.setTrustLine(holder, ISSUER, CURRENCY, null))]);
+  assert.strictEqual(cache.holders, 0);
+  assert.strictEqual(cache.balance(holder), "0");
+});
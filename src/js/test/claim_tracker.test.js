@@ -0,0 +1,137 @@
+// Hocks/test/claim_tracker.test.js
+// ClaimTracker の試験 (フックと同じダイジェスト・請求の保持と拒否・世代の入れ替え・引き落とし)
+const test = require("node:test");
+const assert = require("node:assert");
+const { xrpl } = require("../hocks");
+const { createClaim, ClaimTracker } = require("../claim_tracker");
+const { PrecheckError, PRECHECK_ERROR, allowanceDigest } = require("../state_mirror");
+const { SignaturePool } = require("../signature_pool");
+
+const OPERATOR = xrpl.Wallet.generate();
+const HOOK = xrpl.Wallet.generate().address;
+const SIGNATURE = "30" + "AB".repeat(35);
+const NEXT_SIGNATURE = "30" + "CD".repeat(35);
+
+// 送信した Invoke を記録し、results の順にエンジン結果を返すクライアント
+function fakeClient(results = []) {
+  const client = {
+    submitted: [],
+    async autofill(tx) {
+      return tx;
+    },
+    async submitAndWait(blob) {
+      client.submitted.push(xrpl.decode(blob));
+      return { result: { meta: { TransactionResult: results.shift() || "tesSUCCESS" } } };
+    },
+  };
+  return client;
+}
+
+function tracker(wallets, options = {}) {
+  const publicKeys = new Map(wallets.map((w) => [w.address, w.publicKey]));
+  return new ClaimTracker(OPERATOR, HOOK, { publicKeys, client: fakeClient(), ...options });
+}
+
+const claim = (wallet, total, generation = 1, signature = SIGNATURE, allowanceAmount = "5000") =>
+  createClaim(wallet, OPERATOR.address, allowanceAmount, signature, generation, total);
+
+async function assertRejected(promise, code) {
+  await assert.rejects(promise, (error) => error instanceof PrecheckError && error.code === code);
+}
+
+test("請求のダイジェストは StateMirror (フックのレコード) と同じ", () => {
+  const wallet = xrpl.Wallet.generate();
+  assert.strictEqual(claim(wallet, "100").allowanceDigest,
+    allowanceDigest(xrpl.decodeAccountID(wallet.address), "5000", SIGNATURE));
+  assert.strictEqual(createClaim(wallet, OPERATOR.address, 5000, SIGNATURE, 1, 100).allowanceDigest,
+    claim(wallet, "100").allowanceDigest);
+});
+
+test("累積請求額が大きい請求だけを保持し、差分を引き落とし待ちにする", async () => {
+  const wallet = xrpl.Wallet.generate();
+  const claims = tracker([wallet]);
+  assert.strictEqual(await claims.accept(claim(wallet, "100")), true);
+  assert.strictEqual(await claims.accept(claim(wallet, "300")), true);
+  assert.strictEqual(await claims.accept(claim(wallet, "200")), false);
+  assert.strictEqual(await claims.accept(claim(wallet, "300")), false);
+  const [pending] = claims.pending();
+  assert.strictEqual(pending.claim.total, "300");
+  assert.strictEqual(pending.amount, 300n);
+});
+
+test("署名・金額・世代が不正な請求は拒否する", async () => {
+  const wallet = xrpl.Wallet.generate();
+  const other = xrpl.Wallet.generate();
+  const claims = tracker([wallet]);
+  await assertRejected(claims.accept(claim(wallet, "0")), PRECHECK_ERROR.INVALID_AMOUNT);
+  await assertRejected(claims.accept(claim(wallet, "1.5")), PRECHECK_ERROR.INVALID_AMOUNT);
+  await assertRejected(claims.accept({ ...claim(wallet, "100"), generation: -1 }),
+    PRECHECK_ERROR.CLAIM_VERIFICATION_FAILED);
+  await assertRejected(claims.accept({ ...claim(wallet, "100"), total: "101" }),
+    PRECHECK_ERROR.CLAIM_VERIFICATION_FAILED);
+  // 公開鍵が分からないユーザー
+  await assertRejected(claims.accept(claim(other, "100")), PRECHECK_ERROR.CLAIM_VERIFICATION_FAILED);
+  assert.deepStrictEqual(claims.pending(), []);
+
+  // 保持している請求より古い世代
+  await claims.accept(claim(wallet, "100", 2));
+  await assertRejected(claims.accept(claim(wallet, "500", 1)), PRECHECK_ERROR.CLAIM_STALE);
+});
+
+test("次の利用許可の請求は、前の請求をすべて引き落としてから受け付ける", async () => {
+  const wallet = xrpl.Wallet.generate();
+  const claims = tracker([wallet]);
+  await claims.accept(claim(wallet, "400"));
+  const next = claim(wallet, "50", 2, NEXT_SIGNATURE, "8000");
+  await assertRejected(claims.accept(next), PRECHECK_ERROR.CLAIM_STALE);
+
+  const summary = await claims.redeem();
+  assert.strictEqual(summary.redeemed, 400n);
+  assert.deepStrictEqual(claims.pending(), []);
+
+  // 新しい利用許可では引き落とし済みの額を 0 から数え直す
+  assert.strictEqual(await claims.accept(next), true);
+  assert.deepStrictEqual(claims.pending().map((p) => p.amount), [50n]);
+});
+
+test("成功した Invoke の請求だけを引き落とし済みにする", async () => {
+  const wallets = [xrpl.Wallet.generate(), xrpl.Wallet.generate()];
+  const client = fakeClient(["tecHOOK_REJECTED"]);
+  const claims = tracker(wallets, { client });
+  await claims.accept(claim(wallets[0], "100"));
+  await claims.accept(claim(wallets[1], "200"));
+
+  // 同じ加盟店 (なし) の請求は1件の Invoke にまとまり、失敗すれば両方とも残る
+  let summary = await claims.redeem();
+  assert.strictEqual(client.submitted.length, 1);
+  assert.strictEqual(client.submitted[0].Account, OPERATOR.address);
+  assert.strictEqual(client.submitted[0].Destination, HOOK);
+  assert.deepStrictEqual([summary.redeemed, summary.failed], [0n, 2]);
+  assert.strictEqual(claims.pending().length, 2);
+
+  summary = await claims.redeem();
+  assert.deepStrictEqual([summary.redeemed, summary.failed], [300n, 0]);
+  await claims.accept(claim(wallets[0], "150"));
+  assert.deepStrictEqual(claims.pending().map((p) => p.amount), [50n]);
+  summary = await claims.redeem();
+  assert.strictEqual(summary.redeemed, 50n);
+
+  // 引き落とすものがなければ送信しない
+  summary = await claims.redeem();
+  assert.strictEqual(client.submitted.length, 3);
+  assert.deepStrictEqual(summary.results, []);
+});
+
+test("SignaturePool を指定すると署名をワーカーで検証する", async () => {
+  const wallet = xrpl.Wallet.generate();
+  const pool = new SignaturePool({ size: 1 });
+  try {
+    const claims = tracker([wallet], { signaturePool: pool, publicKeys: async () => wallet.publicKey });
+    assert.strictEqual(await claims.accept(claim(wallet, "100")), true);
+    await assertRejected(claims.accept({ ...claim(wallet, "200"), total: "201" }),
+      PRECHECK_ERROR.CLAIM_VERIFICATION_FAILED);
+    assert.strictEqual(pool.stats().verifyClaim.count, 2);
+  } finally {
+    await pool.close();
+  }
+});
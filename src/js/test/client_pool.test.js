@@ -0,0 +1,149 @@
+// Hocks/test/client_pool.test.js
+// mock_xahaud に対する ClientPool の試験 (ローカル採番・パイプライン送信・再同期・Ticket・期限切れ)
+const test = require("node:test");
+const assert = require("node:assert");
+const { xrpl } = require("../hocks");
+const { ClientPool, SubmitError } = require("../client_pool");
+const { MockXahaud } = require("../mock_xahaud");
+
+// レジャーは closeLedger() で手動で閉じる
+function setup(options = {}) {
+  const mock = new MockXahaud({ closeIntervalMs: 0 });
+  const wallet = xrpl.Wallet.generate();
+  mock.fund(wallet.address, { sequence: 5 });
+  const pool = new ClientPool({ createClient: () => mock.createClient(), ...options });
+  return { mock, wallet, pool };
+}
+
+// ストリームの通知は setImmediate で届く
+const flush = () => new Promise((resolve) => setImmediate(resolve));
+
+async function closeLedger(mock) {
+  mock.closeLedger();
+  await flush();
+}
+
+test("mock_xahaud はシーケンスを確認し、先のシーケンスは保留する", async () => {
+  const mock = new MockXahaud({ closeIntervalMs: 0 });
+  const wallet = xrpl.Wallet.generate();
+  mock.fund(wallet.address, { sequence: 5 });
+  const client = mock.createClient();
+  await client.connect();
+
+  const sign = (sequence) => wallet.sign({ TransactionType: "AccountSet", Account: wallet.address, Fee: "10",
+    Sequence: sequence, NetworkID: mock.networkId }).tx_blob;
+  const submit = async (sequence) => (await client.request({ command: "submit", tx_blob: sign(sequence) }))
+    .result.engine_result;
+
+  assert.strictEqual(await submit(4), "tefPAST_SEQ");
+  assert.strictEqual(await submit(6), "terPRE_SEQ");
+  assert.strictEqual(await submit(5), "tesSUCCESS");
+  // 5 の適用で保留中の 6 も適用される
+  const info = await client.request({ command: "account_info", account: wallet.address });
+  assert.strictEqual(info.result.account_data.Sequence, 7);
+
+  mock.closeLedger();
+  const tx = await client.request({ command: "tx", transaction: xrpl.hashes.hashSignedTx(sign(6)) });
+  assert.strictEqual(tx.result.meta.TransactionResult, "tesSUCCESS");
+  assert.strictEqual(tx.result.ledger_index, mock.validatedLedger);
+  await assert.rejects(client.request({ command: "tx", transaction: "00".repeat(32) }),
+    (error) => error.data.error === "txnNotFound");
+  await client.disconnect();
+});
+
+test("検証を待たずに連続して送信し、シーケンスを連番で採番する", async () => {
+  const { mock, wallet, pool } = setup();
+  const submissions = [];
+  for (let i = 0; i < 30; i++) submissions.push(pool.submit({ TransactionType: "AccountSet" }, wallet));
+  await Promise.all(submissions.map((s) => s.submitted));
+  assert.strictEqual(mock.openTxs.length, 30);
+
+  await closeLedger(mock);
+  const results = await Promise.all(submissions.map((s) => s.validated));
+  assert.deepStrictEqual(results.map((r) => r.result.Sequence), Array.from({ length: 30 }, (_, i) => 5 + i));
+  for (const { result } of results) {
+    assert.strictEqual(result.meta.TransactionResult, "tesSUCCESS");
+    assert.strictEqual(result.NetworkID, mock.networkId);
+    assert.strictEqual(result.LastLedgerSequence, mock.validatedLedger - 1 + pool.lastLedgerOffset);
+  }
+  assert.strictEqual(mock.stats.rejected, 0);
+  await pool.close();
+});
+
+test("他でシーケンスが使われたら取り直して再送する", async () => {
+  const { mock, wallet, pool } = setup();
+  await pool.submit({ TransactionType: "AccountSet" }, wallet).submitted;
+  mock.account(wallet.address).sequence += 3;
+
+  const submission = pool.submit({ TransactionType: "AccountSet" }, wallet);
+  await submission.submitted;
+  await closeLedger(mock);
+  const { result } = await submission.validated;
+  assert.strictEqual(result.Sequence, 9);
+  assert.strictEqual(mock.stats.rejected, 1);
+  await pool.close();
+});
+
+test("送信に失敗したシーケンスは次の送信で使い直す", async () => {
+  const { mock, wallet, pool } = setup();
+  mock.engineResult = () => "tesSUCCESS";
+  await pool.submit({ TransactionType: "AccountSet" }, wallet).submitted;
+  // 手数料不足は1回だけ再送し、それでも失敗すれば SubmitError
+  mock.baseFee = 1000;
+  await assert.rejects(pool.submit({ TransactionType: "AccountSet", Fee: "10" }, wallet).submitted,
+    (error) => error instanceof SubmitError && error.engineResult === "telINSUF_FEE_P");
+  mock.baseFee = 10;
+  const submission = pool.submit({ TransactionType: "AccountSet" }, wallet);
+  await submission.submitted;
+  await closeLedger(mock);
+  assert.strictEqual((await submission.validated).result.Sequence, 6);
+  await pool.close();
+});
+
+test("Ticket を使うと TicketCreate で補充し、重複なく割り当てる", async () => {
+  const { mock, wallet, pool } = setup({ ticketBatch: 10 });
+  // TicketCreate の検証を待つため、レジャーを閉じ続ける
+  const timer = setInterval(() => mock.closeLedger(), 5);
+  try {
+    const submissions = [];
+    for (let i = 0; i < 25; i++) {
+      submissions.push(pool.submit({ TransactionType: "AccountSet" }, wallet, { useTickets: true }));
+    }
+    const results = await Promise.all(submissions.map((s) => s.validated));
+    const tickets = results.map((r) => r.result.TicketSequence);
+    assert.strictEqual(new Set(tickets).size, 25);
+    assert.ok(results.every((r) => r.result.Sequence === 0));
+  } finally {
+    clearInterval(timer);
+    await pool.close();
+  }
+});
+
+test("LastLedgerSequence を過ぎても検証されなければ tefMAX_LEDGER で失敗する", async () => {
+  const { mock, wallet, pool } = setup();
+  const prepared = await pool.autofill({ TransactionType: "AccountSet", Account: wallet.address });
+  // シーケンスを飛ばして保留させる
+  const blob = wallet.sign({ ...prepared, Sequence: prepared.Sequence + 5,
+    LastLedgerSequence: mock.currentLedger + 1 }).tx_blob;
+  const { engineResult, validated } = await pool.submitSigned(blob);
+  assert.strictEqual(engineResult, "terPRE_SEQ");
+
+  await closeLedger(mock);
+  await closeLedger(mock);
+  await closeLedger(mock);
+  await assert.rejects(validated, (error) => error instanceof SubmitError && error.engineResult === "tefMAX_LEDGER");
+  assert.strictEqual(pool.pending.size, 0);
+  await pool.close();
+});
+
+test("submitAndWait は xrpl.Client と同じ形で結果を返す", async () => {
+  const { mock, wallet, pool } = setup();
+  const prepared = await pool.autofill({ TransactionType: "AccountSet", Account: wallet.address });
+  const waiting = pool.submitAndWait(wallet.sign(prepared).tx_blob);
+  await flush();
+  await closeLedger(mock);
+  const response = await waiting;
+  assert.strictEqual(response.result.validated, true);
+  assert.strictEqual(response.result.meta.TransactionResult, "tesSUCCESS");
+  await pool.close();
+});
@@ -0,0 +1,107 @@
+// Hocks/test/signature_pool.test.js
+// 署名の試験 (利用許可・請求の署名対象メッセージ、署名と検証、SignaturePool の結果の順序)
+const test = require("node:test");
+const assert = require("node:assert");
+const { xrpl } = require("../hocks");
+const {
+  SignaturePool,
+  allowanceMessage,
+  signAllowance,
+  verifyAllowance,
+  claimMessage,
+  signClaim,
+  verifyClaim,
+  paymentMessage,
+} = require("../signature_pool");
+
+const OPERATOR = xrpl.Wallet.generate().address;
+const DIGEST = "CD".repeat(32);
+
+function allowanceRequest(wallet, allowanceAmount) {
+  return {
+    userAddress: wallet.address,
+    publicKey: wallet.publicKey,
+    operatorAddress: OPERATOR,
+    allowanceAmount,
+    signature: signAllowance({ userAddress: wallet.address, privateKey: wallet.privateKey, operatorAddress: OPERATOR,
+      allowanceAmount }),
+  };
+}
+
+test("署名対象メッセージはフックが検証するバイト列と同じ", () => {
+  const user = "rUser";
+  const ascii = (hex) => Buffer.from(hex, "hex").toString("ascii");
+  assert.strictEqual(ascii(allowanceMessage(user, OPERATOR, "5000")), `rUser:${OPERATOR}:5000`);
+  assert.strictEqual(ascii(paymentMessage(user, OPERATOR, "7", "300")), `rUser:${OPERATOR}:7:300`);
+
+  // 請求はダイジェストを32バイトのまま挟む
+  const message = Buffer.from(claimMessage(user, OPERATOR, DIGEST, "2", "1500"), "hex");
+  const prefix = Buffer.from(`rUser:${OPERATOR}:`, "ascii");
+  assert.ok(message.subarray(0, prefix.length).equals(prefix));
+  assert.strictEqual(message.subarray(prefix.length, prefix.length + 32).toString("hex").toUpperCase(), DIGEST);
+  assert.strictEqual(message.subarray(prefix.length + 32).toString("ascii"), ":2:1500");
+  assert.strictEqual(message.length, prefix.length + 32 + ":2:1500".length);
+});
+
+test("利用許可署名は署名した許可額・運営者・公開鍵でだけ検証できる", () => {
+  const wallet = xrpl.Wallet.generate();
+  const other = xrpl.Wallet.generate();
+  const request = allowanceRequest(wallet, "5000");
+  assert.strictEqual(verifyAllowance(request), true);
+  assert.strictEqual(verifyAllowance({ ...request, allowanceAmount: "5001" }), false);
+  assert.strictEqual(verifyAllowance({ ...request, operatorAddress: other.address }), false);
+  assert.strictEqual(verifyAllowance({ ...request, publicKey: other.publicKey }), false);
+  // 形式が不正な署名・公開鍵は例外ではなく false
+  assert.strictEqual(verifyAllowance({ ...request, signature: "ZZ" }), false);
+  assert.strictEqual(verifyAllowance({ ...request, publicKey: "" }), false);
+});
+
+test("請求署名は世代・累積請求額・ダイジェストが一致するときだけ検証できる", () => {
+  const wallet = xrpl.Wallet.generate();
+  const claim = {
+    userAddress: wallet.address,
+    operatorAddress: OPERATOR,
+    allowanceDigest: DIGEST,
+    generation: 2,
+    total: "1500",
+  };
+  const request = { ...claim, publicKey: wallet.publicKey, signature: signClaim({ ...claim, privateKey: wallet.privateKey }) };
+  assert.strictEqual(verifyClaim(request), true);
+  assert.strictEqual(verifyClaim({ ...request, generation: "2" }), true);
+  assert.strictEqual(verifyClaim({ ...request, generation: 3 }), false);
+  assert.strictEqual(verifyClaim({ ...request, total: "1501" }), false);
+  assert.strictEqual(verifyClaim({ ...request, allowanceDigest: "CE".repeat(32) }), false);
+  assert.strictEqual(verifyClaim({ ...request, signature: "" }), false);
+});
+
+for (const size of [0, 2]) {
+  test(`SignaturePool (ワーカー ${size}) は複数のチャンクの結果を要求と同じ順に返す`, async () => {
+    const pool = new SignaturePool({ size, chunkSize: 3 });
+    try {
+      const wallets = Array.from({ length: 4 }, () => xrpl.Wallet.generate());
+      const amounts = Array.from({ length: 10 }, (_, i) => String(1000 + i));
+      const signatures = await pool.signAllowances(amounts.map((allowanceAmount, i) => ({
+        wallet: wallets[i % wallets.length], operatorAddress: OPERATOR, allowanceAmount })));
+      assert.strictEqual(signatures.length, amounts.length);
+
+      // 奇数番目だけ許可額を変えて、結果が要求の位置に対応することを確かめる
+      const requests = amounts.map((allowanceAmount, i) => ({
+        userAddress: wallets[i % wallets.length].address,
+        publicKey: wallets[i % wallets.length].publicKey,
+        operatorAddress: OPERATOR,
+        allowanceAmount: i % 2 === 0 ? allowanceAmount : allowanceAmount + "0",
+        signature: signatures[i],
+      }));
+      assert.deepStrictEqual(await pool.verifyAllowances(requests), amounts.map((_, i) => i % 2 === 0));
+
+      const stats = pool.stats();
+      assert.strictEqual(stats.workers, size);
+      assert.strictEqual(stats.sign.count, amounts.length);
+      assert.strictEqual(stats.verify.count, amounts.length);
+      assert.strictEqual(stats.verifyClaim.count, 0);
+    } finally {
+      await pool.close();
+    }
+    await assert.rejects(pool.verifyAllowances([]), /終了しています/);
+  });
+}
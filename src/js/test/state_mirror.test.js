@@ -0,0 +1,218 @@
+// Hocks/test/state_mirror.test.js
+// StateMirror の試験 (レコードのデコード・事前チェックの規則・mock_xahaud からの読み込みと追従・リプレイ)
+const test = require("node:test");
+const assert = require("node:assert");
+const crypto = require("crypto");
+const { xrpl } = require("../hocks");
+const { MockXahaud } = require("../mock_xahaud");
+const { StateMirror, PrecheckError, PRECHECK_ERROR, decodeRecord, allowanceDigest } = require("../state_mirror");
+
+const NAMESPACE = "AA".repeat(32);
+const address = (label) => xrpl.encodeAccountID(crypto.createHash("sha256").update(label).digest().subarray(0, 20));
+const HOOK = address("hook");
+const OPERATOR = address("operator");
+const SIGNATURE = "30" + "AB".repeat(35);
+
+// src/c/xapay_state.h のキー (32バイトに左詰めのゼロで拡張) とユーザーレコード
+function stateKey(prefix, userAddress) {
+  return "00".repeat(11) + prefix + Buffer.from(xrpl.decodeAccountID(userAddress)).toString("hex").toUpperCase();
+}
+
+function encodeRecord({ balance = 0, allowance = 0, spent = 0, generation = 0, hash = null }) {
+  const data = Buffer.alloc(80);
+  data[0] = 1;
+  data[1] = hash ? 0x01 : 0;
+  data.writeUInt32LE(generation, 4);
+  data.writeBigInt64LE(BigInt(balance), 8);
+  data.writeBigInt64LE(BigInt(allowance), 16);
+  data.writeBigInt64LE(BigInt(spent), 24);
+  if (hash) Buffer.from(hash, "hex").copy(data, 48);
+  return data.toString("hex").toUpperCase();
+}
+
+// 現在の利用許可が "5000" / SIGNATURE のユーザーのレコード
+function userRecord(userAddress, fields = {}) {
+  const hash = allowanceDigest(xrpl.decodeAccountID(userAddress), "5000", SIGNATURE);
+  return encodeRecord({ allowance: 5000, generation: 1, hash, ...fields });
+}
+
+function mirrorWith(records) {
+  const mirror = new StateMirror(null, HOOK, { namespace: NAMESPACE });
+  mirror.load(100, Object.entries(records).map(([userAddress, data]) => ({
+    HookStateKey: stateKey("52", userAddress), HookStateData: data })));
+  return mirror;
+}
+
+const payment = (userAddress, amount, withAllowance = false) => ({
+  userAddress, amount, ...(withAllowance ? { allowanceAmount: "5000", signature: SIGNATURE } : {}),
+});
+
+function assertPrecheck(mirror, payments, code) {
+  assert.throws(() => mirror.precheck(payments), (error) => error instanceof PrecheckError && error.code === code);
+}
+
+test("decodeRecord はフックのレコードの配置を読み、長さ・版が違えば null", () => {
+  const data = Buffer.from(encodeRecord({ balance: 1234, allowance: 5000, spent: 10, generation: 7,
+    hash: "CD".repeat(32) }), "hex");
+  data.writeBigUInt64LE(99n, 32);
+  data.writeBigUInt64LE(0b101n, 40);
+  const record = decodeRecord(data);
+  assert.strictEqual(record.flags, 1);
+  assert.strictEqual(record.generation, 7);
+  assert.strictEqual(record.balance, 1234n);
+  assert.strictEqual(record.allowance, 5000n);
+  assert.strictEqual(record.spent, 10n);
+  assert.strictEqual(record.nonceHigh, 99n);
+  assert.strictEqual(record.nonceWindow, 5n);
+  assert.strictEqual(record.allowanceHash, "CD".repeat(32));
+
+  assert.strictEqual(decodeRecord(data.subarray(0, 79)), null);
+  data[0] = 2;
+  assert.strictEqual(decodeRecord(data), null);
+});
+
+test("支払い額は18桁までの正の10進数 (105)", () => {
+  const user = address("alice");
+  const mirror = mirrorWith({ [user]: userRecord(user, { balance: 1000 }) });
+  for (const amount of ["0", "", "12a", "-1", "1.5", "1000000000000000000"]) {
+    assertPrecheck(mirror, payment(user, amount), PRECHECK_ERROR.INVALID_AMOUNT);
+  }
+  assertPrecheck(mirror, payment("not-an-address", "1"), PRECHECK_ERROR.MISSING_FIELD);
+});
+
+test("支払いに付けられるのは現在の利用許可だけ (302)", () => {
+  const user = address("alice");
+  const fresh = address("bob");
+  const mirror = mirrorWith({ [user]: userRecord(user, { balance: 1000 }) });
+
+  assert.strictEqual(mirror.precheck(payment(user, "100", true)).get(user).spent, 100n);
+  assertPrecheck(mirror, { ...payment(user, "100", true), allowanceAmount: "6000" },
+    PRECHECK_ERROR.ALLOWANCE_VERIFICATION_FAILED);
+  assertPrecheck(mirror, { ...payment(user, "100", true), signature: "30" + "CD".repeat(35) },
+    PRECHECK_ERROR.ALLOWANCE_VERIFICATION_FAILED);
+  assertPrecheck(mirror, { ...payment(user, "100", true), allowanceAmount: "" }, PRECHECK_ERROR.MISSING_FIELD);
+
+  // 利用許可のないユーザーは署名を付けても支払えない
+  assertPrecheck(mirror, payment(fresh, "100"), PRECHECK_ERROR.MISSING_FIELD);
+  assertPrecheck(mirror, payment(fresh, "100", true), PRECHECK_ERROR.ALLOWANCE_VERIFICATION_FAILED);
+});
+
+test("利用上限 (303) と残高 (304) は一括決済と同じく先頭から順に判定する", () => {
+  const user = address("alice");
+  const mirror = mirrorWith({ [user]: userRecord(user, { balance: 3000, spent: 4000 }) });
+  assert.strictEqual(mirror.precheck(payment(user, "1000")).get(user).balance, 2000n);
+  assertPrecheck(mirror, payment(user, "1001"), PRECHECK_ERROR.ALLOWANCE_EXCEEDED);
+  assertPrecheck(mirror, [payment(user, "600"), payment(user, "600")], PRECHECK_ERROR.ALLOWANCE_EXCEEDED);
+
+  const poor = mirrorWith({ [user]: userRecord(user, { balance: 500 }) });
+  assertPrecheck(poor, payment(user, "501"), PRECHECK_ERROR.INSUFFICIENT_BALANCE);
+  assertPrecheck(poor, [payment(user, "300"), payment(user, "300")], PRECHECK_ERROR.INSUFFICIENT_BALANCE);
+});
+
+test("仮押さえした支払いは検証されるまで view に反映する", () => {
+  const user = address("alice");
+  const mirror = mirrorWith({ [user]: userRecord(user, { balance: 1000 }) });
+  mirror.reserve("H1", payment(user, "300"));
+  mirror.reserve("H2", [payment(user, "300"), payment(user, "9999")]); // 失敗する見込みの支払いは反映しない
+  assert.strictEqual(mirror.view(user).balance, 400n);
+  assertPrecheck(mirror, payment(user, "401"), PRECHECK_ERROR.INSUFFICIENT_BALANCE);
+
+  // 検証済みトランザクションが届けば (失敗でも) 仮押さえを外す
+  mirror.applyTransaction({ transaction: { hash: "H1", Account: OPERATOR, Destination: HOOK }, validated: true,
+    ledger_index: 101, meta: { TransactionResult: "tecHOOK_REJECTED", AffectedNodes: [] } });
+  mirror.release("H2");
+  assert.strictEqual(mirror.view(user).balance, 1000n);
+  assert.strictEqual(mirror.reserved.size, 0);
+});
+
+test("旧形式のキー ('U' 'A') しかないユーザーはフックの移行と同じレコードとして扱う", () => {
+  const user = address("legacy");
+  const balance = Buffer.alloc(8);
+  balance.writeBigInt64LE(3000n);
+  const mirror = new StateMirror(null, HOOK, { namespace: NAMESPACE });
+  mirror.load(100, [
+    { HookStateKey: stateKey("55", user), HookStateData: balance.toString("hex").toUpperCase() },
+    { HookStateKey: stateKey("41", user), HookStateData: Buffer.from("5000").toString("hex").toUpperCase() },
+  ]);
+  assert.deepStrictEqual(mirror.users(), [user]);
+  assert.strictEqual(mirror.view(user).balance, 3000n);
+  assert.strictEqual(mirror.view(user).allowance, 5000n);
+  // 旧形式の利用許可にはダイジェストがないため、チャージ＋利用許可枠更新までは支払えない
+  assertPrecheck(mirror, payment(user, "100"), PRECHECK_ERROR.MISSING_FIELD);
+
+  // 移行後はレコードを使い、旧キーの削除で消える
+  mirror.applyState(stateKey("52", user), userRecord(user, { balance: 2000 }));
+  mirror.applyState(stateKey("55", user), null);
+  mirror.applyState(stateKey("41", user), null);
+  assert.strictEqual(mirror.legacy.size, 0);
+  assert.strictEqual(mirror.view(user).balance, 2000n);
+});
+
+test("mock_xahaud の名前空間をページ単位で読み込み、HookState の変更に追従する", async () => {
+  const users = ["alice", "bob", "carol", "dave", "erin"].map(address);
+  let next = null;
+  const mock = new MockXahaud({ closeIntervalMs: 0, hook: () => next });
+  users.forEach((user, i) => mock.setState(HOOK, NAMESPACE, stateKey("52", user),
+    userRecord(user, { balance: 1000 * (i + 1) })));
+  mock.setState(HOOK, NAMESPACE, stateKey("4B", users[0]), "01" + "02".repeat(33));
+  mock.setState(HOOK, NAMESPACE, "FF".repeat(32), "00"); // レコード以外は無視する
+
+  const client = mock.createClient();
+  await client.connect();
+  const mirror = new StateMirror(client, HOOK, { namespace: NAMESPACE, pageSize: 2 });
+  await mirror.start();
+  assert.strictEqual(mirror.users().length, 5);
+  assert.strictEqual(mirror.view(users[4]).balance, 5000n);
+  assert.strictEqual(mirror.publicKey(users[0]), "02".repeat(33));
+  assert.strictEqual(mirror.baseLedger, mock.validatedLedger);
+
+  const invoke = (result) => {
+    mock.openTxs.push({ tx: { TransactionType: "Invoke", Account: OPERATOR, Destination: HOOK },
+      hash: crypto.randomBytes(32).toString("hex").toUpperCase(), engineResult: "tesSUCCESS" });
+    next = result;
+    mock.closeLedger();
+    return new Promise((resolve) => setImmediate(resolve));
+  };
+
+  await invoke({ state: [{ account: HOOK, namespace: NAMESPACE, key: stateKey("52", users[0]),
+    data: userRecord(users[0], { balance: 700, spent: 300 }) }] });
+  assert.strictEqual(mirror.view(users[0]).balance, 700n);
+  assert.strictEqual(mirror.view(users[0]).spent, 300n);
+
+  // ロールバックしたトランザクションの State は反映しない
+  await invoke({ result: "tecHOOK_REJECTED", state: [{ account: HOOK, namespace: NAMESPACE,
+    key: stateKey("52", users[1]), data: userRecord(users[1], { balance: 1 }) }] });
+  assert.strictEqual(mirror.view(users[1]).balance, 2000n);
+
+  await invoke({ state: [{ account: HOOK, namespace: NAMESPACE, key: stateKey("52", users[2]), data: null }] });
+  assert.strictEqual(mirror.users().length, 4);
+  assert.strictEqual(mirror.view(users[2]).balance, 0n);
+  assert.strictEqual(mirror.ledgerIndex, mock.validatedLedger);
+
+  await mirror.stop();
+  await client.disconnect();
+});
+
+test("replay は名前空間を初期状態とし、それ以前のレジャーのトランザクションを無視する", async () => {
+  const user = address("alice");
+  const modified = (ledgerIndex, balance) => ({
+    type: "transaction", validated: true, ledger_index: ledgerIndex,
+    transaction: { hash: `H${ledgerIndex}`, Account: OPERATOR, Destination: HOOK },
+    meta: { TransactionResult: "tesSUCCESS", AffectedNodes: [{ ModifiedNode: { LedgerEntryType: "HookState",
+      FinalFields: { HookStateKey: stateKey("52", user), HookStateData: userRecord(user, { balance }) } } }] },
+  });
+  const mirror = new StateMirror(null, HOOK, { namespace: NAMESPACE });
+  await mirror.replay([
+    modified(99, 1),
+    { type: "namespace", ledger_index: 100,
+      namespace_entries: [{ HookStateKey: stateKey("52", user), HookStateData: userRecord(user, { balance: 1000 }) }] },
+    modified(100, 2),
+    { type: "ledgerClosed", ledger_index: 101 },
+  ]);
+  assert.strictEqual(mirror.view(user).balance, 1000n);
+  assert.strictEqual(mirror.ledgerIndex, 101);
+
+  await mirror.replay([modified(102, 900)]);
+  assert.strictEqual(mirror.view(user).balance, 900n);
+  assert.strictEqual(mirror.ledgerIndex, 102);
+});
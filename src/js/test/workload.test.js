@@ -0,0 +1,103 @@
+// Hocks/test/workload.test.js
+// ワークロード生成の試験 (再現性・ノンスの再送と古いノンス・検証まで届く不正な署名)
+const test = require("node:test");
+const assert = require("node:assert");
+const { xrpl } = require("../hocks");
+const { generateWorkload, NONCE_WINDOW } = require("../workload");
+const { allowanceMessage, paymentMessage, emuSign } = require("../signature_pool");
+
+// src/c/xapay_memo.h の TLV (マジック・バージョンの2バイトに続いて タグ・長さ・値)
+const TLV = { TYPE: 0x01, USER: 0x02, AMOUNT: 0x03, ALLOWANCE_AMOUNT: 0x04, SIGNATURE: 0x05, NONCE: 0x09 };
+const TYPE_UPDATE_ALLOWANCE = 2;
+const TYPE_NONCE_PAYMENT = 10;
+
+function decodeMemo(transaction) {
+  const data = Buffer.from(transaction.Memos[0].Memo.MemoData, "hex");
+  const fields = {};
+  for (let p = 2; p < data.length; p += 2 + data[p + 1]) {
+    fields[data[p]] = data.subarray(p + 2, p + 2 + data[p + 1]);
+  }
+  return fields;
+}
+
+function corpus(options) {
+  const [header, ...lines] = generateWorkload({ users: 20, txs: 600, signatures: "emu", ...options });
+  return { header, lines };
+}
+
+test("同じオプション・シードなら同じコーパスになる", () => {
+  const a = JSON.stringify([...generateWorkload({ users: 10, txs: 100, seed: 7, signatures: "emu" })]);
+  const b = JSON.stringify([...generateWorkload({ users: 10, txs: 100, seed: 7, signatures: "emu" })]);
+  const c = JSON.stringify([...generateWorkload({ users: 10, txs: 100, seed: 8, signatures: "emu" })]);
+  assert.strictEqual(a, b);
+  assert.notStrictEqual(a, c);
+});
+
+test("再送と古いノンスはノンス付きの支払いとしてフックまで届く", () => {
+  const { header, lines } = corpus({
+    mix: { charge: 2, nonce_payment: 6, invalid: 2 },
+    invalidMix: { replay: 1, stale_nonce: 1 },
+  });
+  const used = new Map(); // ユーザー => accept されたノンス
+  const seen = { replay: 0, stale_nonce: 0 };
+  for (const line of lines) {
+    if (!["nonce_payment", "replay", "stale_nonce"].includes(line.kind)) continue;
+    const memo = decodeMemo(line.transaction);
+    assert.strictEqual(memo[TLV.TYPE][0], TYPE_NONCE_PAYMENT);
+    assert.strictEqual(line.transaction.Account, header.operator_address);
+    const user = memo[TLV.USER].toString("hex");
+    const nonce = BigInt(memo[TLV.NONCE].toString("ascii"));
+    const nonces = used.get(user) || [];
+    const high = nonces.length > 0 ? nonces[nonces.length - 1] : 0n;
+
+    if (line.kind === "nonce_payment") {
+      assert.deepStrictEqual(line.expected, { outcome: "accept", code: 0 });
+      assert.ok(nonce > high);
+      nonces.push(nonce);
+      used.set(user, nonces);
+    } else if (line.kind === "replay") {
+      assert.deepStrictEqual(line.expected, { outcome: "rollback", code: 33 });
+      assert.ok(nonces.includes(nonce));
+      assert.ok(nonce > high - BigInt(NONCE_WINDOW));
+    } else {
+      assert.deepStrictEqual(line.expected, { outcome: "rollback", code: 35 });
+      assert.ok(nonce === 0n || nonce <= high - BigInt(NONCE_WINDOW));
+    }
+    if (line.kind !== "nonce_payment") seen[line.kind]++;
+  }
+  assert.ok(seen.replay > 0 && seen.stale_nonce > 0);
+});
+
+test("不正な署名は正しいメッセージへの署名と異なり、util_verify で拒否される", () => {
+  const { header, lines } = corpus({ mix: { charge: 3, recharge: 3, nonce_payment: 2, invalid: 2 },
+    invalidMix: { bad_signature: 1 } });
+  const publicKeys = new Map();
+  for (const line of lines) {
+    if (line.kind === "register_key") {
+      publicKeys.set(line.transaction.Account, line.transaction.SigningPubKey);
+    }
+  }
+  const codes = new Set();
+  for (const line of lines) {
+    if (!["bad_signature", "recharge", "nonce_payment"].includes(line.kind)) continue;
+    const memo = decodeMemo(line.transaction);
+    const signature = memo[TLV.SIGNATURE].toString("hex").toUpperCase();
+    // チャージ＋利用許可枠更新はユーザー本人、ノンス付きの支払いは運営者が送る
+    const user = memo[TLV.USER] ? xrpl.encodeAccountID(memo[TLV.USER]) : line.transaction.Account;
+    const message = memo[TLV.TYPE][0] === TYPE_UPDATE_ALLOWANCE
+      ? allowanceMessage(user, header.operator_address, memo[TLV.ALLOWANCE_AMOUNT].toString("ascii"))
+      : paymentMessage(user, header.operator_address, memo[TLV.NONCE].toString("ascii"),
+        memo[TLV.AMOUNT].toString("ascii"));
+    const valid = emuSign(publicKeys.get(user), message);
+    assert.strictEqual(signature.length, valid.length);
+    if (line.kind === "bad_signature") {
+      assert.notStrictEqual(signature, valid);
+      assert.strictEqual(line.expected.outcome, "rollback");
+      assert.strictEqual(line.expected.code, memo[TLV.TYPE][0] === TYPE_UPDATE_ALLOWANCE ? 302 : 32);
+      codes.add(line.expected.code);
+    } else {
+      assert.strictEqual(signature, valid);
+    }
+  }
+  assert.deepStrictEqual([...codes].sort((a, b) => a - b), [32, 302]);
+});
@@ -0,0 +1,409 @@
+// Hocks/workload.js
+// 負荷試験・容量計画用の XApay トランザクションのコーパスを、シードから再現可能に生成する (オフライン)
+//
+// ユーザーのウォレットをシードから生成し、チャージ・チャージ＋利用許可枠更新・利用許可決済・ノンス付きの支払い・
+// 引き出し・引き出しのフラッシュと、意図的に不正なトランザクション (使用済みのノンスの再送・ウィンドウより古い
+// ノンス・利用上限超過・不正な署名・異なる発行者のチャージ) を指定した比率で混ぜ、署名済みの tx_blob と期待される結果を
+// 1行1トランザクションの NDJSON で出力します。ユーザーの利用頻度は Zipf 分布に従います。
+// 同じオプション・シードなら出力は同じです (ed25519 / secp256k1 の署名はいずれも決定的)。
+//
+// 期待される結果は、フックの判定 (src/c/xapay_hock.c) をユーザーごとのモデルで再現したものです。
+// 出力はそのまま build/hook_replay.js のコーパスになり、expected と異なる結果の件数が集計に出ます。
+//
+// 使い方: node src/js/workload.js [オプション] > corpus.ndjson
+//   --seed n            乱数のシード (既定: 1)
+//   --users n           ユーザー数 (既定: 1000)
+//   --txs n             トランザクション数 (署名鍵の登録を除く、既定: 10000)
+//   --zipf s            ユーザーの利用頻度の Zipf 指数 (0 なら一様、既定: 1.1)
+//   --mix k=v,...       種類ごとの比率 (指定しない種類は0、既定: DEFAULT_MIX)
+//   --invalid k=v,...   不正なトランザクションの内訳 (既定: DEFAULT_INVALID_MIX)
+//   --algorithm a       ユーザーの鍵 ed25519 | secp256k1 | mixed (既定: ed25519)
+//   --signatures s      ユーザーの署名 ledger (実際の署名) | emu (エミュレータの emu_sign。hook_replay.js 用)
+//   --hook-address r    フックのアドレス (既定: HOOK_SEED のアドレス、なければシードから生成)
+//   --fee drops         手数料 (既定: 1000)
+//   --out file          出力先 (既定: 標準出力)
+//
+// 運営者の鍵は環境変数 OPERATOR_SEED を使います。未設定ならシードから生成します。フックの OPERATOR_ADDRESS
+// (src/c/xapay_config.h) と一致しない場合、期待される結果はそのアドレスを運営者としたフックのものです
+// (.env の OPERATOR_ADDRESS に設定して npm run gen-config で再生成してください)。
+const fs = require("fs");
+const { once } = require("events");
+const { xrpl, ISSUER_ADDRESS, OPERATOR_ADDRESS, CURRENCY_CODE } = require("./hocks");
+const { buildMemo } = require("./allowance_payment");
+const { allowanceMessage, signAllowance, paymentMessage, signPayment, emuSign } = require("./signature_pool");
+
+// src/c/xapay_hock.c のエラーコードと一致させること
+const EXPECTED_CODE = {
+  CHARGE_INVALID: 13,
+  PAYMENT_VERIFICATION_FAILED: 32,
+  NONCE_USED: 33,
+  NONCE_TOO_OLD: 35,
+  ALLOWANCE_VERIFICATION_FAILED: 302,
+  ALLOWANCE_EXCEEDED: 303,
+  WITHDRAW_QUEUE_FULL: 401,
+};
+// src/c/xapay_state.h と一致させること
+const WITHDRAW_QUEUE_SIZE = 4096;
+const WITHDRAW_FLUSH_MAX = 255;
+const NONCE_WINDOW = 64;
+
+const NETWORK_ID = 21338; // Xahau テストネット
+const DEFAULT_MIX = { charge: 15, recharge: 10, payment: 50, nonce_payment: 10, withdraw: 10, flush: 1, invalid: 4 };
+const DEFAULT_INVALID_MIX = { replay: 1, stale_nonce: 1, over_allowance: 1, bad_signature: 1, wrong_issuer: 1 };
+
+/**
+ * シード付きの乱数 (mulberry32)。[0, 1) の値を返す関数を返します。
+ */
+function seededRandom(seed) {
+  let state = seed >>> 0;
+  return () => {
+    state = (state + 0x6d2b79f5) >>> 0;
+    let t = state;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+  };
+}
+
+/**
+ * 順位 0..n-1 を Zipf 分布 (順位 k の重み 1 / (k+1)^s) で選ぶ関数を返します。
+ */
+function zipfSampler(n, s, random) {
+  const cdf = new Float64Array(n);
+  let sum = 0;
+  for (let k = 0; k < n; k++) {
+    sum += 1 / Math.pow(k + 1, s);
+    cdf[k] = sum;
+  }
+  return () => {
+    const x = random() * sum;
+    let lo = 0;
+    let hi = n - 1;
+    while (lo < hi) {
+      const mid = (lo + hi) >>> 1;
+      if (cdf[mid] < x) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  };
+}
+
+/**
+ * 比率から種類を選ぶ関数を返します。
+ * @param {Object} weights - 種類 => 比率
+ */
+function weightedPicker(weights, random) {
+  const entries = Object.entries(weights).filter(([, w]) => w > 0);
+  const total = entries.reduce((a, [, w]) => a + w, 0);
+  if (total <= 0) throw new Error("比率がすべて0です");
+  return () => {
+    let x = random() * total;
+    for (const [kind, w] of entries) {
+      if ((x -= w) < 0) return kind;
+    }
+    return entries[entries.length - 1][0];
+  };
+}
+
+/** "charge=15,payment=60" の形式の比率を解析します。 */
+function parseMix(str, allowed) {
+  const mix = {};
+  for (const part of str.split(",")) {
+    const [kind, weight] = part.split("=");
+    if (!(kind in allowed) || !(Number(weight) >= 0)) throw new Error(`不正な比率です: ${part}`);
+    mix[kind] = Number(weight);
+  }
+  return mix;
+}
+
+/**
+ * コーパスを1行ずつ生成します。最初の要素は生成条件 ({ type: "workload" }) です。
+ * @param {Object} [options] - CLI のオプションと同じ (users, txs, seed, zipf, mix, invalidMix, algorithm,
+ *   signatures, hookAddress, operatorSeed, fee)
+ */
+function* generateWorkload(options = {}) {
+  const userCount = options.users ?? 1000;
+  const txCount = options.txs ?? 10000;
+  const seed = options.seed ?? 1;
+  const fee = String(options.fee ?? 1000);
+  const random = seededRandom(seed);
+  const randomInt = (min, max) => min + Math.floor(random() * (max - min + 1));
+  const entropy = () => Array.from({ length: 16 }, () => Math.floor(random() * 256));
+  const algorithm = (i) => {
+    const a = options.algorithm || "ed25519";
+    return (a === "mixed" ? (i % 2 === 0 ? "ed25519" : "secp256k1") : a) === "ed25519"
+      ? xrpl.ECDSA.ed25519 : xrpl.ECDSA.secp256k1;
+  };
+
+  // 乱数を引く順序を固定する (運営者・フック・発行者をユーザーより先に生成)
+  const generatedOperator = xrpl.Wallet.fromEntropy(entropy(), { algorithm: xrpl.ECDSA.ed25519 });
+  const generatedHook = xrpl.Wallet.fromEntropy(entropy(), { algorithm: xrpl.ECDSA.ed25519 });
+  const rogueIssuer = xrpl.Wallet.fromEntropy(entropy(), { algorithm: xrpl.ECDSA.ed25519 }).address;
+  const operator = options.operatorSeed ? xrpl.Wallet.fromSeed(options.operatorSeed) : generatedOperator;
+  const hookAddress = options.hookAddress || generatedHook.address;
+  const users = Array.from({ length: userCount }, (_, i) => ({
+    wallet: xrpl.Wallet.fromEntropy(entropy(), { algorithm: algorithm(i) }),
+    registered: false,
+    balance: 0n,
+    allowance: 0n,
+    spent: 0n,
+    allowanceAmount: null,
+    signature: null,
+    nonce: 0n, // 最後に使ったノンス (ノンスは1から順に使う)
+  }));
+
+  const mix = options.mix || DEFAULT_MIX;
+  const invalidMix = options.invalidMix || DEFAULT_INVALID_MIX;
+  const pickUser = zipfSampler(userCount, options.zipf ?? 1.1, random);
+  const pickKind = weightedPicker(mix, random);
+  const pickInvalid = weightedPicker(invalidMix, random);
+
+  yield {
+    type: "workload",
+    seed,
+    users: userCount,
+    txs: txCount,
+    zipf: options.zipf ?? 1.1,
+    mix,
+    invalid_mix: invalidMix,
+    signatures: options.signatures || "ledger",
+    hook_address: hookAddress,
+    operator_address: operator.address,
+    issuer_address: ISSUER_ADDRESS,
+    operator_matches_hook: operator.address === OPERATOR_ADDRESS,
+  };
+
+  const sequences = new Map();
+  const pending = new Set(); // 引き出し待ちの宛先 (キューの順)
+
+  const sign = (wallet, tx) => {
+    const sequence = sequences.get(wallet.address) || 1;
+    sequences.set(wallet.address, sequence + 1);
+    const signed = wallet.sign({ ...tx, Fee: fee, Sequence: sequence, NetworkID: NETWORK_ID });
+    return { transaction: { ...xrpl.decode(signed.tx_blob), hash: signed.hash }, tx_blob: signed.tx_blob };
+  };
+  const line = (kind, signed, expected) => ({ type: "transaction", kind, ...signed, expected });
+  const accept = { outcome: "accept", code: 0 };
+  const rollback = (code) => ({ outcome: "rollback", code });
+
+  const allowanceSignature = (user, allowanceAmount) => {
+    if (options.signatures === "emu") {
+      return emuSign(user.wallet.publicKey, allowanceMessage(user.wallet.address, operator.address, allowanceAmount));
+    }
+    return signAllowance({ userAddress: user.wallet.address, privateKey: user.wallet.privateKey,
+      operatorAddress: operator.address, allowanceAmount });
+  };
+  const paymentSignature = (user, nonce, amount) => {
+    if (options.signatures === "emu") {
+      return emuSign(user.wallet.publicKey, paymentMessage(user.wallet.address, operator.address, nonce, amount));
+    }
+    return signPayment({ userAddress: user.wallet.address, privateKey: user.wallet.privateKey,
+      operatorAddress: operator.address, nonce, amount });
+  };
+  // 形式はそのままで検証に失敗する署名 (フックの util_verify まで届く)
+  const corrupt = (signature) => {
+    const bytes = Buffer.from(signature, "hex");
+    bytes[bytes.length - 1] ^= 0x01;
+    return bytes.toString("hex").toUpperCase();
+  };
+  const jpy = (value, issuer = ISSUER_ADDRESS) => ({ currency: CURRENCY_CODE, issuer, value: String(value) });
+
+  // --- 種類ごとのトランザクション (モデルは accept の場合だけ更新する) ---
+  const registerKey = (user) => {
+    user.registered = true;
+    return line("register_key", sign(user.wallet, {
+      TransactionType: "Invoke", Account: user.wallet.address, Destination: hookAddress,
+      Memos: [buildMemo({ type: "register_key" })],
+    }), accept);
+  };
+  const charge = (user, issuer = ISSUER_ADDRESS) => {
+    const amount = BigInt(randomInt(10, 300) * 100);
+    const signed = sign(user.wallet, {
+      TransactionType: "Payment", Account: user.wallet.address, Destination: hookAddress, Amount: jpy(amount, issuer),
+    });
+    if (issuer !== ISSUER_ADDRESS) return line("wrong_issuer", signed, rollback(EXPECTED_CODE.CHARGE_INVALID));
+    user.balance += amount;
+    return line("charge", signed, accept);
+  };
+  const recharge = (user, kind = "recharge") => {
+    // chargeAndUpdateAllowance と同じく、残りの利用許可枠にチャージ額を加えた額を新しい利用許可にする
+    const amount = BigInt(randomInt(10, 300) * 100);
+    const allowanceAmount = String(user.allowance - user.spent + amount);
+    const signature = allowanceSignature(user, allowanceAmount);
+    const signed = sign(user.wallet, {
+      TransactionType: "Invoke", Account: user.wallet.address, Destination: hookAddress, Amount: jpy(amount),
+      Memos: [buildMemo({ type: "update_allowance", allowanceAmount,
+        signature: kind === "bad_signature" ? corrupt(signature) : signature })],
+    });
+    if (kind === "bad_signature") return line(kind, signed, rollback(EXPECTED_CODE.ALLOWANCE_VERIFICATION_FAILED));
+    Object.assign(user, { balance: user.balance + amount, allowance: BigInt(allowanceAmount), spent: 0n,
+      allowanceAmount, signature });
+    return line("recharge", signed, accept);
+  };
+  const payment = (user, kind) => {
+    const room = user.allowance - user.spent < user.balance ? user.allowance - user.spent : user.balance;
+    let amount = BigInt(randomInt(1, 50) * 100);
+    if (amount > room) amount = room;
+    let expected = accept;
+    if (kind === "over_allowance") {
+      amount = user.allowance - user.spent + BigInt(randomInt(1, 1000));
+      expected = rollback(EXPECTED_CODE.ALLOWANCE_EXCEEDED);
+    }
+    const signed = sign(operator, {
+      TransactionType: "Invoke", Account: operator.address, Destination: hookAddress,
+      Memos: [buildMemo({ type: "allowance_payment", userAddress: user.wallet.address, amount: String(amount),
+        allowanceAmount: user.allowanceAmount, signature: user.signature })],
+    });
+    if (expected === accept) {
+      user.balance -= amount;
+      user.spent += amount;
+    }
+    return line(kind, signed, expected);
+  };
+  // ノンス付きの支払い。署名は正しく、フックはノンスのウィンドウ (または署名の検証) で判定する
+  //   replay: ウィンドウ内の使用済みのノンス (33)、stale_nonce: ウィンドウより古いノンス (35)
+  //   bad_signature: 新しいノンスへの不正な署名 (32、ノンスは消費されない)
+  const noncePayment = (user, kind = "nonce_payment") => {
+    let nonce = user.nonce + 1n;
+    let amount = BigInt(randomInt(1, 50) * 100);
+    if (amount > user.balance) amount = user.balance;
+    let expected = accept;
+    if (kind === "replay") {
+      const oldest = user.nonce > BigInt(NONCE_WINDOW) ? user.nonce - BigInt(NONCE_WINDOW - 1) : 1n;
+      nonce = oldest + BigInt(Math.floor(random() * Number(user.nonce - oldest + 1n)));
+      expected = rollback(EXPECTED_CODE.NONCE_USED);
+    } else if (kind === "stale_nonce") {
+      // ノンス 0 は予約されていて、常にウィンドウより古いものとして扱われる
+      const newest = user.nonce - BigInt(NONCE_WINDOW);
+      nonce = newest >= 1n ? 1n + BigInt(Math.floor(random() * Number(newest))) : 0n;
+      expected = rollback(EXPECTED_CODE.NONCE_TOO_OLD);
+    } else if (kind === "bad_signature") {
+      expected = rollback(EXPECTED_CODE.PAYMENT_VERIFICATION_FAILED);
+    }
+    if (amount <= 0n) amount = 1n;
+    let signature = paymentSignature(user, String(nonce), String(amount));
+    if (kind === "bad_signature") signature = corrupt(signature);
+    const signed = sign(operator, {
+      TransactionType: "Invoke", Account: operator.address, Destination: hookAddress,
+      Memos: [buildMemo({ type: "nonce_payment", userAddress: user.wallet.address, amount: String(amount),
+        nonce: String(nonce), signature })],
+    });
+    if (expected === accept) {
+      user.balance -= amount;
+      user.nonce = nonce;
+    }
+    return line(kind, signed, expected);
+  };
+  const withdraw = (user) => {
+    let amount = BigInt(randomInt(1, 100) * 100);
+    if (amount > user.balance) amount = user.balance;
+    const signed = sign(user.wallet, {
+      TransactionType: "Invoke", Account: user.wallet.address, Destination: hookAddress,
+      Memos: [buildMemo({ type: "withdraw", amount: String(amount) })],
+    });
+    if (!pending.has(user.wallet.address) && pending.size >= WITHDRAW_QUEUE_SIZE) {
+      return line("withdraw", signed, rollback(EXPECTED_CODE.WITHDRAW_QUEUE_FULL));
+    }
+    pending.add(user.wallet.address);
+    user.balance -= amount;
+    return line("withdraw", signed, accept);
+  };
+  const flush = () => {
+    const signed = sign(operator, {
+      TransactionType: "Invoke", Account: operator.address, Destination: hookAddress,
+      Memos: [buildMemo({ type: "withdraw_flush" })],
+    });
+    [...pending].slice(0, WITHDRAW_FLUSH_MAX).forEach((address) => pending.delete(address));
+    return line("flush", signed, accept);
+  };
+
+  for (let n = 0; n < txCount; n++) {
+    let kind = pickKind();
+    if (kind === "invalid") kind = pickInvalid();
+
+    if (kind === "flush") {
+      yield flush();
+      continue;
+    }
+
+    const user = users[pickUser()];
+    if (!user.registered) yield registerKey(user);
+
+    // 前提を満たさない場合 (利用許可・残高・使用済みのノンスがない) は、チャージ＋利用許可枠更新・チャージ・
+    // ノンス付きの支払いに置き換える
+    const canPay = user.allowanceAmount !== null && user.allowance > user.spent && user.balance > 0n;
+    if ((kind === "payment" && !canPay) || (kind === "over_allowance" && user.allowanceAmount === null)) {
+      kind = "recharge";
+    }
+    if ((kind === "nonce_payment" || kind === "withdraw") && user.balance <= 0n) kind = "charge";
+    if (kind === "replay" && user.nonce === 0n) kind = user.balance > 0n ? "nonce_payment" : "charge";
+
+    if (kind === "charge") yield charge(user);
+    else if (kind === "wrong_issuer") yield charge(user, rogueIssuer);
+    else if (kind === "recharge") yield recharge(user);
+    else if (kind === "withdraw") yield withdraw(user);
+    else if (kind === "bad_signature") yield user.balance > 0n ? noncePayment(user, kind) : recharge(user, kind);
+    else if (kind === "nonce_payment" || kind === "replay" || kind === "stale_nonce") yield noncePayment(user, kind);
+    else yield payment(user, kind);
+  }
+}
+
+function parseArgs(argv) {
+  const options = {};
+  for (let i = 0; i < argv.length; i += 2) {
+    if (!argv[i].startsWith("--") || argv[i + 1] === undefined) throw new Error(`不正な引数です: ${argv[i]}`);
+    options[argv[i].slice(2)] = argv[i + 1];
+  }
+  return options;
+}
+
+async function main(argv) {
+  const args = parseArgs(argv);
+  const options = {
+    seed: args.seed !== undefined ? Number(args.seed) : undefined,
+    users: args.users !== undefined ? Number(args.users) : undefined,
+    txs: args.txs !== undefined ? Number(args.txs) : undefined,
+    zipf: args.zipf !== undefined ? Number(args.zipf) : undefined,
+    mix: args.mix ? parseMix(args.mix, DEFAULT_MIX) : undefined,
+    invalidMix: args.invalid ? parseMix(args.invalid, DEFAULT_INVALID_MIX) : undefined,
+    algorithm: args.algorithm,
+    signatures: args.signatures,
+    fee: args.fee,
+    hookAddress: args["hook-address"] ||
+      (process.env.HOOK_SEED ? xrpl.Wallet.fromSeed(process.env.HOOK_SEED).address : undefined),
+    operatorSeed: process.env.OPERATOR_SEED,
+  };
+
+  const out = args.out ? fs.createWriteStream(args.out) : process.stdout;
+  const counts = {};
+  const started = process.hrtime.bigint();
+  for (const message of generateWorkload(options)) {
+    if (message.type === "workload" && !message.operator_matches_hook) {
+      console.error(`warning: operator ${message.operator_address} is not the hook's OPERATOR_ADDRESS (${OPERATOR_ADDRESS})`);
+    }
+    if (message.kind) counts[message.kind] = (counts[message.kind] || 0) + 1;
+    if (!out.write(JSON.stringify(message) + "\n")) await once(out, "drain");
+  }
+  if (out !== process.stdout) out.end();
+
+  const elapsedMs = Number(process.hrtime.bigint() - started) / 1e6;
+  const total = Object.values(counts).reduce((a, b) => a + b, 0);
+  console.error(JSON.stringify({ transactions: total, kinds: counts, elapsed_ms: Math.round(elapsedMs),
+    tx_per_sec: elapsedMs > 0 ? Math.round((total * 1000) / elapsedMs) : 0 }, null, 2));
+}
+
+if (require.main === module) {
+  main(process.argv.slice(2)).catch((error) => {
+    console.error(error.message);
+    process.exit(1);
+  });
+}
+
+module.exports = {
+  generateWorkload,
+  NONCE_WINDOW,
+  seededRandom,
+  zipfSampler,
+  DEFAULT_MIX,
+  DEFAULT_INVALID_MIX,
+};